@@ -0,0 +1,147 @@
+#include "ast/arena.hpp"
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <new>
+#include <vector>
+
+using namespace b2;
+
+static thread_local NodeArena* s_currentArena = nullptr;
+
+Arena::~Arena()
+{
+    for (auto &chunk : m_chunks) {
+        free((void*) chunk.first);
+    }
+}
+
+void* Arena::allocateChunk(size_t size)
+{
+    void* chunk = malloc(size);
+    if (chunk == nullptr) {
+        throw std::bad_alloc();
+    }
+
+    m_chunks[(uintptr_t) chunk] = (uintptr_t) chunk + size;
+    return chunk;
+}
+
+void* Arena::allocate(size_t size, size_t alignment)
+{
+    uintptr_t ptr = ((uintptr_t) m_ptr + alignment - 1) & ~(uintptr_t) (alignment - 1);
+    if (m_ptr == nullptr || ptr + size > (uintptr_t) m_end) {
+        if (size + alignment > chunkSize / 4) {
+            // big allocations get a chunk of their own, so the current chunk can still be used
+            uintptr_t big = (uintptr_t) allocateChunk(size + alignment);
+            return (void*) ((big + alignment - 1) & ~(uintptr_t) (alignment - 1));
+        }
+
+        m_ptr = (char*) allocateChunk(chunkSize);
+        m_end = m_ptr + chunkSize;
+        ptr = ((uintptr_t) m_ptr + alignment - 1) & ~(uintptr_t) (alignment - 1);
+    }
+
+    m_ptr = (char*) (ptr + size);
+    return (void*) ptr;
+}
+
+bool Arena::contains(const void* ptr) const
+{
+    // the chunk starting last at or before ptr
+    auto chunk = m_chunks.upper_bound((uintptr_t) ptr);
+    if (chunk == m_chunks.begin()) {
+        return false;
+    }
+    --chunk;
+    return (uintptr_t) ptr < chunk->second;
+}
+
+namespace {
+
+// every live node arena, for freeing nodes outside the scope of the arena they came from
+struct NodeArenaRegistry {
+    std::mutex mutex;
+    std::vector<NodeArena*> arenas;
+};
+
+NodeArenaRegistry& registry()
+{
+    static NodeArenaRegistry registry;
+    return registry;
+}
+
+} /* anon namespace */
+
+NodeArena::NodeArena()
+{
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    registry().arenas.push_back(this);
+}
+
+NodeArena::~NodeArena()
+{
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    auto &arenas = registry().arenas;
+    arenas.erase(std::find(arenas.begin(), arenas.end(), this));
+}
+
+void* NodeArena::allocate(size_t size)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_arena.allocate(size);
+}
+
+bool NodeArena::contains(const void* ptr)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_arena.contains(ptr);
+}
+
+bool NodeArena::isArenaNode(const void* ptr)
+{
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    for (auto arena : registry().arenas) {
+        if (arena->contains(ptr)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void* b2::allocateNode(size_t size)
+{
+    if (s_currentArena != nullptr) {
+        return s_currentArena->allocate(size);
+    }
+
+    void* ptr = malloc(size);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void b2::freeNode(void* ptr) noexcept
+{
+    if (ptr == nullptr) {
+        return;
+    }
+
+    // nodes are nearly always deleted within the scope of the arena they came from
+    if ((s_currentArena != nullptr && s_currentArena->contains(ptr)) || NodeArena::isArenaNode(ptr)) {
+        return;
+    }
+    free(ptr);
+}
+
+NodeArena* b2::currentArena()
+{
+    return s_currentArena;
+}
+
+void b2::setCurrentArena(NodeArena* arena)
+{
+    s_currentArena = arena;
+}
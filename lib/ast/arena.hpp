@@ -0,0 +1,83 @@
+#ifndef __ARENA_HPP_
+#define __ARENA_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <mutex>
+
+namespace b2 {
+
+/*
+ * A bump allocator: memory is handed out from large chunks and is only returned
+ * (all at once) when the arena gets destroyed. An arena isn't thread-safe.
+ */
+class Arena
+{
+public:
+    static const size_t chunkSize = 64 * 1024;
+    static const size_t defaultAlignment = 16;
+
+    Arena() : m_ptr(nullptr), m_end(nullptr) {}
+    ~Arena();
+
+    void* allocate(size_t size, size_t alignment = defaultAlignment);
+
+    /*
+     * Returns whether `ptr` points into memory handed out by this arena.
+     */
+    bool contains(const void* ptr) const;
+
+private:
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocateChunk(size_t size);
+
+    std::map<uintptr_t, uintptr_t> m_chunks; // start -> end
+    char* m_ptr;
+    char* m_end;
+};
+
+/*
+ * The arena the nodes of a single compilation are allocated from, shared by every
+ * thread working on it.
+ */
+class NodeArena
+{
+public:
+    NodeArena();
+    ~NodeArena();
+
+    void* allocate(size_t size);
+    bool contains(const void* ptr);
+
+    /*
+     * Returns whether `ptr` points into any node arena.
+     */
+    static bool isArenaNode(const void* ptr);
+
+private:
+    NodeArena(const NodeArena&) = delete;
+    NodeArena& operator=(const NodeArena&) = delete;
+
+    std::mutex m_mutex;
+    Arena m_arena;
+};
+
+/*
+ * AST nodes and expressions are allocated with these functions. While an arena is
+ * installed for the current thread (see ASTContext::Scope), they come from that arena
+ * and deleting them only runs their destructor; otherwise they're heap-allocated.
+ * Which of the two a node is, is told by its address.
+ */
+void* allocateNode(size_t size);
+void freeNode(void* ptr) noexcept;
+
+NodeArena* currentArena();
+void setCurrentArena(NodeArena* arena);
+
+} // namespace b2
+
+#endif // __ARENA_HPP_
@@ -2,10 +2,12 @@
 #define __AST_H_
 
 #include "expressions.hpp"
+#include "source_string.hpp"
 #include <list>
 #include <memory>
 #include <unordered_map>
 #include <string>
+#include <vector>
 #include "utils.hpp"
 
 namespace b2 {
@@ -17,11 +19,24 @@ enum ASTType {
     IfBlockASTType,
     ForBlockASTType,
     IncludeBlockASTType,
+    ExtendsBlockASTType,
+    NamedBlockASTType,
+    MacroDefinitionASTType,
+    MacroCallASTType,
+    SetBlockASTType,
+    CaptureBlockASTType,
+    SwitchBlockASTType,
+    CaseBlockASTType,
+    CacheBlockASTType,
 };
 
 struct AST {
     virtual ~AST() {}
+    virtual AST* clone() = 0;
     virtual ASTType type() = 0;
+
+    static void* operator new(size_t size) { return allocateNode(size); }
+    static void operator delete(void* ptr) noexcept { freeNode(ptr); }
 };
 
 template<ASTType T>
@@ -30,27 +45,48 @@ struct TypedAST : AST {
 };
 
 typedef std::list<std::unique_ptr<AST>> ASTList;
-typedef unique_ptr_with_free_deleter<const char> UniquePtrString;
-typedef std::unordered_map<std::string, std::unique_ptr<Expression>> StringExpressionMap;
+typedef std::unordered_map<Symbol, std::unique_ptr<Expression>> SymbolExpressionMap;
+
+static inline AST* cloneAST(const std::unique_ptr<AST> &ast)
+{
+    return ast ? ast->clone() : nullptr;
+}
+
+static inline Expression* cloneExpression(const std::unique_ptr<Expression> &expr)
+{
+    return expr ? expr->clone() : nullptr;
+}
 
 struct StatementsAST : TypedAST<StatementsASTType> {
     std::unique_ptr<ASTList> statements;
 
     StatementsAST() : statements(new ASTList()) {}
     StatementsAST(ASTList* statements) : statements(statements) {}
+    virtual AST* clone() override {
+        auto clonedStatements = new StatementsAST();
+        for (auto &statement : *statements) {
+            clonedStatements->statements->emplace_back(statement->clone());
+        }
+        return clonedStatements;
+    }
 };
 
 struct RawBlockAST : TypedAST<RawBlockASTType> {
-    UniquePtrString text;
+    SourceString text;
 
-    RawBlockAST(const char* text) : text(make_unique_ptr_with_free_deleter(text)) {}
-    RawBlockAST(UniquePtrString text) : text(std::move(text)) {}
+    RawBlockAST(SourceString text) : text(std::move(text)) {}
+    virtual AST* clone() override {
+        return new RawBlockAST(text);
+    }
 };
 
 struct PrintBlockAST : TypedAST<PrintBlockASTType> {
     std::unique_ptr<Expression> expr;
 
     PrintBlockAST(Expression *expr) : expr(expr) {}
+    virtual AST* clone() override {
+        return new PrintBlockAST(expr->clone());
+    }
 };
 
 struct IfBlockAST : TypedAST<IfBlockASTType> {
@@ -59,6 +95,9 @@ struct IfBlockAST : TypedAST<IfBlockASTType> {
     std::unique_ptr<AST> elseBody;
 
     IfBlockAST(Expression* condition, AST* thenBody, AST* elseBody = nullptr) : condition(condition), thenBody(thenBody), elseBody(elseBody) {}
+    virtual AST* clone() override {
+        return new IfBlockAST(condition->clone(), cloneAST(thenBody), cloneAST(elseBody));
+    }
 };
 
 struct ForBlockAST : TypedAST<ForBlockASTType> {
@@ -69,16 +108,178 @@ struct ForBlockAST : TypedAST<ForBlockASTType> {
     std::unique_ptr<AST> elseBody;
 
     ForBlockAST(VariableReferenceExpression* keyVariable, VariableReferenceExpression* valueVariable, Expression* iterable, AST* body, AST* elseBody) : keyVariable(keyVariable), valueVariable(valueVariable), iterable(iterable), body(body), elseBody(elseBody) {}
+    virtual AST* clone() override {
+        return new ForBlockAST(
+            keyVariable ? new VariableReferenceExpression(keyVariable->variableName) : nullptr,
+            valueVariable ? new VariableReferenceExpression(valueVariable->variableName) : nullptr,
+            iterable->clone(),
+            cloneAST(body),
+            cloneAST(elseBody)
+        );
+    }
 };
 
 struct IncludeBlockAST : TypedAST<IncludeBlockASTType> {
-    UniquePtrString includeName;
+    SourceString includeName;
+    // set instead of includeName when the name of the included template is only known at render time
+    std::unique_ptr<Expression> nameExpression;
     std::unique_ptr<Expression> scope;
-    StringExpressionMap variableMapping;
+    SymbolExpressionMap variableMapping;
+    // set when the included template gets compiled as a separate function (see ResolveIncludesPass)
+    std::unique_ptr<AST> body;
+    std::string functionName;
+
+    IncludeBlockAST(SourceString includeName) : includeName(std::move(includeName)) {}
+    IncludeBlockAST(SourceString includeName, Expression* scope) : includeName(std::move(includeName)), scope(scope) {}
+    IncludeBlockAST(SourceString includeName, std::unique_ptr<Expression> scope, SymbolExpressionMap &variableMapping) : includeName(std::move(includeName)), scope(std::move(scope)), variableMapping(std::move(variableMapping)) {}
+    IncludeBlockAST(Expression* nameExpression, Expression* scope) : nameExpression(nameExpression), scope(scope) {}
+    virtual AST* clone() override {
+        SymbolExpressionMap clonedMapping;
+        for (auto &tuple : variableMapping) {
+            clonedMapping[tuple.first].reset(tuple.second->clone());
+        }
+        auto clonedInclude = new IncludeBlockAST(includeName, std::unique_ptr<Expression>(cloneExpression(scope)), clonedMapping);
+        clonedInclude->nameExpression.reset(cloneExpression(nameExpression));
+        clonedInclude->body.reset(cloneAST(body));
+        clonedInclude->functionName = functionName;
+        return clonedInclude;
+    }
+};
+
+struct ExtendsBlockAST : TypedAST<ExtendsBlockASTType> {
+    SourceString templateName;
+
+    ExtendsBlockAST(SourceString templateName) : templateName(std::move(templateName)) {}
+    virtual AST* clone() override {
+        return new ExtendsBlockAST(templateName);
+    }
+};
+
+struct NamedBlockAST : TypedAST<NamedBlockASTType> {
+    Symbol name;
+    std::unique_ptr<AST> body;
+    // a fragment also gets compiled as an entry point of its own (see ExtractFragmentsPass)
+    bool isFragment;
+
+    NamedBlockAST(Symbol name, AST* body, bool isFragment = false) : name(name), body(body), isFragment(isFragment) {}
+    virtual AST* clone() override {
+        return new NamedBlockAST(name, cloneAST(body), isFragment);
+    }
+};
+
+struct MacroDefinitionAST : TypedAST<MacroDefinitionASTType> {
+    Symbol name;
+    std::vector<Symbol> parameters;
+    std::unique_ptr<AST> body;
+
+    MacroDefinitionAST(Symbol name, std::vector<Symbol> parameters, AST* body) : name(name), parameters(std::move(parameters)), body(body) {}
+    virtual AST* clone() override {
+        return new MacroDefinitionAST(name, parameters, cloneAST(body));
+    }
+};
+
+/*
+ * A call of a macro which gets compiled as a separate function (see ResolveMacrosPass),
+ * every call carries its own copy of the macro's body.
+ */
+struct MacroCallAST : TypedAST<MacroCallASTType> {
+    Symbol name;
+    std::vector<Symbol> parameters;
+    std::unique_ptr<ExpressionList> arguments;
+    std::unique_ptr<AST> body;
+    std::string functionName;
+
+    MacroCallAST(Symbol name, std::vector<Symbol> parameters, ExpressionList* arguments, AST* body, std::string functionName) : name(name), parameters(std::move(parameters)), arguments(arguments), body(body), functionName(std::move(functionName)) {}
+    virtual AST* clone() override {
+        return new MacroCallAST(name, parameters, cloneExpressionList(arguments.get()), cloneAST(body), functionName);
+    }
+};
+
+/*
+ * A `{% set %}` block, binding `name` to `value` for the statements following it in
+ * the same block. Those statements make up its body, so the binding goes out of scope
+ * together with the body.
+ */
+struct SetBlockAST : TypedAST<SetBlockASTType> {
+    Symbol name;
+    std::unique_ptr<Expression> value;
+    std::unique_ptr<AST> body;
+
+    SetBlockAST(Symbol name, Expression* value, AST* body = nullptr) : name(name), value(value), body(body) {}
+    virtual AST* clone() override {
+        return new SetBlockAST(name, value->clone(), cloneAST(body));
+    }
+};
+
+/*
+ * Renders `capture` into a string, and binds `name` to that string for `body`. There's
+ * no syntax for this, MemoizeLoopInvariantOutputPass creates these to render the
+ * output which doesn't change between the iterations of a loop only once.
+ */
+struct CaptureBlockAST : TypedAST<CaptureBlockASTType> {
+    Symbol name;
+    std::unique_ptr<AST> capture;
+    std::unique_ptr<AST> body;
+
+    CaptureBlockAST(Symbol name, AST* capture, AST* body) : name(name), capture(capture), body(body) {}
+    virtual AST* clone() override {
+        return new CaptureBlockAST(name, cloneAST(capture), cloneAST(body));
+    }
+};
+
+/*
+ * A case of a SwitchBlockAST: `body` gets rendered when the switch's expression equals
+ * `value`.
+ */
+struct CaseBlockAST : TypedAST<CaseBlockASTType> {
+    std::unique_ptr<Expression> value;
+    std::unique_ptr<AST> body;
+
+    CaseBlockAST(Expression* value, AST* body) : value(value), body(body) {}
+    virtual AST* clone() override {
+        return new CaseBlockAST(value->clone(), cloneAST(body));
+    }
+};
+
+/*
+ * Renders the body of the first of `cases` whose value equals `expr`, or `elseBody` when
+ * there's none, just like an if/elseif chain comparing `expr` to every value would. The
+ * values are distinct literals, either all integers or all (non-numeric) strings.
+ * There's no syntax for this, LowerIfChainsToSwitchPass creates these.
+ */
+struct SwitchBlockAST : TypedAST<SwitchBlockASTType> {
+    std::unique_ptr<Expression> expr;
+    ASTList cases;
+    std::unique_ptr<AST> elseBody;
+
+    SwitchBlockAST(Expression* expr, AST* elseBody = nullptr) : expr(expr), elseBody(elseBody) {}
+    virtual AST* clone() override {
+        auto clonedSwitch = new SwitchBlockAST(expr->clone(), cloneAST(elseBody));
+        for (auto &caseBlock : cases) {
+            clonedSwitch->cases.emplace_back(caseBlock->clone());
+        }
+        return clonedSwitch;
+    }
+};
+
+/*
+ * A `{% cache key ttl %}` block: the output of `body` gets stored in the fragment cache
+ * under the value of `key` for `ttl` seconds (0 meaning until it gets evicted), later
+ * renders print the stored output instead of rendering `body` again. Keys are scoped to
+ * the block: blocks with different bodies never share their output, even under the same
+ * key, while identical blocks (eg. of the same template compiled by different engines)
+ * do; identical blocks calling registered functions which differ between engines should
+ * use different keys.
+ */
+struct CacheBlockAST : TypedAST<CacheBlockASTType> {
+    std::unique_ptr<Expression> key;
+    long ttl;
+    std::unique_ptr<AST> body;
 
-    IncludeBlockAST(const char* includeName) : includeName(make_unique_ptr_with_free_deleter(includeName)) {}
-    IncludeBlockAST(const char* includeName, Expression* scope) : includeName(make_unique_ptr_with_free_deleter(includeName)), scope(scope) {}
-    IncludeBlockAST(UniquePtrString includeName, std::unique_ptr<Expression> scope, StringExpressionMap &variableMapping) : includeName(std::move(includeName)), scope(std::move(scope)), variableMapping(std::move(variableMapping)) {}
+    CacheBlockAST(Expression* key, long ttl, AST* body) : key(key), ttl(ttl), body(body) {}
+    virtual AST* clone() override {
+        return new CacheBlockAST(key->clone(), ttl, cloneAST(body));
+    }
 };
 
 } // namespace b2
@@ -0,0 +1,93 @@
+#ifndef __AST_CONTEXT_HPP_
+#define __AST_CONTEXT_HPP_
+
+#include "ast/arena.hpp"
+#include "ast/source_buffer.hpp"
+#include "ast/symbol.hpp"
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace b2 {
+
+/*
+ * Owns everything the ASTs of a single compilation refer to: the source text of
+ * every template parsed into it, the symbol table and the arena the nodes are
+ * allocated from.
+ *
+ * The AST references its strings straight from the source text (see SourceString),
+ * so a context should outlive all ASTs parsed into it. A context may be shared
+ * between parsers running on different threads.
+ */
+class ASTContext
+{
+public:
+    /*
+     * Allocates all nodes created by the current thread from the arena of `context`,
+     * for as long as this scope lives. Scopes of the same context may be nested, and
+     * be opened by several threads at once.
+     */
+    class Scope
+    {
+    public:
+        Scope(ASTContext &context) : m_previous(currentArena()) {
+            setCurrentArena(&context.m_arena);
+        }
+
+        ~Scope() {
+            setCurrentArena(m_previous);
+        }
+
+    private:
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        NodeArena* m_previous;
+    };
+
+    ASTContext() : m_symbols(std::make_shared<SymbolTable>()) {}
+
+    /*
+     * Creates a context interning its names into `symbols`; symbols can only be compared
+     * between contexts sharing a table.
+     */
+    explicit ASTContext(const std::shared_ptr<SymbolTable> &symbols) : m_symbols(symbols) {}
+
+    /*
+     * Takes ownership of `buffer`, keeping it alive for as long as this context.
+     */
+    SourceBuffer* adopt(SourceBuffer* buffer) {
+        std::unique_ptr<SourceBuffer> ptr(buffer);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_buffers.push_back(std::move(ptr));
+        return buffer;
+    }
+
+    /*
+     * Keeps `buffer`, which other contexts may share as well, alive for as long as this
+     * context.
+     */
+    void share(const std::shared_ptr<SourceBuffer> &buffer) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_sharedBuffers.push_back(buffer);
+    }
+
+    SymbolTable& symbols() { return *m_symbols; }
+    const std::shared_ptr<SymbolTable>& sharedSymbols() const { return m_symbols; }
+
+private:
+    ASTContext(const ASTContext&) = delete;
+    ASTContext& operator=(const ASTContext&) = delete;
+
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<SourceBuffer>> m_buffers;
+    std::vector<std::shared_ptr<SourceBuffer>> m_sharedBuffers;
+    NodeArena m_arena;
+    std::shared_ptr<SymbolTable> m_symbols;
+};
+
+} // namespace b2
+
+#endif // __AST_CONTEXT_HPP_
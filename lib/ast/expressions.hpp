@@ -5,6 +5,9 @@
 #include <cstdlib>
 #include <list>
 #include <memory>
+#include "arena.hpp"
+#include "source_string.hpp"
+#include "symbol.hpp"
 #include "utils.hpp"
 
 namespace b2 {
@@ -20,6 +23,7 @@ enum ExpressionType {
     BinaryOperationExpressionType,
     UnaryOperationExpressionType,
     ComparisonExpressionType,
+    ArrayLiteralExpressionType,
 };
 
 enum ExpressionValueType {
@@ -35,6 +39,9 @@ struct Expression {
     virtual Expression* clone() = 0;
     virtual enum ExpressionType type() = 0;
     virtual enum ExpressionValueType valueType() = 0;
+
+    static void* operator new(size_t size) { return allocateNode(size); }
+    static void operator delete(void* ptr) noexcept { freeNode(ptr); }
 };
 
 template<ExpressionType T, ExpressionValueType V = VariantType>
@@ -49,21 +56,27 @@ struct TypedExpression : Expression {
 };
 
 struct VariableReferenceExpression : TypedExpression<VariableReferenceExpressionType, VariantType> {
-    unique_ptr_with_free_deleter<const char> variableName;
+    Symbol variableName;
+    // the type of the value this references, when known (see InferTypesPass)
+    ExpressionValueType inferredType;
 
-    VariableReferenceExpression(const char* variableName) : variableName(make_unique_ptr_with_free_deleter(variableName)) {}
+    VariableReferenceExpression(Symbol variableName, ExpressionValueType inferredType = VariantType) : variableName(variableName), inferredType(inferredType) {}
     virtual Expression* clone() override {
-        return new VariableReferenceExpression(strdup(variableName.get()));
+        return new VariableReferenceExpression(variableName, inferredType);
+    }
+
+    virtual enum ExpressionValueType valueType() override {
+        return inferredType;
     }
 };
 
 struct GetAttributeExpression : TypedExpression<GetAttributeExpressionType, VariantType> {
     std::unique_ptr<Expression> variable;
-    unique_ptr_with_free_deleter<const char> attributeName;
+    Symbol attributeName;
 
-    GetAttributeExpression(Expression* variable, const char* attributeName) : variable(variable), attributeName(make_unique_ptr_with_free_deleter(attributeName)) {}
+    GetAttributeExpression(Expression* variable, Symbol attributeName) : variable(variable), attributeName(attributeName) {}
     virtual Expression* clone() override {
-        return new GetAttributeExpression(variable->clone(), strdup(attributeName.get()));
+        return new GetAttributeExpression(variable->clone(), attributeName);
     }
 };
 
@@ -71,7 +84,7 @@ typedef std::list<std::unique_ptr<Expression>> ExpressionList;
 
 static inline ExpressionList* cloneExpressionList(ExpressionList* exprList)
 {
-    ExpressionList* clonedExprList = new ExpressionList(exprList->size());
+    ExpressionList* clonedExprList = new ExpressionList();
     for (auto &expr : *exprList) {
         clonedExprList->push_back(std::move(std::unique_ptr<Expression>(expr->clone())));
     }
@@ -79,12 +92,18 @@ static inline ExpressionList* cloneExpressionList(ExpressionList* exprList)
 }
 
 struct MethodCallExpression : TypedExpression<MethodCallExpressionType, VariantType> {
-    unique_ptr_with_free_deleter<const char> methodName;
+    Symbol methodName;
     std::unique_ptr<ExpressionList> arguments;
+    // the type of the value this method returns, when known (see InferTypesPass)
+    ExpressionValueType inferredType;
 
-    MethodCallExpression(const char* methodName, ExpressionList* arguments) : methodName(make_unique_ptr_with_free_deleter(methodName)), arguments(arguments) {}
+    MethodCallExpression(Symbol methodName, ExpressionList* arguments, ExpressionValueType inferredType = VariantType) : methodName(methodName), arguments(arguments), inferredType(inferredType) {}
     virtual Expression* clone() override {
-        return new MethodCallExpression(strdup(methodName.get()), cloneExpressionList(arguments.get()));
+        return new MethodCallExpression(methodName, cloneExpressionList(arguments.get()), inferredType);
+    }
+
+    virtual enum ExpressionValueType valueType() override {
+        return inferredType;
     }
 };
 
@@ -103,11 +122,54 @@ using IntegerLiteralExpression = LiteralExpression<long, IntegerLiteralExpressio
 using BooleanLiteralExpression = LiteralExpression<bool, BooleanLiteralExpressionType, BooleanType>;
 
 struct StringLiteralExpression : TypedExpression<StringLiteralExpressionType, StringType> {
-    unique_ptr_with_free_deleter<const char> value;
+    SourceString value;
 
-    StringLiteralExpression(const char *v) : value(make_unique_ptr_with_free_deleter(v)) {}
+    StringLiteralExpression(SourceString v) : value(std::move(v)) {}
     virtual Expression* clone() override {
-        return new StringLiteralExpression(strdup(value.get()));
+        return new StringLiteralExpression(value);
+    }
+};
+
+/*
+ * A list literal (`["small", "large"]`), whose values are keyed by their position, or a
+ * map literal (`{small: 1, "x-large": 3}`), whose keys are string or integer literals.
+ */
+struct ArrayLiteralExpression : TypedExpression<ArrayLiteralExpressionType, VariantType> {
+    // null for a list
+    std::unique_ptr<ExpressionList> keys;
+    std::unique_ptr<ExpressionList> values;
+
+    ArrayLiteralExpression(ExpressionList* keys, ExpressionList* values) : keys(keys), values(values) {}
+    virtual Expression* clone() override {
+        return new ArrayLiteralExpression(keys ? cloneExpressionList(keys.get()) : nullptr, cloneExpressionList(values.get()));
+    }
+
+    bool isMap() const {
+        return keys != nullptr;
+    }
+
+    /*
+     * Whether every value of this array is a literal or a constant array, which lets it be
+     * built once instead of on every render.
+     */
+    bool isConstant() const {
+        for (auto &value : *values) {
+            switch (value->type()) {
+                case DoubleLiteralExpressionType:
+                case IntegerLiteralExpressionType:
+                case BooleanLiteralExpressionType:
+                case StringLiteralExpressionType:
+                    break;
+                case ArrayLiteralExpressionType:
+                    if (!static_cast<ArrayLiteralExpression*>(value.get())->isConstant()) {
+                        return false;
+                    }
+                    break;
+                default:
+                    return false;
+            }
+        }
+        return true;
     }
 };
 
@@ -117,20 +179,40 @@ enum BinaryOperation {
     Multiplication = '*',
     Division = '/',
     Modulus = '%',
+    Concatenation = '~',
 };
 
+/*
+ * The type of an operation is derived from the types of its operands once, when it gets
+ * created: the parser checks it for every operation it nests in. Passes which replace an
+ * operand keep it as it is, which errs on the safe side as they only make operands more
+ * specific; updateValueType() derives it again.
+ */
 struct BinaryOperationExpression : TypedExpression<BinaryOperationExpressionType> {
     std::unique_ptr<Expression> left;
     std::unique_ptr<Expression> right;
     const BinaryOperation op;
 
-    BinaryOperationExpression(Expression* left, Expression* right, BinaryOperation op) : left(left), right(right), op(op) {}
-    BinaryOperationExpression(Expression* left, Expression* right, const char op) : left(left), right(right), op((BinaryOperation)op) {}
+    BinaryOperationExpression(Expression* left, Expression* right, BinaryOperation op) : left(left), right(right), op(op), m_valueType(deriveValueType()) {}
+    BinaryOperationExpression(Expression* left, Expression* right, const char op) : left(left), right(right), op((BinaryOperation)op), m_valueType(deriveValueType()) {}
     virtual Expression* clone() override {
         return new BinaryOperationExpression(left->clone(), right->clone(), op);
     }
 
     virtual enum ExpressionValueType valueType() override {
+        return m_valueType;
+    }
+
+    void updateValueType() {
+        m_valueType = deriveValueType();
+    }
+
+private:
+    ExpressionValueType deriveValueType() {
+        if (op == Concatenation) {
+            return StringType;
+        }
+
         auto left_vtype = left->valueType();
         auto right_vtype = right->valueType();
 
@@ -145,6 +227,8 @@ struct BinaryOperationExpression : TypedExpression<BinaryOperationExpressionType
             return DoubleType;
         }
     }
+
+    ExpressionValueType m_valueType;
 };
 
 enum UnaryOperation {
@@ -157,13 +241,25 @@ struct UnaryOperationExpression : TypedExpression<UnaryOperationExpressionType>
     std::unique_ptr<Expression> expr;
     const UnaryOperation op;
 
-    UnaryOperationExpression(Expression* expr, UnaryOperation op) : expr(expr), op(op) {}
-    UnaryOperationExpression(Expression* expr, const char op) : expr(expr), op((UnaryOperation) op) {}
+    UnaryOperationExpression(Expression* expr, UnaryOperation op) : expr(expr), op(op), m_valueType(deriveValueType()) {}
+    UnaryOperationExpression(Expression* expr, const char op) : expr(expr), op((UnaryOperation) op), m_valueType(deriveValueType()) {}
     virtual Expression* clone() override {
         return new UnaryOperationExpression(expr->clone(), op);
     }
 
     virtual enum ExpressionValueType valueType() override {
+        return m_valueType;
+    }
+
+    /*
+     * See BinaryOperationExpression::updateValueType().
+     */
+    void updateValueType() {
+        m_valueType = deriveValueType();
+    }
+
+private:
+    ExpressionValueType deriveValueType() {
         switch (op) {
             case BooleanNegation:
                 return BooleanType;
@@ -181,6 +277,8 @@ struct UnaryOperationExpression : TypedExpression<UnaryOperationExpressionType>
                 }
         }
     }
+
+    ExpressionValueType m_valueType;
 };
 
 #define PACK_UINT16(a,b) ((a << 8) | b)
@@ -0,0 +1,131 @@
+#include "ast/flat_ast.hpp"
+
+using namespace b2;
+
+namespace {
+
+size_t countNodes(AST* ast)
+{
+    if (!ast) {
+        return 0;
+    }
+
+    switch (ast->type()) {
+        case StatementsASTType: {
+            size_t count = 0;
+            for (auto &statement : *static_cast<StatementsAST*>(ast)->statements) {
+                count += countNodes(statement.get());
+            }
+            return count;
+        }
+        case IfBlockASTType: {
+            auto ifBlock = static_cast<IfBlockAST*>(ast);
+            return 1 + countNodes(ifBlock->thenBody.get()) + countNodes(ifBlock->elseBody.get());
+        }
+        case ForBlockASTType: {
+            auto forBlock = static_cast<ForBlockAST*>(ast);
+            return 1 + countNodes(forBlock->body.get()) + countNodes(forBlock->elseBody.get());
+        }
+        case NamedBlockASTType:
+            return 1 + countNodes(static_cast<NamedBlockAST*>(ast)->body.get());
+        case SetBlockASTType:
+            return 1 + countNodes(static_cast<SetBlockAST*>(ast)->body.get());
+        case CaptureBlockASTType: {
+            auto captureBlock = static_cast<CaptureBlockAST*>(ast);
+            return 1 + countNodes(captureBlock->capture.get()) + countNodes(captureBlock->body.get());
+        }
+        case SwitchBlockASTType: {
+            auto switchBlock = static_cast<SwitchBlockAST*>(ast);
+            size_t count = 1 + countNodes(switchBlock->elseBody.get());
+            for (auto &caseBlock : switchBlock->cases) {
+                count += countNodes(caseBlock.get());
+            }
+            return count;
+        }
+        case CaseBlockASTType:
+            return 1 + countNodes(static_cast<CaseBlockAST*>(ast)->body.get());
+        case CacheBlockASTType:
+            return 1 + countNodes(static_cast<CacheBlockAST*>(ast)->body.get());
+        default:
+            return 1;
+    }
+}
+
+} /* anon namespace */
+
+FlatAST::FlatAST(AST* ast)
+{
+    m_nodes.reserve(countNodes(ast));
+    this->append(ast);
+}
+
+void FlatAST::append(AST* ast)
+{
+    if (!ast) {
+        return;
+    }
+
+    if (ast->type() == StatementsASTType) {
+        for (auto &statement : *static_cast<StatementsAST*>(ast)->statements) {
+            this->append(statement.get());
+        }
+        return;
+    }
+
+    uint32_t index = this->size();
+    m_nodes.push_back(FlatNode{ast->type(), 0, 0, ast});
+
+    switch (ast->type()) {
+        case IfBlockASTType: {
+            auto ifBlock = static_cast<IfBlockAST*>(ast);
+            this->append(ifBlock->thenBody.get());
+            m_nodes[index].split = this->size();
+            this->append(ifBlock->elseBody.get());
+            break;
+        }
+        case ForBlockASTType: {
+            auto forBlock = static_cast<ForBlockAST*>(ast);
+            this->append(forBlock->body.get());
+            m_nodes[index].split = this->size();
+            this->append(forBlock->elseBody.get());
+            break;
+        }
+        case NamedBlockASTType:
+            this->append(static_cast<NamedBlockAST*>(ast)->body.get());
+            m_nodes[index].split = this->size();
+            break;
+        case SetBlockASTType:
+            this->append(static_cast<SetBlockAST*>(ast)->body.get());
+            m_nodes[index].split = this->size();
+            break;
+        case CaptureBlockASTType: {
+            auto captureBlock = static_cast<CaptureBlockAST*>(ast);
+            this->append(captureBlock->capture.get());
+            m_nodes[index].split = this->size();
+            this->append(captureBlock->body.get());
+            break;
+        }
+        case SwitchBlockASTType: {
+            auto switchBlock = static_cast<SwitchBlockAST*>(ast);
+            for (auto &caseBlock : switchBlock->cases) {
+                this->append(caseBlock.get());
+            }
+            m_nodes[index].split = this->size();
+            this->append(switchBlock->elseBody.get());
+            break;
+        }
+        case CaseBlockASTType:
+            this->append(static_cast<CaseBlockAST*>(ast)->body.get());
+            m_nodes[index].split = this->size();
+            break;
+        case CacheBlockASTType:
+            this->append(static_cast<CacheBlockAST*>(ast)->body.get());
+            m_nodes[index].split = this->size();
+            break;
+        default:
+            m_nodes[index].split = this->size();
+            break;
+    }
+
+    m_nodes[index].end = this->size();
+}
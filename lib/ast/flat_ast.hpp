@@ -0,0 +1,84 @@
+#ifndef __FLAT_AST_HPP_
+#define __FLAT_AST_HPP_
+
+#include "ast/ast.hpp"
+
+#include <stdint.h>
+#include <vector>
+
+namespace b2 {
+
+/*
+ * A range [begin, end) of node indices in a FlatAST, holding a list of sibling
+ * subtrees.
+ */
+struct FlatRange {
+    uint32_t begin;
+    uint32_t end;
+
+    FlatRange(uint32_t begin, uint32_t end) : begin(begin), end(end) {}
+    bool empty() const { return begin == end; }
+};
+
+struct FlatNode {
+    ASTType type;
+    // IfBlock/ForBlock/SwitchBlock: index of the first node of the else body (== end when absent),
+    // CaptureBlock: index of the first node of the body (after the captured nodes),
+    // NamedBlock/SetBlock/CaseBlock/CacheBlock: == end
+    uint32_t split;
+    // index one past the last node of this subtree, iow. the index of the next sibling
+    uint32_t end;
+    AST* ast;
+
+    template<typename T>
+    T* as() const { return static_cast<T*>(ast); }
+};
+
+/*
+ * A contiguous, pre-order encoding of an AST.
+ *
+ * Every node is followed by the nodes of its (then/loop/block/set/captured/case/cached) body
+ * and after that by the nodes of its else body (for a capture block: its actual body), so
+ * walking a list of statements comes down to stepping through an array with `end` as
+ * stride. The body of a switch block consists of its case blocks. StatementsAST nodes
+ * are never encoded, their statements are inlined into the parent's range instead. The
+ * bodies of include blocks, macro definitions and macro calls aren't encoded either, as
+ * those get compiled separately.
+ *
+ * A FlatAST only references the tree it was built from: the tree should outlive
+ * it and shouldn't be modified in the mean time.
+ */
+class FlatAST
+{
+public:
+    explicit FlatAST(AST* ast);
+
+    const FlatNode& operator[](uint32_t index) const { return m_nodes[index]; }
+    uint32_t size() const { return static_cast<uint32_t>(m_nodes.size()); }
+
+    std::vector<FlatNode>::const_iterator begin() const { return m_nodes.begin(); }
+    std::vector<FlatNode>::const_iterator end() const { return m_nodes.end(); }
+
+    FlatRange root() const { return FlatRange(0, size()); }
+
+    FlatRange body(const FlatNode& node) const {
+        return FlatRange(indexOf(node) + 1, node.split);
+    }
+
+    FlatRange elseBody(const FlatNode& node) const {
+        return FlatRange(node.split, node.end);
+    }
+
+private:
+    uint32_t indexOf(const FlatNode& node) const {
+        return static_cast<uint32_t>(&node - m_nodes.data());
+    }
+
+    void append(AST* ast);
+
+    std::vector<FlatNode> m_nodes;
+};
+
+} // namespace b2
+
+#endif // __FLAT_AST_HPP_
@@ -0,0 +1,208 @@
+#include "ast/passes/bindings_checker.hpp"
+
+#include <algorithm>
+
+using namespace b2;
+
+Symbol BindingsChecker::findUnboundVariable(AST* ast)
+{
+    m_unboundVariable = Symbol();
+    this->check(ast);
+    return m_unboundVariable;
+}
+
+std::unordered_set<VariableReferenceExpression*> BindingsChecker::findLocalReferences(AST* ast)
+{
+    std::unordered_set<VariableReferenceExpression*> localReferences;
+    m_unboundVariable = Symbol();
+    m_localReferences = &localReferences;
+    this->check(ast);
+    m_localReferences = nullptr;
+    return localReferences;
+}
+
+void BindingsChecker::check(AST* ast)
+{
+    // collecting the local references doesn't stop at an unbound variable
+    if (ast && (m_localReferences || m_unboundVariable.empty())) {
+        this->ast(ast);
+    }
+}
+
+void BindingsChecker::statements(StatementsAST* ast)
+{
+    for (auto &statement : *ast->statements) {
+        this->check(statement.get());
+    }
+}
+
+void BindingsChecker::raw(RawBlockAST* ast)
+{
+}
+
+void BindingsChecker::print_block(PrintBlockAST* ast)
+{
+    this->expression(ast->expr.get());
+}
+
+void BindingsChecker::if_block(IfBlockAST* ast)
+{
+    this->expression(ast->condition.get());
+    this->check(ast->thenBody.get());
+    this->check(ast->elseBody.get());
+}
+
+void BindingsChecker::for_block(ForBlockAST* ast)
+{
+    this->expression(ast->iterable.get());
+
+    size_t boundCount = m_bindings.size();
+    if (ast->keyVariable) {
+        m_bindings.push_back(ast->keyVariable->variableName);
+    }
+    if (ast->valueVariable) {
+        m_bindings.push_back(ast->valueVariable->variableName);
+    }
+    this->check(ast->body.get());
+    m_bindings.resize(boundCount);
+
+    this->check(ast->elseBody.get());
+}
+
+void BindingsChecker::include_block(IncludeBlockAST* ast)
+{
+    // the body of a nested include has its own bindings, only check the expressions bound to them
+    if (ast->nameExpression) {
+        this->expression(ast->nameExpression.get());
+    }
+    if (ast->scope) {
+        this->expression(ast->scope.get());
+    }
+    for (auto &tuple : ast->variableMapping) {
+        this->expression(tuple.second.get());
+    }
+}
+
+void BindingsChecker::extends_block(ExtendsBlockAST* ast)
+{
+}
+
+void BindingsChecker::named_block(NamedBlockAST* ast)
+{
+    this->check(ast->body.get());
+}
+
+void BindingsChecker::macro_definition(MacroDefinitionAST* ast)
+{
+    // a macro has its own bindings
+}
+
+void BindingsChecker::macro_call(MacroCallAST* ast)
+{
+    for (auto &argument : *ast->arguments) {
+        this->expression(argument.get());
+    }
+}
+
+void BindingsChecker::set_block(SetBlockAST* ast)
+{
+    this->expression(ast->value.get());
+
+    m_bindings.push_back(ast->name);
+    this->check(ast->body.get());
+    m_bindings.pop_back();
+}
+
+void BindingsChecker::capture_block(CaptureBlockAST* ast)
+{
+    this->check(ast->capture.get());
+
+    m_bindings.push_back(ast->name);
+    this->check(ast->body.get());
+    m_bindings.pop_back();
+}
+
+void BindingsChecker::switch_block(SwitchBlockAST* ast)
+{
+    this->expression(ast->expr.get());
+    for (auto &caseBlock : ast->cases) {
+        this->check(caseBlock.get());
+    }
+    this->check(ast->elseBody.get());
+}
+
+void BindingsChecker::case_block(CaseBlockAST* ast)
+{
+    this->check(ast->body.get());
+}
+
+void BindingsChecker::cache_block(CacheBlockAST* ast)
+{
+    this->expression(ast->key.get());
+    this->check(ast->body.get());
+}
+
+void BindingsChecker::variable_reference_expression(VariableReferenceExpression *expr)
+{
+    // the innermost binding wins
+    auto binding = std::find(m_bindings.rbegin(), m_bindings.rend(), expr->variableName);
+    if (binding == m_bindings.rend()) {
+        if (m_unboundVariable.empty()) {
+            m_unboundVariable = expr->variableName;
+        }
+    } else if (m_localReferences && static_cast<size_t>(binding.base() - m_bindings.begin()) > m_boundCount) {
+        m_localReferences->insert(expr);
+    }
+}
+
+void BindingsChecker::get_attribute_expression(GetAttributeExpression *expr)
+{
+    this->expression(expr->variable.get());
+}
+
+void BindingsChecker::method_call_expression(MethodCallExpression *expr)
+{
+    for (auto &argument : *expr->arguments) {
+        this->expression(argument.get());
+    }
+}
+
+void BindingsChecker::double_literal_expression(DoubleLiteralExpression *expr)
+{
+}
+
+void BindingsChecker::integer_literal_expression(IntegerLiteralExpression *expr)
+{
+}
+
+void BindingsChecker::boolean_literal_expression(BooleanLiteralExpression *expr)
+{
+}
+
+void BindingsChecker::string_literal_expression(StringLiteralExpression *expr)
+{
+}
+
+void BindingsChecker::binary_operation_expression(BinaryOperationExpression *expr)
+{
+    this->expression(expr->left.get());
+    this->expression(expr->right.get());
+}
+
+void BindingsChecker::unary_operation_expression(UnaryOperationExpression *expr)
+{
+    this->expression(expr->expr.get());
+}
+
+void BindingsChecker::comparison_expression(ComparisonExpression *expr)
+{
+    this->expression(expr->left.get());
+    this->expression(expr->right.get());
+}
+
+void BindingsChecker::array_literal_expression(ArrayLiteralExpression *expr)
+{
+    for (auto &value : *expr->values) {
+        this->expression(value.get());
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef __BINDINGS_CHECKER_HPP_
+#define __BINDINGS_CHECKER_HPP_
+
+#include "ast/visitors.hpp"
+
+#include <unordered_set>
+#include <vector>
+
+namespace b2 {
+
+/*
+ * Checks the body of a separately compiled include or macro: every variable it
+ * references should be one of `bindings`, or be bound by a for loop or a set block in
+ * that body.
+ */
+class BindingsChecker : private Visitor<void>, private ExpressionVisitor<void> {
+public:
+    explicit BindingsChecker(std::vector<Symbol> bindings) : m_bindings(std::move(bindings)), m_boundCount(m_bindings.size()), m_localReferences(nullptr) {}
+
+    /*
+     * Returns the first variable referenced by `ast` which isn't bound, or an empty
+     * Symbol when there is none.
+     */
+    Symbol findUnboundVariable(AST* ast);
+
+    /*
+     * Returns the variable references in `ast` which are bound by `ast` itself, iow. by
+     * one of its for loops or set blocks.
+     */
+    std::unordered_set<VariableReferenceExpression*> findLocalReferences(AST* ast);
+
+private:
+    void check(AST* ast);
+
+    virtual void statements(StatementsAST* ast) override;
+    virtual void raw(RawBlockAST* ast) override;
+    virtual void print_block(PrintBlockAST* ast) override;
+    virtual void if_block(IfBlockAST* ast) override;
+    virtual void for_block(ForBlockAST* ast) override;
+    virtual void include_block(IncludeBlockAST* ast) override;
+    virtual void extends_block(ExtendsBlockAST* ast) override;
+    virtual void named_block(NamedBlockAST* ast) override;
+    virtual void macro_definition(MacroDefinitionAST* ast) override;
+    virtual void macro_call(MacroCallAST* ast) override;
+    virtual void set_block(SetBlockAST* ast) override;
+    virtual void capture_block(CaptureBlockAST* ast) override;
+    virtual void switch_block(SwitchBlockAST* ast) override;
+    virtual void case_block(CaseBlockAST* ast) override;
+    virtual void cache_block(CacheBlockAST* ast) override;
+
+    virtual void variable_reference_expression(VariableReferenceExpression *expr) override;
+    virtual void get_attribute_expression(GetAttributeExpression *expr) override;
+    virtual void method_call_expression(MethodCallExpression *expr) override;
+    virtual void double_literal_expression(DoubleLiteralExpression *expr) override;
+    virtual void integer_literal_expression(IntegerLiteralExpression *expr) override;
+    virtual void boolean_literal_expression(BooleanLiteralExpression *expr) override;
+    virtual void string_literal_expression(StringLiteralExpression *expr) override;
+    virtual void binary_operation_expression(BinaryOperationExpression *expr) override;
+    virtual void unary_operation_expression(UnaryOperationExpression *expr) override;
+    virtual void comparison_expression(ComparisonExpression *expr) override;
+    virtual void array_literal_expression(ArrayLiteralExpression *expr) override;
+
+    // the bindings, followed by the variables of the for loops, set and capture blocks being checked
+    std::vector<Symbol> m_bindings;
+    size_t m_boundCount;
+    Symbol m_unboundVariable;
+    std::unordered_set<VariableReferenceExpression*>* m_localReferences;
+};
+
+} // namespace b2
+
+#endif /* __BINDINGS_CHECKER_HPP_ */
@@ -1,37 +1,28 @@
 #include "coalesce_rawblocks_pass.hpp"
 
+#include <string>
 #include <vector>
 #include <iostream>
 
 using namespace b2;
 
-static const char* concat(std::vector<const char*> strings)
+static SourceString concat(const std::vector<const SourceString*> &strings)
 {
     size_t length = 0;
 
     // calculate total string size
     for (auto str : strings) {
-        length += strlen(str);
-    }
-
-    // alloc new string
-    const char* new_str = (const char*) malloc(length + 1);
-    if (new_str == nullptr) {
-        throw std::bad_alloc();
+        length += str->length();
     }
 
     // copy strings into new string
-    char* ptr = (char*) new_str;
+    std::string new_str;
+    new_str.reserve(length);
     for (auto str : strings) {
-        size_t str_len = strlen(str);
-        memcpy(ptr, str, str_len);
-        ptr += str_len;
+        new_str.append(str->data(), str->length());
     }
 
-    // terminate new string
-    *ptr = '\0';
-
-    return new_str;
+    return SourceString(new_str);
 }
 
 AST* CoalesceRawBlocksPass::process_node(StatementsAST* ast)
@@ -45,7 +36,7 @@ AST* CoalesceRawBlocksPass::process_node(StatementsAST* ast)
         if (statement->type() == RawBlockASTType) {
             // merge this and all following RawBlockASTs into one
             RawBlockAST* raw_block = static_cast<RawBlockAST*>(statement);
-            std::vector<const char*> strings;
+            std::vector<const SourceString*> strings;
 
             // gather all strings of this raw block and all its succeeding raw blocks
             auto iter2 = iter;
@@ -55,12 +46,12 @@ AST* CoalesceRawBlocksPass::process_node(StatementsAST* ast)
                 }
 
                 RawBlockAST* raw_block2 = static_cast<RawBlockAST*>(iter2->get());
-                strings.push_back(raw_block2->text.get());
+                strings.push_back(&raw_block2->text);
             }
 
             if (strings.size() > 1) {
                 // set this raw block to the concatenation of all strings
-                raw_block->text.reset(concat(strings));
+                raw_block->text = concat(strings);
 
                 // delete all succeeding raw blocks
                 iter2 = iter;
@@ -72,6 +63,7 @@ AST* CoalesceRawBlocksPass::process_node(StatementsAST* ast)
 
                     iter2 = statements->erase(iter2);
                 }
+                this->markModified();
             }
         }
     }
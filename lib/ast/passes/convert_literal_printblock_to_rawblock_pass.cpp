@@ -10,12 +10,7 @@ static RawBlockAST* createFormattedRawBlock(T value)
 	std::stringstream ss;
 	ss << value;
 
-	const char* str = strdup(ss.str().c_str());
-    if (str == nullptr) {
-        throw std::bad_alloc();
-    }
-
-    return new RawBlockAST(str);
+    return new RawBlockAST(SourceString(ss.str()));
 }
 
 AST* ConvertLiteralPrintBlockToRawBlockPass::process_node(PrintBlockAST* ast)
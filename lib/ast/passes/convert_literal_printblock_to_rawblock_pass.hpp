@@ -7,6 +7,8 @@ namespace b2 {
 
 class ConvertLiteralPrintBlockToRawBlockPass : public ASTPass
 {
+public:
+    virtual bool isNodeLocal() const override { return true; }
 protected:
     virtual AST* process_node(PrintBlockAST* ast) override;
 };
@@ -0,0 +1,64 @@
+#include "ast/passes/eliminate_dead_branches_pass.hpp"
+
+using namespace b2;
+
+namespace {
+
+enum Truthiness {
+    False,
+    True,
+    Unknown,
+};
+
+Truthiness truthiness(Expression* expr)
+{
+    switch (expr->type()) {
+        case BooleanLiteralExpressionType:
+            return static_cast<BooleanLiteralExpression*>(expr)->value ? True : False;
+        case IntegerLiteralExpressionType:
+            return static_cast<IntegerLiteralExpression*>(expr)->value != 0 ? True : False;
+        case DoubleLiteralExpressionType:
+            return static_cast<DoubleLiteralExpression*>(expr)->value != 0 ? True : False;
+        case StringLiteralExpressionType: {
+            auto &value = static_cast<StringLiteralExpression*>(expr)->value;
+            if (value.length() == 1 && value.data()[0] == '0') {
+                return Unknown;
+            }
+            return value.empty() ? False : True;
+        }
+        default:
+            return Unknown;
+    }
+}
+
+} /* anon namespace */
+
+AST* EliminateDeadBranchesPass::process_node(IfBlockAST *ast)
+{
+    // the traversal doesn't revisit an if block replaced by another if block, eg. by an
+    // elseif, so this keeps going until it finds a body which does get rendered
+    AST* node = ast;
+    std::unique_ptr<AST> body;
+    while (node->type() == IfBlockASTType) {
+        auto ifBlock = static_cast<IfBlockAST*>(node);
+        std::unique_ptr<AST> renderedBody;
+        switch (truthiness(ifBlock->condition.get())) {
+            case True:
+                renderedBody = std::move(ifBlock->thenBody);
+                break;
+            case False:
+                renderedBody = std::move(ifBlock->elseBody);
+                break;
+            case Unknown:
+                return body ? body.release() : ast;
+        }
+
+        if (!renderedBody) {
+            return new StatementsAST();
+        }
+        body = std::move(renderedBody);
+        node = body.get();
+    }
+
+    return body.release();
+}
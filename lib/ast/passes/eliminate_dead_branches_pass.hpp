@@ -0,0 +1,27 @@
+#ifndef __ELIMINATE_DEAD_BRANCHES_PASS_HPP_
+#define __ELIMINATE_DEAD_BRANCHES_PASS_HPP_
+
+#include "ast/passes/pass.hpp"
+
+namespace b2 {
+
+/*
+ * Replaces every if block whose condition is a literal, eg. after
+ * FoldConstantExpressionsPass turned `{% if 1 > 2 %}` into `{% if false %}`, by the
+ * body which would get rendered.
+ *
+ * Boolean and numeric conditions are true when they're not false or 0, strings when
+ * they're not empty. Conditions on the string "0" are left alone, as the backends
+ * don't agree on its truthiness.
+ */
+class EliminateDeadBranchesPass : public ASTPass
+{
+public:
+    virtual bool isNodeLocal() const override { return true; }
+protected:
+    virtual AST* process_node(IfBlockAST *ast) override;
+};
+
+} // namespace b2
+
+#endif /* __ELIMINATE_DEAD_BRANCHES_PASS_HPP_ */
@@ -0,0 +1,83 @@
+#include <stdexcept>
+#include <unordered_set>
+
+#include "ast/flat_ast.hpp"
+#include "ast/passes/extract_fragments_pass.hpp"
+
+using namespace b2;
+
+namespace {
+
+/*
+ * Collects the macro definitions of `ast`, which include the ones of its separately
+ * compiled includes, but not the ones in `excluded`.
+ */
+void collectMacros(AST* ast, AST* excluded, std::vector<MacroDefinitionAST*> &macros)
+{
+    if (!ast) {
+        return;
+    }
+
+    FlatAST flatAST(ast);
+    for (uint32_t index = 0; index < flatAST.size(); ) {
+        auto &node = flatAST[index];
+        if (node.ast == excluded) {
+            index = node.end;
+            continue;
+        }
+
+        if (node.type == MacroDefinitionASTType) {
+            macros.push_back(node.as<MacroDefinitionAST>());
+        } else if (node.type == IncludeBlockASTType) {
+            collectMacros(node.as<IncludeBlockAST>()->body.get(), excluded, macros);
+        }
+        index++;
+    }
+}
+
+} /* anon namespace */
+
+AST* ExtractFragmentsPass::process(AST* ast)
+{
+    m_fragments.clear();
+
+    std::unordered_set<Symbol> names;
+    FlatAST flatAST(ast);
+    for (auto &node : flatAST) {
+        if (node.type != NamedBlockASTType || !node.as<NamedBlockAST>()->isFragment) {
+            continue;
+        }
+
+        auto fragment = node.as<NamedBlockAST>();
+        if (!names.insert(fragment->name).second) {
+            throw std::runtime_error("Fragment '" + fragment->name.str() + "' is defined more than once");
+        }
+
+        std::vector<MacroDefinitionAST*> macros;
+        collectMacros(ast, fragment, macros);
+
+        auto statements = new StatementsAST();
+        for (auto macro : macros) {
+            statements->statements->emplace_back(macro->clone());
+        }
+        if (fragment->body) {
+            statements->statements->emplace_back(fragment->body->clone());
+        }
+        m_fragments.push_back(Fragment{fragment->name, std::unique_ptr<AST>(statements)});
+    }
+
+    return ASTPass::process(ast);
+}
+
+AST* ExtractFragmentsPass::process_node(NamedBlockAST *ast)
+{
+    if (!ast->isFragment) {
+        return ast;
+    }
+
+    if (!ast->body) {
+        return new StatementsAST();
+    }
+
+    return ast->body.release();
+}
@@ -0,0 +1,47 @@
+#ifndef __EXTRACT_FRAGMENTS_PASS_HPP_
+#define __EXTRACT_FRAGMENTS_PASS_HPP_
+
+#include "ast/passes/pass.hpp"
+
+#include <memory>
+#include <vector>
+
+namespace b2 {
+
+/*
+ * Makes every fragment of a template, eg. `{% fragment comments %}...{% endfragment %}`,
+ * renderable by itself: the AST of a fragment consists of its body, preceded by every
+ * macro definition of the template so it can call them. A fragment gets these ASTs as
+ * a template of its own: the variables its surroundings bind, eg. the loop variable of
+ * a fragment rendering a row of a table, get looked up from the variables it is
+ * rendered with instead. In the template itself every fragment gets replaced by its
+ * body, so it renders in place as before.
+ *
+ * Fragments in the bodies of macros and of separately compiled includes only render in
+ * place. This pass should run after ResolveInheritancePass and ResolveIncludesPass,
+ * which bring in the fragments of layouts and includes, and before ResolveMacrosPass,
+ * which drops the macro definitions.
+ */
+class ExtractFragmentsPass : public ASTPass
+{
+public:
+    struct Fragment {
+        Symbol name;
+        std::unique_ptr<AST> ast;
+    };
+
+    virtual AST* process(AST* ast) override;
+
+    /*
+     * The fragments of the template processed last, in the order they appear in.
+     */
+    std::vector<Fragment>& fragments() { return m_fragments; }
+protected:
+    virtual AST* process_node(NamedBlockAST *ast) override;
+private:
+    std::vector<Fragment> m_fragments;
+};
+
+} // namespace b2
+
+#endif /* __EXTRACT_FRAGMENTS_PASS_HPP_ */
@@ -1,5 +1,9 @@
 #include "fold_constant_expressions_pass.hpp"
 
+#include <string.h>
+
+#include <sstream>
+
 using namespace b2;
 
 static bool isLiteralExpression(Expression* expr)
@@ -31,6 +35,91 @@ static bool isStringLiteralExpression(Expression* expr)
     return expr->type() == StringLiteralExpressionType;
 }
 
+/*
+ * Whether evaluating `expr` could call a method, which might have side effects.
+ */
+static bool callsMethods(Expression* expr)
+{
+    switch (expr->type()) {
+        case MethodCallExpressionType:
+            return true;
+        case GetAttributeExpressionType:
+            return callsMethods(static_cast<GetAttributeExpression*>(expr)->variable.get());
+        case BinaryOperationExpressionType: {
+            auto binary = static_cast<BinaryOperationExpression*>(expr);
+            return callsMethods(binary->left.get()) || callsMethods(binary->right.get());
+        }
+        case UnaryOperationExpressionType:
+            return callsMethods(static_cast<UnaryOperationExpression*>(expr)->expr.get());
+        case ComparisonExpressionType: {
+            auto comparison = static_cast<ComparisonExpression*>(expr);
+            return callsMethods(comparison->left.get()) || callsMethods(comparison->right.get());
+        }
+        case ArrayLiteralExpressionType:
+            for (auto &value : *static_cast<ArrayLiteralExpression*>(expr)->values) {
+                if (callsMethods(value.get())) {
+                    return true;
+                }
+            }
+            return false;
+        default:
+            return false;
+    }
+}
+
+/*
+ * Formats the literal `expr` the way printing it does.
+ */
+static std::string formatLiteralExpression(Expression* expr)
+{
+    std::stringstream ss;
+    switch (expr->type()) {
+        case DoubleLiteralExpressionType:
+            ss << static_cast<DoubleLiteralExpression*>(expr)->value;
+            break;
+        case IntegerLiteralExpressionType:
+            ss << static_cast<IntegerLiteralExpression*>(expr)->value;
+            break;
+        case BooleanLiteralExpressionType:
+            ss << (static_cast<BooleanLiteralExpression*>(expr)->value ? "true" : "false");
+            break;
+        case StringLiteralExpressionType:
+            return static_cast<StringLiteralExpression*>(expr)->value.str();
+        default:
+            break;
+    }
+
+    return ss.str();
+}
+
+static Expression* foldConcatenation(BinaryOperationExpression *expression)
+{
+    auto left = expression->left.get();
+    auto right = expression->right.get();
+
+    if (!isLiteralExpression(right)) {
+        return expression;
+    }
+
+    if (isLiteralExpression(left)) {
+        return new StringLiteralExpression(SourceString(formatLiteralExpression(left) + formatLiteralExpression(right)));
+    }
+
+    // concatenating is associative, so the literal ending the left operand can be folded
+    // with this one, eg. `name ~ "!" ~ "\n"` becomes `name ~ "!\n"`
+    if (left->type() == BinaryOperationExpressionType) {
+        auto concatenation = static_cast<BinaryOperationExpression*>(left);
+        if (concatenation->op == Concatenation && isLiteralExpression(concatenation->right.get())) {
+            auto literal = formatLiteralExpression(concatenation->right.get()) + formatLiteralExpression(right);
+            concatenation->right.reset(new StringLiteralExpression(SourceString(literal)));
+            expression->left.release();
+            return concatenation;
+        }
+    }
+
+    return expression;
+}
+
 #define NUMERIC_VALUE(x) (x->type() == IntegerLiteralExpressionType ? static_cast<IntegerLiteralExpression*>(x)->value : static_cast<DoubleLiteralExpression*>(x)->value)
 
 Expression* FoldConstantExpressionsPass::process_node(BinaryOperationExpression *expression)
@@ -56,6 +145,10 @@ Expression* FoldConstantExpressionsPass::process_node(BinaryOperationExpression
         }
     }
 
+    if (expression->op == Concatenation) {
+        return foldConcatenation(expression);
+    }
+
     if (!isNumericLiteralExpression(left) || !isNumericLiteralExpression(right)) {
         // we can't fold this expression, not all parts are constants
         return expression;
@@ -77,6 +170,9 @@ Expression* FoldConstantExpressionsPass::process_node(BinaryOperationExpression
             case Modulus:
                 // TODO: should an exception be thrown?
                 return expression;
+            case Concatenation:
+                // already folded by foldConcatenation() above
+                return expression;
         }
     } else {
         // both the operands are integer, so the result should also be integer
@@ -100,8 +196,13 @@ Expression* FoldConstantExpressionsPass::process_node(BinaryOperationExpression
 					throw std::runtime_error("Modulo by zero");
 				}
                 return new IntegerLiteralExpression(leftValue % rightValue);
+            case Concatenation:
+                // already folded by foldConcatenation() above
+                return expression;
         }
     }
+
+    return expression;
 }
 
 Expression* FoldConstantExpressionsPass::process_node(UnaryOperationExpression *expression)
@@ -174,6 +275,23 @@ Expression* FoldConstantExpressionsPass::process_node(ComparisonExpression *expr
         }
     }
 
+    if ((expression->op == And || expression->op == Or) && isBooleanLiteralExpression(left) != isBooleanLiteralExpression(right)) {
+        // one of the operands is constant, which either decides the outcome or leaves it to the other one
+        bool isLeftConstant = isBooleanLiteralExpression(left);
+        auto constant = static_cast<BooleanLiteralExpression*>(isLeftConstant ? left : right);
+        auto &other = isLeftConstant ? expression->right : expression->left;
+
+        if (constant->value == (expression->op == Or)) {
+            if (!callsMethods(other.get())) {
+                return new BooleanLiteralExpression(constant->value);
+            }
+        } else if (other->valueType() == BooleanType) {
+            return other.release();
+        }
+
+        return expression;
+    }
+
     if (!isLiteralExpression(left) || !isLiteralExpression(right)) {
         // we can't fold this expression, not all parts are constants
         return expression;
@@ -201,12 +319,12 @@ Expression* FoldConstantExpressionsPass::process_node(ComparisonExpression *expr
                 }
             } else if (isStringLiteralExpression(left) && isStringLiteralExpression(right)) {
                 // string comparison
-                auto left_string = static_cast<StringLiteralExpression*>(left)->value.get();
-                auto right_string = static_cast<StringLiteralExpression*>(right)->value.get();
+                auto &left_string = static_cast<StringLiteralExpression*>(left)->value;
+                auto &right_string = static_cast<StringLiteralExpression*>(right)->value;
 
                 switch (expression->op) {
-                    case Equal: return new BooleanLiteralExpression(strcmp(left_string, right_string) == 0);
-                    case NotEqual: return new BooleanLiteralExpression(strcmp(left_string, right_string) != 0);
+                    case Equal: return new BooleanLiteralExpression(left_string == right_string);
+                    case NotEqual: return new BooleanLiteralExpression(left_string != right_string);
                     default: break;
                 }
             }
@@ -216,7 +334,7 @@ Expression* FoldConstantExpressionsPass::process_node(ComparisonExpression *expr
         case GreaterOrEqual:
         case LessThan:
         case LessOrEqual:
-            if (!isNumericLiteralExpression(left) && !isNumericLiteralExpression(right)) {
+            if (!isNumericLiteralExpression(left) || !isNumericLiteralExpression(right)) {
                 // these comparison operations only supports numeric values
                 // TODO: throw error?
                 break;
@@ -233,7 +351,7 @@ Expression* FoldConstantExpressionsPass::process_node(ComparisonExpression *expr
 
         case Or:
         case And: {
-            if (!isBooleanLiteralExpression(left) && !isBooleanLiteralExpression(right)) {
+            if (!isBooleanLiteralExpression(left) || !isBooleanLiteralExpression(right)) {
                 // "&&" and "||" only supports boolean values
                 // TODO: throw error?
                 break;
@@ -253,3 +371,38 @@ Expression* FoldConstantExpressionsPass::process_node(ComparisonExpression *expr
 
     return expression;
 }
+
+Expression* FoldConstantExpressionsPass::process_node(GetAttributeExpression *expression)
+{
+    auto variable = expression->variable.get();
+
+    // try folding the variable, eg. an attribute of an attribute of a map literal
+    Expression* new_variable = this->process(variable);
+    if (new_variable != variable) {
+        expression->variable.reset(new_variable);
+        variable = new_variable;
+    }
+
+    if (variable->type() != ArrayLiteralExpressionType || callsMethods(variable)) {
+        return expression;
+    }
+
+    // an attribute of a map literal (what unrolling a loop over a list of maps leaves behind)
+    auto map = static_cast<ArrayLiteralExpression*>(variable);
+    if (!map->isMap()) {
+        return expression;
+    }
+
+    auto value = map->values->begin();
+    for (auto &key : *map->keys) {
+        if (isStringLiteralExpression(key.get())) {
+            auto &name = static_cast<StringLiteralExpression*>(key.get())->value;
+            if (name.length() == expression->attributeName.length() && memcmp(name.data(), expression->attributeName.data(), name.length()) == 0) {
+                return (*value)->clone();
+            }
+        }
+        ++value;
+    }
+
+    return expression;
+}
@@ -7,7 +7,10 @@ namespace b2 {
 
 class FoldConstantExpressionsPass : public ExpressionPass
 {
+public:
+    virtual bool isNodeLocal() const override { return true; }
 protected:
+    virtual Expression* process_node(GetAttributeExpression *expr) override;
     virtual Expression* process_node(BinaryOperationExpression *expr) override;
     virtual Expression* process_node(UnaryOperationExpression *expr) override;
     virtual Expression* process_node(ComparisonExpression *expr) override;
@@ -0,0 +1,579 @@
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "ast/passes/hoist_lookups_pass.hpp"
+
+using namespace b2;
+
+namespace {
+
+/*
+ * A node of the trie of the paths looked up in a scope; the path of a node consists
+ * of the names of its ancestors (without the root of the trie) and its own name.
+ */
+struct PathNode {
+    Symbol name;
+    PathNode* parent;
+    // weighted number of times this exact path gets looked up, not counting longer paths
+    unsigned directCount;
+    bool hoisted;
+    Symbol hoistedName;
+    std::vector<std::unique_ptr<PathNode>> children;
+
+    PathNode(Symbol name, PathNode* parent) : name(name), parent(parent), directCount(0), hoisted(false) {}
+
+    PathNode* child(Symbol childName) {
+        for (auto &child : children) {
+            if (child->name == childName) {
+                return child.get();
+            }
+        }
+
+        children.emplace_back(new PathNode(childName, this));
+        return children.back().get();
+    }
+};
+
+typedef std::unordered_map<Expression*, PathNode*> Occurrences;
+typedef std::unordered_set<PathNode*> PathSet;
+
+/*
+ * Collects the paths looked up in a scope which start at one of `roots`, or at a
+ * variable which isn't bound within the scope when collecting free variables.
+ */
+class PathCollector : private Visitor<void>, private ExpressionVisitor<void> {
+public:
+    PathCollector(const std::vector<Symbol> &roots, bool collectsFreeVariables, bool evaluatesLoopBodies) :
+        m_bindings(roots), m_rootCount(roots.size()), m_collectsFreeVariables(collectsFreeVariables), m_evaluatesLoopBodies(evaluatesLoopBodies),
+        m_loopDepth(0), m_paths(Symbol(), nullptr) {}
+
+    void collect(AST* ast);
+
+    /*
+     * Marks the paths which get looked up more than once, and returns them in pre-order.
+     */
+    std::vector<PathNode*> markHoistedPaths();
+
+    Occurrences& occurrences() { return m_occurrences; }
+private:
+    unsigned markHoistedPaths(PathNode* node, std::vector<PathNode*> &hoistedPaths);
+    void path(Expression* expr);
+    PathSet branch(AST* ast);
+    void joinBranches(const std::vector<PathSet> &branches);
+
+    virtual void statements(StatementsAST* ast) override;
+    virtual void raw(RawBlockAST* ast) override;
+    virtual void print_block(PrintBlockAST* ast) override;
+    virtual void if_block(IfBlockAST* ast) override;
+    virtual void for_block(ForBlockAST* ast) override;
+    virtual void include_block(IncludeBlockAST* ast) override;
+    virtual void extends_block(ExtendsBlockAST* ast) override;
+    virtual void named_block(NamedBlockAST* ast) override;
+    virtual void macro_definition(MacroDefinitionAST* ast) override;
+    virtual void macro_call(MacroCallAST* ast) override;
+    virtual void set_block(SetBlockAST* ast) override;
+    virtual void capture_block(CaptureBlockAST* ast) override;
+    virtual void switch_block(SwitchBlockAST* ast) override;
+    virtual void case_block(CaseBlockAST* ast) override;
+    virtual void cache_block(CacheBlockAST* ast) override;
+
+    virtual void variable_reference_expression(VariableReferenceExpression *expr) override;
+    virtual void get_attribute_expression(GetAttributeExpression *expr) override;
+    virtual void method_call_expression(MethodCallExpression *expr) override;
+    virtual void double_literal_expression(DoubleLiteralExpression *expr) override;
+    virtual void integer_literal_expression(IntegerLiteralExpression *expr) override;
+    virtual void boolean_literal_expression(BooleanLiteralExpression *expr) override;
+    virtual void string_literal_expression(StringLiteralExpression *expr) override;
+    virtual void binary_operation_expression(BinaryOperationExpression *expr) override;
+    virtual void unary_operation_expression(UnaryOperationExpression *expr) override;
+    virtual void comparison_expression(ComparisonExpression *expr) override;
+    virtual void array_literal_expression(ArrayLiteralExpression *expr) override;
+
+    // the roots, followed by the variables of the for loops, set and capture blocks being visited
+    std::vector<Symbol> m_bindings;
+    size_t m_rootCount;
+    bool m_collectsFreeVariables;
+    // whether a loop body counts as evaluated, even though an empty iterable skips it
+    bool m_evaluatesLoopBodies;
+    unsigned m_loopDepth;
+    PathNode m_paths;
+    Occurrences m_occurrences;
+    // the paths which get evaluated on every path through the code collected so far
+    PathSet m_evaluatedPaths;
+};
+
+void PathCollector::collect(AST* ast)
+{
+    if (ast) {
+        this->ast(ast);
+    }
+}
+
+std::vector<PathNode*> PathCollector::markHoistedPaths()
+{
+    std::vector<PathNode*> hoistedPaths;
+    for (auto &child : m_paths.children) {
+        this->markHoistedPaths(child.get(), hoistedPaths);
+    }
+    return hoistedPaths;
+}
+
+/*
+ * Returns the number of times the path of `node` gets evaluated once the paths below
+ * it are hoisted: a hoisted path evaluates its prefix once, any other path every time.
+ */
+unsigned PathCollector::markHoistedPaths(PathNode* node, std::vector<PathNode*> &hoistedPaths)
+{
+    // reserve the spot of this node, so the result is in pre-order
+    size_t position = hoistedPaths.size();
+    hoistedPaths.push_back(node);
+
+    unsigned evaluations = node->directCount;
+    for (auto &child : node->children) {
+        unsigned childEvaluations = this->markHoistedPaths(child.get(), hoistedPaths);
+        evaluations += child->hoisted ? 1 : childEvaluations;
+    }
+
+    // a variable itself would only be bound to itself; and a lookup which only happens in
+    // some branches can't be moved in front of them
+    bool isHoistable = node->parent != &m_paths && m_evaluatedPaths.count(node) > 0;
+    node->hoisted = isHoistable && evaluations > 1;
+    if (!node->hoisted) {
+        hoistedPaths.erase(hoistedPaths.begin() + position);
+    }
+
+    return evaluations;
+}
+
+/*
+ * Counts `expr` when it is a path starting at a collected variable, otherwise visits
+ * the expression the path starts at.
+ */
+void PathCollector::path(Expression* expr)
+{
+    std::vector<Symbol> attributes;
+    auto base = expr;
+    while (base->type() == GetAttributeExpressionType) {
+        auto getAttribute = static_cast<GetAttributeExpression*>(base);
+        attributes.push_back(getAttribute->attributeName);
+        base = getAttribute->variable.get();
+    }
+
+    if (base->type() != VariableReferenceExpressionType) {
+        this->expression(base);
+        return;
+    }
+
+    // the innermost binding wins
+    auto variableName = static_cast<VariableReferenceExpression*>(base)->variableName;
+    auto binding = std::find(m_bindings.rbegin(), m_bindings.rend(), variableName);
+    bool isCollected = binding == m_bindings.rend() ? m_collectsFreeVariables : static_cast<size_t>(binding.base() - m_bindings.begin()) <= m_rootCount;
+    if (!isCollected) {
+        return;
+    }
+
+    auto node = m_paths.child(variableName);
+    for (auto attribute = attributes.rbegin(); attribute != attributes.rend(); ++attribute) {
+        node = node->child(*attribute);
+    }
+
+    // every iteration of a loop looks the path up again
+    node->directCount += m_loopDepth > 0 ? 2 : 1;
+    m_occurrences[expr] = node;
+
+    // looking up a path looks up its prefixes as well
+    for (; node != &m_paths; node = node->parent) {
+        m_evaluatedPaths.insert(node);
+    }
+}
+
+/*
+ * Collects `ast`, which only gets rendered on some paths through the scope, and returns
+ * the paths it evaluates whenever it does.
+ */
+PathSet PathCollector::branch(AST* ast)
+{
+    PathSet paths;
+    std::swap(paths, m_evaluatedPaths);
+    this->collect(ast);
+    std::swap(paths, m_evaluatedPaths);
+    return paths;
+}
+
+/*
+ * Marks the paths evaluated by every one of `branches` as evaluated, as one of them
+ * always gets rendered.
+ */
+void PathCollector::joinBranches(const std::vector<PathSet> &branches)
+{
+    for (auto node : branches.front()) {
+        auto isEvaluatedBy = [node](const PathSet &paths) { return paths.count(node) > 0; };
+        if (std::all_of(branches.begin() + 1, branches.end(), isEvaluatedBy)) {
+            m_evaluatedPaths.insert(node);
+        }
+    }
+}
+
+void PathCollector::statements(StatementsAST* ast)
+{
+    for (auto &statement : *ast->statements) {
+        this->ast(statement.get());
+    }
+}
+
+void PathCollector::raw(RawBlockAST* ast)
+{
+}
+
+void PathCollector::print_block(PrintBlockAST* ast)
+{
+    this->expression(ast->expr.get());
+}
+
+void PathCollector::if_block(IfBlockAST* ast)
+{
+    this->expression(ast->condition.get());
+    this->joinBranches({this->branch(ast->thenBody.get()), this->branch(ast->elseBody.get())});
+}
+
+void PathCollector::for_block(ForBlockAST* ast)
+{
+    this->expression(ast->iterable.get());
+
+    size_t boundCount = m_bindings.size();
+    if (ast->keyVariable) {
+        m_bindings.push_back(ast->keyVariable->variableName);
+    }
+    if (ast->valueVariable) {
+        m_bindings.push_back(ast->valueVariable->variableName);
+    }
+    m_loopDepth++;
+    auto bodyPaths = this->branch(ast->body.get());
+    m_loopDepth--;
+    m_bindings.resize(boundCount);
+
+    // the body doesn't get rendered for an empty iterable, the else body does instead
+    auto elsePaths = this->branch(ast->elseBody.get());
+    if (m_evaluatesLoopBodies) {
+        m_evaluatedPaths.insert(bodyPaths.begin(), bodyPaths.end());
+    }
+    this->joinBranches({bodyPaths, elsePaths});
+}
+
+void PathCollector::include_block(IncludeBlockAST* ast)
+{
+    // the body of a separately compiled include is a scope of its own
+    if (ast->nameExpression) {
+        this->expression(ast->nameExpression.get());
+    }
+    if (ast->scope) {
+        this->expression(ast->scope.get());
+    }
+    for (auto &tuple : ast->variableMapping) {
+        this->expression(tuple.second.get());
+    }
+}
+
+void PathCollector::extends_block(ExtendsBlockAST* ast)
+{
+}
+
+void PathCollector::named_block(NamedBlockAST* ast)
+{
+    this->collect(ast->body.get());
+}
+
+void PathCollector::macro_definition(MacroDefinitionAST* ast)
+{
+    // a macro has its own bindings
+}
+
+void PathCollector::macro_call(MacroCallAST* ast)
+{
+    for (auto &argument : *ast->arguments) {
+        this->expression(argument.get());
+    }
+}
+
+void PathCollector::set_block(SetBlockAST* ast)
+{
+    this->expression(ast->value.get());
+
+    m_bindings.push_back(ast->name);
+    this->collect(ast->body.get());
+    m_bindings.pop_back();
+}
+
+void PathCollector::capture_block(CaptureBlockAST* ast)
+{
+    this->collect(ast->capture.get());
+
+    m_bindings.push_back(ast->name);
+    this->collect(ast->body.get());
+    m_bindings.pop_back();
+}
+
+void PathCollector::switch_block(SwitchBlockAST* ast)
+{
+    this->expression(ast->expr.get());
+
+    std::vector<PathSet> branches;
+    for (auto &caseBlock : ast->cases) {
+        branches.push_back(this->branch(caseBlock.get()));
+    }
+    branches.push_back(this->branch(ast->elseBody.get()));
+    this->joinBranches(branches);
+}
+
+void PathCollector::case_block(CaseBlockAST* ast)
+{
+    this->collect(ast->body.get());
+}
+
+void PathCollector::cache_block(CacheBlockAST* ast)
+{
+    // a cached body is a scope of its own, its lookups get skipped when it's cached
+    this->expression(ast->key.get());
+}
+
+void PathCollector::variable_reference_expression(VariableReferenceExpression *expr)
+{
+    this->path(expr);
+}
+
+void PathCollector::get_attribute_expression(GetAttributeExpression *expr)
+{
+    this->path(expr);
+}
+
+void PathCollector::method_call_expression(MethodCallExpression *expr)
+{
+    for (auto &argument : *expr->arguments) {
+        this->expression(argument.get());
+    }
+}
+
+void PathCollector::double_literal_expression(DoubleLiteralExpression *expr)
+{
+}
+
+void PathCollector::integer_literal_expression(IntegerLiteralExpression *expr)
+{
+}
+
+void PathCollector::boolean_literal_expression(BooleanLiteralExpression *expr)
+{
+}
+
+void PathCollector::string_literal_expression(StringLiteralExpression *expr)
+{
+}
+
+void PathCollector::binary_operation_expression(BinaryOperationExpression *expr)
+{
+    this->expression(expr->left.get());
+    this->expression(expr->right.get());
+}
+
+void PathCollector::unary_operation_expression(UnaryOperationExpression *expr)
+{
+    this->expression(expr->expr.get());
+}
+
+void PathCollector::comparison_expression(ComparisonExpression *expr)
+{
+    this->expression(expr->left.get());
+
+    if (expr->op != And && expr->op != Or) {
+        this->expression(expr->right.get());
+        return;
+    }
+
+    // the right operand may get short-circuited
+    PathSet paths;
+    std::swap(paths, m_evaluatedPaths);
+    this->expression(expr->right.get());
+    std::swap(paths, m_evaluatedPaths);
+}
+
+void PathCollector::array_literal_expression(ArrayLiteralExpression *expr)
+{
+    for (auto &value : *expr->values) {
+        this->expression(value.get());
+    }
+}
+
+/*
+ * Builds the expression looking up the path of `node`, starting at the longest hoisted
+ * path which is a prefix of it (or the path itself, when `includingSelf`).
+ */
+Expression* buildPath(PathNode* node, bool includingSelf)
+{
+    std::vector<Symbol> attributes;
+    auto base = node;
+    auto startsAt = [&](PathNode* prefix) { return prefix->hoisted && (prefix != node || includingSelf); };
+    while (!startsAt(base) && base->parent->parent != nullptr) {
+        attributes.push_back(base->name);
+        base = base->parent;
+    }
+
+    Expression* expr = new VariableReferenceExpression(startsAt(base) ? base->hoistedName : base->name);
+    for (auto attribute = attributes.rbegin(); attribute != attributes.rend(); ++attribute) {
+        expr = new GetAttributeExpression(expr, *attribute);
+    }
+    return expr;
+}
+
+class ReplacePathsPass : public ExpressionPass {
+public:
+    ReplacePathsPass(Occurrences &occurrences) : m_occurrences(occurrences) {}
+
+    virtual bool visitsIncludeBodies() const override { return false; }
+    virtual bool visitsMacroBodies() const override { return false; }
+protected:
+    virtual Expression* process_node(VariableReferenceExpression *expr) override { return this->replace(expr); }
+    virtual Expression* process_node(GetAttributeExpression *expr) override { return this->replace(expr); }
+private:
+    Expression* replace(Expression* expr);
+
+    Occurrences &m_occurrences;
+};
+
+Expression* ReplacePathsPass::replace(Expression* expr)
+{
+    auto occurrence = m_occurrences.find(expr);
+    if (occurrence == m_occurrences.end()) {
+        return expr;
+    }
+
+    // the replaced expression gets freed, so its address could be reused by a new one
+    auto node = occurrence->second;
+    m_occurrences.erase(occurrence);
+
+    for (auto prefix = node; prefix->parent != nullptr; prefix = prefix->parent) {
+        if (prefix->hoisted) {
+            return buildPath(node, true);
+        }
+    }
+    return expr;
+}
+
+std::string pathName(PathNode* node)
+{
+    std::string name = node->name.str();
+    for (node = node->parent; node->parent != nullptr; node = node->parent) {
+        name = node->name.str() + "." + name;
+    }
+    return name;
+}
+
+} /* anon namespace */
+
+AST* HoistLookupsPass::hoistLookups(AST* body, const std::vector<Symbol> &roots, bool hoistsFreeVariables)
+{
+    PathCollector collector(roots, hoistsFreeVariables, m_hoistsFromLoopBodies);
+    collector.collect(body);
+
+    auto hoistedPaths = collector.markHoistedPaths();
+    if (hoistedPaths.empty()) {
+        return body;
+    }
+
+    for (auto node : hoistedPaths) {
+        node->hoistedName = m_context.symbols().intern(pathName(node));
+    }
+
+    m_passManager.removeAllPasses();
+    m_passManager.addPass(new ReplacePathsPass(collector.occurrences()));
+    body = m_passManager.run(body);
+
+    // the shortest paths go first, as the longer ones are looked up from them
+    for (auto node = hoistedPaths.rbegin(); node != hoistedPaths.rend(); ++node) {
+        auto set = new SetBlockAST((*node)->hoistedName, buildPath(*node, false), body);
+        m_hoistedSets.insert(set);
+        body = set;
+    }
+
+    return body;
+}
+
+AST* HoistLookupsPass::process(AST* ast)
+{
+    m_hoistedSets.clear();
+
+    // a different AST being returned frees `ast`, so the hoisted set blocks can't wrap it
+    AST* body;
+    if (ast->type() == StatementsASTType) {
+        auto statements = static_cast<StatementsAST*>(ast);
+        body = new StatementsAST(statements->statements.release());
+        statements->statements.reset(new ASTList());
+    } else {
+        body = ast->clone();
+    }
+
+    return ASTPass::process(this->hoistLookups(body, {}, true));
+}
+
+AST* HoistLookupsPass::process_node(ForBlockAST *ast)
+{
+    if (ast->body) {
+        std::vector<Symbol> roots;
+        if (ast->keyVariable) {
+            roots.push_back(ast->keyVariable->variableName);
+        }
+        if (ast->valueVariable) {
+            roots.push_back(ast->valueVariable->variableName);
+        }
+        ast->body.reset(this->hoistLookups(ast->body.release(), roots, false));
+    }
+
+    return ast;
+}
+
+AST* HoistLookupsPass::process_node(IncludeBlockAST *ast)
+{
+    if (ast->body) {
+        ast->body.reset(this->hoistLookups(ast->body.release(), {}, true));
+    }
+
+    return ast;
+}
+
+AST* HoistLookupsPass::process_node(MacroDefinitionAST *ast)
+{
+    if (ast->body) {
+        ast->body.reset(this->hoistLookups(ast->body.release(), ast->parameters, false));
+    }
+
+    return ast;
+}
+
+AST* HoistLookupsPass::process_node(MacroCallAST *ast)
+{
+    if (ast->body) {
+        ast->body.reset(this->hoistLookups(ast->body.release(), ast->parameters, false));
+    }
+
+    return ast;
+}
+
+AST* HoistLookupsPass::process_node(CacheBlockAST *ast)
+{
+    if (ast->body) {
+        ast->body.reset(this->hoistLookups(ast->body.release(), {}, true));
+    }
+
+    return ast;
+}
+
+AST* HoistLookupsPass::process_node(SetBlockAST *ast)
+{
+    if (ast->body && m_hoistedSets.count(ast) == 0) {
+        ast->body.reset(this->hoistLookups(ast->body.release(), {ast->name}, false));
+    }
+
+    return ast;
+}
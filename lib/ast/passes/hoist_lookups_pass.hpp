@@ -0,0 +1,63 @@
+#ifndef __HOIST_LOOKUPS_PASS_HPP_
+#define __HOIST_LOOKUPS_PASS_HPP_
+
+#include "ast/context.hpp"
+#include "ast/passes/pass.hpp"
+#include "ast/passes/pass_manager.hpp"
+
+#include <unordered_set>
+#include <vector>
+
+namespace b2 {
+
+/*
+ * Looks up every attribute path, eg. `user.address.city`, only once per scope: a path
+ * which would otherwise get evaluated more than once is bound to a set block at the
+ * start of the scope, and its occurrences reference that block instead. Longer paths
+ * are looked up from the hoisted prefixes they share. Plain variables aren't hoisted,
+ * as the backends already look those up cheaply (LLVM merges the repeated lookups).
+ *
+ * A scope is the template itself (or the body of a separately compiled include or a
+ * cache block), for the variables it looks up, and every for loop, set block and macro
+ * body, for the variables they bind. A path occurring in the body of a nested for loop
+ * counts as evaluated more than once. Lookups in a cache block stay within it, as
+ * they're skipped when it's cached.
+ *
+ * Only paths which get evaluated on every path through the scope are hoisted: a lookup
+ * in an if or switch branch or the right operand of `and`/`or` would be wasted work in
+ * front of them. A loop body counts as evaluated when `hoistsFromLoopBodies`, so
+ * loop-invariant lookups end up in front of the loop, also when an empty iterable skips
+ * the body: that's for backends in which a lookup that misses is harmless (the PHP
+ * bindings return null). Otherwise, eg. for javascript, where
+ * `{% for x in xs %}{{ user.name }}{% endfor %}` would fail on an undefined `user`, a
+ * loop-invariant lookup only moves in front of its loop when it also gets evaluated
+ * outside of it.
+ *
+ * Hoisted set blocks are named after their path, eg. "user.address"; no template
+ * variable can be named like that.
+ */
+class HoistLookupsPass : public ASTPass
+{
+public:
+    explicit HoistLookupsPass(ASTContext &context, bool hoistsFromLoopBodies = true) : m_context(context), m_hoistsFromLoopBodies(hoistsFromLoopBodies) {}
+
+    virtual AST* process(AST* ast) override;
+protected:
+    virtual AST* process_node(ForBlockAST *ast) override;
+    virtual AST* process_node(IncludeBlockAST *ast) override;
+    virtual AST* process_node(MacroDefinitionAST *ast) override;
+    virtual AST* process_node(MacroCallAST *ast) override;
+    virtual AST* process_node(SetBlockAST *ast) override;
+    virtual AST* process_node(CacheBlockAST *ast) override;
+private:
+    AST* hoistLookups(AST* body, const std::vector<Symbol> &roots, bool hoistsFreeVariables);
+
+    ASTContext &m_context;
+    bool m_hoistsFromLoopBodies;
+    PassManager m_passManager;
+    std::unordered_set<SetBlockAST*> m_hoistedSets;
+};
+
+} // namespace b2
+
+#endif /* __HOIST_LOOKUPS_PASS_HPP_ */
@@ -0,0 +1,310 @@
+#include "ast/passes/infer_types_pass.hpp"
+
+#include <vector>
+
+using namespace b2;
+
+bool b2::parseTypeHint(const std::string &name, ExpressionValueType &type)
+{
+    if (name == "int") {
+        type = IntegerType;
+    } else if (name == "float") {
+        type = DoubleType;
+    } else if (name == "bool") {
+        type = BooleanType;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+namespace {
+
+class TypeAnnotator : private Visitor<void>, private ExpressionVisitor<ExpressionValueType>
+{
+public:
+    explicit TypeAnnotator(const TypeHints &hints) : m_hints(hints), m_hintsVariables(true) {}
+
+    void annotate(AST* ast);
+private:
+    void annotateSeparateBody(AST* ast);
+    void annotateContainer(Expression* expr);
+
+    virtual void statements(StatementsAST* ast) override;
+    virtual void raw(RawBlockAST* ast) override;
+    virtual void print_block(PrintBlockAST* ast) override;
+    virtual void if_block(IfBlockAST* ast) override;
+    virtual void for_block(ForBlockAST* ast) override;
+    virtual void include_block(IncludeBlockAST* ast) override;
+    virtual void extends_block(ExtendsBlockAST* ast) override;
+    virtual void named_block(NamedBlockAST* ast) override;
+    virtual void macro_definition(MacroDefinitionAST* ast) override;
+    virtual void macro_call(MacroCallAST* ast) override;
+    virtual void set_block(SetBlockAST* ast) override;
+    virtual void capture_block(CaptureBlockAST* ast) override;
+    virtual void switch_block(SwitchBlockAST* ast) override;
+    virtual void case_block(CaseBlockAST* ast) override;
+    virtual void cache_block(CacheBlockAST* ast) override;
+
+    virtual ExpressionValueType variable_reference_expression(VariableReferenceExpression *expr) override;
+    virtual ExpressionValueType get_attribute_expression(GetAttributeExpression *expr) override;
+    virtual ExpressionValueType method_call_expression(MethodCallExpression *expr) override;
+    virtual ExpressionValueType double_literal_expression(DoubleLiteralExpression *expr) override;
+    virtual ExpressionValueType integer_literal_expression(IntegerLiteralExpression *expr) override;
+    virtual ExpressionValueType boolean_literal_expression(BooleanLiteralExpression *expr) override;
+    virtual ExpressionValueType string_literal_expression(StringLiteralExpression *expr) override;
+    virtual ExpressionValueType binary_operation_expression(BinaryOperationExpression *expr) override;
+    virtual ExpressionValueType unary_operation_expression(UnaryOperationExpression *expr) override;
+    virtual ExpressionValueType comparison_expression(ComparisonExpression *expr) override;
+    virtual ExpressionValueType array_literal_expression(ArrayLiteralExpression *expr) override;
+
+    const TypeHints &m_hints;
+    // the variables bound by the for loops, set and capture blocks being annotated, with their types
+    std::vector<std::pair<Symbol, ExpressionValueType>> m_bindings;
+    // false while annotating the body of a separately compiled include or macro
+    bool m_hintsVariables;
+};
+
+void TypeAnnotator::annotate(AST* ast)
+{
+    if (ast) {
+        this->ast(ast);
+    }
+}
+
+/*
+ * The variables of a separately compiled body are bound by its caller, so they aren't
+ * hinted; the functions it calls are the same ones.
+ */
+void TypeAnnotator::annotateSeparateBody(AST* ast)
+{
+    auto bindings = std::move(m_bindings);
+    bool hintsVariables = m_hintsVariables;
+
+    m_bindings.clear();
+    m_hintsVariables = false;
+    this->annotate(ast);
+
+    m_bindings = std::move(bindings);
+    m_hintsVariables = hintsVariables;
+}
+
+/*
+ * Annotates an expression which is used as an array or object, eg. iterated over: a
+ * variable there is a variant, whatever its hint says.
+ */
+void TypeAnnotator::annotateContainer(Expression* expr)
+{
+    if (expr->type() == VariableReferenceExpressionType) {
+        static_cast<VariableReferenceExpression*>(expr)->inferredType = VariantType;
+    } else {
+        this->expression(expr);
+    }
+}
+
+void TypeAnnotator::statements(StatementsAST* ast)
+{
+    for (auto &statement : *ast->statements) {
+        this->annotate(statement.get());
+    }
+}
+
+void TypeAnnotator::raw(RawBlockAST* ast)
+{
+}
+
+void TypeAnnotator::print_block(PrintBlockAST* ast)
+{
+    this->expression(ast->expr.get());
+}
+
+void TypeAnnotator::if_block(IfBlockAST* ast)
+{
+    this->expression(ast->condition.get());
+    this->annotate(ast->thenBody.get());
+    this->annotate(ast->elseBody.get());
+}
+
+void TypeAnnotator::for_block(ForBlockAST* ast)
+{
+    this->annotateContainer(ast->iterable.get());
+
+    // the keys of an array can be strings as well as integers
+    size_t boundCount = m_bindings.size();
+    if (ast->keyVariable) {
+        m_bindings.emplace_back(ast->keyVariable->variableName, VariantType);
+    }
+    if (ast->valueVariable) {
+        m_bindings.emplace_back(ast->valueVariable->variableName, VariantType);
+    }
+    this->annotate(ast->body.get());
+    m_bindings.resize(boundCount);
+
+    this->annotate(ast->elseBody.get());
+}
+
+void TypeAnnotator::include_block(IncludeBlockAST* ast)
+{
+    if (ast->nameExpression) {
+        this->expression(ast->nameExpression.get());
+    }
+    if (ast->scope) {
+        this->annotateContainer(ast->scope.get());
+    }
+    for (auto &tuple : ast->variableMapping) {
+        this->expression(tuple.second.get());
+    }
+    this->annotateSeparateBody(ast->body.get());
+}
+
+void TypeAnnotator::extends_block(ExtendsBlockAST* ast)
+{
+}
+
+void TypeAnnotator::named_block(NamedBlockAST* ast)
+{
+    this->annotate(ast->body.get());
+}
+
+void TypeAnnotator::macro_definition(MacroDefinitionAST* ast)
+{
+    this->annotateSeparateBody(ast->body.get());
+}
+
+void TypeAnnotator::macro_call(MacroCallAST* ast)
+{
+    for (auto &argument : *ast->arguments) {
+        this->expression(argument.get());
+    }
+    this->annotateSeparateBody(ast->body.get());
+}
+
+void TypeAnnotator::set_block(SetBlockAST* ast)
+{
+    auto type = this->expression(ast->value.get());
+
+    m_bindings.emplace_back(ast->name, type);
+    this->annotate(ast->body.get());
+    m_bindings.pop_back();
+}
+
+void TypeAnnotator::capture_block(CaptureBlockAST* ast)
+{
+    this->annotate(ast->capture.get());
+
+    m_bindings.emplace_back(ast->name, VariantType);
+    this->annotate(ast->body.get());
+    m_bindings.pop_back();
+}
+
+void TypeAnnotator::switch_block(SwitchBlockAST* ast)
+{
+    this->expression(ast->expr.get());
+    for (auto &caseBlock : ast->cases) {
+        this->annotate(caseBlock.get());
+    }
+    this->annotate(ast->elseBody.get());
+}
+
+void TypeAnnotator::case_block(CaseBlockAST* ast)
+{
+    this->annotate(ast->body.get());
+}
+
+void TypeAnnotator::cache_block(CacheBlockAST* ast)
+{
+    this->expression(ast->key.get());
+    this->annotate(ast->body.get());
+}
+
+ExpressionValueType TypeAnnotator::variable_reference_expression(VariableReferenceExpression *expr)
+{
+    // the innermost binding wins
+    for (auto binding = m_bindings.rbegin(); binding != m_bindings.rend(); ++binding) {
+        if (binding->first == expr->variableName) {
+            return expr->inferredType = binding->second;
+        }
+    }
+
+    auto hint = m_hints.variables.find(expr->variableName);
+    if (m_hintsVariables && hint != m_hints.variables.end()) {
+        return expr->inferredType = hint->second;
+    }
+
+    return expr->inferredType = VariantType;
+}
+
+ExpressionValueType TypeAnnotator::get_attribute_expression(GetAttributeExpression *expr)
+{
+    this->annotateContainer(expr->variable.get());
+    return expr->valueType();
+}
+
+ExpressionValueType TypeAnnotator::method_call_expression(MethodCallExpression *expr)
+{
+    for (auto &argument : *expr->arguments) {
+        this->expression(argument.get());
+    }
+
+    auto hint = m_hints.functions.find(expr->methodName);
+    return expr->inferredType = (hint != m_hints.functions.end() ? hint->second : VariantType);
+}
+
+ExpressionValueType TypeAnnotator::double_literal_expression(DoubleLiteralExpression *expr)
+{
+    return expr->valueType();
+}
+
+ExpressionValueType TypeAnnotator::integer_literal_expression(IntegerLiteralExpression *expr)
+{
+    return expr->valueType();
+}
+
+ExpressionValueType TypeAnnotator::boolean_literal_expression(BooleanLiteralExpression *expr)
+{
+    return expr->valueType();
+}
+
+ExpressionValueType TypeAnnotator::string_literal_expression(StringLiteralExpression *expr)
+{
+    return expr->valueType();
+}
+
+ExpressionValueType TypeAnnotator::binary_operation_expression(BinaryOperationExpression *expr)
+{
+    this->expression(expr->left.get());
+    this->expression(expr->right.get());
+    expr->updateValueType();
+    return expr->valueType();
+}
+
+ExpressionValueType TypeAnnotator::unary_operation_expression(UnaryOperationExpression *expr)
+{
+    this->expression(expr->expr.get());
+    expr->updateValueType();
+    return expr->valueType();
+}
+
+ExpressionValueType TypeAnnotator::comparison_expression(ComparisonExpression *expr)
+{
+    this->expression(expr->left.get());
+    this->expression(expr->right.get());
+    return expr->valueType();
+}
+
+ExpressionValueType TypeAnnotator::array_literal_expression(ArrayLiteralExpression *expr)
+{
+    for (auto &value : *expr->values) {
+        this->expression(value.get());
+    }
+    return expr->valueType();
+}
+
+} /* anon namespace */
+
+AST* InferTypesPass::process(AST* ast)
+{
+    TypeAnnotator(m_hints).annotate(ast);
+    return ast;
+}
@@ -0,0 +1,53 @@
+#ifndef __INFER_TYPES_PASS_HPP_
+#define __INFER_TYPES_PASS_HPP_
+
+#include "ast/passes/pass.hpp"
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace b2 {
+
+/*
+ * The types of the variables and the return values of the functions a template gets
+ * rendered with, as far as they're known at compile time.
+ */
+struct TypeHints {
+    std::unordered_map<Symbol, ExpressionValueType> variables;
+    std::unordered_map<Symbol, ExpressionValueType> functions;
+};
+
+/*
+ * Parses the name of a type which can be hinted: "int", "float" or "bool". Returns false
+ * for anything else.
+ */
+bool parseTypeHint(const std::string &name, ExpressionValueType &type);
+
+/*
+ * Annotates every variable reference and method call with the type of its value, when
+ * that's known: the variables of set blocks have the type of their value, and the
+ * variables and functions of `hints` the hinted type. The operations on them get their
+ * types derived again, so eg. `count * 2` is an integer when `count` is.
+ *
+ * A backend can then load a hinted value once as a native value, converting it when it
+ * has another type, and use native operations from there on. Only the variables of the
+ * template itself are hinted: the bodies of separately compiled includes and macros get
+ * their variables from their callers.
+ *
+ * This pass should run after HoistLookupsPass, which replaces the variable references
+ * it hoists.
+ */
+class InferTypesPass : public ASTPass
+{
+public:
+    explicit InferTypesPass(TypeHints hints) : m_hints(std::move(hints)) {}
+
+    virtual AST* process(AST* ast) override;
+private:
+    const TypeHints m_hints;
+};
+
+} // namespace b2
+
+#endif /* __INFER_TYPES_PASS_HPP_ */
@@ -0,0 +1,147 @@
+#include <cctype>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "ast/passes/lower_if_chains_to_switch_pass.hpp"
+
+using namespace b2;
+
+namespace {
+
+const size_t MIN_CASES = 3;
+
+bool isPath(Expression* expr)
+{
+    while (expr->type() == GetAttributeExpressionType) {
+        expr = static_cast<GetAttributeExpression*>(expr)->variable.get();
+    }
+    return expr->type() == VariableReferenceExpressionType;
+}
+
+bool isSamePath(Expression* left, Expression* right)
+{
+    while (left->type() == GetAttributeExpressionType && right->type() == GetAttributeExpressionType) {
+        auto leftAttribute = static_cast<GetAttributeExpression*>(left);
+        auto rightAttribute = static_cast<GetAttributeExpression*>(right);
+        if (leftAttribute->attributeName != rightAttribute->attributeName) {
+            return false;
+        }
+
+        left = leftAttribute->variable.get();
+        right = rightAttribute->variable.get();
+    }
+
+    return left->type() == VariableReferenceExpressionType && right->type() == VariableReferenceExpressionType &&
+        static_cast<VariableReferenceExpression*>(left)->variableName == static_cast<VariableReferenceExpression*>(right)->variableName;
+}
+
+/*
+ * Whether `str` might be a numeric string (this errs on the safe side): those get
+ * compared numerically to other numeric strings.
+ */
+bool isNumericString(const SourceString& str)
+{
+    size_t i = 0;
+    while (i < str.length() && isspace(static_cast<unsigned char>(str.data()[i]))) {
+        i++;
+    }
+    return i < str.length() && (isdigit(static_cast<unsigned char>(str.data()[i])) || str.data()[i] == '+' || str.data()[i] == '-' || str.data()[i] == '.');
+}
+
+bool isCaseValue(Expression* expr)
+{
+    switch (expr->type()) {
+        case IntegerLiteralExpressionType:
+            return true;
+        case StringLiteralExpressionType:
+            return !isNumericString(static_cast<StringLiteralExpression*>(expr)->value);
+        default:
+            return false;
+    }
+}
+
+/*
+ * The operands of a condition comparing a path to a case value.
+ */
+struct CaseTest {
+    std::unique_ptr<Expression>* path;
+    std::unique_ptr<Expression>* value;
+};
+
+bool matchCaseTest(Expression* condition, CaseTest &test)
+{
+    if (condition->type() != ComparisonExpressionType) {
+        return false;
+    }
+
+    auto comparison = static_cast<ComparisonExpression*>(condition);
+    if (comparison->op != Equal) {
+        return false;
+    }
+
+    if (isPath(comparison->left.get()) && isCaseValue(comparison->right.get())) {
+        test = CaseTest{&comparison->left, &comparison->right};
+        return true;
+    }
+    if (isCaseValue(comparison->left.get()) && isPath(comparison->right.get())) {
+        test = CaseTest{&comparison->right, &comparison->left};
+        return true;
+    }
+    return false;
+}
+
+std::string caseKey(Expression* value)
+{
+    if (value->type() == IntegerLiteralExpressionType) {
+        return std::to_string(static_cast<IntegerLiteralExpression*>(value)->value);
+    }
+    return static_cast<StringLiteralExpression*>(value)->value.str();
+}
+
+} /* anon namespace */
+
+AST* LowerIfChainsToSwitchPass::process_node(IfBlockAST *ast)
+{
+    // collect the arms comparing the same path to values of the same type
+    std::vector<IfBlockAST*> arms;
+    std::vector<CaseTest> tests;
+    for (auto arm = ast; ; arm = static_cast<IfBlockAST*>(arm->elseBody.get())) {
+        CaseTest test;
+        if (!matchCaseTest(arm->condition.get(), test)) {
+            break;
+        }
+        if (!tests.empty()) {
+            auto &first = tests.front();
+            if (!isSamePath(first.path->get(), test.path->get()) || (*first.value)->type() != (*test.value)->type()) {
+                break;
+            }
+        }
+
+        arms.push_back(arm);
+        tests.push_back(test);
+
+        if (!arm->elseBody || arm->elseBody->type() != IfBlockASTType) {
+            break;
+        }
+    }
+
+    if (arms.size() < MIN_CASES) {
+        return ast;
+    }
+
+    // the rest of the chain becomes the else body, the arms themselves get freed along with `ast`
+    auto switchBlock = new SwitchBlockAST(tests.front().path->release(), arms.back()->elseBody.release());
+
+    std::set<std::string> values;
+    for (size_t i = 0; i < arms.size(); i++) {
+        // a value compared to before can't match anymore
+        if (!values.insert(caseKey(tests[i].value->get())).second) {
+            continue;
+        }
+
+        switchBlock->cases.emplace_back(new CaseBlockAST(tests[i].value->release(), arms[i]->thenBody.release()));
+    }
+
+    return switchBlock;
+}
@@ -0,0 +1,27 @@
+#ifndef __LOWER_IF_CHAINS_TO_SWITCH_PASS_HPP_
+#define __LOWER_IF_CHAINS_TO_SWITCH_PASS_HPP_
+
+#include "ast/passes/pass.hpp"
+
+namespace b2 {
+
+/*
+ * Turns an if/elseif chain comparing the same variable (or attribute) to integer or
+ * string literals, eg. `{% if status == "new" %}…{% elseif status == "paid" %}…`, into a
+ * switch block. The variable then gets looked up once, and a backend can find the
+ * matching case without comparing it to every literal.
+ *
+ * Only chains of at least 3 such comparisons are turned into a switch. Numeric strings,
+ * eg. "1e3", are left alone, as those compare equal to other strings as well.
+ */
+class LowerIfChainsToSwitchPass : public ASTPass
+{
+public:
+    virtual bool isNodeLocal() const override { return true; }
+protected:
+    virtual AST* process_node(IfBlockAST *ast) override;
+};
+
+} // namespace b2
+
+#endif /* __LOWER_IF_CHAINS_TO_SWITCH_PASS_HPP_ */
@@ -0,0 +1,382 @@
+#include <algorithm>
+#include <string>
+
+#include "ast/passes/memoize_loop_invariant_output_pass.hpp"
+
+using namespace b2;
+
+namespace {
+
+/*
+ * Checks whether a statement renders the same output in every iteration of a loop,
+ * ie. it doesn't reference any of the variables bound within the loop (unless it binds
+ * them itself) and has no side effects.
+ */
+class InvarianceChecker : private Visitor<void>, private ExpressionVisitor<void> {
+public:
+    InvarianceChecker(const std::vector<Symbol> &loopBindings, const std::unordered_set<Symbol> &captureNames) :
+        m_loopBindings(loopBindings), m_captureNames(captureNames), m_isInvariant(true), m_evaluates(false) {}
+
+    /*
+     * Returns whether `ast` is loop-invariant; `evaluates` is set when it evaluates an
+     * expression other than a literal or captured output.
+     */
+    bool check(AST* ast, bool &evaluates);
+private:
+    void check(AST* ast);
+
+    virtual void statements(StatementsAST* ast) override;
+    virtual void raw(RawBlockAST* ast) override;
+    virtual void print_block(PrintBlockAST* ast) override;
+    virtual void if_block(IfBlockAST* ast) override;
+    virtual void for_block(ForBlockAST* ast) override;
+    virtual void include_block(IncludeBlockAST* ast) override;
+    virtual void extends_block(ExtendsBlockAST* ast) override;
+    virtual void named_block(NamedBlockAST* ast) override;
+    virtual void macro_definition(MacroDefinitionAST* ast) override;
+    virtual void macro_call(MacroCallAST* ast) override;
+    virtual void set_block(SetBlockAST* ast) override;
+    virtual void capture_block(CaptureBlockAST* ast) override;
+    virtual void switch_block(SwitchBlockAST* ast) override;
+    virtual void case_block(CaseBlockAST* ast) override;
+    virtual void cache_block(CacheBlockAST* ast) override;
+
+    virtual void variable_reference_expression(VariableReferenceExpression *expr) override;
+    virtual void get_attribute_expression(GetAttributeExpression *expr) override;
+    virtual void method_call_expression(MethodCallExpression *expr) override;
+    virtual void double_literal_expression(DoubleLiteralExpression *expr) override;
+    virtual void integer_literal_expression(IntegerLiteralExpression *expr) override;
+    virtual void boolean_literal_expression(BooleanLiteralExpression *expr) override;
+    virtual void string_literal_expression(StringLiteralExpression *expr) override;
+    virtual void binary_operation_expression(BinaryOperationExpression *expr) override;
+    virtual void unary_operation_expression(UnaryOperationExpression *expr) override;
+    virtual void comparison_expression(ComparisonExpression *expr) override;
+    virtual void array_literal_expression(ArrayLiteralExpression *expr) override;
+
+    const std::vector<Symbol> &m_loopBindings;
+    const std::unordered_set<Symbol> &m_captureNames;
+    // the variables bound by the statement itself
+    std::vector<Symbol> m_localBindings;
+    bool m_isInvariant;
+    bool m_evaluates;
+};
+
+bool InvarianceChecker::check(AST* ast, bool &evaluates)
+{
+    m_isInvariant = true;
+    m_evaluates = false;
+    m_localBindings.clear();
+
+    this->check(ast);
+
+    evaluates = m_evaluates;
+    return m_isInvariant;
+}
+
+void InvarianceChecker::check(AST* ast)
+{
+    if (ast && m_isInvariant) {
+        this->ast(ast);
+    }
+}
+
+void InvarianceChecker::statements(StatementsAST* ast)
+{
+    for (auto &statement : *ast->statements) {
+        this->check(statement.get());
+    }
+}
+
+void InvarianceChecker::raw(RawBlockAST* ast)
+{
+}
+
+void InvarianceChecker::print_block(PrintBlockAST* ast)
+{
+    this->expression(ast->expr.get());
+}
+
+void InvarianceChecker::if_block(IfBlockAST* ast)
+{
+    this->expression(ast->condition.get());
+    this->check(ast->thenBody.get());
+    this->check(ast->elseBody.get());
+}
+
+void InvarianceChecker::for_block(ForBlockAST* ast)
+{
+    this->expression(ast->iterable.get());
+
+    size_t boundCount = m_localBindings.size();
+    if (ast->keyVariable) {
+        m_localBindings.push_back(ast->keyVariable->variableName);
+    }
+    if (ast->valueVariable) {
+        m_localBindings.push_back(ast->valueVariable->variableName);
+    }
+    this->check(ast->body.get());
+    m_localBindings.resize(boundCount);
+
+    this->check(ast->elseBody.get());
+}
+
+void InvarianceChecker::include_block(IncludeBlockAST* ast)
+{
+    m_isInvariant = false;
+}
+
+void InvarianceChecker::extends_block(ExtendsBlockAST* ast)
+{
+    m_isInvariant = false;
+}
+
+void InvarianceChecker::named_block(NamedBlockAST* ast)
+{
+    this->check(ast->body.get());
+}
+
+void InvarianceChecker::macro_definition(MacroDefinitionAST* ast)
+{
+    m_isInvariant = false;
+}
+
+void InvarianceChecker::macro_call(MacroCallAST* ast)
+{
+    m_isInvariant = false;
+}
+
+void InvarianceChecker::set_block(SetBlockAST* ast)
+{
+    this->expression(ast->value.get());
+
+    m_localBindings.push_back(ast->name);
+    this->check(ast->body.get());
+    m_localBindings.pop_back();
+}
+
+void InvarianceChecker::capture_block(CaptureBlockAST* ast)
+{
+    this->check(ast->capture.get());
+
+    m_localBindings.push_back(ast->name);
+    this->check(ast->body.get());
+    m_localBindings.pop_back();
+}
+
+void InvarianceChecker::switch_block(SwitchBlockAST* ast)
+{
+    this->expression(ast->expr.get());
+    for (auto &caseBlock : ast->cases) {
+        this->check(caseBlock.get());
+    }
+    this->check(ast->elseBody.get());
+}
+
+void InvarianceChecker::case_block(CaseBlockAST* ast)
+{
+    this->check(ast->body.get());
+}
+
+void InvarianceChecker::cache_block(CacheBlockAST* ast)
+{
+    m_evaluates = true;
+    this->expression(ast->key.get());
+    this->check(ast->body.get());
+}
+
+void InvarianceChecker::variable_reference_expression(VariableReferenceExpression *expr)
+{
+    auto name = expr->variableName;
+    if (std::find(m_localBindings.begin(), m_localBindings.end(), name) != m_localBindings.end()) {
+        m_evaluates = true;
+        return;
+    }
+
+    if (std::find(m_loopBindings.begin(), m_loopBindings.end(), name) != m_loopBindings.end()) {
+        m_isInvariant = false;
+    } else if (m_captureNames.count(name) == 0) {
+        m_evaluates = true;
+    }
+}
+
+void InvarianceChecker::get_attribute_expression(GetAttributeExpression *expr)
+{
+    m_evaluates = true;
+    this->expression(expr->variable.get());
+}
+
+void InvarianceChecker::method_call_expression(MethodCallExpression *expr)
+{
+    m_isInvariant = false;
+}
+
+void InvarianceChecker::double_literal_expression(DoubleLiteralExpression *expr)
+{
+}
+
+void InvarianceChecker::integer_literal_expression(IntegerLiteralExpression *expr)
+{
+}
+
+void InvarianceChecker::boolean_literal_expression(BooleanLiteralExpression *expr)
+{
+}
+
+void InvarianceChecker::string_literal_expression(StringLiteralExpression *expr)
+{
+}
+
+void InvarianceChecker::binary_operation_expression(BinaryOperationExpression *expr)
+{
+    m_evaluates = true;
+    this->expression(expr->left.get());
+    this->expression(expr->right.get());
+}
+
+void InvarianceChecker::unary_operation_expression(UnaryOperationExpression *expr)
+{
+    m_evaluates = true;
+    this->expression(expr->expr.get());
+}
+
+void InvarianceChecker::comparison_expression(ComparisonExpression *expr)
+{
+    m_evaluates = true;
+    this->expression(expr->left.get());
+    this->expression(expr->right.get());
+}
+
+void InvarianceChecker::array_literal_expression(ArrayLiteralExpression *expr)
+{
+    if (!expr->isConstant()) {
+        m_evaluates = true;
+    }
+    for (auto &value : *expr->values) {
+        this->expression(value.get());
+    }
+}
+
+} /* anon namespace */
+
+Symbol MemoizeLoopInvariantOutputPass::newCaptureName()
+{
+    auto name = m_context.symbols().intern("output#" + std::to_string(++m_captureCount));
+    m_captureNames.insert(name);
+    return name;
+}
+
+/*
+ * Replaces the loop-invariant runs of statements in `body`, and the ones nested in
+ * the set and capture blocks in it, by prints of their captured output.
+ */
+void MemoizeLoopInvariantOutputPass::captureInvariantRuns(std::unique_ptr<AST> &body, std::vector<Symbol> &loopBindings, Captures &captures)
+{
+    InvarianceChecker checker(loopBindings, m_captureNames);
+    bool evaluates;
+
+    if (body->type() != StatementsASTType) {
+        if (checker.check(body.get(), evaluates)) {
+            if (evaluates) {
+                auto name = this->newCaptureName();
+                captures.emplace_back(name, body.release());
+                body.reset(new PrintBlockAST(new VariableReferenceExpression(name)));
+            }
+        } else {
+            this->captureNestedRuns(body, loopBindings, captures);
+        }
+        return;
+    }
+
+    auto statements = static_cast<StatementsAST*>(body.get())->statements.get();
+    auto runStart = statements->end();
+    bool runEvaluates = false;
+    for (auto it = statements->begin(); ; ++it) {
+        if (it != statements->end() && checker.check(it->get(), evaluates)) {
+            if (runStart == statements->end()) {
+                runStart = it;
+            }
+            runEvaluates = runEvaluates || evaluates;
+            continue;
+        }
+
+        // the run ends here
+        if (runStart != statements->end() && runEvaluates) {
+            auto run = new StatementsAST();
+            run->statements->splice(run->statements->end(), *statements, runStart, it);
+
+            auto name = this->newCaptureName();
+            captures.emplace_back(name, run);
+            statements->emplace(it, new PrintBlockAST(new VariableReferenceExpression(name)));
+        }
+        runStart = statements->end();
+        runEvaluates = false;
+
+        if (it == statements->end()) {
+            break;
+        }
+        this->captureNestedRuns(*it, loopBindings, captures);
+    }
+}
+
+/*
+ * Looks for loop-invariant runs in the body of a statement which depends on the loop,
+ * as long as that body gets rendered unconditionally.
+ */
+void MemoizeLoopInvariantOutputPass::captureNestedRuns(std::unique_ptr<AST> &statement, std::vector<Symbol> &loopBindings, Captures &captures)
+{
+    std::unique_ptr<AST>* body;
+    Symbol name;
+    if (statement->type() == SetBlockASTType) {
+        auto set = static_cast<SetBlockAST*>(statement.get());
+        body = &set->body;
+        name = set->name;
+    } else if (statement->type() == CaptureBlockASTType) {
+        auto capture = static_cast<CaptureBlockAST*>(statement.get());
+        body = &capture->body;
+        name = capture->name;
+    } else {
+        return;
+    }
+
+    if (*body) {
+        loopBindings.push_back(name);
+        this->captureInvariantRuns(*body, loopBindings, captures);
+        loopBindings.pop_back();
+    }
+}
+
+AST* MemoizeLoopInvariantOutputPass::process(AST* ast)
+{
+    m_captureCount = 0;
+    m_captureNames.clear();
+
+    return ASTPass::process(ast);
+}
+
+AST* MemoizeLoopInvariantOutputPass::process_node(ForBlockAST *ast)
+{
+    if (!ast->body) {
+        return ast;
+    }
+
+    std::vector<Symbol> loopBindings;
+    if (ast->keyVariable) {
+        loopBindings.push_back(ast->keyVariable->variableName);
+    }
+    if (ast->valueVariable) {
+        loopBindings.push_back(ast->valueVariable->variableName);
+    }
+
+    Captures captures;
+    this->captureInvariantRuns(ast->body, loopBindings, captures);
+    if (captures.empty()) {
+        return ast;
+    }
+
+    // a different AST being returned frees `ast`, so move the loop into a new one
+    AST* result = new ForBlockAST(ast->keyVariable.release(), ast->valueVariable.release(), ast->iterable.release(), ast->body.release(), ast->elseBody.release());
+    for (auto capture = captures.rbegin(); capture != captures.rend(); ++capture) {
+        result = new CaptureBlockAST(capture->first, capture->second, result);
+    }
+    return result;
+}
@@ -0,0 +1,47 @@
+#ifndef __MEMOIZE_LOOP_INVARIANT_OUTPUT_PASS_HPP_
+#define __MEMOIZE_LOOP_INVARIANT_OUTPUT_PASS_HPP_
+
+#include "ast/context.hpp"
+#include "ast/passes/pass.hpp"
+
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace b2 {
+
+/*
+ * Renders the parts of a for loop body which render the same output in every iteration
+ * only once, in front of the loop: every run of consecutive statements which doesn't
+ * depend on the variables bound within the loop is moved into a capture block around
+ * the loop, and gets replaced by a print of the captured output.
+ *
+ * Method calls, includes and macros could have side effects, so statements containing
+ * these are never moved. Runs which don't evaluate any expression aren't worth
+ * capturing, they consist of raw text only.
+ *
+ * Captures are named "output#N"; no template variable can be named like that.
+ */
+class MemoizeLoopInvariantOutputPass : public ASTPass
+{
+public:
+    explicit MemoizeLoopInvariantOutputPass(ASTContext &context) : m_context(context), m_captureCount(0) {}
+
+    virtual AST* process(AST* ast) override;
+protected:
+    virtual AST* process_node(ForBlockAST *ast) override;
+private:
+    typedef std::vector<std::pair<Symbol, AST*>> Captures;
+
+    void captureInvariantRuns(std::unique_ptr<AST> &body, std::vector<Symbol> &loopBindings, Captures &captures);
+    void captureNestedRuns(std::unique_ptr<AST> &statement, std::vector<Symbol> &loopBindings, Captures &captures);
+    Symbol newCaptureName();
+
+    ASTContext &m_context;
+    unsigned m_captureCount;
+    std::unordered_set<Symbol> m_captureNames;
+};
+
+} // namespace b2
+
+#endif /* __MEMOIZE_LOOP_INVARIANT_OUTPUT_PASS_HPP_ */
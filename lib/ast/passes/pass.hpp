@@ -8,10 +8,87 @@ namespace b2 {
 class ASTPass : private Visitor<AST*>
 {
 public:
-    AST* process(AST* ast) {
+    virtual AST* process(AST* ast) {
         return this->ast(ast);
     }
 
+    /*
+     * Whether this pass only rewrites the node it's given, depending on nothing but that
+     * node and its descendants. PassManager runs consecutive node-local passes in a
+     * single traversal, see PassManager::run().
+     */
+    virtual bool isNodeLocal() const { return false; }
+
+    /*
+     * Whether the bodies of includes which are compiled as separate functions get
+     * processed as well. Passes depending on the variables in scope shouldn't do this,
+     * as such a body has its own variables.
+     */
+    virtual bool visitsIncludeBodies() const { return true; }
+
+    /*
+     * Whether the bodies of macros get processed as well, see visitsIncludeBodies().
+     */
+    virtual bool visitsMacroBodies() const { return true; }
+
+    /*
+     * Rewrites `ast` itself, but not its descendants, and returns what replaces it (or
+     * `ast`). Sets `modified` when `ast` got changed in place.
+     */
+    AST* rewrite(AST* ast, bool &modified) {
+        m_modified = false;
+        AST* new_ast;
+        switch (ast->type()) {
+            case StatementsASTType:
+                new_ast = this->process_node(static_cast<StatementsAST*>(ast));
+                break;
+            case RawBlockASTType:
+                new_ast = this->process_node(static_cast<RawBlockAST*>(ast));
+                break;
+            case PrintBlockASTType:
+                new_ast = this->process_node(static_cast<PrintBlockAST*>(ast));
+                break;
+            case IfBlockASTType:
+                new_ast = this->process_node(static_cast<IfBlockAST*>(ast));
+                break;
+            case ForBlockASTType:
+                new_ast = this->process_node(static_cast<ForBlockAST*>(ast));
+                break;
+            case IncludeBlockASTType:
+                new_ast = this->process_node(static_cast<IncludeBlockAST*>(ast));
+                break;
+            case ExtendsBlockASTType:
+                new_ast = this->process_node(static_cast<ExtendsBlockAST*>(ast));
+                break;
+            case NamedBlockASTType:
+                new_ast = this->process_node(static_cast<NamedBlockAST*>(ast));
+                break;
+            case MacroDefinitionASTType:
+                new_ast = this->process_node(static_cast<MacroDefinitionAST*>(ast));
+                break;
+            case MacroCallASTType:
+                new_ast = this->process_node(static_cast<MacroCallAST*>(ast));
+                break;
+            case SetBlockASTType:
+                new_ast = this->process_node(static_cast<SetBlockAST*>(ast));
+                break;
+            case CaptureBlockASTType:
+                new_ast = this->process_node(static_cast<CaptureBlockAST*>(ast));
+                break;
+            case SwitchBlockASTType:
+                new_ast = this->process_node(static_cast<SwitchBlockAST*>(ast));
+                break;
+            case CaseBlockASTType:
+                new_ast = this->process_node(static_cast<CaseBlockAST*>(ast));
+                break;
+            case CacheBlockASTType:
+                new_ast = this->process_node(static_cast<CacheBlockAST*>(ast));
+                break;
+        }
+        modified = m_modified;
+        return new_ast;
+    }
+
 protected:
     virtual AST* process_node(StatementsAST* ast) { return ast; }
     virtual AST* process_node(RawBlockAST* ast) { return ast; }
@@ -19,8 +96,25 @@ protected:
     virtual AST* process_node(IfBlockAST* ast) { return ast; }
     virtual AST* process_node(ForBlockAST* ast) { return ast; }
     virtual AST* process_node(IncludeBlockAST *ast) { return ast; }
+    virtual AST* process_node(ExtendsBlockAST *ast) { return ast; }
+    virtual AST* process_node(NamedBlockAST *ast) { return ast; }
+    virtual AST* process_node(MacroDefinitionAST *ast) { return ast; }
+    virtual AST* process_node(MacroCallAST *ast) { return ast; }
+    virtual AST* process_node(SetBlockAST *ast) { return ast; }
+    virtual AST* process_node(CaptureBlockAST *ast) { return ast; }
+    virtual AST* process_node(SwitchBlockAST *ast) { return ast; }
+    virtual AST* process_node(CaseBlockAST *ast) { return ast; }
+    virtual AST* process_node(CacheBlockAST *ast) { return ast; }
+
+    /*
+     * Tells rewrite() the node being processed got changed in place; node-local passes
+     * should call this when they do, so the nodes around it get rewritten again.
+     */
+    void markModified() { m_modified = true; }
 
 private:
+    bool m_modified = false;
+
     virtual AST* statements(StatementsAST* ast) override {
         auto new_ast = this->process_node(ast);
         if (new_ast->type() != StatementsASTType) {
@@ -28,7 +122,7 @@ private:
         }
         ast = static_cast<StatementsAST*>(new_ast);
 
-        for (auto it = ast->statements->begin(); it != ast->statements->end(); ++it) {
+        for (auto it = ast->statements->begin(); it != ast->statements->end(); ) {
             auto &statement = *it;
             auto old_statement = statement.get();
             auto new_statement = this->ast(old_statement);
@@ -41,16 +135,14 @@ private:
                 // this child is also a StatementsAST, merge it with its parent
                 auto statementToRemove = it;
 
-                // move statements from child StatementsAST to parent StatementsAST
+                // relink the list nodes of the child StatementsAST into the parent StatementsAST
                 auto childStatements = static_cast<StatementsAST*>(statement.get());
-                for (auto &childStatement : *childStatements->statements) {
-                    it = ast->statements->insert(it, std::move(childStatement));
-                    it++;
-                }
+                ast->statements->splice(it, *childStatements->statements);
 
-                // remove child StatementsAST
+                // remove child StatementsAST, this continues right after the (already processed) merged statements
                 it = ast->statements->erase(statementToRemove);
-                --it;
+            } else {
+                ++it;
             }
         }
 
@@ -127,8 +219,194 @@ private:
     }
 
     virtual AST* include_block(IncludeBlockAST *ast) override {
+        auto new_ast = this->process_node(ast);
+        if (new_ast->type() != IncludeBlockASTType) {
+            return new_ast;
+        }
+        ast = static_cast<IncludeBlockAST*>(new_ast);
+
+        if (ast->body && this->visitsIncludeBodies()) {
+            auto oldBody = ast->body.get();
+            auto newBody = this->ast(oldBody);
+
+            if (newBody != oldBody) {
+                ast->body.reset(newBody);
+            }
+        }
+
+        return ast;
+    }
+
+    virtual AST* extends_block(ExtendsBlockAST *ast) override {
         return this->process_node(ast);
     }
+
+    virtual AST* named_block(NamedBlockAST *ast) override {
+        auto new_ast = this->process_node(ast);
+        if (new_ast->type() != NamedBlockASTType) {
+            return this->ast(new_ast);
+        }
+        ast = static_cast<NamedBlockAST*>(new_ast);
+
+        if (ast->body) {
+            auto oldBody = ast->body.get();
+            auto newBody = this->ast(oldBody);
+
+            if (newBody != oldBody) {
+                ast->body.reset(newBody);
+            }
+        }
+
+        return ast;
+    }
+
+    virtual AST* macro_definition(MacroDefinitionAST *ast) override {
+        auto new_ast = this->process_node(ast);
+        if (new_ast->type() != MacroDefinitionASTType) {
+            return this->ast(new_ast);
+        }
+        ast = static_cast<MacroDefinitionAST*>(new_ast);
+
+        if (ast->body && this->visitsMacroBodies()) {
+            auto oldBody = ast->body.get();
+            auto newBody = this->ast(oldBody);
+
+            if (newBody != oldBody) {
+                ast->body.reset(newBody);
+            }
+        }
+
+        return ast;
+    }
+
+    virtual AST* macro_call(MacroCallAST *ast) override {
+        auto new_ast = this->process_node(ast);
+        if (new_ast->type() != MacroCallASTType) {
+            return this->ast(new_ast);
+        }
+        ast = static_cast<MacroCallAST*>(new_ast);
+
+        if (ast->body && this->visitsMacroBodies()) {
+            auto oldBody = ast->body.get();
+            auto newBody = this->ast(oldBody);
+
+            if (newBody != oldBody) {
+                ast->body.reset(newBody);
+            }
+        }
+
+        return ast;
+    }
+
+    virtual AST* set_block(SetBlockAST *ast) override {
+        auto new_ast = this->process_node(ast);
+        if (new_ast->type() != SetBlockASTType) {
+            return this->ast(new_ast);
+        }
+        ast = static_cast<SetBlockAST*>(new_ast);
+
+        if (ast->body) {
+            auto oldBody = ast->body.get();
+            auto newBody = this->ast(oldBody);
+
+            if (newBody != oldBody) {
+                ast->body.reset(newBody);
+            }
+        }
+
+        return ast;
+    }
+
+    virtual AST* capture_block(CaptureBlockAST *ast) override {
+        auto new_ast = this->process_node(ast);
+        if (new_ast->type() != CaptureBlockASTType) {
+            return this->ast(new_ast);
+        }
+        ast = static_cast<CaptureBlockAST*>(new_ast);
+
+        if (ast->capture) {
+            auto oldCapture = ast->capture.get();
+            auto newCapture = this->ast(oldCapture);
+
+            if (newCapture != oldCapture) {
+                ast->capture.reset(newCapture);
+            }
+        }
+
+        if (ast->body) {
+            auto oldBody = ast->body.get();
+            auto newBody = this->ast(oldBody);
+
+            if (newBody != oldBody) {
+                ast->body.reset(newBody);
+            }
+        }
+
+        return ast;
+    }
+
+    virtual AST* switch_block(SwitchBlockAST *ast) override {
+        auto new_ast = this->process_node(ast);
+        if (new_ast->type() != SwitchBlockASTType) {
+            return this->ast(new_ast);
+        }
+        ast = static_cast<SwitchBlockAST*>(new_ast);
+
+        for (auto &caseBlock : ast->cases) {
+            auto oldCase = caseBlock.get();
+            auto newCase = this->ast(oldCase);
+
+            if (newCase != oldCase) {
+                caseBlock.reset(newCase);
+            }
+        }
+
+        if (ast->elseBody) {
+            auto oldElseBody = ast->elseBody.get();
+            auto newElseBody = this->ast(oldElseBody);
+
+            if (newElseBody != oldElseBody) {
+                ast->elseBody.reset(newElseBody);
+            }
+        }
+
+        return ast;
+    }
+
+    virtual AST* case_block(CaseBlockAST *ast) override {
+        // a case only lives within a switch, so it should stay a case
+        ast = static_cast<CaseBlockAST*>(this->process_node(ast));
+
+        if (ast->body) {
+            auto oldBody = ast->body.get();
+            auto newBody = this->ast(oldBody);
+
+            if (newBody != oldBody) {
+                ast->body.reset(newBody);
+            }
+        }
+
+        return ast;
+    }
+
+    virtual AST* cache_block(CacheBlockAST *ast) override {
+        auto new_ast = this->process_node(ast);
+        if (new_ast->type() != CacheBlockASTType) {
+            return this->ast(new_ast);
+        }
+        ast = static_cast<CacheBlockAST*>(new_ast);
+
+        if (ast->body) {
+            auto oldBody = ast->body.get();
+            auto newBody = this->ast(oldBody);
+
+            if (newBody != oldBody) {
+                ast->body.reset(newBody);
+            }
+        }
+
+        return ast;
+    }
 };
 
 class ExpressionPass : private ExpressionVisitor<Expression*> {
@@ -137,6 +415,22 @@ public:
         return this->expression(expression);
     }
 
+    /*
+     * See ASTPass::isNodeLocal(): whether this pass only rewrites an expression depending
+     * on nothing but that expression.
+     */
+    virtual bool isNodeLocal() const { return false; }
+
+    /*
+     * See ASTPass::visitsIncludeBodies().
+     */
+    virtual bool visitsIncludeBodies() const { return true; }
+
+    /*
+     * See ASTPass::visitsMacroBodies().
+     */
+    virtual bool visitsMacroBodies() const { return true; }
+
 protected:
     virtual Expression* process_node(VariableReferenceExpression *expr) { return expr; }
     virtual Expression* process_node(GetAttributeExpression *expr) { return expr; }
@@ -148,6 +442,7 @@ protected:
     virtual Expression* process_node(BinaryOperationExpression *expr) { return expr; }
     virtual Expression* process_node(UnaryOperationExpression *expr) { return expr; }
     virtual Expression* process_node(ComparisonExpression *expr) { return expr; }
+    virtual Expression* process_node(ArrayLiteralExpression *expr) { return expr; }
 
 private:
     virtual Expression* variable_reference_expression(VariableReferenceExpression *expr) override {
@@ -264,6 +559,26 @@ private:
 
         return expr;
     }
+
+    virtual Expression* array_literal_expression(ArrayLiteralExpression *expr) override {
+        auto new_expr = this->process_node(expr);
+        if (new_expr->type() != ArrayLiteralExpressionType) {
+            return this->expression(new_expr);
+        }
+        expr = static_cast<ArrayLiteralExpression*>(new_expr);
+
+        // the keys are literals, only the values can change
+        for (auto &value : *expr->values) {
+            auto old_value = value.get();
+            auto new_value = this->expression(old_value);
+
+            if (new_value != old_value) {
+                value.reset(new_value);
+            }
+        }
+
+        return expr;
+    }
 };
 
 } // namespace b2
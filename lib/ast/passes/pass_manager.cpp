@@ -1,15 +1,11 @@
 #include "pass_manager.hpp"
 
+#include <iterator>
 #include <memory>
+#include <unordered_set>
 
 using namespace b2;
 
-void PassManager::addPass(ASTPass* pass)
-{
-    std::unique_ptr<ASTPass> p_pass(pass);
-    m_passes.push_back(std::move(p_pass));
-}
-
 namespace {
 
 class ExpressionPassWrapper : public ASTPass {
@@ -22,6 +18,7 @@ protected:
         auto new_expr = this->m_expressionPass->process(old_expr);
         if (new_expr != old_expr) {
             ast->expr.reset(new_expr);
+            this->markModified();
         }
 
         return ast;
@@ -32,6 +29,18 @@ protected:
         auto new_condition = this->m_expressionPass->process(old_condition);
         if (new_condition != old_condition) {
             ast->condition.reset(new_condition);
+            this->markModified();
+        }
+
+        return ast;
+    }
+
+    virtual AST* process_node(SwitchBlockAST* ast) override {
+        auto old_expr = ast->expr.get();
+        auto new_expr = this->m_expressionPass->process(old_expr);
+        if (new_expr != old_expr) {
+            ast->expr.reset(new_expr);
+            this->markModified();
         }
 
         return ast;
@@ -42,17 +51,28 @@ protected:
         auto new_iterable = this->m_expressionPass->process(old_iterable);
         if (new_iterable != old_iterable) {
             ast->iterable.reset(new_iterable);
+            this->markModified();
         }
 
         return ast;
     }
 
     virtual AST* process_node(IncludeBlockAST* ast) override {
+        if (ast->nameExpression) {
+            auto old_name = ast->nameExpression.get();
+            auto new_name = this->m_expressionPass->process(old_name);
+            if (new_name != old_name) {
+                ast->nameExpression.reset(new_name);
+                this->markModified();
+            }
+        }
+
         if (ast->scope) {
             auto old_scope = ast->scope.get();
             auto new_scope = this->m_expressionPass->process(old_scope);
             if (new_scope != old_scope) {
                 ast->scope.reset(new_scope);
+                this->markModified();
             }
         }
 
@@ -61,27 +81,327 @@ protected:
             auto new_expr = this->m_expressionPass->process(old_expr);
             if (new_expr != old_expr) {
                 tuple.second.reset(new_expr);
+                this->markModified();
+            }
+        }
+
+        return ast;
+    }
+
+    virtual AST* process_node(MacroCallAST* ast) override {
+        for (auto &argument : *ast->arguments) {
+            auto old_expr = argument.get();
+            auto new_expr = this->m_expressionPass->process(old_expr);
+            if (new_expr != old_expr) {
+                argument.reset(new_expr);
+                this->markModified();
             }
         }
 
         return ast;
     }
 
+    virtual AST* process_node(SetBlockAST* ast) override {
+        auto old_value = ast->value.get();
+        auto new_value = this->m_expressionPass->process(old_value);
+        if (new_value != old_value) {
+            ast->value.reset(new_value);
+            this->markModified();
+        }
+
+        return ast;
+    }
+
+    virtual AST* process_node(CacheBlockAST* ast) override {
+        auto old_key = ast->key.get();
+        auto new_key = this->m_expressionPass->process(old_key);
+        if (new_key != old_key) {
+            ast->key.reset(new_key);
+            this->markModified();
+        }
+
+        return ast;
+    }
+
+    virtual bool isNodeLocal() const override {
+        return this->m_expressionPass->isNodeLocal();
+    }
+
+    virtual bool visitsIncludeBodies() const override {
+        return this->m_expressionPass->visitsIncludeBodies();
+    }
+
+    virtual bool visitsMacroBodies() const override {
+        return this->m_expressionPass->visitsMacroBodies();
+    }
+
 private:
     std::unique_ptr<ExpressionPass> m_expressionPass;
 };
 
 } /* anon namespace */
 
+namespace b2 {
+
+/*
+ * Runs node-local passes (see ASTPass::isNodeLocal()) in a single traversal. Every node
+ * gets rewritten by all of them, in order and until none of them changes it anymore,
+ * before its children get traversed; and again after that when one of its children
+ * changed. One rewrite enabling another, eg. folding an if condition to a literal which
+ * lets its dead branch get eliminated, which lets the raw blocks around the if block get
+ * coalesced, is then picked up without traversing the whole AST again: only the
+ * subtrees which changed get traversed again, until nothing changes anymore.
+ */
+class FusedPass : public ASTPass {
+public:
+    bool canFuse(const ASTPass& pass) const {
+        return pass.isNodeLocal() && (m_passes.empty() || (
+            pass.visitsIncludeBodies() == this->visitsIncludeBodies() &&
+            pass.visitsMacroBodies() == this->visitsMacroBodies()
+        ));
+    }
+
+    void fuse(ASTPass* pass) {
+        m_passes.emplace_back(pass);
+    }
+
+    virtual AST* process(AST* ast) override {
+        bool changed = false;
+        return this->sweep(ast, changed);
+    }
+
+    virtual bool isNodeLocal() const override {
+        return true;
+    }
+
+    virtual bool visitsIncludeBodies() const override {
+        return m_passes.front()->visitsIncludeBodies();
+    }
+
+    virtual bool visitsMacroBodies() const override {
+        return m_passes.front()->visitsMacroBodies();
+    }
+
+private:
+    AST* rewriteNode(AST* ast, AST* original, bool &changed);
+    AST* sweep(AST* ast, bool &changed);
+    bool flatten(StatementsAST* ast);
+
+    template<typename Function>
+    void forEachChild(AST* ast, Function function);
+
+    std::vector<std::unique_ptr<ASTPass>> m_passes;
+};
+
+} // namespace b2
+
+/*
+ * Rewrites `ast` until none of the passes changes it anymore. Every node replacing
+ * another one gets freed, except for `original`, which is owned by its parent.
+ */
+AST* FusedPass::rewriteNode(AST* ast, AST* original, bool &changed)
+{
+    bool modified;
+    do {
+        modified = false;
+        for (auto &pass : m_passes) {
+            bool passModified = false;
+            AST* new_ast;
+            try {
+                new_ast = pass->rewrite(ast, passModified);
+            } catch (...) {
+                if (ast != original) {
+                    delete ast;
+                }
+                throw;
+            }
+
+            if (new_ast != ast) {
+                if (ast != original) {
+                    delete ast;
+                }
+                ast = new_ast;
+                passModified = true;
+            }
+            modified = modified || passModified;
+        }
+        changed = changed || modified;
+    } while (modified);
+
+    return ast;
+}
+
+/*
+ * Merges the StatementsAST children of `ast` into it, like ASTPass does; returns whether
+ * there were any.
+ */
+bool FusedPass::flatten(StatementsAST* ast)
+{
+    bool flattened = false;
+    for (auto it = ast->statements->begin(); it != ast->statements->end(); ) {
+        if ((*it)->type() == StatementsASTType) {
+            auto childStatements = static_cast<StatementsAST*>(it->get());
+            ast->statements->splice(it, *childStatements->statements);
+            it = ast->statements->erase(it);
+            flattened = true;
+        } else {
+            ++it;
+        }
+    }
+    return flattened;
+}
+
+template<typename Function>
+void FusedPass::forEachChild(AST* ast, Function function)
+{
+    switch (ast->type()) {
+        case StatementsASTType:
+            for (auto &statement : *static_cast<StatementsAST*>(ast)->statements) {
+                function(statement);
+            }
+            break;
+        case IfBlockASTType:
+            function(static_cast<IfBlockAST*>(ast)->thenBody);
+            function(static_cast<IfBlockAST*>(ast)->elseBody);
+            break;
+        case ForBlockASTType:
+            function(static_cast<ForBlockAST*>(ast)->body);
+            function(static_cast<ForBlockAST*>(ast)->elseBody);
+            break;
+        case IncludeBlockASTType:
+            if (this->visitsIncludeBodies()) {
+                function(static_cast<IncludeBlockAST*>(ast)->body);
+            }
+            break;
+        case NamedBlockASTType:
+            function(static_cast<NamedBlockAST*>(ast)->body);
+            break;
+        case MacroDefinitionASTType:
+            if (this->visitsMacroBodies()) {
+                function(static_cast<MacroDefinitionAST*>(ast)->body);
+            }
+            break;
+        case MacroCallASTType:
+            if (this->visitsMacroBodies()) {
+                function(static_cast<MacroCallAST*>(ast)->body);
+            }
+            break;
+        case SetBlockASTType:
+            function(static_cast<SetBlockAST*>(ast)->body);
+            break;
+        case CaptureBlockASTType:
+            function(static_cast<CaptureBlockAST*>(ast)->capture);
+            function(static_cast<CaptureBlockAST*>(ast)->body);
+            break;
+        case SwitchBlockASTType:
+            for (auto &caseBlock : static_cast<SwitchBlockAST*>(ast)->cases) {
+                function(caseBlock);
+            }
+            function(static_cast<SwitchBlockAST*>(ast)->elseBody);
+            break;
+        case CaseBlockASTType:
+            function(static_cast<CaseBlockAST*>(ast)->body);
+            break;
+        case CacheBlockASTType:
+            function(static_cast<CacheBlockAST*>(ast)->body);
+            break;
+        case RawBlockASTType:
+        case PrintBlockASTType:
+        case ExtendsBlockASTType:
+            break;
+    }
+}
+
+/*
+ * Rewrites `ast` and its descendants, returns what replaces `ast` (or `ast`). Sets
+ * `changed` when anything in it changed.
+ */
+AST* FusedPass::sweep(AST* original, bool &changed)
+{
+    AST* ast = this->rewriteNode(original, original, changed);
+
+    // the children which are done, these only need another traversal when they get replaced
+    std::unordered_set<AST*> doneChildren;
+    while (true) {
+        bool childrenChanged = false;
+        this->forEachChild(ast, [&](std::unique_ptr<AST> &child) {
+            if (!child || doneChildren.count(child.get()) > 0) {
+                return;
+            }
+
+            auto new_child = this->sweep(child.get(), childrenChanged);
+            if (new_child != child.get()) {
+                child.reset(new_child);
+            }
+            doneChildren.insert(new_child);
+        });
+
+        if (ast->type() == StatementsASTType && this->flatten(static_cast<StatementsAST*>(ast))) {
+            childrenChanged = true;
+        }
+        if (!childrenChanged) {
+            break;
+        }
+        changed = true;
+
+        // what changed in its children could let `ast` get rewritten
+        bool modified = false;
+        auto new_ast = this->rewriteNode(ast, original, modified);
+        if (!modified) {
+            break;
+        }
+        if (new_ast != ast) {
+            doneChildren.clear();
+        } else {
+            // rewriting `ast` in place could have freed some of its children and allocated
+            // new ones at their address; only arena memory never gets reused
+            NodeArena* arena = currentArena();
+            for (auto it = doneChildren.begin(); it != doneChildren.end();) {
+                it = arena != nullptr && arena->contains(*it) ? std::next(it) : doneChildren.erase(it);
+            }
+        }
+        ast = new_ast;
+    }
+
+    // fold a StatementsAST containing 1 child to its single child
+    if (ast->type() == StatementsASTType && static_cast<StatementsAST*>(ast)->statements->size() == 1) {
+        auto child = static_cast<StatementsAST*>(ast)->statements->front().release();
+        if (ast != original) {
+            delete ast;
+        }
+        changed = true;
+        return child;
+    }
+
+    return ast;
+}
+
+void PassManager::addPass(ASTPass* pass)
+{
+    std::unique_ptr<ASTPass> p_pass(pass);
+    if (!pass->isNodeLocal()) {
+        m_passes.push_back(std::move(p_pass));
+        m_lastFusedPass = nullptr;
+        return;
+    }
+
+    // consecutive node-local passes share a single traversal
+    if (!m_lastFusedPass || !m_lastFusedPass->canFuse(*pass)) {
+        m_lastFusedPass = new FusedPass();
+        m_passes.emplace_back(m_lastFusedPass);
+    }
+    m_lastFusedPass->fuse(p_pass.release());
+}
+
 void PassManager::addPass(ExpressionPass* pass)
 {
-    std::unique_ptr<ASTPass> p_pass(new ExpressionPassWrapper(pass));
-    m_passes.push_back(std::move(p_pass));
+    this->addPass(new ExpressionPassWrapper(pass));
 }
 
 void PassManager::removeAllPasses()
 {
     m_passes.clear();
+    m_lastFusedPass = nullptr;
 }
 
 AST* PassManager::run(AST* ast)
@@ -8,9 +8,13 @@
 
 namespace b2 {
 
+class FusedPass;
+
 class PassManager
 {
 public:
+    PassManager() : m_lastFusedPass(nullptr) {}
+
     void addPass(ASTPass* pass);
     void addPass(ExpressionPass* pass);
     void removeAllPasses();
@@ -18,6 +22,10 @@ public:
     /*
      * Runs the registered passes over the given AST.
      *
+     * Consecutive node-local passes (see ASTPass::isNodeLocal()) run in a single
+     * traversal, which repeats them over what they changed until nothing changes
+     * anymore.
+     *
      * Calling this passes the ownership of the AST to PassManager.
      * The returned AST is no longer owned by PassManager (and could
      * or could not be the given AST).
@@ -26,6 +34,8 @@ public:
 
 private:
     std::vector<std::unique_ptr<ASTPass>> m_passes;
+    // the last pass, when node-local passes added after it can be fused into it
+    FusedPass* m_lastFusedPass;
 };
 
 } // namespace b2
@@ -1,6 +1,12 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
 #include <memory>
 #include <unordered_set>
 
+#include "ast/flat_ast.hpp"
+#include "ast/passes/bindings_checker.hpp"
 #include "ast/passes/resolve_includes_pass.hpp"
 #include "ast/passes/pass_manager.hpp"
 #include "parser/parser.hpp"
@@ -9,26 +15,35 @@ using namespace b2;
 
 namespace {
 
+typedef std::unordered_set<VariableReferenceExpression*> LocalReferences;
+
 class ReplaceVariableReferencesPass : public ExpressionPass {
 public:
-    ReplaceVariableReferencesPass(const std::string &includeFilename, StringExpressionMap& replacements) :
-        m_replacements(replacements), m_includeFilename(includeFilename) {}
+    ReplaceVariableReferencesPass(const std::string &includeFilename, SymbolExpressionMap& replacements, LocalReferences localReferences) :
+        m_replacements(replacements), m_includeFilename(includeFilename), m_localReferences(std::move(localReferences)) {}
+
+    virtual bool visitsIncludeBodies() const override { return false; }
+    virtual bool visitsMacroBodies() const override { return false; }
 protected:
     virtual Expression* process_node(VariableReferenceExpression *expr) override;
 private:
-    StringExpressionMap &m_replacements;
+    SymbolExpressionMap &m_replacements;
     const std::string &m_includeFilename;
+    LocalReferences m_localReferences;
 };
 
 Expression* ReplaceVariableReferencesPass::process_node(VariableReferenceExpression *expr)
 {
-    std::string variableName = expr->variableName.get();
+    if (m_localReferences.count(expr) > 0) {
+        // bound by a for loop or set block of the included template
+        return expr;
+    }
 
     // look for replacement
-    auto replacement = m_replacements.find(variableName);
+    auto replacement = m_replacements.find(expr->variableName);
     if (replacement == m_replacements.end()) {
         // not found, throw error
-        throw MissingVariableReferenceError(m_includeFilename, variableName);
+        throw MissingVariableReferenceError(m_includeFilename, expr->variableName.str());
     }
 
     return replacement->second->clone();
@@ -36,20 +51,72 @@ Expression* ReplaceVariableReferencesPass::process_node(VariableReferenceExpress
 
 class PrependScopePass : public ExpressionPass {
 public:
-    PrependScopePass(Expression* scope) : m_scope(scope) {}
+    PrependScopePass(Expression* scope, LocalReferences localReferences) : m_scope(scope), m_localReferences(std::move(localReferences)) {}
+
+    virtual bool visitsIncludeBodies() const override { return false; }
+    virtual bool visitsMacroBodies() const override { return false; }
 protected:
     virtual Expression* process_node(VariableReferenceExpression *expr) override;
 private:
     Expression* m_scope;
+    LocalReferences m_localReferences;
 };
 
 Expression* PrependScopePass::process_node(VariableReferenceExpression *expr)
 {
-    return new GetAttributeExpression(m_scope->clone(), strdup(expr->variableName.get()));
+    if (m_localReferences.count(expr) > 0) {
+        return expr;
+    }
+
+    return new GetAttributeExpression(m_scope->clone(), expr->variableName);
+}
+
+uint64_t combineHashes(uint64_t seed, uint64_t hash)
+{
+    return seed ^ (hash + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+}
+
+std::string includeFunctionName(const std::string &includeFilename, uint64_t hash)
+{
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long) hash);
+    return "include:" + includeFilename + "#" + hex;
 }
 
 } /* anon namespace */
 
+ResolveIncludesPass::ResolveIncludesPass(ASTContext &context, const std::string &includeBasePath, size_t threadCount, IncludeCache* includeCache) :
+    m_includeBasePath(includeBasePath),
+    m_context(context),
+    m_ownIncludeCache(includeCache ? nullptr : new IncludeCache(context)),
+    m_includeCache(includeCache ? includeCache : m_ownIncludeCache.get()),
+    m_maxInlineSize(SIZE_MAX),
+    m_threadPool(&m_ownThreadPool),
+    m_ownThreadPool(threadCount)
+{
+    if (m_includeCache->context().sharedSymbols() != context.sharedSymbols()) {
+        throw std::runtime_error("The include cache doesn't share its symbol table with the AST context");
+    }
+}
+
+ResolveIncludesPass::~ResolveIncludesPass()
+{
+    // a shared pool outlives this pass, so wait for the includes still being parsed on
+    // it (which may prefetch more includes in turn)
+    while (true) {
+        std::future<LoadedInclude> pendingInclude;
+        {
+            std::lock_guard<std::mutex> lock(m_pendingMutex);
+            if (m_pendingIncludes.empty()) {
+                break;
+            }
+            pendingInclude = std::move(m_pendingIncludes.begin()->second);
+            m_pendingIncludes.erase(m_pendingIncludes.begin());
+        }
+        pendingInclude.wait();
+    }
+}
+
 std::string ResolveIncludesPass::resolvePath(const std::string &path)
 {
     // TODO: this is UNIX-specific
@@ -60,42 +127,148 @@ std::string ResolveIncludesPass::resolvePath(const std::string &path)
     return m_includeBasePath + "/" + path;
 }
 
-AST* ResolveIncludesPass::replaceVariableReferences(AST* ast, const std::string &includeFilename, StringExpressionMap &replacements)
+AST* ResolveIncludesPass::replaceVariableReferences(AST* ast, const std::string &includeFilename, SymbolExpressionMap &replacements)
 {
     m_passManager.removeAllPasses();
-    m_passManager.addPass(new ReplaceVariableReferencesPass(includeFilename, replacements));
+    m_passManager.addPass(new ReplaceVariableReferencesPass(includeFilename, replacements, BindingsChecker({}).findLocalReferences(ast)));
     return m_passManager.run(ast);
 }
 
 AST* ResolveIncludesPass::prependScope(AST *ast, Expression *scope)
 {
     m_passManager.removeAllPasses();
-    m_passManager.addPass(new PrependScopePass(scope));
+    m_passManager.addPass(new PrependScopePass(scope, BindingsChecker({}).findLocalReferences(ast)));
     return m_passManager.run(ast);
 }
 
+void ResolveIncludesPass::prefetchIncludes(AST* ast, const IncludeStack &includeStack)
+{
+    if (m_threadPool->threadCount() <= 1) {
+        return;
+    }
+
+    FlatAST flatAST(ast);
+    for (auto &node : flatAST) {
+        if (node.type != IncludeBlockASTType) {
+            continue;
+        }
+
+        auto include = node.as<IncludeBlockAST>();
+        if (include->body || include->nameExpression) {
+            continue;
+        }
+
+        auto includeFilename = this->resolvePath(include->includeName.str());
+        if (std::find(includeStack.begin(), includeStack.end(), includeFilename) != includeStack.end()) {
+            // recursive include, leave it to process_node() to report this
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(m_pendingMutex);
+        if (m_pendingIncludes.count(include) > 0) {
+            continue;
+        }
+
+        IncludeStack nestedIncludeStack(includeStack);
+        nestedIncludeStack.push_back(includeFilename);
+
+        m_pendingIncludes[include] = m_threadPool->enqueue([this, includeFilename, nestedIncludeStack]() {
+            LoadedInclude include;
+            include.ast = m_includeCache->get(includeFilename, m_context, &include.hash);
+
+            // start parsing the includes of this include as well
+            this->prefetchIncludes(include.ast.get(), nestedIncludeStack);
+
+            return include;
+        });
+    }
+}
+
+ResolveIncludesPass::LoadedInclude ResolveIncludesPass::takeInclude(IncludeBlockAST* ast, const std::string &includeFilename)
+{
+    std::future<LoadedInclude> pendingInclude;
+    {
+        std::lock_guard<std::mutex> lock(m_pendingMutex);
+        auto it = m_pendingIncludes.find(ast);
+        if (it != m_pendingIncludes.end()) {
+            pendingInclude = std::move(it->second);
+            m_pendingIncludes.erase(it);
+        }
+    }
+
+    if (pendingInclude.valid()) {
+        return pendingInclude.get();
+    }
+
+    LoadedInclude include;
+    include.ast = m_includeCache->get(includeFilename, m_context, &include.hash);
+    return include;
+}
+
+AST* ResolveIncludesPass::process_node(StatementsAST *ast)
+{
+    this->prefetchIncludes(ast, m_includeStack);
+    return ast;
+}
+
 AST* ResolveIncludesPass::process_node(IncludeBlockAST *ast)
 {
-    auto includeFilename = this->resolvePath(ast->includeName.get());
-    std::unique_ptr<AST> includeAST(m_parser.parse(includeFilename.c_str()));
+    if (ast->body) {
+        // already resolved
+        return ast;
+    }
+    if (ast->nameExpression) {
+        // gets resolved at render time, by the backend
+        return ast;
+    }
+
+    auto includeFilename = this->resolvePath(ast->includeName.str());
+    if (std::find(m_includeStack.begin(), m_includeStack.end(), includeFilename) != m_includeStack.end()) {
+        throw std::runtime_error("Recursive include of '" + includeFilename + "'");
+    }
+
+    LoadedInclude include = this->takeInclude(ast, includeFilename);
+    std::unique_ptr<AST> includeAST = std::move(include.ast);
 
 	// (recursively) process this node, it could contain 'include' blocks itself
+	m_includeStack.push_back(includeFilename);
+	m_hashStack.push_back(include.hash);
 	auto processedIncludeAST = this->process(includeAST.get());
+	uint64_t hash = m_hashStack.back();
+	m_hashStack.pop_back();
+	m_includeStack.pop_back();
 	if (processedIncludeAST != includeAST.get()) {
 		includeAST.reset(processedIncludeAST);
 	}
 
-    AST* newIncludeAST;
-    if (ast->scope) {
-        newIncludeAST = prependScope(includeAST.get(), ast->scope.get());
-    } else {
-        newIncludeAST = replaceVariableReferences(includeAST.get(), includeFilename, ast->variableMapping);
+    // whatever gets generated for the including template depends on this template as well
+    if (!m_hashStack.empty()) {
+        m_hashStack.back() = combineHashes(m_hashStack.back(), hash);
     }
 
-    // replace includeAST, if necessary
-    if (newIncludeAST != includeAST.get()) {
-        includeAST.reset(newIncludeAST);
+    if (FlatAST(includeAST.get()).size() > m_maxInlineSize) {
+        // compile it as a separate function, called with the bindings of this include block
+        if (!ast->scope) {
+            std::vector<Symbol> bindings;
+            for (auto &tuple : ast->variableMapping) {
+                bindings.push_back(tuple.first);
+            }
+
+            auto unboundVariable = BindingsChecker(std::move(bindings)).findUnboundVariable(includeAST.get());
+            if (!unboundVariable.empty()) {
+                throw MissingVariableReferenceError(includeFilename, unboundVariable.str());
+            }
+        }
+
+        ast->body = std::move(includeAST);
+        ast->functionName = includeFunctionName(includeFilename, hash);
+        return ast;
     }
 
-    return includeAST.release();
+    // the pass manager takes ownership of includeAST, it frees it as well when a pass fails
+    if (ast->scope) {
+        return prependScope(includeAST.release(), ast->scope.get());
+    } else {
+        return replaceVariableReferences(includeAST.release(), includeFilename, ast->variableMapping);
+    }
 }
@@ -3,10 +3,17 @@
 
 #include "ast/passes/pass.hpp"
 #include "ast/passes/pass_manager.hpp"
+#include "parser/include_cache.hpp"
 #include "parser/parser.hpp"
+#include "thread_pool.hpp"
 
+#include <future>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace b2 {
 
@@ -27,20 +34,79 @@ private:
     const std::string m_variableName;
 };
 
+/*
+ * Replaces every include block with the (processed) AST of the included template.
+ *
+ * As soon as a statement list is visited, all include blocks below it are handed to
+ * a thread pool to be parsed in the background; the same happens recursively for the
+ * include blocks of every parsed template. Passing a `threadCount` of 1 makes this
+ * pass parse everything synchronously, unless it's given a shared pool to use instead
+ * (see setThreadPool()).
+ *
+ * Every included template is only parsed once: by `includeCache` when given (which
+ * should share its symbol table with `context`), otherwise by a cache private to
+ * this pass. `context` keeps the source text of the included templates alive.
+ *
+ * Includes whose (processed) template is larger than the maximum inline size are
+ * left in place instead, with the template attached as their body: a backend
+ * compiles such a body once as a separate function, named after the template and
+ * the hash of its contents, and calls it with the include's bindings.
+ *
+ * Includes naming their template with an expression are left alone: those can only
+ * be resolved at render time.
+ */
 class ResolveIncludesPass : public ASTPass
 {
 public:
-    ResolveIncludesPass(const std::string &includeBasePath) : m_includeBasePath(includeBasePath) {}
+    ResolveIncludesPass(ASTContext &context, const std::string &includeBasePath, size_t threadCount = ThreadPool::defaultThreadCount(), IncludeCache* includeCache = nullptr);
+    ~ResolveIncludesPass();
+
+    /*
+     * Sets the maximum size (in statements, see FlatAST) of an included template that
+     * still gets inlined. Defaults to SIZE_MAX, iow. inlining everything.
+     */
+    void setMaxInlineSize(size_t maxInlineSize) { m_maxInlineSize = maxInlineSize; }
+
+    /*
+     * Parses the includes on `threadPool` instead of on a pool of this pass. Its tasks
+     * never wait on each other, but this pass does wait on them: it shouldn't be run by
+     * one of the workers of `threadPool` itself.
+     */
+    void setThreadPool(ThreadPool* threadPool) { m_threadPool = threadPool; }
 protected:
+    virtual AST* process_node(StatementsAST *ast) override;
     virtual AST* process_node(IncludeBlockAST *ast) override;
+    virtual bool visitsIncludeBodies() const override { return false; }
 private:
+    typedef std::vector<std::string> IncludeStack;
+
+    struct LoadedInclude {
+        std::unique_ptr<AST> ast;
+        uint64_t hash;
+    };
+
     std::string resolvePath(const std::string &path);
     AST* prependScope(AST* ast, Expression* scope);
-    AST* replaceVariableReferences(AST* ast, const std::string &includeFilename, StringExpressionMap &replacements);
+    AST* replaceVariableReferences(AST* ast, const std::string &includeFilename, SymbolExpressionMap &replacements);
+
+    void prefetchIncludes(AST* ast, const IncludeStack &includeStack);
+    LoadedInclude takeInclude(IncludeBlockAST* ast, const std::string &includeFilename);
 
     const std::string m_includeBasePath;
     PassManager m_passManager;
-    Parser m_parser;
+    ASTContext &m_context;
+    std::unique_ptr<IncludeCache> m_ownIncludeCache;
+    IncludeCache* m_includeCache;
+    IncludeStack m_includeStack;
+    // for every template on m_includeStack: the combined hash of its contents and of the templates it includes
+    std::vector<uint64_t> m_hashStack;
+    size_t m_maxInlineSize;
+
+    std::mutex m_pendingMutex;
+    std::unordered_map<IncludeBlockAST*, std::future<LoadedInclude>> m_pendingIncludes;
+    ThreadPool* m_threadPool;
+    // declared last, so its workers are joined before anything they use is destroyed
+    ThreadPool m_ownThreadPool;
 };
 
 } // namespace b2
@@ -0,0 +1,204 @@
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "ast/flat_ast.hpp"
+#include "ast/passes/resolve_inheritance_pass.hpp"
+
+using namespace b2;
+
+namespace {
+
+typedef std::unordered_map<Symbol, NamedBlockAST*> BlockMap;
+
+/*
+ * Collects the top-level statements of `ast`, which include the statements in the bodies
+ * of its top-level set blocks.
+ */
+void collectTopLevelStatements(AST* ast, std::vector<AST*> &statements)
+{
+    if (!ast) {
+        return;
+    }
+
+    if (ast->type() == StatementsASTType) {
+        for (auto &statement : *static_cast<StatementsAST*>(ast)->statements) {
+            collectTopLevelStatements(statement.get(), statements);
+        }
+    } else if (ast->type() == SetBlockASTType) {
+        collectTopLevelStatements(static_cast<SetBlockAST*>(ast)->body.get(), statements);
+    } else {
+        statements.push_back(ast);
+    }
+}
+
+/*
+ * Collects the blocks `ast` defines: the blocks among its statements, and the blocks
+ * nested in those. Everything else gets ignored.
+ */
+void collectBlocks(AST* ast, BlockMap &blocks)
+{
+    if (!ast) {
+        return;
+    }
+
+    if (ast->type() == StatementsASTType) {
+        for (auto &statement : *static_cast<StatementsAST*>(ast)->statements) {
+            collectBlocks(statement.get(), blocks);
+        }
+        return;
+    }
+
+    if (ast->type() == SetBlockASTType) {
+        collectBlocks(static_cast<SetBlockAST*>(ast)->body.get(), blocks);
+        return;
+    }
+
+    if (ast->type() != NamedBlockASTType) {
+        return;
+    }
+
+    auto block = static_cast<NamedBlockAST*>(ast);
+    if (!blocks.emplace(block->name, block).second) {
+        throw std::runtime_error("Block '" + block->name.str() + "' is defined more than once");
+    }
+    collectBlocks(block->body.get(), blocks);
+}
+
+/*
+ * Replaces the bodies of the blocks in `ast` by the ones of the overriding `blocks`.
+ */
+void overrideBlocks(AST* ast, const BlockMap &blocks)
+{
+    FlatAST flatAST(ast);
+    for (uint32_t index = 0; index < flatAST.size(); ) {
+        auto &node = flatAST[index];
+        if (node.type == NamedBlockASTType) {
+            auto block = node.as<NamedBlockAST>();
+            auto overridingBlock = blocks.find(block->name);
+            if (overridingBlock != blocks.end()) {
+                // the nested blocks of the overriding body are overridden already, so skip them
+                block->body.reset(cloneAST(overridingBlock->second->body));
+                block->isFragment = block->isFragment || overridingBlock->second->isFragment;
+                index = node.end;
+                continue;
+            }
+        }
+
+        index++;
+    }
+}
+
+} /* anon namespace */
+
+ResolveInheritancePass::ResolveInheritancePass(ASTContext &context, const std::string &templateBasePath, IncludeCache* includeCache) :
+    m_templateBasePath(templateBasePath),
+    m_context(context),
+    m_ownIncludeCache(includeCache ? nullptr : new IncludeCache(context)),
+    m_includeCache(includeCache ? includeCache : m_ownIncludeCache.get())
+{
+    if (m_includeCache->context().sharedSymbols() != context.sharedSymbols()) {
+        throw std::runtime_error("The include cache doesn't share its symbol table with the AST context");
+    }
+}
+
+std::string ResolveInheritancePass::resolvePath(const std::string &path)
+{
+    // TODO: this is UNIX-specific
+    if (path[0] == '/') {
+        return path;
+    }
+
+    return m_templateBasePath + "/" + path;
+}
+
+/*
+ * Returns the template `ast` extends with the blocks of `ast` substituted, or nullptr
+ * when it doesn't extend any template.
+ */
+std::unique_ptr<AST> ResolveInheritancePass::resolveInheritance(AST* ast)
+{
+    ExtendsBlockAST* extends = nullptr;
+    BlockMap blocks;
+
+    std::vector<AST*> statements;
+    collectTopLevelStatements(ast, statements);
+    for (auto statement : statements) {
+        if (statement->type() == ExtendsBlockASTType) {
+            if (extends) {
+                throw std::runtime_error("A template can only extend a single template");
+            }
+            extends = static_cast<ExtendsBlockAST*>(statement);
+        }
+    }
+    collectBlocks(ast, blocks);
+
+    if (!extends) {
+        return nullptr;
+    }
+
+    auto templateFilename = this->resolvePath(extends->templateName.str());
+    if (std::find(m_extendsStack.begin(), m_extendsStack.end(), templateFilename) != m_extendsStack.end()) {
+        throw std::runtime_error("Recursive extends of '" + templateFilename + "'");
+    }
+
+    // the extended template could be extending another template itself
+    std::unique_ptr<AST> extendedAST = m_includeCache->get(templateFilename, m_context);
+    m_extendsStack.push_back(templateFilename);
+    std::unique_ptr<AST> resolvedAST = this->resolveInheritance(extendedAST.get());
+    m_extendsStack.pop_back();
+    if (resolvedAST) {
+        extendedAST = std::move(resolvedAST);
+    }
+
+    overrideBlocks(extendedAST.get(), blocks);
+
+    // the macros of the extending template should remain available to its blocks
+    for (auto statement : statements) {
+        if (statement->type() != MacroDefinitionASTType) {
+            continue;
+        }
+
+        if (extendedAST->type() != StatementsASTType) {
+            auto extendedStatements = new StatementsAST();
+            extendedStatements->statements->emplace_back(extendedAST.release());
+            extendedAST.reset(extendedStatements);
+        }
+        static_cast<StatementsAST*>(extendedAST.get())->statements->emplace_back(statement->clone());
+    }
+
+    return extendedAST;
+}
+
+AST* ResolveInheritancePass::process(AST* ast)
+{
+    std::unique_ptr<AST> resolvedAST = this->resolveInheritance(ast);
+    if (!resolvedAST) {
+        return ASTPass::process(ast);
+    }
+
+    // unwrap the blocks of the resolved template
+    auto processedAST = ASTPass::process(resolvedAST.get());
+    if (processedAST == resolvedAST.get()) {
+        resolvedAST.release();
+    }
+    return processedAST;
+}
+
+AST* ResolveInheritancePass::process_node(ExtendsBlockAST *ast)
+{
+    throw std::runtime_error("An extends block should be a top-level statement of a template");
+}
+
+AST* ResolveInheritancePass::process_node(NamedBlockAST *ast)
+{
+    if (ast->isFragment) {
+        return ast;
+    }
+
+    if (!ast->body) {
+        return new StatementsAST();
+    }
+
+    return ast->body.release();
+}
@@ -0,0 +1,51 @@
+#ifndef __RESOLVE_INHERITANCE_PASS_HPP_
+#define __RESOLVE_INHERITANCE_PASS_HPP_
+
+#include "ast/passes/pass.hpp"
+#include "parser/include_cache.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace b2 {
+
+/*
+ * Resolves template inheritance at compile time.
+ *
+ * A template with an `extends` block gets replaced by (the resolved AST of) the template
+ * it extends, in which every block overridden by the extending template has its body
+ * replaced; everything outside the blocks of the extending template is dropped, except
+ * for its macro definitions. After that, every block gets replaced by its body, so a page
+ * ends up as a single AST without any trace of its layouts. Fragments are blocks as well,
+ * but they are kept for ExtractFragmentsPass; a block overridden by a fragment (or the
+ * other way around) becomes a fragment.
+ *
+ * Only the template this pass is run on can extend another template, so this pass should
+ * run before ResolveIncludesPass. Extended templates are parsed by `includeCache` when
+ * given (which should share its symbol table with `context`), otherwise by a cache
+ * private to this pass.
+ */
+class ResolveInheritancePass : public ASTPass
+{
+public:
+    ResolveInheritancePass(ASTContext &context, const std::string &templateBasePath, IncludeCache* includeCache = nullptr);
+
+    virtual AST* process(AST* ast) override;
+protected:
+    virtual AST* process_node(ExtendsBlockAST *ast) override;
+    virtual AST* process_node(NamedBlockAST *ast) override;
+private:
+    std::string resolvePath(const std::string &path);
+    std::unique_ptr<AST> resolveInheritance(AST* ast);
+
+    const std::string m_templateBasePath;
+    ASTContext &m_context;
+    std::unique_ptr<IncludeCache> m_ownIncludeCache;
+    IncludeCache* m_includeCache;
+    std::vector<std::string> m_extendsStack;
+};
+
+} // namespace b2
+
+#endif /* __RESOLVE_INHERITANCE_PASS_HPP_ */
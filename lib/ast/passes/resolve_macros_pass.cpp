@@ -0,0 +1,211 @@
+#include <atomic>
+#include <stdexcept>
+#include <string>
+
+#include "ast/flat_ast.hpp"
+#include "ast/passes/bindings_checker.hpp"
+#include "ast/passes/resolve_macros_pass.hpp"
+
+using namespace b2;
+
+namespace {
+
+class BindArgumentsPass : public ExpressionPass {
+public:
+    BindArgumentsPass(const std::vector<Symbol> &parameters, ExpressionList* arguments, std::unordered_set<VariableReferenceExpression*> localReferences) :
+        m_parameters(parameters), m_arguments(arguments), m_localReferences(std::move(localReferences)) {}
+
+    virtual bool visitsIncludeBodies() const override { return false; }
+    virtual bool visitsMacroBodies() const override { return false; }
+protected:
+    virtual Expression* process_node(VariableReferenceExpression *expr) override;
+private:
+    const std::vector<Symbol> &m_parameters;
+    ExpressionList* m_arguments;
+    std::unordered_set<VariableReferenceExpression*> m_localReferences;
+};
+
+Expression* BindArgumentsPass::process_node(VariableReferenceExpression *expr)
+{
+    if (m_localReferences.count(expr) > 0) {
+        // bound by a for loop or set block of the macro, which could shadow a parameter
+        return expr;
+    }
+
+    auto argument = m_arguments->begin();
+    for (auto &parameter : m_parameters) {
+        if (parameter == expr->variableName) {
+            return (*argument)->clone();
+        }
+        ++argument;
+    }
+
+    // resolveMacro() ensures this doesn't happen
+    return expr;
+}
+
+/*
+ * Rejects the calls of macros which aren't printed right away, eg. `{% if button() %}`:
+ * macros render into the output, they don't have a value.
+ */
+class RejectMacroCallsPass : public ExpressionPass {
+public:
+    RejectMacroCallsPass(const std::unordered_set<Symbol> &macroNames) : m_macroNames(macroNames) {}
+protected:
+    virtual Expression* process_node(MethodCallExpression *expr) override;
+private:
+    const std::unordered_set<Symbol> &m_macroNames;
+};
+
+Expression* RejectMacroCallsPass::process_node(MethodCallExpression *expr)
+{
+    if (m_macroNames.count(expr->methodName) > 0) {
+        throw std::runtime_error("Macro '" + expr->methodName.str() + "' can only be called on its own, as in {{ " + expr->methodName.str() + "(...) }}");
+    }
+
+    return expr;
+}
+
+std::string macroFunctionName(Symbol name)
+{
+    // equally named macros of different templates end up in the same module
+    static std::atomic<unsigned long> macroCount(0);
+
+    return "macro:" + name.str() + "#" + std::to_string(++macroCount);
+}
+
+} /* anon namespace */
+
+ResolveMacrosPass::ResolveMacrosPass() :
+    m_maxInlineSize(SIZE_MAX)
+{
+}
+
+/*
+ * Takes a copy of every macro defined in `ast`, including the ones in the bodies of
+ * includes and macros.
+ */
+void ResolveMacrosPass::collectMacros(AST* ast)
+{
+    if (!ast) {
+        return;
+    }
+
+    FlatAST flatAST(ast);
+    for (auto &node : flatAST) {
+        if (node.type == IncludeBlockASTType) {
+            this->collectMacros(node.as<IncludeBlockAST>()->body.get());
+        } else if (node.type == MacroCallASTType) {
+            this->collectMacros(node.as<MacroCallAST>()->body.get());
+        } else if (node.type == MacroDefinitionASTType) {
+            auto definition = node.as<MacroDefinitionAST>();
+            if (m_macroNames.count(definition->name) > 0) {
+                throw std::runtime_error("Macro '" + definition->name.str() + "' is defined more than once");
+            }
+
+            m_macroNames.insert(definition->name);
+            auto &macro = m_macros[definition->name];
+            macro.definition.reset(static_cast<MacroDefinitionAST*>(definition->clone()));
+            macro.state = Unresolved;
+
+            this->collectMacros(definition->body.get());
+        }
+    }
+}
+
+/*
+ * Resolves the calls in the body of macro `name`, when that didn't happen yet, and
+ * ensures the body only depends on its parameters.
+ */
+ResolveMacrosPass::Macro& ResolveMacrosPass::resolveMacro(Symbol name)
+{
+    auto &macro = m_macros[name];
+    if (macro.state == Resolved) {
+        return macro;
+    }
+    if (macro.state == Resolving) {
+        throw std::runtime_error("Recursive call of macro '" + name.str() + "'");
+    }
+
+    macro.state = Resolving;
+    auto definition = macro.definition.get();
+    auto oldBody = definition->body.get();
+    auto newBody = ASTPass::process(oldBody);
+    if (newBody != oldBody) {
+        definition->body.reset(newBody);
+    }
+
+    auto unboundVariable = BindingsChecker(definition->parameters).findUnboundVariable(newBody);
+    if (!unboundVariable.empty()) {
+        throw std::runtime_error("No value found for variable '" + unboundVariable.str() + "', referenced in macro '" + name.str() + "'");
+    }
+
+    macro.functionName = macroFunctionName(name);
+    macro.state = Resolved;
+    return macro;
+}
+
+AST* ResolveMacrosPass::bindArguments(AST* body, const Macro &macro, ExpressionList* arguments)
+{
+    m_passManager.removeAllPasses();
+    m_passManager.addPass(new BindArgumentsPass(macro.definition->parameters, arguments, BindingsChecker({}).findLocalReferences(body)));
+    return m_passManager.run(body);
+}
+
+AST* ResolveMacrosPass::process(AST* ast)
+{
+    m_macros.clear();
+    m_macroNames.clear();
+    this->collectMacros(ast);
+    if (m_macros.empty()) {
+        return ast;
+    }
+
+    ast = ASTPass::process(ast);
+
+    // what's left are calls of macros in the middle of an expression
+    m_passManager.removeAllPasses();
+    m_passManager.addPass(new RejectMacroCallsPass(m_macroNames));
+    return m_passManager.run(ast);
+}
+
+AST* ResolveMacrosPass::process_node(PrintBlockAST *ast)
+{
+    if (ast->expr->type() != MethodCallExpressionType) {
+        return ast;
+    }
+
+    auto call = static_cast<MethodCallExpression*>(ast->expr.get());
+    if (m_macroNames.count(call->methodName) == 0) {
+        return ast;
+    }
+
+    // an argument has to be a value, so it can't call a macro either
+    RejectMacroCallsPass rejectMacroCalls(m_macroNames);
+    for (auto &argument : *call->arguments) {
+        rejectMacroCalls.process(argument.get());
+    }
+
+    auto &macro = this->resolveMacro(call->methodName);
+    auto definition = macro.definition.get();
+    if (call->arguments->size() != definition->parameters.size()) {
+        throw std::runtime_error(
+            "Macro '" + definition->name.str() + "' takes " + std::to_string(definition->parameters.size()) +
+            " arguments, " + std::to_string(call->arguments->size()) + " given"
+        );
+    }
+
+    std::unique_ptr<AST> body(cloneAST(definition->body));
+    if (FlatAST(body.get()).size() > m_maxInlineSize) {
+        return new MacroCallAST(definition->name, definition->parameters, call->arguments.release(), body.release(), macro.functionName);
+    }
+
+    // the pass manager takes ownership of the body, it frees it as well when a pass fails
+    return this->bindArguments(body.release(), macro, call->arguments.get());
+}
+
+AST* ResolveMacrosPass::process_node(MacroDefinitionAST *ast)
+{
+    // a copy got collected already
+    return new StatementsAST();
+}
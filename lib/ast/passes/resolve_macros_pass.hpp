@@ -0,0 +1,67 @@
+#ifndef __RESOLVE_MACROS_PASS_HPP_
+#define __RESOLVE_MACROS_PASS_HPP_
+
+#include "ast/passes/pass.hpp"
+#include "ast/passes/pass_manager.hpp"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace b2 {
+
+/*
+ * Replaces every call of a macro by the macro's body, with its parameters bound to the
+ * arguments of the call, and drops the macro definitions.
+ *
+ * A macro gets called by printing it, as in `{{ button("OK", "primary") }}`. Macros are
+ * visible everywhere in the template being compiled, so this pass should run after
+ * ResolveIncludesPass: a template can call every macro its includes define. The body of
+ * a macro can only reference its parameters (and the variables of its own for loops and set blocks).
+ *
+ * Macros whose (resolved) body is larger than the maximum inline size are called
+ * instead, with a MacroCallAST: a backend compiles such a body once as a separate
+ * function, which takes the arguments as-is and renders into the buffer of its caller.
+ */
+class ResolveMacrosPass : public ASTPass
+{
+public:
+    ResolveMacrosPass();
+
+    /*
+     * Sets the maximum size (in statements, see FlatAST) of a macro which still gets
+     * inlined. Defaults to SIZE_MAX, iow. inlining everything.
+     */
+    void setMaxInlineSize(size_t maxInlineSize) { m_maxInlineSize = maxInlineSize; }
+
+    virtual AST* process(AST* ast) override;
+protected:
+    virtual AST* process_node(PrintBlockAST *ast) override;
+    virtual AST* process_node(MacroDefinitionAST *ast) override;
+private:
+    enum MacroState {
+        Unresolved,
+        Resolving,
+        Resolved,
+    };
+
+    struct Macro {
+        std::unique_ptr<MacroDefinitionAST> definition;
+        std::string functionName;
+        MacroState state;
+    };
+
+    void collectMacros(AST* ast);
+    Macro& resolveMacro(Symbol name);
+    AST* bindArguments(AST* body, const Macro &macro, ExpressionList* arguments);
+
+    std::unordered_map<Symbol, Macro> m_macros;
+    std::unordered_set<Symbol> m_macroNames;
+    PassManager m_passManager;
+    size_t m_maxInlineSize;
+};
+
+} // namespace b2
+
+#endif /* __RESOLVE_MACROS_PASS_HPP_ */
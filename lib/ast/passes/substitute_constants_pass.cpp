@@ -0,0 +1,273 @@
+#include "ast/passes/bindings_checker.hpp"
+#include "ast/passes/substitute_constants_pass.hpp"
+
+#include <string.h>
+
+#include <functional>
+#include <stdexcept>
+
+using namespace b2;
+
+Constant::Constant(Expression* literal) : m_literal(literal)
+{
+    if (literal->type() != ArrayLiteralExpressionType) {
+        return;
+    }
+
+    auto array = static_cast<ArrayLiteralExpression*>(literal);
+    auto key = array->isMap() ? array->keys->begin() : ExpressionList::iterator();
+    long index = 0;
+    for (auto &value : *array->values) {
+        Expression* keyLiteral = array->isMap() ? (key++)->get()->clone() : new IntegerLiteralExpression(index++);
+        this->append(new Constant(keyLiteral), new Constant(value->clone()));
+    }
+}
+
+void Constant::append(Constant* key, Constant* value)
+{
+    Element element;
+    element.key.reset(key);
+    element.value.reset(value);
+    m_elements.push_back(std::move(element));
+}
+
+const Constant* Constant::attribute(Symbol name) const
+{
+    for (auto &element : m_elements) {
+        auto key = element.key->literal();
+        if (key->type() != StringLiteralExpressionType) {
+            continue;
+        }
+
+        auto &keyString = static_cast<StringLiteralExpression*>(key)->value;
+        if (keyString.length() == name.length() && memcmp(keyString.data(), name.data(), name.length()) == 0) {
+            return element.value.get();
+        }
+    }
+
+    return nullptr;
+}
+
+namespace {
+
+typedef std::function<Symbol(const Constant*, const std::string&)> ArrayReferencer;
+
+/*
+ * Replaces the references to the bound constants which aren't shadowed by a for loop,
+ * set or capture block of the AST: by their literal, or by a variable standing for the
+ * array.
+ */
+class ReplaceReferencesPass : public ExpressionPass {
+public:
+    ReplaceReferencesPass(const std::unordered_map<Symbol, const Constant*> &bindings, std::unordered_set<VariableReferenceExpression*> localReferences, ArrayReferencer referenceArray) :
+        m_bindings(bindings), m_localReferences(std::move(localReferences)), m_referenceArray(std::move(referenceArray)) {}
+
+    virtual bool visitsIncludeBodies() const override { return false; }
+    virtual bool visitsMacroBodies() const override { return false; }
+protected:
+    virtual Expression* process_node(VariableReferenceExpression *expr) override;
+    virtual Expression* process_node(GetAttributeExpression *expr) override;
+private:
+    Expression* replace(const Constant* constant, const std::string &path);
+
+    const std::unordered_map<Symbol, const Constant*> &m_bindings;
+    std::unordered_set<VariableReferenceExpression*> m_localReferences;
+    ArrayReferencer m_referenceArray;
+};
+
+Expression* ReplaceReferencesPass::replace(const Constant* constant, const std::string &path)
+{
+    if (!constant->literal()) {
+        return new VariableReferenceExpression(m_referenceArray(constant, path));
+    }
+
+    return constant->literal()->clone();
+}
+
+Expression* ReplaceReferencesPass::process_node(VariableReferenceExpression *expr)
+{
+    if (m_localReferences.count(expr) > 0) {
+        return expr;
+    }
+
+    auto binding = m_bindings.find(expr->variableName);
+    if (binding == m_bindings.end()) {
+        return expr;
+    }
+
+    return this->replace(binding->second, expr->variableName.str());
+}
+
+Expression* ReplaceReferencesPass::process_node(GetAttributeExpression *expr)
+{
+    // find the variable this path starts from
+    std::vector<GetAttributeExpression*> attributes;
+    Expression* root = expr;
+    while (root->type() == GetAttributeExpressionType) {
+        auto attribute = static_cast<GetAttributeExpression*>(root);
+        attributes.push_back(attribute);
+        root = attribute->variable.get();
+    }
+
+    if (root->type() != VariableReferenceExpressionType) {
+        return expr;
+    }
+
+    auto variable = static_cast<VariableReferenceExpression*>(root);
+    auto binding = m_bindings.find(variable->variableName);
+    if (m_localReferences.count(variable) > 0 || binding == m_bindings.end()) {
+        return expr;
+    }
+
+    // and follow it through the constant, from the shortest path to the longest
+    const Constant* constant = binding->second;
+    std::string path = variable->variableName.str();
+    for (auto attribute = attributes.rbegin(); attribute != attributes.rend(); ++attribute) {
+        auto name = (*attribute)->attributeName;
+        if (!constant->isArray()) {
+            throw std::runtime_error("Constant '" + path + "' has no attributes, it can't be used as '" + path + "." + name.str() + "'");
+        }
+
+        constant = constant->attribute(name);
+        path += "." + name.str();
+        if (!constant) {
+            throw std::runtime_error("No value found for constant '" + path + "'");
+        }
+    }
+
+    return this->replace(constant, path);
+}
+
+/*
+ * Rejects what's left of the array constants after unrolling the loops over them: their
+ * value isn't available at render time.
+ */
+class RejectArrayReferencesPass : public ExpressionPass {
+public:
+    RejectArrayReferencesPass(std::function<const std::string*(Symbol)> arrayPath) : m_arrayPath(std::move(arrayPath)) {}
+
+    virtual bool visitsIncludeBodies() const override { return false; }
+    virtual bool visitsMacroBodies() const override { return false; }
+protected:
+    virtual Expression* process_node(VariableReferenceExpression *expr) override;
+private:
+    std::function<const std::string*(Symbol)> m_arrayPath;
+};
+
+Expression* RejectArrayReferencesPass::process_node(VariableReferenceExpression *expr)
+{
+    auto path = m_arrayPath(expr->variableName);
+    if (path) {
+        throw std::runtime_error("Constant '" + *path + "' is an array, it can only be used through its attributes or iterated over by a for loop");
+    }
+
+    return expr;
+}
+
+} /* anon namespace */
+
+Symbol SubstituteConstantsPass::referenceArray(const Constant* constant, const std::string &path)
+{
+    auto name = m_context.symbols().intern("constant#" + std::to_string(m_arrays.size() + 1));
+    m_arrays[name] = ArrayReference{constant, path};
+    return name;
+}
+
+/*
+ * Substitutes the constants in `bindings` in `ast`; the variables `ast` binds itself
+ * shadow them.
+ */
+AST* SubstituteConstantsPass::substitute(AST* ast, const Bindings &bindings)
+{
+    auto localReferences = BindingsChecker({}).findLocalReferences(ast);
+
+    m_passManager.removeAllPasses();
+    m_passManager.addPass(new ReplaceReferencesPass(bindings, std::move(localReferences), [this](const Constant* constant, const std::string &path) {
+        return this->referenceArray(constant, path);
+    }));
+    return m_passManager.run(ast);
+}
+
+AST* SubstituteConstantsPass::process(AST* ast)
+{
+    m_arrays.clear();
+    if (m_constants.empty()) {
+        // nothing to substitute, but the loops over array literals still get unrolled
+        return ASTPass::process(ast);
+    }
+
+    Bindings bindings;
+    for (auto &tuple : m_constants) {
+        bindings[tuple.first] = tuple.second.get();
+    }
+
+    // the pass manager frees what it runs on when a pass fails, so it can't run on `ast` itself
+    AST* body;
+    if (ast->type() == StatementsASTType) {
+        auto statements = static_cast<StatementsAST*>(ast);
+        body = new StatementsAST(statements->statements.release());
+        statements->statements.reset(new ASTList());
+    } else {
+        body = ast->clone();
+    }
+
+    std::unique_ptr<AST> substituted(this->substitute(body, bindings));
+    body = ASTPass::process(substituted.get());
+    if (body == substituted.get()) {
+        substituted.release();
+    }
+
+    m_passManager.removeAllPasses();
+    m_passManager.addPass(new RejectArrayReferencesPass([this](Symbol name) -> const std::string* {
+        auto array = m_arrays.find(name);
+        return array != m_arrays.end() ? &array->second.path : nullptr;
+    }));
+    return m_passManager.run(body);
+}
+
+AST* SubstituteConstantsPass::process_node(ForBlockAST *ast)
+{
+    const Constant* constant = nullptr;
+    std::unique_ptr<Constant> literal;
+
+    if (ast->iterable->type() == VariableReferenceExpressionType) {
+        auto array = m_arrays.find(static_cast<VariableReferenceExpression*>(ast->iterable.get())->variableName);
+        if (array != m_arrays.end()) {
+            constant = array->second.constant;
+        }
+    } else if (ast->iterable->type() == ArrayLiteralExpressionType && static_cast<ArrayLiteralExpression*>(ast->iterable.get())->isConstant()) {
+        literal.reset(new Constant(ast->iterable->clone()));
+        constant = literal.get();
+    }
+
+    if (!constant) {
+        return ast;
+    }
+
+    auto &elements = constant->elements();
+    if (elements.empty()) {
+        return ast->elseBody ? ast->elseBody.release() : new StatementsAST();
+    }
+
+    // every iteration gets a copy of the body, with the loop variables bound to the element;
+    // loops over the arrays in the element get unrolled when the traversal visits the copies
+    std::unique_ptr<StatementsAST> unrolled(new StatementsAST());
+    for (auto &element : elements) {
+        if (!ast->body) {
+            break;
+        }
+
+        Bindings bindings;
+        if (ast->keyVariable) {
+            bindings[ast->keyVariable->variableName] = element.key.get();
+        }
+        if (ast->valueVariable) {
+            bindings[ast->valueVariable->variableName] = element.value.get();
+        }
+
+        std::unique_ptr<AST> body(this->substitute(ast->body->clone(), bindings));
+        unrolled->statements->push_back(std::move(body));
+    }
+
+    return unrolled.release();
+}
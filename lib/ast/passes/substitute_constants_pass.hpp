@@ -0,0 +1,111 @@
+#ifndef __SUBSTITUTE_CONSTANTS_PASS_HPP_
+#define __SUBSTITUTE_CONSTANTS_PASS_HPP_
+
+#include "ast/context.hpp"
+#include "ast/passes/pass.hpp"
+#include "ast/passes/pass_manager.hpp"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace b2 {
+
+/*
+ * The compile-time value of a template variable: either a literal, or an array of
+ * constants keyed by integer or string literals (eg. the configuration of a site). An
+ * array literal of the template is both: it has elements, and a literal to use it with
+ * as a whole.
+ */
+class Constant
+{
+public:
+    struct Element {
+        std::unique_ptr<Constant> key;
+        std::unique_ptr<Constant> value;
+    };
+
+    // an empty array
+    Constant() {}
+    // takes ownership of `literal`, which is a constant array literal or any other literal
+    explicit Constant(Expression* literal);
+
+    bool isArray() const { return !m_literal || m_literal->type() == ArrayLiteralExpressionType; }
+    Expression* literal() const { return m_literal.get(); }
+    const std::vector<Element>& elements() const { return m_elements; }
+
+    /*
+     * Appends an element to this array, taking ownership of `key` and `value`.
+     */
+    void append(Constant* key, Constant* value);
+
+    /*
+     * Returns the element of this array keyed by `name`, or nullptr when there is none.
+     */
+    const Constant* attribute(Symbol name) const;
+    Constant* attribute(Symbol name) {
+        return const_cast<Constant*>(static_cast<const Constant*>(this)->attribute(name));
+    }
+
+private:
+    Constant(const Constant&) = delete;
+    Constant& operator=(const Constant&) = delete;
+
+    std::unique_ptr<Expression> m_literal;
+    std::vector<Element> m_elements;
+};
+
+typedef std::unordered_map<Symbol, std::unique_ptr<Constant>> ConstantMap;
+
+/*
+ * Specializes a template for a set of compile-time constant variables: every reference
+ * to one of them, or to an attribute path of an array constant, eg. `site.labels.home`,
+ * gets replaced by its literal value. Variables bound by a for loop, set block or
+ * capture block of the template shadow the constants, as they do at render time.
+ *
+ * For loops iterating over an array constant are unrolled, with the loop variables
+ * bound to the key and value of every element; a loop over an empty array is replaced
+ * by its else body. Other than that an array constant can only be used through its
+ * attributes, as its value isn't available at render time.
+ *
+ * Array literals whose values are all constant, eg. `["small", "large"]`, are constants
+ * as well: loops over them get unrolled the same way, also when no constants are given.
+ * Unlike array constants they can be used as a whole, as the literal is compiled.
+ *
+ * This pass should run before FoldConstantExpressionsPass and
+ * EliminateDeadBranchesPass, which evaluate what got constant. The bodies of includes
+ * and macros which are compiled separately are left alone: they get their variables
+ * from the arguments of their callers.
+ */
+class SubstituteConstantsPass : public ASTPass
+{
+public:
+    explicit SubstituteConstantsPass(ASTContext &context, const ConstantMap &constants) : m_context(context), m_constants(constants) {}
+
+    virtual AST* process(AST* ast) override;
+protected:
+    virtual AST* process_node(ForBlockAST *ast) override;
+    virtual bool visitsIncludeBodies() const override { return false; }
+    virtual bool visitsMacroBodies() const override { return false; }
+private:
+    typedef std::unordered_map<Symbol, const Constant*> Bindings;
+
+    struct ArrayReference {
+        const Constant* constant;
+        std::string path;
+    };
+
+    AST* substitute(AST* ast, const Bindings &bindings);
+    Symbol referenceArray(const Constant* constant, const std::string &path);
+
+    ASTContext &m_context;
+    const ConstantMap &m_constants;
+    PassManager m_passManager;
+    // array constants, referenced by variables named "constant#<n>" in the AST being processed
+    std::unordered_map<Symbol, ArrayReference> m_arrays;
+};
+
+} // namespace b2
+
+#endif /* __SUBSTITUTE_CONSTANTS_PASS_HPP_ */
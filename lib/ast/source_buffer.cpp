@@ -0,0 +1,137 @@
+#include "ast/source_buffer.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <sstream>
+#include <stdexcept>
+
+using namespace b2;
+
+static std::runtime_error fileError(const char* action, const std::string &filename)
+{
+    std::stringstream ss;
+    ss << "Couldn't " << action << " '" << filename << "': " << strerror(errno);
+    return std::runtime_error(ss.str());
+}
+
+static char* allocateBuffer(size_t length)
+{
+    char* buffer = (char*) malloc(length + SourceBuffer::padding);
+    if (buffer == nullptr) {
+        throw std::bad_alloc();
+    }
+
+    memset(&buffer[length], 0, SourceBuffer::padding);
+    return buffer;
+}
+
+namespace {
+
+struct DescriptorGuard {
+    int fd;
+
+    DescriptorGuard(int fd) : fd(fd) {}
+    ~DescriptorGuard() { close(fd); }
+};
+
+} /* anon namespace */
+
+SourceBuffer* SourceBuffer::fromFile(const std::string &filename)
+{
+    DescriptorGuard file(open(filename.c_str(), O_RDONLY));
+    if (file.fd < 0) {
+        throw fileError("open", filename);
+    }
+
+    struct stat st;
+    if (fstat(file.fd, &st) != 0) {
+        throw fileError("stat", filename);
+    }
+
+    size_t length = st.st_size;
+    if (length == 0) {
+        return fromMemory("", 0);
+    }
+
+    // the bytes following EOF in the last mapped page are guaranteed to be zero, so the
+    // file can be mapped as-is if that page still has room for the padding
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t tail = length % pageSize;
+    if (tail != 0 && tail <= pageSize - padding) {
+        void* mapping = mmap(nullptr, length + padding, PROT_READ | PROT_WRITE, MAP_PRIVATE, file.fd, 0);
+        if (mapping != MAP_FAILED) {
+            return new SourceBuffer((char*) mapping, length, length + padding);
+        }
+        // fall back to reading the file
+    }
+
+    char* buffer = allocateBuffer(length);
+    size_t offset = 0;
+    while (offset < length) {
+        ssize_t count = read(file.fd, &buffer[offset], length - offset);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        } else if (count <= 0) {
+            free(buffer);
+            throw fileError("read", filename);
+        }
+        offset += count;
+    }
+
+    return new SourceBuffer(buffer, length, 0);
+}
+
+SourceBuffer* SourceBuffer::fromStream(FILE* fd)
+{
+    size_t allocated = 4096;
+    size_t length = 0;
+    char* buffer = (char*) malloc(allocated);
+    if (buffer == nullptr) {
+        throw std::bad_alloc();
+    }
+
+    while (true) {
+        length += fread(&buffer[length], 1, allocated - length - padding, fd);
+        if (length < allocated - padding) {
+            break;
+        }
+
+        allocated *= 2;
+        char* new_buffer = (char*) realloc(buffer, allocated);
+        if (new_buffer == nullptr) {
+            free(buffer);
+            throw std::bad_alloc();
+        }
+        buffer = new_buffer;
+    }
+
+    if (ferror(fd)) {
+        free(buffer);
+        throw std::runtime_error(std::string("Couldn't read stream: ") + strerror(errno));
+    }
+
+    memset(&buffer[length], 0, padding);
+    return new SourceBuffer(buffer, length, 0);
+}
+
+SourceBuffer* SourceBuffer::fromMemory(const char* data, size_t length)
+{
+    char* buffer = allocateBuffer(length);
+    memcpy(buffer, data, length);
+    return new SourceBuffer(buffer, length, 0);
+}
+
+SourceBuffer::~SourceBuffer()
+{
+    if (m_mappedLength > 0) {
+        munmap(m_data, m_mappedLength);
+    } else {
+        free(m_data);
+    }
+}
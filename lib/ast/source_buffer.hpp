@@ -0,0 +1,45 @@
+#ifndef __SOURCE_BUFFER_HPP_
+#define __SOURCE_BUFFER_HPP_
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include <string>
+
+namespace b2 {
+
+/*
+ * Holds the complete source text of a template in memory.
+ *
+ * The text is always writable and followed by `padding` NUL bytes, which is what
+ * the lexer needs to scan it in-place (see yy_scan_buffer()). Files are mmap()'ed
+ * when their last page has room for the padding, otherwise they're read into a
+ * heap-allocated buffer.
+ */
+class SourceBuffer
+{
+public:
+    static const size_t padding = 2;
+
+    static SourceBuffer* fromFile(const std::string &filename);
+    static SourceBuffer* fromStream(FILE* fd);
+    static SourceBuffer* fromMemory(const char* data, size_t length);
+
+    ~SourceBuffer();
+
+    char* data() const { return m_data; }
+    size_t length() const { return m_length; }
+
+private:
+    SourceBuffer(char* data, size_t length, size_t mappedLength) : m_data(data), m_length(length), m_mappedLength(mappedLength) {}
+    SourceBuffer(const SourceBuffer&) = delete;
+    SourceBuffer& operator=(const SourceBuffer&) = delete;
+
+    char* m_data;
+    size_t m_length;
+    size_t m_mappedLength; // 0 when m_data is heap-allocated
+};
+
+} // namespace b2
+
+#endif /* __SOURCE_BUFFER_HPP_ */
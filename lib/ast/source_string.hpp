@@ -0,0 +1,80 @@
+#ifndef __SOURCE_STRING_HPP_
+#define __SOURCE_STRING_HPP_
+
+#include <string.h>
+
+#include <string>
+#include <utility>
+
+namespace b2 {
+
+/*
+ * A string stored in the AST.
+ *
+ * Strings produced by the lexer are slices of the template's SourceBuffer, which is
+ * kept alive by the ASTContext the template was parsed into; these are NOT
+ * NUL-terminated. Strings created by passes own a copy of their contents instead.
+ */
+class SourceString
+{
+public:
+    SourceString() : m_data(""), m_length(0), m_owned(false) {}
+    SourceString(const std::string &str) : m_data(copy(str.data(), str.length())), m_length(str.length()), m_owned(true) {}
+    SourceString(const SourceString &other) :
+        m_data(other.m_owned ? copy(other.m_data, other.m_length) : other.m_data),
+        m_length(other.m_length),
+        m_owned(other.m_owned) {}
+    SourceString(SourceString &&other) : m_data(other.m_data), m_length(other.m_length), m_owned(other.m_owned) {
+        other.m_owned = false;
+    }
+
+    ~SourceString() {
+        if (m_owned) {
+            delete[] m_data;
+        }
+    }
+
+    SourceString& operator=(SourceString other) {
+        std::swap(m_data, other.m_data);
+        std::swap(m_length, other.m_length);
+        std::swap(m_owned, other.m_owned);
+        return *this;
+    }
+
+    /*
+     * Returns a string referencing (and not copying) `length` bytes at `data`.
+     */
+    static SourceString slice(const char* data, size_t length) {
+        return SourceString(data, length);
+    }
+
+    const char* data() const { return m_data; }
+    size_t length() const { return m_length; }
+    bool empty() const { return m_length == 0; }
+    std::string str() const { return std::string(m_data, m_length); }
+
+    bool operator==(const SourceString &other) const {
+        return m_length == other.m_length && memcmp(m_data, other.m_data, m_length) == 0;
+    }
+    bool operator!=(const SourceString &other) const {
+        return !(*this == other);
+    }
+
+private:
+    SourceString(const char* data, size_t length) : m_data(data), m_length(length), m_owned(false) {}
+
+    static const char* copy(const char* data, size_t length) {
+        char* buffer = new char[length + 1];
+        memcpy(buffer, data, length);
+        buffer[length] = '\0';
+        return buffer;
+    }
+
+    const char* m_data;
+    size_t m_length;
+    bool m_owned;
+};
+
+} // namespace b2
+
+#endif // __SOURCE_STRING_HPP_
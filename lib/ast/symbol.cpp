@@ -0,0 +1,69 @@
+#include "ast/symbol.hpp"
+
+#include <string.h>
+
+#include "utils.hpp"
+
+using namespace b2;
+
+// the empty symbol is never stored in a table, so its hash doesn't have to match computeHash()
+const Symbol::Data Symbol::s_empty = { 0, 0, 0, { '\0' } };
+
+size_t Symbol::computeHash(const char* data, size_t length)
+{
+    return (size_t) hashBytes(data, length);
+}
+
+Symbol SymbolTable::intern(const char* data, size_t length)
+{
+    if (length == 0) {
+        return Symbol();
+    }
+
+    size_t hash = Symbol::computeHash(data, length);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if ((m_count + 1) * 2 > m_buckets.size()) {
+        grow();
+    }
+
+    // open addressing with linear probing, the table is always at most half full
+    size_t mask = m_buckets.size() - 1;
+    size_t index = hash & mask;
+    while (const Symbol::Data* entry = m_buckets[index]) {
+        if (entry->hash == hash && entry->length == length && memcmp(entry->text, data, length) == 0) {
+            return Symbol(entry);
+        }
+        index = (index + 1) & mask;
+    }
+
+    Symbol::Data* entry = (Symbol::Data*) m_arena.allocate(offsetof(Symbol::Data, text) + length + 1, alignof(Symbol::Data));
+    entry->id = ++m_count;
+    entry->hash = hash;
+    entry->length = length;
+    memcpy(entry->text, data, length);
+    entry->text[length] = '\0';
+
+    m_buckets[index] = entry;
+    return Symbol(entry);
+}
+
+void SymbolTable::grow()
+{
+    std::vector<const Symbol::Data*> buckets(m_buckets.empty() ? 64 : m_buckets.size() * 2, nullptr);
+    size_t mask = buckets.size() - 1;
+
+    for (auto entry : m_buckets) {
+        if (entry == nullptr) {
+            continue;
+        }
+
+        size_t index = entry->hash & mask;
+        while (buckets[index] != nullptr) {
+            index = (index + 1) & mask;
+        }
+        buckets[index] = entry;
+    }
+
+    m_buckets.swap(buckets);
+}
@@ -0,0 +1,92 @@
+#ifndef __SYMBOL_HPP_
+#define __SYMBOL_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ast/arena.hpp"
+
+namespace b2 {
+
+/*
+ * An interned name (of a variable, attribute or method).
+ *
+ * Symbols are created by a SymbolTable, which stores every distinct name only once;
+ * two symbols from the same table are equal if and only if they're the same object,
+ * so comparing and hashing them is O(1). The text is NUL-terminated.
+ */
+class Symbol
+{
+public:
+    struct Data {
+        uint32_t id;
+        size_t hash;
+        size_t length;
+        char text[1];
+    };
+
+    Symbol() : m_data(&s_empty) {}
+    explicit Symbol(const Data* data) : m_data(data) {}
+
+    uint32_t id() const { return m_data->id; }
+    size_t hash() const { return m_data->hash; }
+    const char* data() const { return m_data->text; }
+    size_t length() const { return m_data->length; }
+    bool empty() const { return m_data->length == 0; }
+    std::string str() const { return std::string(m_data->text, m_data->length); }
+
+    bool operator==(const Symbol &other) const { return m_data == other.m_data; }
+    bool operator!=(const Symbol &other) const { return m_data != other.m_data; }
+
+    static size_t computeHash(const char* data, size_t length);
+
+private:
+    static const Data s_empty;
+
+    const Data* m_data;
+};
+
+/*
+ * Interns names into Symbols; it's safe to use a single table from multiple threads.
+ */
+class SymbolTable
+{
+public:
+    SymbolTable() : m_count(0) {}
+
+    Symbol intern(const char* data, size_t length);
+    Symbol intern(const std::string &str) {
+        return intern(str.data(), str.length());
+    }
+
+private:
+    SymbolTable(const SymbolTable&) = delete;
+    SymbolTable& operator=(const SymbolTable&) = delete;
+
+    void grow();
+
+    std::mutex m_mutex;
+    Arena m_arena;
+    std::vector<const Symbol::Data*> m_buckets;
+    size_t m_count;
+};
+
+} // namespace b2
+
+namespace std {
+
+template<>
+struct hash<b2::Symbol> {
+    size_t operator()(const b2::Symbol &symbol) const {
+        return symbol.hash();
+    }
+};
+
+} // namespace std
+
+#endif // __SYMBOL_HPP_
@@ -3,6 +3,7 @@
 
 #include "ast.hpp"
 #include "expressions.hpp"
+#include "flat_ast.hpp"
 
 namespace b2 {
 
@@ -32,6 +33,24 @@ public:
                 return this->for_block(static_cast<ForBlockAST*>(ast));
             case IncludeBlockASTType:
                 return this->include_block(static_cast<IncludeBlockAST*>(ast));
+            case ExtendsBlockASTType:
+                return this->extends_block(static_cast<ExtendsBlockAST*>(ast));
+            case NamedBlockASTType:
+                return this->named_block(static_cast<NamedBlockAST*>(ast));
+            case MacroDefinitionASTType:
+                return this->macro_definition(static_cast<MacroDefinitionAST*>(ast));
+            case MacroCallASTType:
+                return this->macro_call(static_cast<MacroCallAST*>(ast));
+            case SetBlockASTType:
+                return this->set_block(static_cast<SetBlockAST*>(ast));
+            case CaptureBlockASTType:
+                return this->capture_block(static_cast<CaptureBlockAST*>(ast));
+            case SwitchBlockASTType:
+                return this->switch_block(static_cast<SwitchBlockAST*>(ast));
+            case CaseBlockASTType:
+                return this->case_block(static_cast<CaseBlockAST*>(ast));
+            case CacheBlockASTType:
+                return this->cache_block(static_cast<CacheBlockAST*>(ast));
         }
     }
 
@@ -41,6 +60,94 @@ public:
     virtual T if_block(IfBlockAST* ast) = 0;
     virtual T for_block(ForBlockAST* ast) = 0;
     virtual T include_block(IncludeBlockAST* ast) = 0;
+    virtual T extends_block(ExtendsBlockAST* ast) = 0;
+    virtual T named_block(NamedBlockAST* ast) = 0;
+    virtual T macro_definition(MacroDefinitionAST* ast) = 0;
+    virtual T macro_call(MacroCallAST* ast) = 0;
+    virtual T set_block(SetBlockAST* ast) = 0;
+    virtual T capture_block(CaptureBlockAST* ast) = 0;
+    virtual T switch_block(SwitchBlockAST* ast) = 0;
+    virtual T case_block(CaseBlockAST* ast) = 0;
+    virtual T cache_block(CacheBlockAST* ast) = 0;
+};
+
+/*
+ * Walks a FlatAST: statements are visited in order by stepping through the node array,
+ * a block's bodies can be walked by passing `ast.body(node)` / `ast.elseBody(node)`
+ * to walk().
+ */
+class FlatVisitor
+{
+public:
+	FlatVisitor() {}
+	virtual ~FlatVisitor() {}
+
+    void walk(const FlatAST& ast, FlatRange range) {
+        for (uint32_t index = range.begin; index < range.end; index = ast[index].end) {
+            const FlatNode& node = ast[index];
+            switch (node.type) {
+                case StatementsASTType:
+                    // never encoded in a FlatAST
+                    break;
+                case RawBlockASTType:
+                    this->raw(ast, node);
+                    break;
+                case PrintBlockASTType:
+                    this->print_block(ast, node);
+                    break;
+                case IfBlockASTType:
+                    this->if_block(ast, node);
+                    break;
+                case ForBlockASTType:
+                    this->for_block(ast, node);
+                    break;
+                case IncludeBlockASTType:
+                    this->include_block(ast, node);
+                    break;
+                case ExtendsBlockASTType:
+                    this->extends_block(ast, node);
+                    break;
+                case NamedBlockASTType:
+                    this->named_block(ast, node);
+                    break;
+                case MacroDefinitionASTType:
+                    this->macro_definition(ast, node);
+                    break;
+                case MacroCallASTType:
+                    this->macro_call(ast, node);
+                    break;
+                case SetBlockASTType:
+                    this->set_block(ast, node);
+                    break;
+                case CaptureBlockASTType:
+                    this->capture_block(ast, node);
+                    break;
+                case SwitchBlockASTType:
+                    this->switch_block(ast, node);
+                    break;
+                case CaseBlockASTType:
+                    // only encoded within a SwitchBlock, which walks its cases itself
+                    break;
+                case CacheBlockASTType:
+                    this->cache_block(ast, node);
+                    break;
+            }
+        }
+    }
+
+    virtual void raw(const FlatAST& ast, const FlatNode& node) = 0;
+    virtual void print_block(const FlatAST& ast, const FlatNode& node) = 0;
+    virtual void if_block(const FlatAST& ast, const FlatNode& node) = 0;
+    virtual void for_block(const FlatAST& ast, const FlatNode& node) = 0;
+    virtual void include_block(const FlatAST& ast, const FlatNode& node) = 0;
+    virtual void extends_block(const FlatAST& ast, const FlatNode& node) = 0;
+    virtual void named_block(const FlatAST& ast, const FlatNode& node) = 0;
+    virtual void macro_definition(const FlatAST& ast, const FlatNode& node) = 0;
+    virtual void macro_call(const FlatAST& ast, const FlatNode& node) = 0;
+    virtual void set_block(const FlatAST& ast, const FlatNode& node) = 0;
+    virtual void capture_block(const FlatAST& ast, const FlatNode& node) = 0;
+    virtual void switch_block(const FlatAST& ast, const FlatNode& node) = 0;
+    virtual void cache_block(const FlatAST& ast, const FlatNode& node) = 0;
 };
 
 template<typename T>
@@ -72,6 +179,8 @@ public:
                 return this->unary_operation_expression(static_cast<UnaryOperationExpression*>(expr));
 			case ComparisonExpressionType:
                 return this->comparison_expression(static_cast<ComparisonExpression*>(expr));
+			case ArrayLiteralExpressionType:
+                return this->array_literal_expression(static_cast<ArrayLiteralExpression*>(expr));
 		}
 	}
 
@@ -85,6 +194,7 @@ public:
     virtual T binary_operation_expression(BinaryOperationExpression *expr) = 0;
     virtual T unary_operation_expression(UnaryOperationExpression *expr) = 0;
     virtual T comparison_expression(ComparisonExpression *expr) = 0;
+    virtual T array_literal_expression(ArrayLiteralExpression *expr) = 0;
 };
 
 } // namespace b2
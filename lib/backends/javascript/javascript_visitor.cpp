@@ -46,10 +46,30 @@ inline const std::string escape(const std::string& text) {
 	return ret;
 }
 
+/*
+ * Appends the operands of `expr` to `operands` when it's a concatenation, flattening the
+ * concatenations nested in it; otherwise appends `expr`.
+ */
+static void collectConcatenationOperands(Expression* expr, std::vector<Expression*>& operands)
+{
+	if (expr->type() == BinaryOperationExpressionType) {
+		auto binary = static_cast<BinaryOperationExpression*>(expr);
+		if (binary->op == Concatenation) {
+			collectConcatenationOperands(binary->left.get(), operands);
+			collectConcatenationOperands(binary->right.get(), operands);
+			return;
+		}
+	}
+
+	operands.push_back(expr);
+}
+
 void JavascriptVisitor::visit(AST *ast)
 {
+	FlatAST flatAST(ast);
+
 	this->printHeader();
-	this->ast(ast);
+	this->walk(flatAST, flatAST.root());
 	this->printFooter();
 }
 
@@ -74,33 +94,39 @@ void JavascriptVisitor::printFooter()
 	;
 }
 
-void JavascriptVisitor::statements(StatementsAST *ast)
+void JavascriptVisitor::raw(const FlatAST& flatAST, const FlatNode& node)
 {
-	for (auto& statement : *ast->statements) {
-		this->ast(statement.get());
-	}
-}
+	auto ast = node.as<RawBlockAST>();
 
-void JavascriptVisitor::raw(RawBlockAST *ast)
-{
 	m_output.start_line();
-	m_output << "buffer += '" << escape(ast->text.get()) << "';";
+	m_output << "buffer += '" << escape(ast->text.str()) << "';";
 	m_output.end_line();
 }
 
-void JavascriptVisitor::print_block(PrintBlockAST *ast)
+void JavascriptVisitor::print_block(const FlatAST& flatAST, const FlatNode& node)
 {
-	m_output.start_line();
-	m_output << "buffer += " << this->expression(ast->expr.get());
-	if (m_undefinedCheck) {
-		m_output << " || ''";
+	auto ast = node.as<PrintBlockAST>();
+
+	// a printed concatenation gets appended operand by operand
+	std::vector<Expression*> operands;
+	collectConcatenationOperands(ast->expr.get(), operands);
+
+	for (auto operand : operands) {
+		m_output.start_line();
+		m_output << "buffer += " << this->expression(operand);
+		if (m_undefinedCheck) {
+			m_output << " || ''";
+		}
+		m_output << ";";
+		m_output.end_line();
 	}
-	m_output << ";";
-	m_output.end_line();
 }
 
-void JavascriptVisitor::if_block(IfBlockAST *ast, bool is_elseif)
+void JavascriptVisitor::if_block(const FlatAST& flatAST, const FlatNode& node, bool is_elseif)
 {
+	auto ast = node.as<IfBlockAST>();
+	auto elseBody = flatAST.elseBody(node);
+
 	if (!is_elseif) {
 		m_output.blankline();
 	}
@@ -110,17 +136,18 @@ void JavascriptVisitor::if_block(IfBlockAST *ast, bool is_elseif)
 	m_output.end_line();
 
 	m_output.indent();
-	this->ast(ast->thenBody.get());
+	this->walk(flatAST, flatAST.body(node));
 	m_output.outdent();
 
-	if (ast->elseBody) {
-		if (ast->elseBody->type() == IfBlockASTType) {
-			this->if_block(static_cast<IfBlockAST*>(ast->elseBody.get()), true);
+	if (!elseBody.empty()) {
+		const FlatNode& elseNode = flatAST[elseBody.begin];
+		if (elseNode.type == IfBlockASTType && elseNode.end == elseBody.end) {
+			this->if_block(flatAST, elseNode, true);
 		} else {
 			m_output.line("} else {");
 			
 			m_output.indent();
-			this->ast(ast->elseBody.get());
+			this->walk(flatAST, elseBody);
 			m_output.outdent();
 
 			m_output
@@ -136,17 +163,18 @@ void JavascriptVisitor::if_block(IfBlockAST *ast, bool is_elseif)
 	}
 }
 
-void JavascriptVisitor::for_block(ForBlockAST *ast)
+void JavascriptVisitor::for_block(const FlatAST& flatAST, const FlatNode& node)
 {
+	auto ast = node.as<ForBlockAST>();
 	m_forCounter++;
 
 	// variables
-	bool has_else_body = (ast->elseBody != nullptr);
+	bool has_else_body = !flatAST.elseBody(node).empty();
 	bool has_key_variable = (ast->keyVariable != nullptr);
 	bool has_value_variable = (ast->valueVariable != nullptr);
 
-	std::string key_variable_name = has_key_variable ? ast->keyVariable->variableName.get() : std::string();
-	std::string value_variable_name = has_value_variable ? ast->valueVariable->variableName.get() : std::string();
+	Symbol key_variable_name = has_key_variable ? ast->keyVariable->variableName : Symbol();
+	Symbol value_variable_name = has_value_variable ? ast->valueVariable->variableName : Symbol();
 
 	std::string iterable_id = "iterable_" + std::to_string(m_forCounter);
 	std::string is_empty_id = "is_empty_" + std::to_string(m_forCounter);
@@ -195,7 +223,7 @@ void JavascriptVisitor::for_block(ForBlockAST *ast)
 	}
 
 	// walk body
-	this->ast(ast->body.get());
+	this->walk(flatAST, flatAST.body(node));
 
 	// restore old shadow values
 	if (has_key_variable) {
@@ -234,7 +262,7 @@ void JavascriptVisitor::for_block(ForBlockAST *ast)
 		m_output.end_line();
 
 		m_output.indent();
-		this->ast(ast->elseBody.get());
+		this->walk(flatAST, flatAST.elseBody(node));
 		m_output.outdent();
 
 		m_output
@@ -244,33 +272,159 @@ void JavascriptVisitor::for_block(ForBlockAST *ast)
 	}
 }
 
-void JavascriptVisitor::include_block(IncludeBlockAST *ast)
+void JavascriptVisitor::include_block(const FlatAST& flatAST, const FlatNode& node)
 {
 	throw std::runtime_error("Unsupported");
 }
 
-void JavascriptVisitor::variable_reference_expression(VariableReferenceExpression *expr)
+void JavascriptVisitor::extends_block(const FlatAST& flatAST, const FlatNode& node)
+{
+	throw std::runtime_error("Unsupported");
+}
+
+void JavascriptVisitor::named_block(const FlatAST& flatAST, const FlatNode& node)
 {
-	std::string variableName = expr->variableName.get();
+	// a block which isn't overridden renders in place
+	this->walk(flatAST, flatAST.body(node));
+}
 
+void JavascriptVisitor::macro_definition(const FlatAST& flatAST, const FlatNode& node)
+{
+	throw std::runtime_error("Unsupported");
+}
+
+void JavascriptVisitor::macro_call(const FlatAST& flatAST, const FlatNode& node)
+{
+	throw std::runtime_error("Unsupported");
+}
+
+void JavascriptVisitor::set_block(const FlatAST& flatAST, const FlatNode& node)
+{
+	auto ast = node.as<SetBlockAST>();
+	m_setCounter++;
+
+	std::string local_id = "local_" + std::to_string(m_setCounter);
+
+	m_output.start_line();
+	m_output << "var " << local_id << " = " << this->expression(ast->value.get()) << ";";
+	m_output.end_line();
+
+	// shadow the variable for the rest of the block
+	auto oldValue = m_shadowValues.find(ast->name) != m_shadowValues.end() ? m_shadowValues[ast->name] : std::string();
+	m_shadowValues[ast->name] = local_id;
+
+	this->walk(flatAST, flatAST.body(node));
+
+	if (!oldValue.empty()) {
+		m_shadowValues[ast->name] = oldValue;
+	} else {
+		m_shadowValues.erase(ast->name);
+	}
+}
+
+void JavascriptVisitor::capture_block(const FlatAST& flatAST, const FlatNode& node)
+{
+	auto ast = node.as<CaptureBlockAST>();
+	m_captureCounter++;
+
+	std::string capture_id = "capture_" + std::to_string(m_captureCounter);
+
+	// render the capture into a buffer of its own
+	m_output.start_line();
+	m_output << "var " << capture_id << " = (function() {";
+	m_output.end_line();
+
+	m_output
+		.indent()
+		.line("var buffer = '';")
+	;
+	this->walk(flatAST, flatAST.body(node));
+	m_output
+		.line("return buffer;")
+		.outdent()
+		.line("})();")
+	;
+
+	// shadow the variable for the rest of the block
+	auto oldValue = m_shadowValues.find(ast->name) != m_shadowValues.end() ? m_shadowValues[ast->name] : std::string();
+	m_shadowValues[ast->name] = capture_id;
+
+	this->walk(flatAST, flatAST.elseBody(node));
+
+	if (!oldValue.empty()) {
+		m_shadowValues[ast->name] = oldValue;
+	} else {
+		m_shadowValues.erase(ast->name);
+	}
+}
+
+void JavascriptVisitor::switch_block(const FlatAST& flatAST, const FlatNode& node)
+{
+	auto ast = node.as<SwitchBlockAST>();
+	m_switchCounter++;
+
+	std::string switch_id = "switch_" + std::to_string(m_switchCounter);
+
+	m_output.blankline();
+	m_output.start_line();
+	m_output << "var " << switch_id << " = " << this->expression(ast->expr.get()) << ";";
+	m_output.end_line();
+
+	// the cases are compared like the if/elseif chain they were lowered from
+	auto cases = flatAST.body(node);
+	for (auto index = cases.begin; index < cases.end; index = flatAST[index].end) {
+		const FlatNode& caseNode = flatAST[index];
+
+		m_output.start_line();
+		m_output << (index != cases.begin ? "} else " : "") << "if (" << switch_id << " == " << this->expression(caseNode.as<CaseBlockAST>()->value.get()) << ") {";
+		m_output.end_line();
+
+		m_output.indent();
+		this->walk(flatAST, flatAST.body(caseNode));
+		m_output.outdent();
+	}
+
+	auto elseBody = flatAST.elseBody(node);
+	if (!elseBody.empty()) {
+		m_output.line("} else {");
+
+		m_output.indent();
+		this->walk(flatAST, elseBody);
+		m_output.outdent();
+	}
+
+	m_output
+		.line("}")
+		.blankline()
+	;
+}
+
+void JavascriptVisitor::cache_block(const FlatAST& flatAST, const FlatNode& node)
+{
+	// there's no fragment cache on the client, the body renders in place
+	this->walk(flatAST, flatAST.body(node));
+}
+
+void JavascriptVisitor::variable_reference_expression(VariableReferenceExpression *expr)
+{
 	// check shadow values
-	auto shadowValue = m_shadowValues.find(variableName);
+	auto shadowValue = m_shadowValues.find(expr->variableName);
 	if (shadowValue != m_shadowValues.end()) {
 		m_output << shadowValue->second;
 		return;
 	}
 
-	m_output << "data['" << escape(expr->variableName.get()) << "']";
+	m_output << "data['" << escape(expr->variableName.str()) << "']";
 }
 
 void JavascriptVisitor::get_attribute_expression(GetAttributeExpression *expr)
 {
-	m_output << this->expression(expr->variable.get()) << "['" << escape(expr->attributeName.get()) << "']";
+	m_output << this->expression(expr->variable.get()) << "['" << escape(expr->attributeName.str()) << "']";
 }
 
 void JavascriptVisitor::method_call_expression(MethodCallExpression *expr)
 {
-	m_output << "helpers['" << expr->methodName.get() << "'](";
+	m_output << "helpers['" << expr->methodName.str() << "'](";
 
 	bool first = true;
 	for (auto &argument : *expr->arguments) {
@@ -302,11 +456,27 @@ void JavascriptVisitor::boolean_literal_expression(BooleanLiteralExpression *exp
 
 void JavascriptVisitor::string_literal_expression(StringLiteralExpression *expr)
 {
-	m_output << "'" << escape(expr->value.get()) << "'";
+	m_output << "'" << escape(expr->value.str()) << "'";
 }
 
 void JavascriptVisitor::binary_operation_expression(BinaryOperationExpression *expr)
 {
+	if (expr->op == Concatenation) {
+		std::vector<Expression*> operands;
+		collectConcatenationOperands(expr, operands);
+
+		m_output << "(''";
+		for (auto operand : operands) {
+			m_output << " + (" << this->expression(operand);
+			if (m_undefinedCheck) {
+				m_output << " || ''";
+			}
+			m_output << ")";
+		}
+		m_output << ")";
+		return;
+	}
+
 	std::string op = {(char) (expr->op >> 8), (char) (expr->op & 0xFF)};
 
 	m_output << this->expression(expr->left.get()) << " " << op << " " << this->expression(expr->right.get());
@@ -325,3 +495,24 @@ void JavascriptVisitor::comparison_expression(ComparisonExpression *expr)
 
 	m_output << this->expression(expr->left.get()) << " " << op << " " << this->expression(expr->right.get());
 }
+
+void JavascriptVisitor::array_literal_expression(ArrayLiteralExpression *expr)
+{
+	m_output << (expr->isMap() ? "{" : "[");
+
+	auto key = expr->isMap() ? expr->keys->begin() : ExpressionList::iterator();
+	bool first = true;
+	for (auto &value : *expr->values) {
+		if (!first) {
+			m_output << ", ";
+		}
+
+		if (expr->isMap()) {
+			m_output << this->expression((key++)->get()) << ": ";
+		}
+		m_output << this->expression(value.get());
+		first = false;
+	}
+
+	m_output << (expr->isMap() ? "}" : "]");
+}
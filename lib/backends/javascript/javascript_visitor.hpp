@@ -9,10 +9,10 @@
 
 namespace b2 {
 
-class JavascriptVisitor : protected Visitor<void>, protected ExpressionVisitor<void>
+class JavascriptVisitor : protected FlatVisitor, protected ExpressionVisitor<void>
 {
 public:
-    JavascriptVisitor(CodeEmitter &output) : m_output(output), m_forCounter(0), m_undefinedCheck(false) {}
+    JavascriptVisitor(CodeEmitter &output) : m_output(output), m_undefinedCheck(false), m_forCounter(0), m_setCounter(0), m_captureCounter(0), m_switchCounter(0) {}
 
 	inline void performUndefinedCheck(bool undefined_check) {
 		m_undefinedCheck = undefined_check;
@@ -25,12 +25,19 @@ public:
 	void visit(AST* ast);
 
 protected:
-    virtual void statements(StatementsAST* ast) override;
-    virtual void raw(RawBlockAST* ast) override;
-    virtual void print_block(PrintBlockAST* ast) override;
-    virtual void if_block(IfBlockAST* ast) override { this->if_block(ast, false); }
-    virtual void for_block(ForBlockAST* ast) override;
-    virtual void include_block(IncludeBlockAST* ast) override;
+    virtual void raw(const FlatAST& ast, const FlatNode& node) override;
+    virtual void print_block(const FlatAST& ast, const FlatNode& node) override;
+    virtual void if_block(const FlatAST& ast, const FlatNode& node) override { this->if_block(ast, node, false); }
+    virtual void for_block(const FlatAST& ast, const FlatNode& node) override;
+    virtual void include_block(const FlatAST& ast, const FlatNode& node) override;
+    virtual void extends_block(const FlatAST& ast, const FlatNode& node) override;
+    virtual void named_block(const FlatAST& ast, const FlatNode& node) override;
+    virtual void macro_definition(const FlatAST& ast, const FlatNode& node) override;
+    virtual void macro_call(const FlatAST& ast, const FlatNode& node) override;
+    virtual void set_block(const FlatAST& ast, const FlatNode& node) override;
+    virtual void capture_block(const FlatAST& ast, const FlatNode& node) override;
+    virtual void switch_block(const FlatAST& ast, const FlatNode& node) override;
+    virtual void cache_block(const FlatAST& ast, const FlatNode& node) override;
 
     virtual void variable_reference_expression(VariableReferenceExpression *expr) override;
     virtual void get_attribute_expression(GetAttributeExpression *expr) override;
@@ -42,9 +49,10 @@ protected:
     virtual void binary_operation_expression(BinaryOperationExpression *expr) override;
     virtual void unary_operation_expression(UnaryOperationExpression *expr) override;
     virtual void comparison_expression(ComparisonExpression *expr) override;
+    virtual void array_literal_expression(ArrayLiteralExpression *expr) override;
 
 private:
-    void if_block(IfBlockAST* ast, bool is_elseif);
+    void if_block(const FlatAST& ast, const FlatNode& node, bool is_elseif);
 
 	void printHeader();
 	void printFooter();
@@ -57,7 +65,10 @@ private:
 	CodeEmitter& m_output;
 	bool m_undefinedCheck;
 	int m_forCounter;
-	std::unordered_map<std::string, std::string> m_shadowValues;
+	int m_setCounter;
+	int m_captureCounter;
+	int m_switchCounter;
+	std::unordered_map<Symbol, std::string> m_shadowValues;
 };
 
 } // namespace b2
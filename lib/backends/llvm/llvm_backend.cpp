@@ -64,42 +64,83 @@ LLVMBackend::LLVMBackend(llvm::IRBuilder<> &irBuilder, LLVMBindings &bindings) :
 	}
 }
 
+void LLVMBackend::optimizeFunction(llvm::Function* llvmFunc)
+{
+    auto module = llvmFunc->getParent();
+#if 0
+    std::string error;
+    llvm::raw_fd_ostream strm("output.bc", error);
+    llvm::WriteBitcodeToFile(module, strm);
+#endif
+
+    // verify IR
+    if (llvm::verifyFunction(*llvmFunc, llvm::PrintMessageAction) || llvm::verifyModule(*module, llvm::PrintMessageAction)) {
+        throw std::runtime_error("Error occured during verification of IR!");
+    }
+
+    // optimize IR
+    llvm::legacy::FunctionPassManager p(module);
+    p.add(llvm::createBasicAliasAnalysisPass());
+    p.add(llvm::createInstructionCombiningPass());
+    p.add(llvm::createReassociatePass());
+    p.add(llvm::createGVNPass());
+    p.add(llvm::createCFGSimplificationPass());
+    //p.add(llvm::createFunctionInliningPass());
+    //p.add(llvm::createAlwaysInlinerPass());
+
+    p.doInitialization();
+    p.run(*llvmFunc);
+    p.doFinalization();
+
+    //llvmFunc->dump();
+}
+
+/*
+ * Generates a function for every include block (in `ast`) which got resolved to a separate
+ * function, and for every macro called. Includes are named after the included template and
+ * its contents, so every template of this backend including it calls the same function.
+ */
+void LLVMBackend::createCalledFunctions(AST* ast)
+{
+    FlatAST flatAST(ast);
+    for (auto &node : flatAST) {
+        if (node.type == IncludeBlockASTType) {
+            auto include = node.as<IncludeBlockAST>();
+            if (!include->body || m_module->getFunction(include->functionName) != nullptr) {
+                continue;
+            }
+
+            // the includes of this include should exist before it calls them
+            this->createCalledFunctions(include->body.get());
+
+            auto llvmFunc = m_visitor->visit(include->body.get(), include->functionName);
+            this->optimizeFunction(llvmFunc);
+        } else if (node.type == MacroCallASTType) {
+            auto macroCall = node.as<MacroCallAST>();
+            if (m_module->getFunction(macroCall->functionName) != nullptr) {
+                continue;
+            }
+
+            this->createCalledFunctions(macroCall->body.get());
+
+            auto llvmFunc = m_visitor->visitMacro(macroCall);
+            this->optimizeFunction(llvmFunc);
+        }
+    }
+}
+
 void* LLVMBackend::createFunction(const std::string &name, AST *ast)
 {
     auto llvmFunc = m_functions[name];
 
     if (llvmFunc == nullptr) {
+        this->createCalledFunctions(ast);
+
         // create LLVM IR
         llvmFunc = m_visitor->visit(ast);
         //llvmFunc->dump();
 
-        auto module = llvmFunc->getParent();
-    #if 0
-        std::string error;
-        llvm::raw_fd_ostream strm("output.bc", error);
-        llvm::WriteBitcodeToFile(module, strm);
-    #endif
-
-        // verify IR
-        if (llvm::verifyFunction(*llvmFunc, llvm::PrintMessageAction) || llvm::verifyModule(*module, llvm::PrintMessageAction)) {
-            throw std::runtime_error("Error occured during verification of IR!");
-        }
-
-        // optimize IR
-        llvm::legacy::FunctionPassManager p(module);
-        p.add(llvm::createBasicAliasAnalysisPass());
-        p.add(llvm::createInstructionCombiningPass());
-        p.add(llvm::createReassociatePass());
-        p.add(llvm::createGVNPass());
-        p.add(llvm::createCFGSimplificationPass());
-        //p.add(llvm::createFunctionInliningPass());
-        //p.add(llvm::createAlwaysInlinerPass());
-
-        p.doInitialization();
-        p.run(*llvmFunc);
-        p.doFinalization();
-
-        //llvmFunc->dump();
+        this->optimizeFunction(llvmFunc);
 
         m_functions[name] = llvmFunc;
     }
@@ -23,6 +23,9 @@ public:
     void* createFunction(const std::string &name, AST* ast);
 	llvm::Module* getModule() { return m_module; }
 protected:
+	void createCalledFunctions(AST* ast);
+	void optimizeFunction(llvm::Function* llvmFunc);
+
 	llvm::IRBuilder<> &m_irBuilder;
 	LLVMBindings &m_bindings;
 	llvm::Module* m_module;
@@ -6,6 +6,8 @@
 #include <llvm/IR/Function.h>
 #include <llvm/IR/IRBuilder.h>
 
+#include <stdexcept>
+
 namespace b2 {
 
 class LLVMBindings
@@ -90,15 +92,145 @@ public:
 
     /*
      */
-    virtual llvm::Value* createVariableLookup(const char* variableName) = 0;
+    virtual llvm::Value* createVariableLookup(llvm::StringRef variableName) = 0;
 
     /*
      */
-    virtual llvm::Value* createMethodCall(const char* methodName, llvm::ArrayRef<llvm::Value*> arguments) = 0;
+    virtual llvm::Value* createMethodCall(llvm::StringRef methodName, llvm::ArrayRef<llvm::Value*> arguments) = 0;
 
     /*
      */
-    virtual llvm::Value* createGetAttribute(const char* attributeName, llvm::Value* variable) = 0;
+    virtual llvm::Value* createGetAttribute(llvm::StringRef attributeName, llvm::Value* variable) = 0;
+
+    /*
+     * Calls `function`, a template function generated for an include block or returned by
+     * createIncludeLookup(). Its variables are looked up in `scope` when given, otherwise in
+     * the `variables` bound to `variableNames`.
+     */
+    virtual void createIncludeCall(llvm::Value* function, llvm::Value* scope, llvm::ArrayRef<llvm::StringRef> variableNames, llvm::ArrayRef<llvm::Value*> variables) {
+        throw std::runtime_error("These bindings don't support calling includes");
+    }
+
+    /*
+     * Returns the template function named by `name`, which is only known at render time.
+     */
+    virtual llvm::Value* createIncludeLookup(llvm::Value* name) {
+        throw std::runtime_error("These bindings don't support dynamic includes");
+    }
+
+    /*
+     * Returns the type of the function generated for a macro: the one of a template function,
+     * followed by a variant for every parameter of the macro.
+     */
+    virtual llvm::FunctionType* getMacroFunctionType(llvm::Module* module, size_t parameterCount) {
+        throw std::runtime_error("These bindings don't support macros");
+    }
+
+    /*
+     * Returns the argument bound to parameter `index` of `function`, a function generated for a
+     * macro. It's owned by the caller.
+     */
+    virtual llvm::Value* getMacroArgument(llvm::Function* function, size_t index) {
+        throw std::runtime_error("These bindings don't support macros");
+    }
+
+    /*
+     * Calls `function`, a function generated for a macro, which renders into the buffer of the
+     * calling template.
+     */
+    virtual void createMacroCall(llvm::Function* function, llvm::ArrayRef<llvm::Value*> arguments) {
+        throw std::runtime_error("These bindings don't support macros");
+    }
+
+    /*
+     * Makes everything rendered from here on end up in a scratch buffer instead, until the
+     * matching createCaptureEnd(). Captures can be nested.
+     */
+    virtual void createCaptureStart() {
+        throw std::runtime_error("These bindings don't support capturing output");
+    }
+
+    /*
+     * Returns what got rendered since the matching createCaptureStart(), as a variant holding
+     * a string, and continues rendering into the previous buffer.
+     */
+    virtual llvm::Value* createCaptureEnd() {
+        throw std::runtime_error("These bindings don't support capturing output");
+    }
+
+    /*
+     * Returns whether `variant` holds an integer, and sets `value` to that integer (which is
+     * undefined when it doesn't).
+     */
+    virtual llvm::Value* createVariantGetInteger(llvm::Value* variant, llvm::Value** value) {
+        throw std::runtime_error("These bindings don't support switching on variants");
+    }
+
+    /*
+     * Returns whether `variant` holds a string, and sets `characters` and `length` to that
+     * string (which are undefined when it doesn't). The characters are owned by `variant`.
+     */
+    virtual llvm::Value* createVariantGetString(llvm::Value* variant, llvm::Value** characters, llvm::Value** length) {
+        throw std::runtime_error("These bindings don't support switching on variants");
+    }
+
+    /*
+     * Returns the value of `variant` as a native integer, double or boolean (depending on
+     * `type`), converting it when it holds another type. `variant` goes out of scope.
+     */
+    virtual llvm::Value* createVariantConversion(llvm::Value* variant, ExpressionValueType type) {
+        throw std::runtime_error("These bindings don't support typed variables");
+    }
+
+    /*
+     * Returns a variant holding the concatenation of `operands` (variants or native values)
+     * as a string, which gets allocated once at its final size. The variants among `operands`
+     * go out of scope.
+     */
+    virtual llvm::Value* createConcatenation(llvm::ArrayRef<llvm::Value*> operands) {
+        throw std::runtime_error("These bindings don't support concatenating");
+    }
+
+    /*
+     * Returns a new variant holding an array of `values` (variants or native values), keyed by
+     * `keys` when given and by position otherwise. The variants among them go out of scope.
+     */
+    virtual llvm::Value* createArray(llvm::ArrayRef<llvm::Value*> keys, llvm::ArrayRef<llvm::Value*> values) {
+        throw std::runtime_error("These bindings don't support array literals");
+    }
+
+    /*
+     * Returns a variant holding `literal`, an array literal whose values are all constant. It
+     * gets built once, when compiling, and is shared by every render; it doesn't go out of scope.
+     */
+    virtual llvm::Value* createConstantArray(ArrayLiteralExpression* literal) {
+        throw std::runtime_error("These bindings don't support array literals");
+    }
+
+    /*
+     * Prints the output stored in the fragment cache under `key` by the cache block
+     * identified by `block`, and returns whether there was any. `key` doesn't go out of
+     * scope.
+     */
+    virtual llvm::Value* createCacheFetch(llvm::StringRef block, llvm::Value* key) {
+        throw std::runtime_error("These bindings don't support cache blocks");
+    }
+
+    /*
+     * Returns a mark of the output rendered so far, for createCacheStore().
+     */
+    virtual llvm::Value* createCacheMark() {
+        throw std::runtime_error("These bindings don't support cache blocks");
+    }
+
+    /*
+     * Stores the output rendered since `mark` in the fragment cache under `key` of the
+     * cache block identified by `block`, for `ttl` seconds (0 meaning until it gets
+     * evicted). `key` doesn't go out of scope.
+     */
+    virtual void createCacheStore(llvm::StringRef block, llvm::Value* key, long ttl, llvm::Value* mark) {
+        throw std::runtime_error("These bindings don't support cache blocks");
+    }
 
 protected:
 	llvm::IRBuilder<> &m_irBuilder;
@@ -1,4 +1,6 @@
 #include "llvm_visitor.hpp"
+#include "utils.hpp"
+#include "utils/print_visitor.hpp"
 
 #include <llvm/IR/Module.h>
 #include <llvm/IR/BasicBlock.h>
@@ -14,49 +16,129 @@
 #include <llvm/Support/system_error.h>
 #include <llvm/Support/MemoryBuffer.h>
 
+#include <map>
+#include <sstream>
+
 using namespace llvm;
 using namespace b2;
 
-Function* LLVMVisitor::visit(AST* ast)
+/*
+ * Returns whether `value` is a native integer or double, which native arithmetic works on.
+ */
+static inline bool isNumber(Value* value)
+{
+    return value->getType()->isIntegerTy(64) || value->getType()->isFloatingPointTy();
+}
+
+/*
+ * Returns whether `value` is a constant other than zero, which is safe to divide by.
+ */
+static inline bool isNonZeroConstant(Value* value)
+{
+    auto constant = dyn_cast<llvm::Constant>(value);
+    return constant && !constant->isNullValue();
+}
+
+/*
+ * Appends the operands of `expr` to `operands` when it's a concatenation, flattening the
+ * concatenations nested in it (`a ~ b ~ c` has three operands); otherwise appends `expr`.
+ */
+static void collectConcatenationOperands(Expression* expr, std::vector<Expression*>& operands)
+{
+    if (expr->type() == BinaryOperationExpressionType) {
+        auto binary = static_cast<BinaryOperationExpression*>(expr);
+        if (binary->op == Concatenation) {
+            collectConcatenationOperands(binary->left.get(), operands);
+            collectConcatenationOperands(binary->right.get(), operands);
+            return;
+        }
+    }
+
+    operands.push_back(expr);
+}
+
+static inline StringRef toStringRef(const SourceString& str)
+{
+    return StringRef(str.data(), str.length());
+}
+
+static inline StringRef toStringRef(const Symbol& symbol)
+{
+    return StringRef(symbol.data(), symbol.length());
+}
+
+Function* LLVMVisitor::visit(AST* ast, const std::string &name)
 {
     // create function
-    m_function.reset(Function::Create(m_bindings.getTemplateFunctionType(m_module), GlobalValue::ExternalLinkage, "template", m_module));
+    m_function.reset(Function::Create(m_bindings.getTemplateFunctionType(m_module), GlobalValue::ExternalLinkage, name, m_module));
 
     m_bindings.functionSetup(m_function.get());
 
     // walk AST
-    this->ast(ast);
+    FlatAST flatAST(ast);
+    this->walk(flatAST, flatAST.root());
 
     m_bindings.functionTeardown();
 
     return m_function.take();
 }
 
-void LLVMVisitor::statements(StatementsAST* ast)
+/*
+ * Generates the function called by `ast`, which takes the arguments of the macro after
+ * the ones of a template function.
+ */
+Function* LLVMVisitor::visitMacro(MacroCallAST* ast)
 {
-    for (std::unique_ptr<AST> &statement : *ast->statements) {
-        this->ast(statement.get());
+    // create function
+    auto functionType = m_bindings.getMacroFunctionType(m_module, ast->parameters.size());
+    m_function.reset(Function::Create(functionType, GlobalValue::InternalLinkage, ast->functionName, m_module));
+
+    m_bindings.functionSetup(m_function.get());
+
+    // the parameters are only bound to the arguments
+    for (size_t i = 0; i < ast->parameters.size(); i++) {
+        m_overriden_variables[ast->parameters[i]] = m_bindings.getMacroArgument(m_function.get(), i);
     }
+
+    // walk AST
+    FlatAST flatAST(ast->body.get());
+    this->walk(flatAST, flatAST.root());
+
+    m_overriden_variables.clear();
+    m_bindings.functionTeardown();
+
+    return m_function.take();
 }
 
-void LLVMVisitor::raw(RawBlockAST* ast)
+void LLVMVisitor::raw(const FlatAST& flatAST, const FlatNode& node)
 {
-    Value *stringPtr = m_irBuilder.CreateGlobalStringPtr(ast->text.get());
+    auto ast = node.as<RawBlockAST>();
+    Value *stringPtr = m_irBuilder.CreateGlobalStringPtr(toStringRef(ast->text));
     m_bindings.createPrintCall(stringPtr);
 }
 
-void LLVMVisitor::print_block(PrintBlockAST* ast)
+void LLVMVisitor::print_block(const FlatAST& flatAST, const FlatNode& node)
 {
-    Value *value = this->expression(ast->expr.get());
-    m_bindings.createPrintCall(value);
+    auto ast = node.as<PrintBlockAST>();
 
-    if (m_bindings.isVariantType(value->getType())) {
-        m_bindings.variableGoesOutOfScope(value);
+    // a printed concatenation doesn't get built: its operands are appended to the output
+    // one after another
+    std::vector<Expression*> operands;
+    collectConcatenationOperands(ast->expr.get(), operands);
+
+    for (auto operand : operands) {
+        Value *value = this->expression(operand);
+        m_bindings.createPrintCall(value);
+
+        if (m_bindings.isVariantType(value->getType())) {
+            m_bindings.variableGoesOutOfScope(value);
+        }
     }
 }
 
-void LLVMVisitor::if_block(IfBlockAST* ast)
+void LLVMVisitor::if_block(const FlatAST& flatAST, const FlatNode& node)
 {
+    auto ast = node.as<IfBlockAST>();
     Value *condition = this->expression(ast->condition.get());
     if (!condition->getType()->isIntegerTy(1)) {
         // TODO
@@ -72,9 +154,7 @@ void LLVMVisitor::if_block(IfBlockAST* ast)
     m_irBuilder.SetInsertPoint(thenBlock);
 
     // walk then body
-    if (ast->thenBody) {
-        this->ast(ast->thenBody.get());
-    }
+    this->walk(flatAST, flatAST.body(node));
 
     m_irBuilder.CreateBr(mergeBlock);
 
@@ -83,9 +163,7 @@ void LLVMVisitor::if_block(IfBlockAST* ast)
     m_irBuilder.SetInsertPoint(elseBlock);
 
     // walk else body
-    if (ast->elseBody) {
-        this->ast(ast->elseBody.get());
-    }
+    this->walk(flatAST, flatAST.elseBody(node));
 
     m_irBuilder.CreateBr(mergeBlock);
 
@@ -94,8 +172,9 @@ void LLVMVisitor::if_block(IfBlockAST* ast)
     m_irBuilder.SetInsertPoint(mergeBlock);
 }
 
-void LLVMVisitor::for_block(ForBlockAST* ast)
+void LLVMVisitor::for_block(const FlatAST& flatAST, const FlatNode& node)
 {
+    auto ast = node.as<ForBlockAST>();
     auto iterable = this->expression(ast->iterable.get());
 
     // create blocks
@@ -113,8 +192,8 @@ void LLVMVisitor::for_block(ForBlockAST* ast)
     bool hasKeyVariable = (ast->keyVariable != nullptr);
     bool hasValueVariable = (ast->valueVariable != nullptr);
 
-    std::string keyVariableName = hasKeyVariable ? ast->keyVariable->variableName.get() : "";
-    std::string valueVariableName = hasValueVariable ? ast->valueVariable->variableName.get() : "";
+    Symbol keyVariableName = hasKeyVariable ? ast->keyVariable->variableName : Symbol();
+    Symbol valueVariableName = hasValueVariable ? ast->valueVariable->variableName : Symbol();
 
     auto oldKeyVariable = m_overriden_variables[keyVariableName], oldValueVariable = m_overriden_variables[valueVariableName];
     llvm::Value *keyVariable = nullptr, *valueVariable = nullptr;
@@ -130,9 +209,7 @@ void LLVMVisitor::for_block(ForBlockAST* ast)
     }
 
     // visit the body
-    if (ast->body) {
-        this->ast(ast->body.get());
-    }
+    this->walk(flatAST, flatAST.body(node));
 
     // destroy variables
     if (hasKeyVariable) {
@@ -164,9 +241,7 @@ void LLVMVisitor::for_block(ForBlockAST* ast)
 
     // create loopElse block
     m_irBuilder.SetInsertPoint(loopElseBlock);
-    if (ast->elseBody) {
-        this->ast(ast->elseBody.get());
-    }
+    this->walk(flatAST, flatAST.elseBody(node));
     m_irBuilder.CreateBr(afterLoopBlock);
 
     // all done
@@ -175,26 +250,350 @@ void LLVMVisitor::for_block(ForBlockAST* ast)
     m_bindings.variableGoesOutOfScope(iterable);
 }
 
-void LLVMVisitor::include_block(IncludeBlockAST *ast)
+void LLVMVisitor::include_block(const FlatAST& flatAST, const FlatNode& node)
+{
+    auto ast = node.as<IncludeBlockAST>();
+    Value* function;
+    if (ast->nameExpression) {
+        auto name = this->expression(ast->nameExpression.get());
+        function = m_bindings.createIncludeLookup(name);
+    } else if (ast->body) {
+        // generated up front by LLVMBackend
+        function = m_module->getFunction(ast->functionName);
+        if (!function) {
+            throw std::runtime_error("No function generated for include '" + ast->functionName + "'");
+        }
+    } else {
+        throw std::runtime_error("LLVMVisitor doesn't support unresolved include blocks!");
+    }
+
+    if (ast->scope) {
+        auto scope = this->expression(ast->scope.get());
+        m_bindings.createIncludeCall(function, scope, ArrayRef<StringRef>(), ArrayRef<Value*>());
+        return;
+    }
+
+    std::vector<StringRef> variableNames;
+    std::vector<Value*> variables;
+    for (auto &tuple : ast->variableMapping) {
+        variableNames.push_back(toStringRef(tuple.first));
+        variables.push_back(this->expression(tuple.second.get()));
+    }
+    m_bindings.createIncludeCall(function, nullptr, variableNames, variables);
+}
+
+void LLVMVisitor::extends_block(const FlatAST& flatAST, const FlatNode& node)
+{
+    throw std::runtime_error("LLVMVisitor doesn't support unresolved extends blocks!");
+}
+
+void LLVMVisitor::named_block(const FlatAST& flatAST, const FlatNode& node)
+{
+    // a block which isn't overridden renders in place
+    this->walk(flatAST, flatAST.body(node));
+}
+
+void LLVMVisitor::macro_definition(const FlatAST& flatAST, const FlatNode& node)
+{
+    throw std::runtime_error("LLVMVisitor doesn't support unresolved macros!");
+}
+
+void LLVMVisitor::macro_call(const FlatAST& flatAST, const FlatNode& node)
+{
+    auto ast = node.as<MacroCallAST>();
+
+    // generated up front by LLVMBackend
+    auto function = m_module->getFunction(ast->functionName);
+    if (!function) {
+        throw std::runtime_error("No function generated for macro '" + ast->functionName + "'");
+    }
+
+    std::vector<Value*> arguments;
+    for (auto &argument : *ast->arguments) {
+        arguments.push_back(this->expression(argument.get()));
+    }
+    m_bindings.createMacroCall(function, arguments);
+}
+
+/*
+ * The value of a set block gets computed once, its body references the resulting SSA
+ * value instead of looking the variable up again.
+ */
+void LLVMVisitor::set_block(const FlatAST& flatAST, const FlatNode& node)
+{
+    auto ast = node.as<SetBlockAST>();
+    auto value = this->expression(ast->value.get());
+
+    // temporarily overwrite the variable
+    auto oldValue = m_overriden_variables[ast->name];
+    m_overriden_variables[ast->name] = value;
+
+    // visit the body
+    this->walk(flatAST, flatAST.body(node));
+
+    // destroy the value
+    if (m_bindings.isVariantType(value->getType())) {
+        m_bindings.variableGoesOutOfScope(value);
+    }
+
+    // restore the old variable
+    if (oldValue) {
+        m_overriden_variables[ast->name] = oldValue;
+    } else {
+        m_overriden_variables.erase(ast->name);
+    }
+}
+
+void LLVMVisitor::capture_block(const FlatAST& flatAST, const FlatNode& node)
 {
-    throw std::runtime_error("LLVMVisitor doesn't support include blocks!");
+    auto ast = node.as<CaptureBlockAST>();
+
+    // render the capture into a scratch buffer
+    m_bindings.createCaptureStart();
+    this->walk(flatAST, flatAST.body(node));
+    auto value = m_bindings.createCaptureEnd();
+
+    // temporarily overwrite the variable
+    auto oldValue = m_overriden_variables[ast->name];
+    m_overriden_variables[ast->name] = value;
+
+    // visit the body
+    this->walk(flatAST, flatAST.elseBody(node));
+
+    // destroy the value
+    m_bindings.variableGoesOutOfScope(value);
+
+    // restore the old variable
+    if (oldValue) {
+        m_overriden_variables[ast->name] = oldValue;
+    } else {
+        m_overriden_variables.erase(ast->name);
+    }
+}
+
+void LLVMVisitor::switch_block(const FlatAST& flatAST, const FlatNode& node)
+{
+    auto ast = node.as<SwitchBlockAST>();
+    auto value = this->expression(ast->expr.get());
+
+    std::vector<const FlatNode*> caseNodes;
+    auto cases = flatAST.body(node);
+    for (auto index = cases.begin; index < cases.end; index = flatAST[index].end) {
+        caseNodes.push_back(&flatAST[index]);
+    }
+
+    std::vector<BasicBlock*> caseBlocks;
+    for (size_t i = 0; i < caseNodes.size(); i++) {
+        caseBlocks.push_back(BasicBlock::Create(m_llvmContext, "case"));
+    }
+    BasicBlock* elseBlock = BasicBlock::Create(m_llvmContext, "switchElse");
+    BasicBlock* mergeBlock = BasicBlock::Create(m_llvmContext, "switchEnd");
+
+    bool isVariant = m_bindings.isVariantType(value->getType());
+    if (isVariant && !caseNodes.empty()) {
+        // a value of the same type as the cases can be matched directly
+        auto matchBlock = BasicBlock::Create(m_llvmContext, "switchMatch", m_function.get());
+        auto compareBlock = BasicBlock::Create(m_llvmContext, "switchCompare", m_function.get());
+
+        if (caseNodes.front()->as<CaseBlockAST>()->value->type() == IntegerLiteralExpressionType) {
+            Value* integer;
+            m_irBuilder.CreateCondBr(m_bindings.createVariantGetInteger(value, &integer), matchBlock, compareBlock);
+
+            m_irBuilder.SetInsertPoint(matchBlock);
+            auto switchInst = m_irBuilder.CreateSwitch(integer, elseBlock, caseNodes.size());
+            for (size_t i = 0; i < caseNodes.size(); i++) {
+                auto literal = static_cast<IntegerLiteralExpression*>(caseNodes[i]->as<CaseBlockAST>()->value.get());
+                // FIXME: hard-coded 64-bits
+                switchInst->addCase(m_irBuilder.getInt64(literal->value), caseBlocks[i]);
+            }
+        } else {
+            Value* characters;
+            Value* length;
+            m_irBuilder.CreateCondBr(m_bindings.createVariantGetString(value, &characters, &length), matchBlock, compareBlock);
+
+            StringCases stringCases;
+            for (size_t i = 0; i < caseNodes.size(); i++) {
+                auto literal = static_cast<StringLiteralExpression*>(caseNodes[i]->as<CaseBlockAST>()->value.get());
+                stringCases.emplace_back(toStringRef(literal->value), caseBlocks[i]);
+            }
+
+            m_irBuilder.SetInsertPoint(matchBlock);
+            this->createStringSwitch(characters, length, stringCases, elseBlock);
+        }
+
+        m_irBuilder.SetInsertPoint(compareBlock);
+    }
+
+    // any other value gets compared to every case, like the if/elseif chain this was lowered from
+    for (size_t i = 0; i < caseNodes.size(); i++) {
+        auto left = isVariant ? m_bindings.getNewReferenceForVariable(value) : value;
+        auto right = this->expression(caseNodes[i]->as<CaseBlockAST>()->value.get());
+        auto nextBlock = BasicBlock::Create(m_llvmContext, "nextCase", m_function.get());
+
+        m_irBuilder.CreateCondBr(this->createComparison(Equal, left, right), caseBlocks[i], nextBlock);
+        m_irBuilder.SetInsertPoint(nextBlock);
+    }
+    m_irBuilder.CreateBr(elseBlock);
+
+    // walk the case bodies
+    for (size_t i = 0; i < caseNodes.size(); i++) {
+        m_function->getBasicBlockList().push_back(caseBlocks[i]);
+        m_irBuilder.SetInsertPoint(caseBlocks[i]);
+
+        this->walk(flatAST, flatAST.body(*caseNodes[i]));
+
+        m_irBuilder.CreateBr(mergeBlock);
+    }
+
+    // walk else body
+    m_function->getBasicBlockList().push_back(elseBlock);
+    m_irBuilder.SetInsertPoint(elseBlock);
+
+    this->walk(flatAST, flatAST.elseBody(node));
+
+    m_irBuilder.CreateBr(mergeBlock);
+
+    // start mergeBlock
+    m_function->getBasicBlockList().push_back(mergeBlock);
+    m_irBuilder.SetInsertPoint(mergeBlock);
+
+    if (isVariant) {
+        m_bindings.variableGoesOutOfScope(value);
+    }
+}
+
+/*
+ * The body of a cache block only gets rendered when its output isn't cached yet: it
+ * renders into the buffer as usual, after which that output gets stored.
+ *
+ * The keys of a block are its own: every block is identified by the hash of its body,
+ * so blocks of different templates (or processes) using the same key don't get each
+ * other's output.
+ */
+void LLVMVisitor::cache_block(const FlatAST& flatAST, const FlatNode& node)
+{
+    auto ast = node.as<CacheBlockAST>();
+    auto key = this->expression(ast->key.get());
+
+    std::stringstream body;
+    if (ast->body) {
+        PrintVisitor(body).visit(ast->body.get());
+    }
+    char block[17];
+    snprintf(block, sizeof(block), "%016llx", (unsigned long long) hashBytes(body.str().data(), body.str().length()));
+
+    // create blocks
+    auto missBlock = BasicBlock::Create(m_llvmContext, "cacheMiss", m_function.get());
+    auto mergeBlock = BasicBlock::Create(m_llvmContext, "cacheEnd");
+
+    m_irBuilder.CreateCondBr(m_bindings.createCacheFetch(block, key), mergeBlock, missBlock);
+
+    // render the body, and store its output
+    m_irBuilder.SetInsertPoint(missBlock);
+    auto mark = m_bindings.createCacheMark();
+    this->walk(flatAST, flatAST.body(node));
+    m_bindings.createCacheStore(block, key, ast->ttl, mark);
+
+    m_irBuilder.CreateBr(mergeBlock);
+
+    // start mergeBlock
+    m_function->getBasicBlockList().push_back(mergeBlock);
+    m_irBuilder.SetInsertPoint(mergeBlock);
+
+    if (m_bindings.isVariantType(key->getType())) {
+        m_bindings.variableGoesOutOfScope(key);
+    }
+}
+
+/*
+ * Branches to the block of the case equal to the `length` characters at `characters`, or
+ * to `defaultBlock` when there's none. The length, followed by the characters which tell
+ * the cases of that length apart, select the only candidate, which then gets verified.
+ */
+void LLVMVisitor::createStringSwitch(Value* characters, Value* length, const StringCases& cases, BasicBlock* defaultBlock)
+{
+    std::map<size_t, StringCases> casesByLength;
+    for (auto &stringCase : cases) {
+        casesByLength[stringCase.first.size()].push_back(stringCase);
+    }
+
+    auto switchInst = m_irBuilder.CreateSwitch(length, defaultBlock, casesByLength.size());
+    for (auto &lengthCases : casesByLength) {
+        auto lengthBlock = BasicBlock::Create(m_llvmContext, "switchLength", m_function.get());
+        // TODO: find out native size_t width
+        switchInst->addCase(m_irBuilder.getInt64(lengthCases.first), lengthBlock);
+
+        m_irBuilder.SetInsertPoint(lengthBlock);
+        this->createCharacterSwitch(characters, lengthCases.first, lengthCases.second, defaultBlock);
+    }
+}
+
+/*
+ * See createStringSwitch(), for `cases` which all are `length` characters long.
+ */
+void LLVMVisitor::createCharacterSwitch(Value* characters, size_t length, const StringCases& cases, BasicBlock* defaultBlock)
+{
+    if (cases.size() == 1) {
+        auto &stringCase = cases.front();
+        if (length == 0) {
+            m_irBuilder.CreateBr(stringCase.second);
+            return;
+        }
+
+        auto memcmpFunction = m_module->getOrInsertFunction("memcmp", m_irBuilder.getInt32Ty(), m_irBuilder.getInt8PtrTy(), m_irBuilder.getInt8PtrTy(), m_irBuilder.getInt64Ty(), nullptr);
+        Value* args[] = {
+            characters,
+            m_irBuilder.CreateGlobalStringPtr(stringCase.first),
+            m_irBuilder.getInt64(length),
+        };
+        auto isEqual = m_irBuilder.CreateICmpEQ(m_irBuilder.CreateCall(memcmpFunction, args), m_irBuilder.getInt32(0));
+        m_irBuilder.CreateCondBr(isEqual, stringCase.second, defaultBlock);
+        return;
+    }
+
+    // switch on the character which tells most cases apart, distinct cases always differ in one
+    size_t position = 0;
+    std::map<unsigned char, StringCases> casesByCharacter;
+    for (size_t i = 0; i < length; i++) {
+        std::map<unsigned char, StringCases> candidate;
+        for (auto &stringCase : cases) {
+            candidate[stringCase.first[i]].push_back(stringCase);
+        }
+        if (candidate.size() > casesByCharacter.size()) {
+            position = i;
+            casesByCharacter.swap(candidate);
+        }
+    }
+
+    auto character = m_irBuilder.CreateLoad(m_irBuilder.CreateConstGEP1_64(characters, position));
+    auto switchInst = m_irBuilder.CreateSwitch(character, defaultBlock, casesByCharacter.size());
+    for (auto &characterCases : casesByCharacter) {
+        auto characterBlock = BasicBlock::Create(m_llvmContext, "switchCharacter", m_function.get());
+        switchInst->addCase(m_irBuilder.getInt8(characterCases.first), characterBlock);
+
+        m_irBuilder.SetInsertPoint(characterBlock);
+        this->createCharacterSwitch(characters, length, characterCases.second, defaultBlock);
+    }
 }
 
 Value* LLVMVisitor::variable_reference_expression(VariableReferenceExpression *expr)
 {
-    auto variableName = expr->variableName.get();
-    auto overridenVariable = m_overriden_variables[variableName];
+    auto overridenVariable = m_overriden_variables[expr->variableName];
     if (overridenVariable) {
+        if (!m_bindings.isVariantType(overridenVariable->getType())) {
+            // a value of a set block which didn't need a variant
+            return overridenVariable;
+        }
         return m_bindings.getNewReferenceForVariable(overridenVariable);
     }
 
-    return m_bindings.createVariableLookup(variableName);
+    return this->convertVariant(m_bindings.createVariableLookup(toStringRef(expr->variableName)), expr->valueType());
 }
 
 Value* LLVMVisitor::get_attribute_expression(GetAttributeExpression *expr)
 {
     Value* variable = this->expression(expr->variable.get());
-    return m_bindings.createGetAttribute(expr->attributeName.get(), variable);
+    return m_bindings.createGetAttribute(toStringRef(expr->attributeName), variable);
 }
 
 Value* LLVMVisitor::method_call_expression(MethodCallExpression *expr)
@@ -203,7 +602,23 @@ Value* LLVMVisitor::method_call_expression(MethodCallExpression *expr)
     for (auto &argument : *expr->arguments) {
         arguments.push_back(this->expression(argument.get()));
     }
-    return m_bindings.createMethodCall(expr->methodName.get(), arguments);
+    return this->convertVariant(m_bindings.createMethodCall(toStringRef(expr->methodName), arguments), expr->valueType());
+}
+
+/*
+ * Returns `variant` as a native value of `type`, when it's known to have one (see
+ * InferTypesPass); this is the only check of its type the operations on it need.
+ */
+Value* LLVMVisitor::convertVariant(Value* variant, ExpressionValueType type)
+{
+    switch (type) {
+        case IntegerType:
+        case DoubleType:
+        case BooleanType:
+            return m_bindings.createVariantConversion(variant, type);
+        default:
+            return variant;
+    }
 }
 
 Value* LLVMVisitor::double_literal_expression(DoubleLiteralExpression *expr)
@@ -224,20 +639,34 @@ Value* LLVMVisitor::boolean_literal_expression(BooleanLiteralExpression *expr)
 
 Value* LLVMVisitor::string_literal_expression(StringLiteralExpression *expr)
 {
-    return m_irBuilder.CreateGlobalStringPtr(expr->value.get());
+    return m_irBuilder.CreateGlobalStringPtr(toStringRef(expr->value));
 }
 
 Value* LLVMVisitor::binary_operation_expression(BinaryOperationExpression *expr)
 {
+    if (expr->op == Concatenation) {
+        std::vector<Expression*> operands;
+        collectConcatenationOperands(expr, operands);
+
+        std::vector<Value*> values;
+        for (auto operand : operands) {
+            values.push_back(this->expression(operand));
+        }
+        return m_bindings.createConcatenation(values);
+    }
+
     Value* left = this->expression(expr->left.get());
     Value* right = this->expression(expr->right.get());
 
-    if (m_bindings.isVariantType(left->getType()) || m_bindings.isVariantType(right->getType())) {
-        // left and/or right are variants, this is a variant operation
+    bool isDivision = (expr->op == '/' || expr->op == '%');
+    bool isIntegerOperation = left->getType()->isIntegerTy() && right->getType()->isIntegerTy();
+    if (!isNumber(left) || !isNumber(right) || (isDivision && !isNonZeroConstant(right)) || (expr->op == '%' && !isIntegerOperation)) {
+        // left and/or right aren't numbers (eg. variants or booleans), or this could divide by zero
+        // or take the modulus of a double: do it the way a variant operation does
         return m_bindings.createVariantBinaryOperation(expr->op, left, right);
     }
 
-    if (left->getType()->isIntegerTy() && right->getType()->isIntegerTy()) {
+    if (isIntegerOperation && expr->op != '/') {
         // left and right are integers, this is an integer operation
         switch (expr->op) {
             case '+':
@@ -246,13 +675,12 @@ Value* LLVMVisitor::binary_operation_expression(BinaryOperationExpression *expr)
                 return m_irBuilder.CreateSub(left, right);
             case '*':
                 return m_irBuilder.CreateMul(left, right);
-            case '/':
-                return m_irBuilder.CreateExactSDiv(left, right);
             case '%':
                 return m_irBuilder.CreateSRem(left, right);
         }
     } else {
-        // left and/or right are float types, this is a float comparison
+        // left and/or right are float types, this is a float operation; so is dividing integers,
+        // which doesn't need to give an integer
 
         // convert to double if necessary
         if (!left->getType()->isFloatingPointTy()) {
@@ -273,8 +701,6 @@ Value* LLVMVisitor::binary_operation_expression(BinaryOperationExpression *expr)
                 return m_irBuilder.CreateFMul(left, right);
             case '/':
                 return m_irBuilder.CreateFDiv(left, right);
-            case '%':
-                return m_irBuilder.CreateFRem(left, right);
         }
     }
 }
@@ -283,21 +709,28 @@ Value* LLVMVisitor::unary_operation_expression(UnaryOperationExpression *expr)
 {
     Value* subexpr = this->expression(expr->expr.get());
 
-    // TODO: check operations
-	if (m_bindings.isVariantType(subexpr->getType())) {
-		return m_bindings.createVariantUnaryOperation(expr->op, subexpr);
-	}
-
     switch (expr->op) {
         case NumericPositive:
-            // TODO
-            //m_irBuilder->CreateCast(NULL, subexpr, m_irBuilder.getDoubleTy());
-            return subexpr;
+            if (isNumber(subexpr)) {
+                return subexpr;
+            }
+            break;
         case NumericNegative:
-            return m_irBuilder.CreateNeg(subexpr);
+            if (subexpr->getType()->isFloatingPointTy()) {
+                return m_irBuilder.CreateFNeg(subexpr);
+            } else if (isNumber(subexpr)) {
+                return m_irBuilder.CreateNeg(subexpr);
+            }
+            break;
         case BooleanNegation:
-            return m_irBuilder.CreateNot(subexpr);
+            if (subexpr->getType()->isIntegerTy(1)) {
+                return m_irBuilder.CreateNot(subexpr);
+            }
+            break;
     }
+
+    // subexpr is a variant, or a native value this operation doesn't apply to
+    return m_bindings.createVariantUnaryOperation(expr->op, subexpr);
 }
 
 Value* LLVMVisitor::comparison_expression(ComparisonExpression *expr)
@@ -305,14 +738,45 @@ Value* LLVMVisitor::comparison_expression(ComparisonExpression *expr)
     Value* left = this->expression(expr->left.get());
     Value* right = this->expression(expr->right.get());
 
-    if (m_bindings.isVariantType(left->getType()) || m_bindings.isVariantType(right->getType())) {
-        // left and/or right are variants, this is a variant comparison
-        return m_bindings.createVariantComparison(expr->op, left, right);
+    return this->createComparison(expr->op, left, right);
+}
+
+Value* LLVMVisitor::array_literal_expression(ArrayLiteralExpression *expr)
+{
+    if (expr->isConstant()) {
+        return m_bindings.createConstantArray(expr);
+    }
+
+    std::vector<Value*> keys;
+    if (expr->isMap()) {
+        for (auto &key : *expr->keys) {
+            keys.push_back(this->expression(key.get()));
+        }
+    }
+
+    std::vector<Value*> values;
+    for (auto &value : *expr->values) {
+        values.push_back(this->expression(value.get()));
     }
 
-    if (left->getType()->isIntegerTy() && right->getType()->isIntegerTy()) {
+    return m_bindings.createArray(keys, values);
+}
+
+Value* LLVMVisitor::createComparison(ComparisonOperation op, Value* left, Value* right)
+{
+    bool isBooleanOperation = left->getType()->isIntegerTy(1) && right->getType()->isIntegerTy(1);
+    if (op == And || op == Or) {
+        if (!isBooleanOperation) {
+            // left and/or right aren't booleans, let the variant comparison decide what's true
+            return m_bindings.createVariantComparison(op, left, right);
+        }
+
+        return op == And ? m_irBuilder.CreateAnd(left, right) : m_irBuilder.CreateOr(left, right);
+    }
+
+    if ((left->getType()->isIntegerTy(64) && right->getType()->isIntegerTy(64)) || (isBooleanOperation && (op == Equal || op == NotEqual))) {
         // left and right are integers, this is an integer comparison
-        switch (expr->op) {
+        switch (op) {
             case Equal:
                 return m_irBuilder.CreateICmpEQ(left, right);
             case NotEqual:
@@ -325,16 +789,12 @@ Value* LLVMVisitor::comparison_expression(ComparisonExpression *expr)
                 return m_irBuilder.CreateICmpSGT(left, right);
             case LessThan:
                 return m_irBuilder.CreateICmpSLT(left, right);
-			case And:
-				return m_irBuilder.CreateAnd(left, right);
-			case Or:
-				return m_irBuilder.CreateOr(left, right);
+            default:
+                break;
         }
-    } else {
+    } else if (isNumber(left) && isNumber(right)) {
         // left and/or right are float types, this is a float comparison
 
-        // TODO: support strings/bools!
-
         // convert to double if necessary
         if (!left->getType()->isFloatingPointTy()) {
             left = m_irBuilder.CreateSIToFP(left, m_irBuilder.getDoubleTy());
@@ -346,7 +806,7 @@ Value* LLVMVisitor::comparison_expression(ComparisonExpression *expr)
         }
 
         // construct float compare instruction
-        switch (expr->op) {
+        switch (op) {
             case Equal:
                 return m_irBuilder.CreateFCmpOEQ(left, right);
             case NotEqual:
@@ -359,10 +819,11 @@ Value* LLVMVisitor::comparison_expression(ComparisonExpression *expr)
                 return m_irBuilder.CreateFCmpOGT(left, right);
             case LessThan:
                 return m_irBuilder.CreateFCmpOLT(left, right);
-			case And:
-				return m_irBuilder.CreateAnd(left, right);
-			case Or:
-				return m_irBuilder.CreateOr(left, right);
+            default:
+                break;
         }
     }
+
+    // left and/or right are variants, strings or booleans, this is a variant comparison
+    return m_bindings.createVariantComparison(op, left, right);
 }
@@ -10,24 +10,34 @@
 
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace b2 {
 
-class LLVMVisitor : private Visitor<void>, private ExpressionVisitor<llvm::Value*> {
+class LLVMVisitor : private FlatVisitor, private ExpressionVisitor<llvm::Value*> {
 public:
     LLVMVisitor(llvm::IRBuilder<> &irBuilder, llvm::Module *module, LLVMBindings &bindings) : m_llvmContext(irBuilder.getContext()), m_irBuilder(irBuilder), m_module(module), m_bindings(bindings) {
     }
 
-    llvm::Function* visit(AST* ast);
+    llvm::Function* visit(AST* ast, const std::string &name = "template");
+    llvm::Function* visitMacro(MacroCallAST* ast);
     LLVMBindings& bindings() { return m_bindings; }
 
 private:
-    virtual void statements(StatementsAST* ast) override;
-    virtual void raw(RawBlockAST* ast) override;
-    virtual void print_block(PrintBlockAST* ast) override;
-    virtual void if_block(IfBlockAST* ast) override;
-    virtual void for_block(ForBlockAST* ast) override;
-    virtual void include_block(IncludeBlockAST* ast) override;
+    virtual void raw(const FlatAST& ast, const FlatNode& node) override;
+    virtual void print_block(const FlatAST& ast, const FlatNode& node) override;
+    virtual void if_block(const FlatAST& ast, const FlatNode& node) override;
+    virtual void for_block(const FlatAST& ast, const FlatNode& node) override;
+    virtual void include_block(const FlatAST& ast, const FlatNode& node) override;
+    virtual void extends_block(const FlatAST& ast, const FlatNode& node) override;
+    virtual void named_block(const FlatAST& ast, const FlatNode& node) override;
+    virtual void macro_definition(const FlatAST& ast, const FlatNode& node) override;
+    virtual void macro_call(const FlatAST& ast, const FlatNode& node) override;
+    virtual void set_block(const FlatAST& ast, const FlatNode& node) override;
+    virtual void capture_block(const FlatAST& ast, const FlatNode& node) override;
+    virtual void switch_block(const FlatAST& ast, const FlatNode& node) override;
+    virtual void cache_block(const FlatAST& ast, const FlatNode& node) override;
 
     virtual llvm::Value* variable_reference_expression(VariableReferenceExpression *expr) override;
     virtual llvm::Value* get_attribute_expression(GetAttributeExpression* expr) override;
@@ -39,13 +49,21 @@ private:
     virtual llvm::Value* binary_operation_expression(BinaryOperationExpression *expr) override;
     virtual llvm::Value* unary_operation_expression(UnaryOperationExpression *expr) override;
     virtual llvm::Value* comparison_expression(ComparisonExpression *expr) override;
+    virtual llvm::Value* array_literal_expression(ArrayLiteralExpression *expr) override;
+
+    typedef std::vector<std::pair<llvm::StringRef, llvm::BasicBlock*>> StringCases;
+
+    llvm::Value* convertVariant(llvm::Value* variant, ExpressionValueType type);
+    llvm::Value* createComparison(ComparisonOperation op, llvm::Value* left, llvm::Value* right);
+    void createStringSwitch(llvm::Value* characters, llvm::Value* length, const StringCases& cases, llvm::BasicBlock* defaultBlock);
+    void createCharacterSwitch(llvm::Value* characters, size_t length, const StringCases& cases, llvm::BasicBlock* defaultBlock);
 
     llvm::OwningPtr<llvm::Function> m_function;
     llvm::LLVMContext& m_llvmContext;
     llvm::IRBuilder<>& m_irBuilder;
     llvm::Module* m_module;
     LLVMBindings& m_bindings;
-    std::unordered_map<std::string, llvm::Value*> m_overriden_variables;
+    std::unordered_map<Symbol, llvm::Value*> m_overriden_variables;
 };
 
 } // namespace b2
@@ -0,0 +1,70 @@
+#include "parser/include_cache.hpp"
+#include "parser/parser.hpp"
+#include "utils.hpp"
+
+#include <sys/stat.h>
+
+using namespace b2;
+
+std::unique_ptr<AST> IncludeCache::get(const std::string &filename, ASTContext &context, uint64_t* hash)
+{
+    // when stat() fails, reading the file below reports why
+    struct stat st;
+    bool isStatted = stat(filename.c_str(), &st) == 0;
+
+    std::shared_ptr<Entry> entry;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto cachedEntry = m_entries.find(filename);
+        if (isStatted && cachedEntry != m_entries.end() && cachedEntry->second->modificationTime == st.st_mtime && cachedEntry->second->size == (size_t) st.st_size) {
+            // unmodified, no need to read it again
+            entry = cachedEntry->second;
+        }
+    }
+
+    if (!entry) {
+        std::shared_ptr<SourceBuffer> source(SourceBuffer::fromFile(filename));
+        uint64_t contentHash = hashBytes(source->data(), source->length());
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto &cachedEntry = m_entries[filename];
+        if (!cachedEntry || cachedEntry->hash != contentHash) {
+            // not seen before or modified since, (re)parse it; the entry it replaces gets
+            // freed as soon as no other thread is using it anymore
+            cachedEntry = std::make_shared<Entry>(contentHash, m_context.sharedSymbols());
+            cachedEntry->source = source;
+        }
+        if (isStatted) {
+            cachedEntry->modificationTime = st.st_mtime;
+            cachedEntry->size = st.st_size;
+        }
+        entry = cachedEntry;
+    }
+
+    if (hash) {
+        *hash = entry->hash;
+    }
+
+    AST* ast;
+    {
+        // when another thread is already parsing this template, wait for it; if that
+        // parse failed, try again
+        std::lock_guard<std::mutex> lock(entry->mutex);
+        if (!entry->parsed) {
+            // the lexer scans the source in-place, so after a failed parse it gets read again
+            std::shared_ptr<SourceBuffer> source = entry->source ? entry->source : std::shared_ptr<SourceBuffer>(SourceBuffer::fromFile(filename));
+            entry->source.reset();
+
+            ASTContext::Scope scope(entry->context);
+            Parser parser(entry->context);
+            entry->ast.reset(parser.parse(*source));
+            entry->source = source;
+            entry->parsed = true;
+        }
+        ast = entry->ast.get();
+    }
+
+    // a parsed entry is never modified anymore, so it can be copied without holding the lock
+    context.share(entry->source);
+    return std::unique_ptr<AST>(ast ? ast->clone() : nullptr);
+}
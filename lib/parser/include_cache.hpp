@@ -0,0 +1,69 @@
+#ifndef __INCLUDE_CACHE_HPP_
+#define __INCLUDE_CACHE_HPP_
+
+#include <stdint.h>
+#include <time.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "ast/ast.hpp"
+#include "ast/context.hpp"
+
+namespace b2 {
+
+/*
+ * Parses every included template only once.
+ *
+ * Templates are keyed by their path and the hash of their contents, so a modified
+ * file gets parsed again; the file only gets read and hashed again when its
+ * modification time or size changed. Every get() returns a private copy of the cached
+ * AST, which the caller is free to modify.
+ *
+ * Every template is parsed into a context of its own, which gets freed together with
+ * its entry when the file is modified. The copies returned by get() reference the
+ * source text of their entry, so the context they're returned for keeps it alive. The
+ * cache only uses `context` for its symbol table: the ASTs taken from the cache should
+ * only be combined with ASTs of contexts sharing it. A cache is thread-safe.
+ */
+class IncludeCache
+{
+public:
+    IncludeCache(ASTContext &context) : m_context(context) {}
+
+    ASTContext& context() { return m_context; }
+
+    /*
+     * Returns a copy of the AST of `filename`, for use in `context`; `hash` is set to the
+     * hash of its contents.
+     */
+    std::unique_ptr<AST> get(const std::string &filename, ASTContext &context, uint64_t* hash = nullptr);
+
+private:
+    IncludeCache(const IncludeCache&) = delete;
+    IncludeCache& operator=(const IncludeCache&) = delete;
+
+    struct Entry {
+        const uint64_t hash;
+        time_t modificationTime;
+        size_t size;
+        std::mutex mutex;
+        bool parsed;
+        std::shared_ptr<SourceBuffer> source;
+        // declared after the context, so the AST is destroyed before the arena holding it
+        ASTContext context;
+        std::unique_ptr<AST> ast;
+
+        Entry(uint64_t hash, const std::shared_ptr<SymbolTable> &symbols) : hash(hash), modificationTime(0), size(0), parsed(false), context(symbols) {}
+    };
+
+    ASTContext &m_context;
+    std::mutex m_mutex;
+    std::unordered_map<std::string, std::shared_ptr<Entry>> m_entries;
+};
+
+} // namespace b2
+
+#endif // __INCLUDE_CACHE_HPP_
@@ -1,3 +1,4 @@
+#include <memory>
 #include <stdexcept>
 
 #include "parser/parser.hpp"
@@ -6,11 +7,14 @@
 
 using namespace b2;
 
-Parser::Parser() : lexer(NULL)
+Parser::Parser(ASTContext &context) : context(context), lexer(NULL)
 {
 	if (syntax_lex_init(&this->lexer) != 0) {
 		throw std::runtime_error("Couldn't init lexer");
 	}
+
+	this->state.context = &context;
+	syntax_set_extra(&this->state, this->lexer);
 }
 
 Parser::~Parser()
@@ -22,38 +26,60 @@ Parser::~Parser()
 	}
 }
 
-static const char* err_message;
-
-b2::AST* Parser::parse(FILE* fd)
+b2::AST* Parser::parse(SourceBuffer &source)
 {
 	// TODO: removeme
     //syntax_set_debug(1, this->lexer);
     //syntax_debug = 1;
 
-	err_message = NULL;
+	state.ast = nullptr;
+	state.error.clear();
+
+	// allocate all nodes of this template from the context's arena
+	ASTContext::Scope scope(this->context);
 
-	syntax_set_in(fd, this->lexer);
+	if (syntax_begin_scan(source.data(), source.length(), this->lexer) != 0) {
+		throw std::runtime_error("Couldn't setup lexer buffer");
+	}
 
     if (syntax_parse(this->lexer) != 0) {
 		// TODO
 	}
 
-	if (err_message != NULL) {
-		throw SyntaxError(err_message, syntax_get_lineno(this->lexer));
+	int line_no = syntax_get_lineno(this->lexer);
+	syntax_end_scan(this->lexer);
+
+	if (!state.error.empty()) {
+		delete state.ast;
+		throw SyntaxError(state.error, line_no);
 	}
 
-    return syntax_get_extra(this->lexer);
+    return state.ast;
+}
+
+b2::AST* Parser::parse(FILE* fd)
+{
+    auto source = this->context.adopt(SourceBuffer::fromStream(fd));
+
+    return this->parse(*source);
 }
 
 b2::AST* Parser::parse(const std::string &filename)
 {
-    FileGuard file(filename.c_str(), "r");
+    auto source = this->context.adopt(SourceBuffer::fromFile(filename));
+
+    return this->parse(*source);
+}
+
+b2::AST* Parser::parse(const char* buffer, size_t length)
+{
+    auto source = this->context.adopt(SourceBuffer::fromMemory(buffer, length));
 
-    return this->parse(file.fd);
+    return this->parse(*source);
 }
 
 int syntax_error(LexPosition* position, const void* lexer, const char* message)
 {
-	err_message = strdup(message); // FIXME: this isn't thread-safe!
+	syntax_get_extra((void*) lexer)->error = message;
 	return 0;
 }
@@ -5,14 +5,16 @@
 #include <string>
 
 #include "ast/ast.hpp"
+#include "ast/context.hpp"
+#include "ast/source_buffer.hpp"
 
 namespace b2 {
 
 struct SyntaxError : std::exception {
-	SyntaxError(const char* message, const int line_no) : m_message(message), m_line_no(line_no) {}
+	SyntaxError(const std::string &message, const int line_no) : m_message(message), m_line_no(line_no) {}
 
 	virtual const char* what() const throw() {
-		return m_message;
+		return m_message.c_str();
 	}
 
 	const int line_no() const throw() {
@@ -20,20 +22,47 @@ struct SyntaxError : std::exception {
 	}
 
 private:
-	const char* m_message;
+	const std::string m_message;
 	const int m_line_no;
 };
 
+/*
+ * All state of a single parse, stored as the scanner's extra data so that
+ * separate Parser instances never share anything.
+ */
+struct ParserState {
+	b2::ASTContext* context;
+	b2::AST* ast;
+	std::string error;
+	bool eatWhitespace;
+	int braceDepth; // of the map literals open in the current tag
+
+	ParserState() : context(nullptr), ast(nullptr), eatWhitespace(false), braceDepth(0) {}
+};
+
+/*
+ * A Parser keeps no global state, so separate instances can be used concurrently
+ * from different threads. A single instance isn't thread-safe though.
+ *
+ * The source text of every parsed template is handed to `context`, as the
+ * resulting AST references its strings from there.
+ */
 class Parser {
 public:
-	Parser();
+	Parser(ASTContext &context);
 	~Parser();
 
     b2::AST* parse(FILE* fd);
     b2::AST* parse(const std::string &filename);
+    b2::AST* parse(const char* buffer, size_t length);
+    // `source` should be owned by this parser's context (see ASTContext::adopt())
+    b2::AST* parse(SourceBuffer &source);
 
 private:
+
+	ASTContext &context;
 	void* lexer;
+	ParserState state;
 };
 
 } // namespace b2
@@ -2,16 +2,24 @@
 #define __SYNTAX_H_
 
 #include <stdio.h>
+#include <vector>
 #include "ast/ast.hpp"
 #include "ast/expressions.hpp"
 #include "ast/visitors.hpp"
+#include "parser/parser.hpp"
 
-#define YY_EXTRA_TYPE b2::AST*
+#define YY_EXTRA_TYPE b2::ParserState*
 #define YYSTYPE SyntaxType
 #define YYLTYPE LexPosition
 
+// a slice of the source buffer, see SourceString
+struct TokenString {
+  const char* data;
+  size_t length;
+};
+
 union SyntaxType {
-  const char* str;
+  TokenString str;
   long l;
   double d;
   bool b;
@@ -19,7 +27,8 @@ union SyntaxType {
   b2::ExpressionList* expr_arr;
   b2::AST* ast;
   b2::ASTList* ast_arr;
-  b2::StringExpressionMap* strexpr_map;
+  b2::SymbolExpressionMap* symexpr_map;
+  std::vector<b2::Symbol>* sym_arr;
 };
 
 struct LexPosition
@@ -35,9 +44,10 @@ extern int syntax_error(LexPosition*, const void* scanner, const char *s);
 extern int syntax_lex(SyntaxType*, LexPosition*, void* scanner);
 extern int syntax_lex_destroy(void* scanner);
 extern int syntax_lex_init(void** scanner_ptr);
-extern b2::AST* syntax_get_extra(void* scanner);
-extern void syntax_set_extra(b2::AST*, void* scanner);
-extern void syntax_set_in(FILE* file, void* scanner);
+extern b2::ParserState* syntax_get_extra(void* scanner);
+extern void syntax_set_extra(b2::ParserState*, void* scanner);
+extern int syntax_begin_scan(char* buffer, size_t length, void* scanner);
+extern void syntax_end_scan(void* scanner);
 extern int syntax_get_lineno(void* scanner);
 
 extern void syntax_set_debug(int bdebug, void* scanner);
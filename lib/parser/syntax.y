@@ -1,4 +1,6 @@
 %{
+  #include <algorithm>
+
   #include "ast/visitors.hpp"
   #include "parser/syntax.hpp"
 
@@ -22,6 +24,24 @@
 
   static inline AST* from_statements_array(ASTList *list)
   {
+    // the statements following a set block make up its body
+    for (auto it = list->begin(); it != list->end(); ++it) {
+      if ((*it)->type() != SetBlockASTType) {
+        continue;
+      }
+
+      auto set_block = static_cast<SetBlockAST*>(it->get());
+      auto body = new ASTList();
+      body->splice(body->end(), *list, std::next(it), list->end());
+      if (body->empty()) {
+        delete body;
+        set_block->body.reset(new StatementsAST());
+      } else {
+        set_block->body.reset(from_statements_array(body));
+      }
+      break;
+    }
+
     if (list->size() == 1) {
       AST* ast = list->front().release();
       delete list;
@@ -45,16 +65,67 @@
     }
   }
 
-  static inline void add_to_stringexprmap(StringExpressionMap* map, const char* value)
+  static inline SourceString to_string(const TokenString& token)
+  {
+    return SourceString::slice(token.data, token.length);
+  }
+
+  static inline IncludeBlockAST* new_include_block(Expression* name, Expression* scope)
+  {
+    if (name->type() != StringLiteralExpressionType) {
+      // resolved at render time
+      return new IncludeBlockAST(name, scope);
+    }
+
+    auto include = new IncludeBlockAST(std::move(static_cast<StringLiteralExpression*>(name)->value), scope);
+    delete name;
+    return include;
+  }
+
+  static inline Symbol to_symbol(void* scanner, const TokenString& token)
   {
-    (*map)[value] = std::move(std::unique_ptr<Expression>(new VariableReferenceExpression(value)));
-    // don't free `value`, it is now owned by the above created VariableReferenceExpression
+    return syntax_get_extra(scanner)->context->symbols().intern(token.data, token.length);
   }
 
-  static inline void add_to_stringexprmap(StringExpressionMap* map, const char* key, Expression* value)
+  static inline void add_to_symbolexprmap(void* scanner, SymbolExpressionMap* map, const TokenString& value)
   {
-    (*map)[key] = std::move(std::unique_ptr<Expression>(value));
-    free((void*) key);
+    Symbol symbol = to_symbol(scanner, value);
+    (*map)[symbol] = std::move(std::unique_ptr<Expression>(new VariableReferenceExpression(symbol)));
+  }
+
+  static inline void add_to_symbolexprmap(void* scanner, SymbolExpressionMap* map, const TokenString& key, Expression* value)
+  {
+    (*map)[to_symbol(scanner, key)] = std::move(std::unique_ptr<Expression>(value));
+  }
+
+  static inline bool is_duplicate_key(Expression* map, Expression* key)
+  {
+    for (auto &other : *static_cast<ArrayLiteralExpression*>(map)->keys) {
+      if (other->type() != key->type()) {
+        continue;
+      }
+
+      if (key->type() == IntegerLiteralExpressionType) {
+        if (static_cast<IntegerLiteralExpression*>(other.get())->value == static_cast<IntegerLiteralExpression*>(key)->value) {
+          return true;
+        }
+      } else {
+        auto &a = static_cast<StringLiteralExpression*>(other.get())->value;
+        auto &b = static_cast<StringLiteralExpression*>(key)->value;
+        if (a.length() == b.length() && memcmp(a.data(), b.data(), a.length()) == 0) {
+          return true;
+        }
+      }
+    }
+
+    return false;
+  }
+
+  static inline void add_to_map_literal(Expression* map, Expression* key, Expression* value)
+  {
+    auto literal = static_cast<ArrayLiteralExpression*>(map);
+    literal->keys->push_back(std::unique_ptr<Expression>(key));
+    literal->values->push_back(std::unique_ptr<Expression>(value));
   }
 
   #define ASSERT_THAT(cond, msg) if (!(cond)) { yyerror(&yyloc, scanner, YY_(msg)); YYERROR; }
@@ -77,43 +148,48 @@
 %token<str> T_RAW
 %token T_VARIABLE_START T_VARIABLE_END T_BLOCK_START T_BLOCK_END
 %token T_KW_IF T_KW_ELSEIF T_KW_ELSE T_KW_ENDIF T_KW_FOR T_KW_ENDFOR T_KW_IN T_KW_INCLUDE T_KW_WITH T_KW_USING
+%token T_KW_EXTENDS T_KW_BLOCK T_KW_ENDBLOCK T_KW_FRAGMENT T_KW_ENDFRAGMENT T_KW_MACRO T_KW_ENDMACRO T_KW_SET
+%token T_KW_CACHE T_KW_ENDCACHE
 
 %token<str> T_IDENTIFIER T_STRING_LITERAL
 %token<b> T_BOOLEAN_LITERAL
 %token<d> T_DOUBLE_LITERAL
 %token<l> T_INTEGER_LITERAL
 
-%destructor { free((void*)$$); } <str>
-
-%token T_EQ T_NEQ T_GT T_GE T_LT T_LE T_AND T_OR T_NOT T_PLUS T_MINUS T_MUL T_DIV T_MOD T_OPEN_PAREN T_CLOSE_PAREN T_ATTRIBUTE_SEPARATOR T_COMMA T_ASSIGN
+%token T_EQ T_NEQ T_GT T_GE T_LT T_LE T_AND T_OR T_NOT T_PLUS T_MINUS T_MUL T_DIV T_MOD T_CONCAT T_OPEN_PAREN T_CLOSE_PAREN T_ATTRIBUTE_SEPARATOR T_COMMA T_ASSIGN
+%token T_OPEN_BRACKET T_CLOSE_BRACKET T_OPEN_BRACE T_CLOSE_BRACE T_COLON
 
 %right T_OR
 %right T_AND
 %right T_EQ T_NEQ
 %right T_GT T_LT T_GE T_LE
+%left T_CONCAT
 %left T_PLUS T_MINUS
 %left T_MUL T_DIV T_MOD
 %left UMINUS UPLUS
 %left T_NOT
 
-%type<expr> expression var_ref_expression
+%type<expr> expression var_ref_expression iterable_expression array_literal_expression map_elements map_key
 %type<expr_arr> arguments
 %destructor { delete $$; } <expr>
 %destructor { delete $$; } <expr_arr>
 
-%type<ast> statement print_block if_block else_block elseif_blocks for_statement elsefor_statement include_block
+%type<ast> statement print_block if_block else_block elseif_blocks for_statement elsefor_statement include_block extends_block named_block macro_definition set_block cache_block
 %type<ast_arr> statements raw_blocks
 %destructor { delete $$; } <ast>
 %destructor { delete $$; } <ast_arr>
 
-%type<strexpr_map> include_variable_mapping
-%destructor { delete $$; } <strexpr_map>
+%type<symexpr_map> include_variable_mapping
+%destructor { delete $$; } <symexpr_map>
+
+%type<sym_arr> macro_parameters macro_parameter_list
+%destructor { delete $$; } <sym_arr>
 
 %%
 
 root
-  : %empty { syntax_set_extra(new StatementsAST(), scanner); }
-  | statements { syntax_set_extra(from_statements_array($1), scanner); }
+  : %empty { syntax_get_extra(scanner)->ast = new StatementsAST(); }
+  | statements { syntax_get_extra(scanner)->ast = from_statements_array($1); }
 ;
 
 statements
@@ -133,16 +209,21 @@ statement
   | if_block
   | for_statement
   | include_block
+  | extends_block
+  | named_block
+  | macro_definition
+  | set_block
+  | cache_block
 ;
 
 raw_blocks
   : T_RAW {
       $$ = new ASTList();
-      std::unique_ptr<AST> ast(new RawBlockAST($1));
+      std::unique_ptr<AST> ast(new RawBlockAST(to_string($1)));
       $$->push_back(std::move(ast));
     }
   | raw_blocks T_RAW {
-      std::unique_ptr<AST> ast(new RawBlockAST($2));
+      std::unique_ptr<AST> ast(new RawBlockAST(to_string($2)));
       $1->push_back(std::move(ast));
       $$ = $1;
     }
@@ -181,7 +262,12 @@ elseif_blocks
     {
       AST* elif = new IfBlockAST($cond, from_statements_array($body));
       if ($prev_elif) {
-        static_cast<IfBlockAST*>($prev_elif)->elseBody.reset(elif);
+        // append to the end of the chain
+        IfBlockAST* last_elif = static_cast<IfBlockAST*>($prev_elif);
+        while (last_elif->elseBody) {
+          last_elif = static_cast<IfBlockAST*>(last_elif->elseBody.get());
+        }
+        last_elif->elseBody.reset(elif);
         $$ = $prev_elif;
       } else {
         $$ = elif;
@@ -199,7 +285,7 @@ else_block
 
 for_statement
   :
-    T_BLOCK_START T_KW_FOR var_ref_expression[value] T_KW_IN var_ref_expression[iterable] T_BLOCK_END
+    T_BLOCK_START T_KW_FOR var_ref_expression[value] T_KW_IN iterable_expression[iterable] T_BLOCK_END
     statements[body]
     T_BLOCK_START
     elsefor_statement[elseBody]
@@ -208,13 +294,13 @@ for_statement
       $$ = new ForBlockAST(
         NULL,
         static_cast<VariableReferenceExpression*>($value),
-        static_cast<VariableReferenceExpression*>($iterable),
+        $iterable,
         from_statements_array($body),
         $elseBody
       );
     }
   |
-    T_BLOCK_START T_KW_FOR var_ref_expression[key] T_COMMA var_ref_expression[value] T_KW_IN var_ref_expression[iterable] T_BLOCK_END
+    T_BLOCK_START T_KW_FOR var_ref_expression[key] T_COMMA var_ref_expression[value] T_KW_IN iterable_expression[iterable] T_BLOCK_END
     statements[body]
     T_BLOCK_START
     elsefor_statement[elseBody]
@@ -223,7 +309,7 @@ for_statement
       $$ = new ForBlockAST(
         static_cast<VariableReferenceExpression*>($key),
         static_cast<VariableReferenceExpression*>($value),
-        static_cast<VariableReferenceExpression*>($iterable),
+        $iterable,
         from_statements_array($body),
         $elseBody
       );
@@ -241,33 +327,154 @@ elsefor_statement
 ;
 
 include_block
-  : T_BLOCK_START T_KW_INCLUDE T_STRING_LITERAL[templateName] T_BLOCK_END
+  : T_BLOCK_START T_KW_INCLUDE expression[templateName] T_BLOCK_END
     {
-      $$ = new IncludeBlockAST($templateName);
+      $$ = new_include_block($templateName, nullptr);
     }
-  | T_BLOCK_START T_KW_INCLUDE T_STRING_LITERAL[templateName] T_KW_USING expression[scope] T_BLOCK_END
+  | T_BLOCK_START T_KW_INCLUDE expression[templateName] T_KW_USING expression[scope] T_BLOCK_END
     {
       ASSERT_MAP($scope);
-      $$ = new IncludeBlockAST($templateName, $scope);
+      $$ = new_include_block($templateName, $scope);
     }
-  | T_BLOCK_START T_KW_INCLUDE T_STRING_LITERAL[templateName] T_KW_WITH include_variable_mapping[varMapping] T_BLOCK_END
+  | T_BLOCK_START T_KW_INCLUDE expression[templateName] T_KW_WITH include_variable_mapping[varMapping] T_BLOCK_END
     {
-      $$ = new IncludeBlockAST($templateName);
+      $$ = new_include_block($templateName, nullptr);
       static_cast<IncludeBlockAST*>($$)->variableMapping = std::move(*$varMapping);
       delete $varMapping;
     }
 ;
 
+extends_block
+  : T_BLOCK_START T_KW_EXTENDS T_STRING_LITERAL[templateName] T_BLOCK_END
+    {
+      $$ = new ExtendsBlockAST(to_string($templateName));
+    }
+;
+
+named_block
+  : T_BLOCK_START T_KW_BLOCK T_IDENTIFIER[name] T_BLOCK_END
+    statements[body]
+    T_BLOCK_START T_KW_ENDBLOCK T_BLOCK_END
+    {
+      $$ = new NamedBlockAST(to_symbol(scanner, $name), from_statements_array($body));
+    }
+  | T_BLOCK_START T_KW_BLOCK T_IDENTIFIER[name] T_BLOCK_END
+    T_BLOCK_START T_KW_ENDBLOCK T_BLOCK_END
+    {
+      $$ = new NamedBlockAST(to_symbol(scanner, $name), new StatementsAST());
+    }
+  | T_BLOCK_START T_KW_FRAGMENT T_IDENTIFIER[name] T_BLOCK_END
+    statements[body]
+    T_BLOCK_START T_KW_ENDFRAGMENT T_BLOCK_END
+    {
+      $$ = new NamedBlockAST(to_symbol(scanner, $name), from_statements_array($body), true);
+    }
+  | T_BLOCK_START T_KW_FRAGMENT T_IDENTIFIER[name] T_BLOCK_END
+    T_BLOCK_START T_KW_ENDFRAGMENT T_BLOCK_END
+    {
+      $$ = new NamedBlockAST(to_symbol(scanner, $name), new StatementsAST(), true);
+    }
+;
+
+macro_definition
+  : T_BLOCK_START T_KW_MACRO T_IDENTIFIER[name] T_OPEN_PAREN macro_parameters[params] T_CLOSE_PAREN T_BLOCK_END
+    statements[body]
+    T_BLOCK_START T_KW_ENDMACRO T_BLOCK_END
+    {
+      $$ = new MacroDefinitionAST(to_symbol(scanner, $name), std::move(*$params), from_statements_array($body));
+      delete $params;
+    }
+  | T_BLOCK_START T_KW_MACRO T_IDENTIFIER[name] T_OPEN_PAREN macro_parameters[params] T_CLOSE_PAREN T_BLOCK_END
+    T_BLOCK_START T_KW_ENDMACRO T_BLOCK_END
+    {
+      $$ = new MacroDefinitionAST(to_symbol(scanner, $name), std::move(*$params), new StatementsAST());
+      delete $params;
+    }
+;
+
+macro_parameters
+  : %empty { $$ = new std::vector<Symbol>(); }
+  | macro_parameter_list
+;
+
+macro_parameter_list
+  : T_IDENTIFIER[param] { $$ = new std::vector<Symbol>(1, to_symbol(scanner, $param)); }
+  | macro_parameter_list[params] T_COMMA T_IDENTIFIER[param]
+    {
+      Symbol symbol = to_symbol(scanner, $param);
+      ASSERT_THAT(std::find($params->begin(), $params->end(), symbol) == $params->end(), "duplicate macro parameter");
+      $params->push_back(symbol);
+      $$ = $params;
+    }
+;
+
+set_block
+  : T_BLOCK_START T_KW_SET T_IDENTIFIER[name] T_ASSIGN expression[value] T_BLOCK_END
+    {
+      // its body gets filled in by from_statements_array()
+      $$ = new SetBlockAST(to_symbol(scanner, $name), $value);
+    }
+;
+
+cache_block
+  : T_BLOCK_START T_KW_CACHE expression[key] T_INTEGER_LITERAL[ttl] T_BLOCK_END
+    statements[body]
+    T_BLOCK_START T_KW_ENDCACHE T_BLOCK_END
+    {
+      $$ = new CacheBlockAST($key, $ttl, from_statements_array($body));
+    }
+  | T_BLOCK_START T_KW_CACHE expression[key] T_INTEGER_LITERAL[ttl] T_BLOCK_END
+    T_BLOCK_START T_KW_ENDCACHE T_BLOCK_END
+    {
+      $$ = new CacheBlockAST($key, $ttl, new StatementsAST());
+    }
+;
+
 include_variable_mapping
-  : T_IDENTIFIER[val] { $$ = new StringExpressionMap(); add_to_stringexprmap($$, $val); }
-  | T_IDENTIFIER[key] T_ASSIGN expression[val] { $$ = new StringExpressionMap(); add_to_stringexprmap($$, $key, $val); }
-  | include_variable_mapping[mapping] T_COMMA T_IDENTIFIER[val] { $$ = $mapping; add_to_stringexprmap($$, $val); }
-  | include_variable_mapping[mapping] T_COMMA T_IDENTIFIER[key] T_ASSIGN expression[val] { $$ = $mapping; add_to_stringexprmap($$, $key, $val); }
+  : T_IDENTIFIER[val] { $$ = new SymbolExpressionMap(); add_to_symbolexprmap(scanner, $$, $val); }
+  | T_IDENTIFIER[key] T_ASSIGN expression[val] { $$ = new SymbolExpressionMap(); add_to_symbolexprmap(scanner, $$, $key, $val); }
+  | include_variable_mapping[mapping] T_COMMA T_IDENTIFIER[val] { $$ = $mapping; add_to_symbolexprmap(scanner, $$, $val); }
+  | include_variable_mapping[mapping] T_COMMA T_IDENTIFIER[key] T_ASSIGN expression[val] { $$ = $mapping; add_to_symbolexprmap(scanner, $$, $key, $val); }
 ;
 
 var_ref_expression
-  : T_IDENTIFIER { $$ = new VariableReferenceExpression($1); }
-  | var_ref_expression[variable] T_ATTRIBUTE_SEPARATOR T_IDENTIFIER[attribute] { $$ = new GetAttributeExpression($variable, $attribute); }
+  : T_IDENTIFIER { $$ = new VariableReferenceExpression(to_symbol(scanner, $1)); }
+  | var_ref_expression[variable] T_ATTRIBUTE_SEPARATOR T_IDENTIFIER[attribute] { $$ = new GetAttributeExpression($variable, to_symbol(scanner, $attribute)); }
+;
+
+iterable_expression
+  : var_ref_expression
+  | array_literal_expression
+;
+
+array_literal_expression
+  : T_OPEN_BRACKET T_CLOSE_BRACKET { $$ = new ArrayLiteralExpression(nullptr, new ExpressionList()); }
+  | T_OPEN_BRACKET arguments[values] T_CLOSE_BRACKET { $$ = new ArrayLiteralExpression(nullptr, $values); }
+  | T_OPEN_BRACE T_CLOSE_BRACE { $$ = new ArrayLiteralExpression(new ExpressionList(), new ExpressionList()); }
+  | T_OPEN_BRACE map_elements[elements] T_CLOSE_BRACE { $$ = $elements; }
+;
+
+map_elements
+  : map_key[key] T_COLON expression[value] {
+      $$ = new ArrayLiteralExpression(new ExpressionList(), new ExpressionList());
+      add_to_map_literal($$, $key, $value);
+    }
+  | map_elements[other] T_COMMA map_key[key] T_COLON expression[value] {
+      if (is_duplicate_key($other, $key)) {
+        delete $other;
+        delete $key;
+        delete $value;
+        ASSERT_THAT(false, "duplicate key in map literal");
+      }
+      add_to_map_literal($other, $key, $value);
+      $$ = $other;
+    }
+;
+
+map_key
+  : T_IDENTIFIER { $$ = new StringLiteralExpression(to_string($1)); }
+  | T_STRING_LITERAL { $$ = new StringLiteralExpression(to_string($1)); }
+  | T_INTEGER_LITERAL { $$ = new IntegerLiteralExpression($1); }
 ;
 
 arguments
@@ -285,7 +492,7 @@ arguments
 
 expression
   : var_ref_expression
-  | T_STRING_LITERAL { $$ = new StringLiteralExpression($1); }
+  | T_STRING_LITERAL { $$ = new StringLiteralExpression(to_string($1)); }
   | T_DOUBLE_LITERAL { $$ = new DoubleLiteralExpression($1); }
   | T_INTEGER_LITERAL { $$ = new IntegerLiteralExpression($1); }
   | T_BOOLEAN_LITERAL { $$ = new BooleanLiteralExpression($1); }
@@ -296,6 +503,7 @@ expression
   | expression T_MUL expression { ASSERT_NUMERIC($1); ASSERT_NUMERIC($3); $$ = new BinaryOperationExpression($1, $3, '*'); }
   | expression T_DIV expression { ASSERT_NUMERIC($1); ASSERT_NUMERIC($3); $$ = new BinaryOperationExpression($1, $3, '/'); }
   | expression T_MOD expression { ASSERT_NUMERIC($1); ASSERT_NUMERIC($3); $$ = new BinaryOperationExpression($1, $3, '%'); }
+  | expression T_CONCAT expression { $$ = new BinaryOperationExpression($1, $3, '~'); }
   | expression T_EQ expression { $$ = new ComparisonExpression($1, $3, "=="); }
   | expression T_NEQ expression { $$ = new ComparisonExpression($1, $3, "!="); }
   | expression T_GT expression { ASSERT_NUMERIC($1); ASSERT_NUMERIC($3); $$ = new ComparisonExpression($1, $3, ">"); }
@@ -306,5 +514,7 @@ expression
   | expression T_AND expression { ASSERT_BOOLEAN($1); ASSERT_BOOLEAN($3); $$ = new ComparisonExpression($1, $3, "&&"); }
   | T_NOT expression { ASSERT_BOOLEAN($2); $$ = new UnaryOperationExpression($2, '!'); }
   | T_OPEN_PAREN expression T_CLOSE_PAREN { $$ = $2; }
-  | T_IDENTIFIER[method] T_OPEN_PAREN arguments[args] T_CLOSE_PAREN { $$ = new MethodCallExpression($method, $args); }
+  | array_literal_expression
+  | T_IDENTIFIER[method] T_OPEN_PAREN T_CLOSE_PAREN { $$ = new MethodCallExpression(to_symbol(scanner, $method), new ExpressionList()); }
+  | T_IDENTIFIER[method] T_OPEN_PAREN arguments[args] T_CLOSE_PAREN { $$ = new MethodCallExpression(to_symbol(scanner, $method), $args); }
 ;
@@ -0,0 +1,100 @@
+#ifndef __THREAD_POOL_HPP_
+#define __THREAD_POOL_HPP_
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace b2 {
+
+/*
+ * A fixed-size pool of worker threads.
+ *
+ * Workers are only spawned when the first task is enqueued, so an unused pool is
+ * (almost) free. Tasks which haven't started yet when the pool gets destroyed are
+ * dropped; their futures will report a broken promise.
+ */
+class ThreadPool
+{
+public:
+    static size_t defaultThreadCount() {
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    explicit ThreadPool(size_t threadCount = defaultThreadCount()) : m_threadCount(threadCount), m_stopping(false) {}
+
+    ~ThreadPool() {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_stopping = true;
+            m_tasks.clear();
+        }
+        m_condition.notify_all();
+
+        for (auto &worker : m_workers) {
+            worker.join();
+        }
+    }
+
+    size_t threadCount() const { return m_threadCount; }
+
+    template<typename F>
+    std::future<typename std::result_of<F()>::type> enqueue(F&& func) {
+        typedef typename std::result_of<F()>::type Result;
+
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(func));
+        auto future = task->get_future();
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (m_workers.empty()) {
+                for (size_t i = 0; i < m_threadCount; i++) {
+                    m_workers.emplace_back([this]() { this->work(); });
+                }
+            }
+            m_tasks.emplace_back([task]() { (*task)(); });
+        }
+        m_condition.notify_one();
+
+        return future;
+    }
+
+private:
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void work() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_condition.wait(lock, [this]() { return m_stopping || !m_tasks.empty(); });
+                if (m_stopping) {
+                    return;
+                }
+
+                task = std::move(m_tasks.front());
+                m_tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    const size_t m_threadCount;
+    bool m_stopping;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::deque<std::function<void()>> m_tasks;
+    std::vector<std::thread> m_workers;
+};
+
+} // namespace b2
+
+#endif // __THREAD_POOL_HPP_
@@ -1,6 +1,7 @@
 #ifndef __UTILS_HPP_
 #define __UTILS_HPP_
 
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -25,6 +26,19 @@ std::unique_ptr<T, decltype(&free_deleter<T>)> make_unique_ptr_with_free_deleter
 template<typename T>
 using unique_ptr_with_free_deleter = std::unique_ptr<T, decltype(&free_deleter<T>)>;
 
+/*
+ * FNV-1a hash of `length` bytes at `data`.
+ */
+inline uint64_t hashBytes(const char* data, size_t length)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char) data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
 struct FileGuard {
     FILE* fd;
 
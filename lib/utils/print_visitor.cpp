@@ -1,9 +1,30 @@
 #include "print_visitor.hpp"
 
 #include <map>
+#include <string>
 
 using namespace b2;
 
+/*
+ * Returns the type annotation to print for an expression of type `type`: nothing for a
+ * variant, as that's what a variable or method call holds unless its type got inferred.
+ */
+static std::string typeAnnotation(ExpressionValueType type)
+{
+	switch (type) {
+		case DoubleType:
+			return " type=float";
+		case IntegerType:
+			return " type=int";
+		case BooleanType:
+			return " type=bool";
+		case StringType:
+			return " type=string";
+		default:
+			return "";
+	}
+}
+
 void PrintVisitor::visit(AST* ast)
 {
 	m_output << indentation() << "[SOF]" << std::endl;
@@ -26,7 +47,7 @@ void PrintVisitor::statements(StatementsAST* ast)
 
 void PrintVisitor::raw(RawBlockAST* ast)
 {
-	m_output << indentation() << "[RAW] \"" << escape(ast->text.get()) << "\"" << std::endl;
+	m_output << indentation() << "[RAW] \"" << escape(ast->text) << "\"" << std::endl;
 }
 
 void PrintVisitor::print_block(PrintBlockAST* ast)
@@ -93,7 +114,13 @@ void PrintVisitor::for_block(ForBlockAST* ast)
 
 void PrintVisitor::include_block(IncludeBlockAST *ast)
 {
-	m_output << indentation() << "[INCLUDE_BLOCK includeName=\"" << ast->includeName.get() << "\"";
+	m_output << indentation() << "[INCLUDE_BLOCK ";
+    if (ast->nameExpression) {
+		m_output << "includeExpression=";
+        this->expression(ast->nameExpression.get());
+    } else {
+		m_output << "includeName=\"" << ast->includeName.str() << "\"";
+    }
     if (ast->scope) {
 		m_output << " scope=";
         this->expression(ast->scope.get());
@@ -101,7 +128,7 @@ void PrintVisitor::include_block(IncludeBlockAST *ast)
     if (ast->variableMapping.size() > 0) {
 		std::map<std::string, Expression*> sortedMapping;
 		for (auto &it : ast->variableMapping) {
-			sortedMapping[it.first] = it.second.get();
+			sortedMapping[it.first.str()] = it.second.get();
 		}
 
 		m_output << " variableMapping={";
@@ -116,23 +143,171 @@ void PrintVisitor::include_block(IncludeBlockAST *ast)
 		m_output << "}";
     }
 	m_output << "]" << std::endl;
+
+    if (ast->body) {
+        m_indentation++;
+        this->ast(ast->body.get());
+        m_indentation--;
+		m_output << indentation() << "[END_INCLUDE_BLOCK]" << std::endl;
+    }
+}
+
+void PrintVisitor::extends_block(ExtendsBlockAST *ast)
+{
+	m_output << indentation() << "[EXTENDS_BLOCK templateName=\"" << ast->templateName.str() << "\"]" << std::endl;
+}
+
+void PrintVisitor::named_block(NamedBlockAST *ast)
+{
+	m_output << indentation() << (ast->isFragment ? "[FRAGMENT" : "[BLOCK") << " name=\"" << ast->name.str() << "\"]" << std::endl;
+
+    if (ast->body) {
+        m_indentation++;
+        this->ast(ast->body.get());
+        m_indentation--;
+    }
+
+	m_output << indentation() << (ast->isFragment ? "[ENDFRAGMENT]" : "[ENDBLOCK]") << std::endl;
+}
+
+void PrintVisitor::macro_definition(MacroDefinitionAST *ast)
+{
+	m_output << indentation() << "[MACRO name=\"" << ast->name.str() << "\" parameters=[";
+    for (auto iter = ast->parameters.begin(); iter != ast->parameters.end(); ++iter) {
+        if (iter != ast->parameters.begin()) {
+			m_output << ", ";
+        }
+		m_output << "\"" << iter->str() << "\"";
+    }
+	m_output << "]]" << std::endl;
+
+    if (ast->body) {
+        m_indentation++;
+        this->ast(ast->body.get());
+        m_indentation--;
+    }
+
+	m_output << indentation() << "[ENDMACRO]" << std::endl;
+}
+
+void PrintVisitor::macro_call(MacroCallAST *ast)
+{
+	m_output << indentation() << "[MACRO_CALL name=\"" << ast->name.str() << "\" args=[";
+    auto arguments = ast->arguments.get();
+    for (auto iter = arguments->begin(); iter != arguments->end(); ++iter) {
+        if (iter != arguments->begin()) {
+			m_output << ", ";
+        }
+        this->expression(iter->get());
+    }
+	m_output << "]]" << std::endl;
+
+    if (ast->body) {
+        m_indentation++;
+        this->ast(ast->body.get());
+        m_indentation--;
+		m_output << indentation() << "[END_MACRO_CALL]" << std::endl;
+    }
+}
+
+void PrintVisitor::set_block(SetBlockAST *ast)
+{
+	m_output << indentation() << "[SET name=\"" << ast->name.str() << "\" value=";
+    this->expression(ast->value.get());
+	m_output << "]" << std::endl;
+
+    if (ast->body) {
+        m_indentation++;
+        this->ast(ast->body.get());
+        m_indentation--;
+    }
+
+	m_output << indentation() << "[ENDSET]" << std::endl;
+}
+
+void PrintVisitor::capture_block(CaptureBlockAST *ast)
+{
+	m_output << indentation() << "[CAPTURE name=\"" << ast->name.str() << "\"]" << std::endl;
+
+    if (ast->capture) {
+        m_indentation++;
+        this->ast(ast->capture.get());
+        m_indentation--;
+    }
+	m_output << indentation() << "[IN_CAPTURE]" << std::endl;
+    if (ast->body) {
+        m_indentation++;
+        this->ast(ast->body.get());
+        m_indentation--;
+    }
+
+	m_output << indentation() << "[ENDCAPTURE]" << std::endl;
+}
+
+void PrintVisitor::switch_block(SwitchBlockAST *ast)
+{
+	m_output << indentation() << "[SWITCH_BLOCK ";
+    this->expression(ast->expr.get());
+	m_output << "]" << std::endl;
+
+    m_indentation++;
+    for (auto &caseBlock : ast->cases) {
+        this->ast(caseBlock.get());
+    }
+    m_indentation--;
+    if (ast->elseBody) {
+		m_output << indentation() << "[ELSE_BLOCK]" << std::endl;
+        m_indentation++;
+        this->ast(ast->elseBody.get());
+        m_indentation--;
+    }
+
+	m_output << indentation() << "[ENDSWITCH_BLOCK]" << std::endl;
+}
+
+void PrintVisitor::case_block(CaseBlockAST *ast)
+{
+	m_output << indentation() << "[CASE ";
+    this->expression(ast->value.get());
+	m_output << "]" << std::endl;
+
+    if (ast->body) {
+        m_indentation++;
+        this->ast(ast->body.get());
+        m_indentation--;
+    }
+}
+
+void PrintVisitor::cache_block(CacheBlockAST *ast)
+{
+	m_output << indentation() << "[CACHE_BLOCK key=";
+    this->expression(ast->key.get());
+	m_output << " ttl=" << ast->ttl << "]" << std::endl;
+
+    if (ast->body) {
+        m_indentation++;
+        this->ast(ast->body.get());
+        m_indentation--;
+    }
+
+	m_output << indentation() << "[ENDCACHE_BLOCK]" << std::endl;
 }
 
 void PrintVisitor::variable_reference_expression(VariableReferenceExpression *expr)
 {
-	m_output << "{VARIABLE name=\"" << expr->variableName.get() << "\"}";
+	m_output << "{VARIABLE name=\"" << expr->variableName.str() << "\"" << typeAnnotation(expr->valueType()) << "}";
 }
 
 void PrintVisitor::get_attribute_expression(GetAttributeExpression *expr)
 {
 	m_output << "{GET_ATTRIBUTE variable=";
     this->expression(expr->variable.get());
-	m_output << " attributeName=\"" << expr->attributeName.get() << "\"}";
+	m_output << " attributeName=\"" << expr->attributeName.str() << "\"}";
 }
 
 void PrintVisitor::method_call_expression(MethodCallExpression *expr)
 {
-	m_output << "{METHOD_CALL name=\"" << expr->methodName.get() << "\", args=[";
+	m_output << "{METHOD_CALL name=\"" << expr->methodName.str() << "\", args=[";
     auto arguments = expr->arguments.get();
     for (auto iter = arguments->begin(); iter != arguments->end(); ++iter) {
         if (iter != arguments->begin()) {
@@ -140,7 +315,7 @@ void PrintVisitor::method_call_expression(MethodCallExpression *expr)
         }
         this->expression(iter->get());
     }
-	m_output << "]}";
+	m_output << "]" << typeAnnotation(expr->valueType()) << "}";
 }
 
 void PrintVisitor::double_literal_expression(DoubleLiteralExpression *expr)
@@ -160,7 +335,7 @@ void PrintVisitor::boolean_literal_expression(BooleanLiteralExpression *expr)
 
 void PrintVisitor::string_literal_expression(StringLiteralExpression *expr)
 {
-	m_output << "{STRING value=\"" << escape(expr->value.get()) << "\"}";
+	m_output << "{STRING value=\"" << escape(expr->value) << "\"}";
 }
 
 void PrintVisitor::binary_operation_expression(BinaryOperationExpression *expr)
@@ -194,3 +369,20 @@ void PrintVisitor::comparison_expression(ComparisonExpression *expr)
 	}
 	m_output << "\"}";
 }
+
+void PrintVisitor::array_literal_expression(ArrayLiteralExpression *expr)
+{
+	m_output << "{ARRAY elements=[";
+	auto key = expr->isMap() ? expr->keys->begin() : ExpressionList::iterator();
+	for (auto value = expr->values->begin(); value != expr->values->end(); ++value) {
+		if (value != expr->values->begin()) {
+			m_output << ", ";
+		}
+		if (expr->isMap()) {
+			this->expression((key++)->get());
+			m_output << ": ";
+		}
+		this->expression(value->get());
+	}
+	m_output << "]}";
+}
@@ -21,6 +21,15 @@ private:
     virtual void if_block(IfBlockAST* ast) override;
     virtual void for_block(ForBlockAST* ast) override;
     virtual void include_block(IncludeBlockAST* ast) override;
+    virtual void extends_block(ExtendsBlockAST* ast) override;
+    virtual void named_block(NamedBlockAST* ast) override;
+    virtual void macro_definition(MacroDefinitionAST* ast) override;
+    virtual void macro_call(MacroCallAST* ast) override;
+    virtual void set_block(SetBlockAST* ast) override;
+    virtual void capture_block(CaptureBlockAST* ast) override;
+    virtual void switch_block(SwitchBlockAST* ast) override;
+    virtual void case_block(CaseBlockAST* ast) override;
+    virtual void cache_block(CacheBlockAST* ast) override;
 
     virtual void variable_reference_expression(VariableReferenceExpression *expr) override;
     virtual void get_attribute_expression(GetAttributeExpression* expr) override;
@@ -32,13 +41,14 @@ private:
     virtual void binary_operation_expression(BinaryOperationExpression *expr) override;
     virtual void unary_operation_expression(UnaryOperationExpression *expr) override;
     virtual void comparison_expression(ComparisonExpression *expr) override;
+    virtual void array_literal_expression(ArrayLiteralExpression *expr) override;
 
 	inline const std::string indentation() {
 		return std::string(m_indentation, '\t');
 	}
 
-	inline std::string escape(const char* raw) {
-		std::string text(raw);
+	inline std::string escape(const SourceString& raw) {
+		std::string text = raw.str();
 		return escape(text);
 	}
 
@@ -3,15 +3,29 @@
 
 #include <libgen.h>
 #include <getopt.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
 
 #include "parser/parser.hpp"
 #include "utils/print_visitor.hpp"
 
 #include "ast/passes/coalesce_rawblocks_pass.hpp"
 #include "ast/passes/convert_literal_printblock_to_rawblock_pass.hpp"
+#include "ast/passes/eliminate_dead_branches_pass.hpp"
+#include "ast/passes/extract_fragments_pass.hpp"
 #include "ast/passes/fold_constant_expressions_pass.hpp"
+#include "ast/passes/hoist_lookups_pass.hpp"
+#include "ast/passes/infer_types_pass.hpp"
+#include "ast/passes/lower_if_chains_to_switch_pass.hpp"
+#include "ast/passes/memoize_loop_invariant_output_pass.hpp"
 #include "ast/passes/pass_manager.hpp"
 #include "ast/passes/resolve_includes_pass.hpp"
+#include "ast/passes/resolve_inheritance_pass.hpp"
+#include "ast/passes/resolve_macros_pass.hpp"
+#include "ast/passes/substitute_constants_pass.hpp"
 
 using namespace b2;
 
@@ -22,9 +36,9 @@ static void printAST(AST* ast)
     visitor.visit(ast);
 }
 
-static AST* parseAST(const std::string &path)
+static AST* parseAST(ASTContext &context, const std::string &path)
 {
-	Parser parser;
+	Parser parser(context);
 
     try {
         return parser.parse(path);
@@ -34,37 +48,203 @@ static AST* parseAST(const std::string &path)
     }
 }
 
+static int enable_resolve_inheritance_pass = 1;
 static int enable_resolve_includes_pass = 1;
+static int enable_extract_fragments_pass = 1;
+static int enable_resolve_macros_pass = 1;
+static int enable_constant_substitution_pass = 1;
 static int enable_constant_folding_pass = 1;
+static int enable_dead_branch_elimination_pass = 1;
+static int enable_if_chain_to_switch_pass = 1;
+static int enable_hoist_lookups_pass = 1;
+static int enable_type_inference_pass = 1;
 static int enable_literal_print_block_to_raw_block_conversion_pass = 1;
 static int enable_raw_block_coalescing_pass = 1;
+static int enable_memoize_loop_invariant_output_pass = 1;
+static size_t max_inline_include_size = SIZE_MAX;
+static size_t max_inline_macro_size = SIZE_MAX;
+
+static Expression* parseLiteral(const std::string &value)
+{
+	if (value == "true" || value == "false") {
+		return new BooleanLiteralExpression(value == "true");
+	}
+
+	char* end;
+	long integer = strtol(value.c_str(), &end, 10);
+	if (!value.empty() && *end == '\0') {
+		return new IntegerLiteralExpression(integer);
+	}
+
+	double number = strtod(value.c_str(), &end);
+	if (!value.empty() && *end == '\0') {
+		return new DoubleLiteralExpression(number);
+	}
+
+	return new StringLiteralExpression(SourceString(value));
+}
+
+/*
+ * Adds the constant assigned by `assignment`, eg. "site.title=Foo"; every dot in the name
+ * descends into an array constant.
+ */
+static bool addConstant(ASTContext &context, ConstantMap &constants, const std::string &assignment)
+{
+	auto equals = assignment.find('=');
+	if (equals == std::string::npos || equals == 0) {
+		return false;
+	}
+
+	std::vector<Symbol> path;
+	for (size_t start = 0, end; start < equals; start = end + 1) {
+		end = assignment.find('.', start);
+		if (end == std::string::npos || end > equals) {
+			end = equals;
+		}
+		path.push_back(context.symbols().intern(assignment.substr(start, end - start)));
+	}
+
+	auto &root = constants[path.front()];
+	if (path.size() == 1) {
+		root.reset(new Constant(parseLiteral(assignment.substr(equals + 1))));
+		return true;
+	}
+
+	if (!root || !root->isArray()) {
+		root.reset(new Constant());
+	}
+
+	Constant* array = root.get();
+	for (size_t i = 1; i < path.size(); i++) {
+		bool isLast = (i == path.size() - 1);
+		Constant* element = array->attribute(path[i]);
+		if (!element || isLast || !element->isArray()) {
+			element = isLast ? new Constant(parseLiteral(assignment.substr(equals + 1))) : new Constant();
+			array->append(new Constant(new StringLiteralExpression(SourceString(path[i].str()))), element);
+		}
+		array = element;
+	}
+
+	return true;
+}
+
+/*
+ * Adds the type hint given by `assignment`, eg. "count=int", or "now()=int" for the
+ * return value of a function.
+ */
+static bool addTypeHint(ASTContext &context, TypeHints &hints, const std::string &assignment)
+{
+	auto equals = assignment.find('=');
+	if (equals == std::string::npos || equals == 0) {
+		return false;
+	}
+
+	ExpressionValueType type;
+	if (!parseTypeHint(assignment.substr(equals + 1), type)) {
+		return false;
+	}
+
+	auto name = assignment.substr(0, equals);
+	if (name.size() > 2 && name.compare(name.size() - 2, 2, "()") == 0) {
+		hints.functions[context.symbols().intern(name.substr(0, name.size() - 2))] = type;
+	} else {
+		hints.variables[context.symbols().intern(name)] = type;
+	}
+	return true;
+}
 
-static AST* optimizeAST(AST* ast, std::string basepath)
+/*
+ * Resolves the inheritance and includes of `ast`; replaces it by the AST of its fragment
+ * `fragment`, when given.
+ */
+static AST* resolveAST(ASTContext &context, AST* ast, std::string basepath, const std::string &fragment)
 {
     PassManager passManager;
 
+	if (enable_resolve_inheritance_pass) {
+		passManager.addPass(new ResolveInheritancePass(context, basepath));
+	}
 	if (enable_resolve_includes_pass) {
-		passManager.addPass(new ResolveIncludesPass(basepath));
+		auto resolveIncludesPass = new ResolveIncludesPass(context, basepath);
+		resolveIncludesPass->setMaxInlineSize(max_inline_include_size);
+		passManager.addPass(resolveIncludesPass);
+	}
+	ExtractFragmentsPass* extractFragmentsPass = nullptr;
+	if (enable_extract_fragments_pass || !fragment.empty()) {
+		extractFragmentsPass = new ExtractFragmentsPass();
+		passManager.addPass(extractFragmentsPass);
+	}
+    ast = passManager.run(ast);
+
+	if (fragment.empty()) {
+		return ast;
+	}
+
+	delete ast;
+	for (auto &extracted : extractFragmentsPass->fragments()) {
+		if (extracted.name.str() == fragment) {
+			return extracted.ast.release();
+		}
+	}
+	throw std::runtime_error("No fragment named '" + fragment + "' found");
+}
+
+static AST* optimizeAST(ASTContext &context, AST* ast, const ConstantMap &constants, const TypeHints &typeHints)
+{
+    PassManager passManager;
+
+	if (enable_resolve_macros_pass) {
+		auto resolveMacrosPass = new ResolveMacrosPass();
+		resolveMacrosPass->setMaxInlineSize(max_inline_macro_size);
+		passManager.addPass(resolveMacrosPass);
+	}
+	// constants given on the command line always get substituted
+	if (enable_constant_substitution_pass || !constants.empty()) {
+		passManager.addPass(new SubstituteConstantsPass(context, constants));
 	}
 	if (enable_constant_folding_pass) {
 	    passManager.addPass(new FoldConstantExpressionsPass());
 	}
+	if (enable_dead_branch_elimination_pass) {
+		passManager.addPass(new EliminateDeadBranchesPass());
+	}
+	if (enable_if_chain_to_switch_pass) {
+		passManager.addPass(new LowerIfChainsToSwitchPass());
+	}
 	if (enable_literal_print_block_to_raw_block_conversion_pass) {
 	    passManager.addPass(new ConvertLiteralPrintBlockToRawBlockPass());
 	}
 	if (enable_raw_block_coalescing_pass) {
 		passManager.addPass(new CoalesceRawBlocksPass());
 	}
+	if (enable_hoist_lookups_pass) {
+		passManager.addPass(new HoistLookupsPass(context));
+	}
+	if (enable_type_inference_pass) {
+		passManager.addPass(new InferTypesPass(typeHints));
+	}
+	if (enable_memoize_loop_invariant_output_pass) {
+		passManager.addPass(new MemoizeLoopInvariantOutputPass(context));
+	}
     return passManager.run(ast);
 }
 
 static void usage(char* binary)
 {
 	static const char* passes[] = {
+		"resolve-inheritance-pass",
 		"resolve-includes-pass",
+		"extract-fragments-pass",
+		"resolve-macros-pass",
+		"constant-substitution-pass",
 		"constant-folding-pass",
+		"dead-branch-elimination-pass",
+		"if-chain-to-switch-pass",
 		"literal-print-to-raw-conversion-pass",
-		"raw-block-coalescing-pass"
+		"raw-block-coalescing-pass",
+		"hoist-lookups-pass",
+		"type-inference-pass",
+		"memoize-loop-invariant-output-pass"
 	};
 
 	std::cerr << "USAGE: " << binary << " [options] <template>" << std::endl;
@@ -76,6 +256,11 @@ static void usage(char* binary)
 		std::cerr << "  --enable-" << pass << std::endl;
 		std::cerr << "  --disable-" << pass << std::endl;
 	}
+	std::cerr << "  --max-inline-include-size <n>              Compile includes of more than <n> statements separately" << std::endl;
+	std::cerr << "  --max-inline-macro-size <n>                Compile macros of more than <n> statements separately" << std::endl;
+	std::cerr << "  --constant <name>=<value>                  Compile with variable <name> set to <value>" << std::endl;
+	std::cerr << "  --type <name>=<int|float|bool>             Compile with variable <name> (or function <name>()) typed" << std::endl;
+	std::cerr << "  --fragment <name>                          Display the fragment <name> instead of the template" << std::endl;
 	std::cerr << "  --template-basepath | -t                   Template basepath" << std::endl;
 	std::cerr << "  --help | -h                                Display this message" << std::endl;
 }
@@ -83,14 +268,37 @@ static void usage(char* binary)
 static struct option long_options[] = {
 	{"disable-all-passes", no_argument, nullptr, 'd'},
 	{"enable-all-passes", no_argument, nullptr, 'e'},
+	{"enable-resolve-inheritance-pass", no_argument, &enable_resolve_inheritance_pass, 1},
+	{"disable-resolve-inheritance-pass", no_argument, &enable_resolve_inheritance_pass, 0},
 	{"enable-resolve-includes-pass", no_argument, &enable_resolve_includes_pass, 1},
 	{"disable-resolve-includes-pass", no_argument, &enable_resolve_includes_pass, 0},
+	{"enable-extract-fragments-pass", no_argument, &enable_extract_fragments_pass, 1},
+	{"disable-extract-fragments-pass", no_argument, &enable_extract_fragments_pass, 0},
+	{"enable-resolve-macros-pass", no_argument, &enable_resolve_macros_pass, 1},
+	{"disable-resolve-macros-pass", no_argument, &enable_resolve_macros_pass, 0},
+	{"enable-constant-substitution-pass", no_argument, &enable_constant_substitution_pass, 1},
+	{"disable-constant-substitution-pass", no_argument, &enable_constant_substitution_pass, 0},
 	{"enable-constant-folding-pass", no_argument, &enable_constant_folding_pass, 1},
 	{"disable-constant-folding-pass", no_argument, &enable_constant_folding_pass, 0},
+	{"enable-dead-branch-elimination-pass", no_argument, &enable_dead_branch_elimination_pass, 1},
+	{"disable-dead-branch-elimination-pass", no_argument, &enable_dead_branch_elimination_pass, 0},
+	{"enable-if-chain-to-switch-pass", no_argument, &enable_if_chain_to_switch_pass, 1},
+	{"disable-if-chain-to-switch-pass", no_argument, &enable_if_chain_to_switch_pass, 0},
+	{"enable-hoist-lookups-pass", no_argument, &enable_hoist_lookups_pass, 1},
+	{"disable-hoist-lookups-pass", no_argument, &enable_hoist_lookups_pass, 0},
+	{"enable-type-inference-pass", no_argument, &enable_type_inference_pass, 1},
+	{"disable-type-inference-pass", no_argument, &enable_type_inference_pass, 0},
 	{"enable-literal-print-to-raw-conversion-pass", no_argument, &enable_literal_print_block_to_raw_block_conversion_pass, 1},
 	{"disable-literal-print-to-raw-conversion-pass", no_argument, &enable_literal_print_block_to_raw_block_conversion_pass, 0},
 	{"enable-raw-block-coalescing-pass", no_argument, &enable_raw_block_coalescing_pass, 1},
 	{"disable-raw-block-coalescing-pass", no_argument, &enable_raw_block_coalescing_pass, 0},
+	{"enable-memoize-loop-invariant-output-pass", no_argument, &enable_memoize_loop_invariant_output_pass, 1},
+	{"disable-memoize-loop-invariant-output-pass", no_argument, &enable_memoize_loop_invariant_output_pass, 0},
+	{"max-inline-include-size", required_argument, nullptr, 'i'},
+	{"max-inline-macro-size", required_argument, nullptr, 'm'},
+	{"constant", required_argument, nullptr, 'c'},
+	{"type", required_argument, nullptr, 'y'},
+	{"fragment", required_argument, nullptr, 'f'},
 	{"template-basepath", required_argument, nullptr, 't'},
 	{"help", no_argument, nullptr, 'h'},
 	{nullptr, 0, nullptr, 0},
@@ -100,6 +308,9 @@ int main(int argc, char* argv[])
 {
 	char* binary = argv[0];
 	std::string basepath;
+	std::vector<std::string> constantAssignments;
+	std::vector<std::string> typeAssignments;
+	std::string fragment;
 	while (1) {
 		int option_index = 0;
 		int c = getopt_long(argc, argv, "ht:", long_options, &option_index);
@@ -117,16 +328,49 @@ int main(int argc, char* argv[])
 
 		switch (c) {
 			case 'd':
+				enable_resolve_inheritance_pass = 0;
 				enable_resolve_includes_pass = 0;
+				enable_extract_fragments_pass = 0;
+				enable_resolve_macros_pass = 0;
+				enable_constant_substitution_pass = 0;
 				enable_constant_folding_pass = 0;
+				enable_dead_branch_elimination_pass = 0;
+				enable_if_chain_to_switch_pass = 0;
+				enable_hoist_lookups_pass = 0;
+				enable_type_inference_pass = 0;
 				enable_literal_print_block_to_raw_block_conversion_pass = 0;
 				enable_raw_block_coalescing_pass = 0;
+				enable_memoize_loop_invariant_output_pass = 0;
 				break;
 			case 'e':
+				enable_resolve_inheritance_pass = 1;
 				enable_resolve_includes_pass = 1;
+				enable_extract_fragments_pass = 1;
+				enable_resolve_macros_pass = 1;
+				enable_constant_substitution_pass = 1;
 				enable_constant_folding_pass = 1;
+				enable_dead_branch_elimination_pass = 1;
+				enable_if_chain_to_switch_pass = 1;
+				enable_hoist_lookups_pass = 1;
+				enable_type_inference_pass = 1;
 				enable_literal_print_block_to_raw_block_conversion_pass = 1;
 				enable_raw_block_coalescing_pass = 1;
+				enable_memoize_loop_invariant_output_pass = 1;
+				break;
+			case 'i':
+				max_inline_include_size = strtoul(optarg, nullptr, 10);
+				break;
+			case 'm':
+				max_inline_macro_size = strtoul(optarg, nullptr, 10);
+				break;
+			case 'c':
+				constantAssignments.push_back(optarg);
+				break;
+			case 'y':
+				typeAssignments.push_back(optarg);
+				break;
+			case 'f':
+				fragment = optarg;
 				break;
 			case 't':
 				basepath = optarg;
@@ -151,14 +395,31 @@ int main(int argc, char* argv[])
 		basepath = dirname(argv[0]);
 	}
 
+	ASTContext context;
+	ConstantMap constants;
+	for (auto &assignment : constantAssignments) {
+		if (!addConstant(context, constants, assignment)) {
+			usage(binary);
+			return 1;
+		}
+	}
+	TypeHints typeHints;
+	for (auto &assignment : typeAssignments) {
+		if (!addTypeHint(context, typeHints, assignment)) {
+			usage(binary);
+			return 1;
+		}
+	}
+
 	std::unique_ptr<AST> ast;
-    ast.reset(parseAST(argv[0]));
+    ast.reset(parseAST(context, argv[0]));
     if (!ast) {
         return 1;
     }
 
 	try {
-		ast.reset(optimizeAST(ast.release(), basepath));
+		ast.reset(resolveAST(context, ast.release(), basepath, fragment));
+		ast.reset(optimizeAST(context, ast.release(), constants, typeHints));
 	} catch (std::runtime_error& e) {
 		std::cerr << "Runtime error: " << e.what() << std::endl;
 		return 1;
@@ -10,15 +10,22 @@
 
 #include "ast/passes/coalesce_rawblocks_pass.hpp"
 #include "ast/passes/convert_literal_printblock_to_rawblock_pass.hpp"
+#include "ast/passes/eliminate_dead_branches_pass.hpp"
 #include "ast/passes/fold_constant_expressions_pass.hpp"
+#include "ast/passes/hoist_lookups_pass.hpp"
+#include "ast/passes/lower_if_chains_to_switch_pass.hpp"
+#include "ast/passes/memoize_loop_invariant_output_pass.hpp"
 #include "ast/passes/pass_manager.hpp"
 #include "ast/passes/resolve_includes_pass.hpp"
+#include "ast/passes/resolve_inheritance_pass.hpp"
+#include "ast/passes/resolve_macros_pass.hpp"
+#include "ast/passes/substitute_constants_pass.hpp"
 
 using namespace b2;
 
-static AST* parseAST(const std::string &path)
+static AST* parseAST(ASTContext &context, const std::string &path)
 {
-	Parser parser;
+	Parser parser(context);
 
     try {
         return parser.parse(path);
@@ -28,27 +35,58 @@ static AST* parseAST(const std::string &path)
     }
 }
 
+static int enable_resolve_inheritance_pass = 1;
 static int enable_resolve_includes_pass = 1;
+static int enable_resolve_macros_pass = 1;
+static int enable_constant_substitution_pass = 1;
 static int enable_constant_folding_pass = 1;
+static int enable_dead_branch_elimination_pass = 1;
+static int enable_if_chain_to_switch_pass = 1;
+static int enable_hoist_lookups_pass = 1;
 static int enable_literal_print_block_to_raw_block_conversion_pass = 1;
 static int enable_raw_block_coalescing_pass = 1;
+static int enable_memoize_loop_invariant_output_pass = 1;
 
-static AST* optimizeAST(AST* ast, std::string basepath)
+static AST* optimizeAST(ASTContext &context, AST* ast, std::string basepath)
 {
+    // templates are precompiled without constants, this only unrolls loops over array literals
+    static const ConstantMap constants;
     PassManager passManager;
 
+	if (enable_resolve_inheritance_pass) {
+		passManager.addPass(new ResolveInheritancePass(context, basepath));
+	}
 	if (enable_resolve_includes_pass) {
-		passManager.addPass(new ResolveIncludesPass(basepath));
+		passManager.addPass(new ResolveIncludesPass(context, basepath));
+	}
+	if (enable_resolve_macros_pass) {
+		passManager.addPass(new ResolveMacrosPass());
+	}
+	if (enable_constant_substitution_pass) {
+		passManager.addPass(new SubstituteConstantsPass(context, constants));
 	}
 	if (enable_constant_folding_pass) {
 	    passManager.addPass(new FoldConstantExpressionsPass());
 	}
+	if (enable_dead_branch_elimination_pass) {
+		passManager.addPass(new EliminateDeadBranchesPass());
+	}
+	if (enable_if_chain_to_switch_pass) {
+		passManager.addPass(new LowerIfChainsToSwitchPass());
+	}
 	if (enable_literal_print_block_to_raw_block_conversion_pass) {
 	    passManager.addPass(new ConvertLiteralPrintBlockToRawBlockPass());
 	}
 	if (enable_raw_block_coalescing_pass) {
 		passManager.addPass(new CoalesceRawBlocksPass());
 	}
+	if (enable_hoist_lookups_pass) {
+		// a lookup on an undefined value throws, so lookups can't be hoisted out of a loop body
+		passManager.addPass(new HoistLookupsPass(context, false));
+	}
+	if (enable_memoize_loop_invariant_output_pass) {
+		passManager.addPass(new MemoizeLoopInvariantOutputPass(context));
+	}
     return passManager.run(ast);
 }
 
@@ -66,10 +104,17 @@ static struct {
 	const char* name;
 	int* enabled;
 } passes[] = {
+	{"resolve-inheritance-pass", &enable_resolve_inheritance_pass},
 	{"resolve-includes-pass", &enable_resolve_includes_pass},
+	{"resolve-macros-pass", &enable_resolve_macros_pass},
+	{"constant-substitution-pass", &enable_constant_substitution_pass},
 	{"constant-folding-pass", &enable_constant_folding_pass},
+	{"dead-branch-elimination-pass", &enable_dead_branch_elimination_pass},
+	{"if-chain-to-switch-pass", &enable_if_chain_to_switch_pass},
 	{"literal-print-to-raw-conversion-pass", &enable_literal_print_block_to_raw_block_conversion_pass},
 	{"raw-block-coalescing-pass", &enable_raw_block_coalescing_pass},
+	{"hoist-lookups-pass", &enable_hoist_lookups_pass},
+	{"memoize-loop-invariant-output-pass", &enable_memoize_loop_invariant_output_pass},
 };
 
 static void list_passes()
@@ -160,13 +205,14 @@ int main(int argc, char* argv[])
 		basepath = dirname(argv[0]);
 	}
 
+	ASTContext context;
 	std::unique_ptr<AST> ast;
-    ast.reset(parseAST(argv[0]));
+    ast.reset(parseAST(context, argv[0]));
     if (!ast) {
         return 1;
     }
 
-	ast.reset(optimizeAST(ast.release(), basepath));
+	ast.reset(optimizeAST(context, ast.release(), basepath));
 
 	js_visitor.visit(ast.get());
 
@@ -1,23 +1,44 @@
 #include <main/php.h>
+#include <main/php_ini.h>
 #include <main/php_output.h>
+#include <main/SAPI.h>
 #include <ext/standard/info.h>
 #include <Zend/zend_API.h>
 #include <Zend/zend_exceptions.h>
 
+#include <stdio.h>
+
+#include <algorithm>
+#include <future>
 #include <memory>
+#include <stdexcept>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
+#include "ast/flat_ast.hpp"
 #include "backends/llvm/llvm_backend.hpp"
+#include "parser/include_cache.hpp"
 #include "parser/parser.hpp"
+#include "thread_pool.hpp"
 
 #include "php_template.h"
 #include "php_bindings.hpp"
 
 #include "ast/passes/coalesce_rawblocks_pass.hpp"
 #include "ast/passes/convert_literal_printblock_to_rawblock_pass.hpp"
+#include "ast/passes/eliminate_dead_branches_pass.hpp"
+#include "ast/passes/extract_fragments_pass.hpp"
 #include "ast/passes/fold_constant_expressions_pass.hpp"
+#include "ast/passes/hoist_lookups_pass.hpp"
+#include "ast/passes/infer_types_pass.hpp"
+#include "ast/passes/lower_if_chains_to_switch_pass.hpp"
+#include "ast/passes/memoize_loop_invariant_output_pass.hpp"
 #include "ast/passes/pass_manager.hpp"
 #include "ast/passes/resolve_includes_pass.hpp"
+#include "ast/passes/resolve_inheritance_pass.hpp"
+#include "ast/passes/resolve_macros_pass.hpp"
+#include "ast/passes/substitute_constants_pass.hpp"
 
 #define B2_VERSION_STRING "0.0.1-dev"
 
@@ -28,28 +49,57 @@ static zend_class_entry* b2_engine_class_entry;
 static zend_class_entry* b2_template_class_entry;
 static zend_class_entry* b2_syntaxerror_class_entry;
 
+// shared by every engine, and by every process forked after module startup
+static fragment_cache* b2_fragment_cache;
+
+// shared by every engine, or null when templates get parsed inline; its workers are only
+// spawned once it gets used, so every forked process gets its own
+static b2::ThreadPool* b2_parse_pool;
+
+/* {{{ INI entries */
+PHP_INI_BEGIN()
+    // the size of the fragment cache, 0 disables it
+    PHP_INI_ENTRY("b2.fragment_cache_size", "16M", PHP_INI_SYSTEM, nullptr)
+    // the largest output (plus key) a cache block can store
+    PHP_INI_ENTRY("b2.fragment_cache_slot_size", "8K", PHP_INI_SYSTEM, nullptr)
+    // how much output display() and renderTo() hold on to before writing it, 0 holds all of it
+    PHP_INI_ENTRY("b2.flush_threshold", "8K", PHP_INI_ALL, nullptr)
+    // how many threads parse templates and their includes, 0 or 1 parses them inline
+    PHP_INI_ENTRY("b2.parse_threads", "0", PHP_INI_SYSTEM, nullptr)
+PHP_INI_END()
+/* }}} */
+
+/*
+ * Returns the value of a size setting, which can have a K, M or G suffix.
+ */
+static size_t ini_size(const char* name)
+{
+    char* value = zend_ini_string((char*) name, strlen(name) + 1, 0);
+    return value ? zend_atol(value, strlen(value)) : 0;
+}
+
 // internal structures
 struct Engine_object {
     zend_object zo;
 	HashTable registeredFunctions;
+	// the return types of the registered functions which declared one
+	std::unordered_map<b2::Symbol, b2::ExpressionValueType> functionTypes;
     std::string basePath;
 	llvm::LLVMContext llvmContext;
 	llvm::IRBuilder<> irBuilder;
 	b2::PHPBindings bindings;
 	b2::LLVMBackend backend;
-	b2::Parser parser;
+	// every template compiled by this engine shares the symbol table of includeContext
+	b2::ASTContext includeContext;
+	b2::IncludeCache includeCache;
+	// every template compiled by this engine, for resolving dynamic includes
+	template_registry registry;
 
-	Engine_object() :
-		irBuilder(llvmContext),
-		bindings(irBuilder),
-		backend(irBuilder, bindings)
-	{
-		bindings.linkInFunctions(backend.getModule());
-		zend_hash_init(&registeredFunctions, 16, nullptr, ZVAL_PTR_DTOR, 0);
-	}
+	Engine_object();
 
 	~Engine_object()
 	{
+		zend_hash_destroy(&registry.templates);
 		zend_hash_destroy(&registeredFunctions);
 	}
 };
@@ -58,8 +108,33 @@ struct Template_object {
     zend_object zo;
     size_t estimatedBufferSize;
     template_fn renderFunc;
+    // the functions rendering the fragments of this template, by name
+    std::unordered_map<std::string, template_fn> fragments;
+    // the output every render starts with, and whether flushPrefix() already wrote it
+    std::string staticPrefix;
+    bool prefixFlushed;
 };
 
+static compiled_template* loadTemplate(template_registry* registry, const char* name, uint nameLength);
+
+Engine_object::Engine_object() :
+	irBuilder(llvmContext),
+	bindings(irBuilder),
+	backend(irBuilder, bindings),
+	includeCache(includeContext)
+{
+	bindings.linkInFunctions(backend.getModule());
+	zend_hash_init(&registeredFunctions, 16, nullptr, ZVAL_PTR_DTOR, 0);
+
+	zend_hash_init(&registry.templates, 16, nullptr, [](void* data) {
+		efree(((compiled_template*) data)->name);
+	}, 0);
+	registry.load = loadTemplate;
+	registry.engine = this;
+	bindings.setTemplateRegistry(&registry);
+	bindings.setFragmentCache(b2_fragment_cache);
+}
+
 /* {{{ Engine_object_create */
 static zend_object_value Engine_object_create(zend_class_entry *ce TSRMLS_DC)
 {
@@ -110,61 +185,184 @@ static PHP_METHOD(Engine, __construct)
     engine->basePath = std::string(basePath, basePathLen);
 }
 
-static b2::AST* optimizeAST(b2::AST* ast, const std::string& basePath)
+// includes larger than this are compiled once as a function shared by all templates, instead of being inlined at every use
+static const size_t maxInlineIncludeSize = 8;
+// macros larger than this are compiled once as a function, called directly by every use
+static const size_t maxInlineMacroSize = 8;
+
+typedef std::vector<b2::ExtractFragmentsPass::Fragment> Fragments;
+
+/*
+ * Optimizes `ast`, of which the inheritance and includes are resolved already.
+ */
+static b2::AST* optimizeResolvedAST(b2::ASTContext& context, b2::AST* ast, const b2::ConstantMap* constants, const b2::TypeHints& typeHints)
 {
     b2::PassManager passManager;
 
-    passManager.addPass(new b2::ResolveIncludesPass(basePath));
+    auto resolveMacrosPass = new b2::ResolveMacrosPass();
+    resolveMacrosPass->setMaxInlineSize(maxInlineMacroSize);
+    passManager.addPass(resolveMacrosPass);
+    // without constants, this still unrolls the loops over array literals
+    static const b2::ConstantMap noConstants;
+    passManager.addPass(new b2::SubstituteConstantsPass(context, constants ? *constants : noConstants));
     passManager.addPass(new b2::FoldConstantExpressionsPass());
+    passManager.addPass(new b2::EliminateDeadBranchesPass());
+    passManager.addPass(new b2::LowerIfChainsToSwitchPass());
     passManager.addPass(new b2::ConvertLiteralPrintBlockToRawBlockPass());
     passManager.addPass(new b2::CoalesceRawBlocksPass());
+    passManager.addPass(new b2::HoistLookupsPass(context));
+    passManager.addPass(new b2::InferTypesPass(typeHints));
+    passManager.addPass(new b2::MemoizeLoopInvariantOutputPass(context));
     return passManager.run(ast);
 }
 
-static PHP_METHOD(Engine, parseTemplate)
+/*
+ * Optimizes `ast` for rendering. When `fragments` is given, it receives the optimized ASTs
+ * of the fragments of the template, which get compiled as entry points of their own.
+ */
+static b2::AST* optimizeAST(Engine_object* engine, b2::ASTContext& context, b2::AST* ast, b2::ThreadPool* includeThreadPool = b2_parse_pool, const b2::ConstantMap* constants = nullptr, const b2::TypeHints* variableTypes = nullptr, Fragments* fragments = nullptr)
 {
-    char* input = NULL;
-    int input_len = 0;
+    b2::TypeHints typeHints;
+    if (variableTypes) {
+        typeHints.variables = variableTypes->variables;
+    }
+    typeHints.functions = engine->functionTypes;
 
-    // parse parameters
-    if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s", &input, &input_len) == FAILURE) {
-        RETURN_NULL();
+    b2::PassManager passManager;
+
+    passManager.addPass(new b2::ResolveInheritancePass(context, engine->basePath, &engine->includeCache));
+
+    auto resolveIncludesPass = new b2::ResolveIncludesPass(context, engine->basePath, 1, &engine->includeCache);
+    resolveIncludesPass->setMaxInlineSize(maxInlineIncludeSize);
+    if (includeThreadPool) {
+        resolveIncludesPass->setThreadPool(includeThreadPool);
     }
+    passManager.addPass(resolveIncludesPass);
 
-    Engine_object* engine = (Engine_object*) zend_object_store_get_object(getThis() TSRMLS_CC);
+    b2::ExtractFragmentsPass* extractFragmentsPass = nullptr;
+    if (fragments) {
+        extractFragmentsPass = new b2::ExtractFragmentsPass();
+        passManager.addPass(extractFragmentsPass);
+    }
+
+    std::unique_ptr<b2::AST> resolvedAST(passManager.run(ast));
+    if (fragments) {
+        *fragments = std::move(extractFragmentsPass->fragments());
+        for (auto &fragment : *fragments) {
+            fragment.ast.reset(optimizeResolvedAST(context, fragment.ast.release(), constants, typeHints));
+        }
+    }
 
-	std::string path(input, input_len);
-	if (path[0] != '/') {
+    return optimizeResolvedAST(context, resolvedAST.release(), constants, typeHints);
+}
+
+static std::string resolveTemplatePath(Engine_object* engine, const std::string& filename)
+{
+	if (filename[0] != '/') {
 		// TODO: this is UNIX-specific
-		path = engine->basePath + "/" + path;
+		return engine->basePath + "/" + filename;
 	}
-	
-    std::unique_ptr<b2::AST> ast;
+
+	return filename;
+}
+
+/*
+ * Compiles `ast` and makes it available to dynamic includes as `templateName`. The backend
+ * returns the same function for the same `functionName`, so it should identify the source
+ * of `ast` as well.
+ */
+static template_fn registerTemplate(Engine_object* engine, const std::string& templateName, const std::string& functionName, b2::AST* ast)
+{
+    auto func = (template_fn) engine->backend.createFunction(functionName, ast);
+
+    compiled_template* registered;
+    if (zend_hash_find(&engine->registry.templates, templateName.data(), templateName.length() + 1, (void**) &registered) == SUCCESS) {
+        // compiled again, possibly from another source: the last one compiled wins. The entry
+        // gets updated in place, as include sites keep pointing at it
+        registered->render = func;
+        return func;
+    }
+
+    compiled_template compiled;
+    compiled.name = estrndup(templateName.data(), templateName.length());
+    compiled.name_length = templateName.length();
+    compiled.render = func;
+    zend_hash_add(&engine->registry.templates, templateName.data(), templateName.length() + 1, &compiled, sizeof(compiled), nullptr);
+
+    return func;
+}
+
+/*
+ * Compiles the template file `name` refers to, for a dynamic include which didn't find it in
+ * the registry.
+ */
+static compiled_template* loadTemplate(template_registry* registry, const char* name, uint nameLength)
+{
+    Engine_object* engine = (Engine_object*) registry->engine;
+    std::string templateName(name, nameLength);
+
     try {
-        ast.reset(engine->parser.parse(path));
+        b2::ASTContext context(engine->includeContext.sharedSymbols());
+        b2::ASTContext::Scope scope(context);
+        b2::Parser parser(context);
+        std::unique_ptr<b2::AST> ast(parser.parse(resolveTemplatePath(engine, templateName)));
+        ast.reset(optimizeAST(engine, context, ast.release()));
+        registerTemplate(engine, templateName, templateName, ast.get());
     } catch (b2::SyntaxError& err) {
         // TODO: pass line number and filename
         zend_throw_exception(b2_syntaxerror_class_entry, (char*) err.what(), 0);
-        return;
+        return nullptr;
     } catch (std::exception& ex) {
         zend_throw_exception(nullptr, (char*) ex.what(), 0);
-        return;
+        return nullptr;
     }
 
-    try {
-        ast.reset(optimizeAST(ast.release(), engine->basePath));
-    } catch (std::exception& ex) {
-        zend_throw_exception(nullptr, (char*) ex.what(), 0);
-        return;
+    compiled_template* compiled;
+    zend_hash_find(&registry->templates, name, nameLength + 1, (void**) &compiled);
+    return compiled;
+}
+
+/*
+ * Returns the output `ast` starts with whatever its variables are: the raw blocks in
+ * front of everything else, also the ones within the set blocks and named blocks at its
+ * start, which don't render anything themselves.
+ */
+static std::string staticPrefix(b2::AST* ast)
+{
+    b2::FlatAST flatAST(ast);
+    std::string prefix;
+
+    for (uint32_t index = 0; index < flatAST.size(); ) {
+        auto &node = flatAST[index];
+        if (node.type == b2::RawBlockASTType) {
+            prefix += node.as<b2::RawBlockAST>()->text.str();
+            index = node.end;
+        } else if (node.type == b2::SetBlockASTType || node.type == b2::NamedBlockASTType) {
+            // continue with its body
+            index++;
+        } else {
+            break;
+        }
     }
 
+    return prefix;
+}
+
+static bool createTemplate(Engine_object* engine, zval* engine_zv, const std::string& templateName, const std::string& functionName, b2::AST* ast, const Fragments& fragments, zval* return_value)
+{
     template_fn func;
+    std::unordered_map<std::string, template_fn> fragmentFuncs;
     try {
-        std::string templateName(input, input_len);
-        func = (template_fn) engine->backend.createFunction(templateName, ast.get());
+        func = registerTemplate(engine, templateName, functionName, ast);
+
+        // a fragment can't be included, so it doesn't get registered
+        for (auto &fragment : fragments) {
+            auto name = fragment.name.str();
+            fragmentFuncs[name] = (template_fn) engine->backend.createFunction(functionName + "@" + name, fragment.ast.get());
+        }
     } catch (std::exception& ex) {
         zend_throw_exception(nullptr, (char*) ex.what(), 0);
-        return;
+        return false;
     }
 
     // create template object
@@ -174,10 +372,329 @@ static PHP_METHOD(Engine, parseTemplate)
     Template_object* templ = (Template_object*) zend_object_store_get_object(return_value TSRMLS_CC);
     templ->estimatedBufferSize = 200; // TODO
     templ->renderFunc = func;
+    templ->fragments = std::move(fragmentFuncs);
+    templ->staticPrefix = staticPrefix(ast);
+    templ->prefixFlushed = false;
 
     // add engine reference to template
-    zend_update_property(b2_template_class_entry, return_value, "engine", strlen("engine"), getThis());
+    zend_update_property(b2_template_class_entry, return_value, "engine", strlen("engine"), engine_zv);
 	// zend_update_property() will increase the refcount
+
+    return true;
+}
+
+template<typename ParseFunc>
+static void compileTemplate(Engine_object* engine, zval* engine_zv, const std::string& templateName, const std::string& functionName, ParseFunc parse, zval* return_value, const b2::ConstantMap* constants = nullptr, const b2::TypeHints* variableTypes = nullptr)
+{
+    // the AST references the template sources, which are owned by this context
+    b2::ASTContext context(engine->includeContext.sharedSymbols());
+    b2::ASTContext::Scope scope(context);
+    std::unique_ptr<b2::AST> ast;
+    try {
+        b2::Parser parser(context);
+        ast.reset(parse(parser));
+    } catch (b2::SyntaxError& err) {
+        // TODO: pass line number and filename
+        zend_throw_exception(b2_syntaxerror_class_entry, (char*) err.what(), 0);
+        return;
+    } catch (std::exception& ex) {
+        zend_throw_exception(nullptr, (char*) ex.what(), 0);
+        return;
+    }
+
+    Fragments fragments;
+    try {
+        ast.reset(optimizeAST(engine, context, ast.release(), b2_parse_pool, constants, variableTypes, &fragments));
+    } catch (std::exception& ex) {
+        zend_throw_exception(nullptr, (char*) ex.what(), 0);
+        return;
+    }
+
+    createTemplate(engine, engine_zv, templateName, functionName, ast.get(), fragments, return_value);
+}
+
+/*
+ * Converts `value`, the value of the constant named `path`, and appends what identifies
+ * it to `signature`.
+ */
+static b2::Constant* createConstant(zval* value, const std::string& path, std::string& signature)
+{
+    switch (Z_TYPE_P(value)) {
+        case IS_LONG:
+            signature += "l" + std::to_string(Z_LVAL_P(value)) + ";";
+            return new b2::Constant(new b2::IntegerLiteralExpression(Z_LVAL_P(value)));
+        case IS_DOUBLE: {
+            char number[32];
+            snprintf(number, sizeof(number), "%.17g", Z_DVAL_P(value));
+            signature += std::string("d") + number + ";";
+            return new b2::Constant(new b2::DoubleLiteralExpression(Z_DVAL_P(value)));
+        }
+        case IS_BOOL:
+            signature += Z_BVAL_P(value) ? "t;" : "f;";
+            return new b2::Constant(new b2::BooleanLiteralExpression(Z_BVAL_P(value)));
+        case IS_STRING: {
+            std::string str(Z_STRVAL_P(value), Z_STRLEN_P(value));
+            signature += "s" + std::to_string(str.length()) + ":" + str + ";";
+            return new b2::Constant(new b2::StringLiteralExpression(b2::SourceString(str)));
+        }
+        case IS_ARRAY: {
+            std::unique_ptr<b2::Constant> array(new b2::Constant());
+            signature += "a{";
+
+            HashTable* elements = Z_ARRVAL_P(value);
+            HashPosition pos;
+            zval** entry;
+            for (zend_hash_internal_pointer_reset_ex(elements, &pos);
+                 zend_hash_get_current_data_ex(elements, (void**) &entry, &pos) == SUCCESS;
+                 zend_hash_move_forward_ex(elements, &pos)) {
+                char* key;
+                uint key_len;
+                ulong index;
+
+                zval keyValue;
+                if (zend_hash_get_current_key_ex(elements, &key, &key_len, &index, 0, &pos) == HASH_KEY_IS_STRING) {
+                    ZVAL_STRINGL(&keyValue, key, key_len - 1, false);
+                } else {
+                    ZVAL_LONG(&keyValue, index);
+                }
+
+                std::unique_ptr<b2::Constant> elementKey(createConstant(&keyValue, path, signature));
+                std::string elementPath = path + "." + (Z_TYPE(keyValue) == IS_STRING ? std::string(Z_STRVAL(keyValue), Z_STRLEN(keyValue)) : std::to_string(index));
+                b2::Constant* elementValue = createConstant(*entry, elementPath, signature);
+                array->append(elementKey.release(), elementValue);
+            }
+
+            signature += "}";
+            return array.release();
+        }
+        default:
+            throw std::runtime_error("Constant '" + path + "' should be a scalar or an array");
+    }
+}
+
+/*
+ * Converts `assignments`, which maps variable names to their values, into `constants`;
+ * appends what identifies these constants to `signature`.
+ */
+static void createConstants(Engine_object* engine, HashTable* assignments, b2::ConstantMap& constants, std::string& signature)
+{
+    HashPosition pos;
+    zval** entry;
+    for (zend_hash_internal_pointer_reset_ex(assignments, &pos);
+         zend_hash_get_current_data_ex(assignments, (void**) &entry, &pos) == SUCCESS;
+         zend_hash_move_forward_ex(assignments, &pos)) {
+        char* key;
+        uint key_len;
+        ulong index;
+        if (zend_hash_get_current_key_ex(assignments, &key, &key_len, &index, 0, &pos) != HASH_KEY_IS_STRING) {
+            throw std::runtime_error("The constants should be keyed by variable name");
+        }
+
+        std::string name(key, key_len - 1);
+        signature += name + "=";
+        constants[engine->includeContext.symbols().intern(name)].reset(createConstant(*entry, name, signature));
+    }
+}
+
+/*
+ * Converts the name of a type, eg. "int", into `type`.
+ */
+static void parseTypeHint(zval* name, const std::string& what, b2::ExpressionValueType& type)
+{
+    if (Z_TYPE_P(name) != IS_STRING || !b2::parseTypeHint(std::string(Z_STRVAL_P(name), Z_STRLEN_P(name)), type)) {
+        throw std::runtime_error("The type of " + what + " should be 'int', 'float' or 'bool'");
+    }
+}
+
+/*
+ * Converts `types`, which maps variable names to the names of their types, into the variable
+ * hints of `typeHints`; appends what identifies these types to `signature`.
+ */
+static void createTypeHints(Engine_object* engine, HashTable* types, b2::TypeHints& typeHints, std::string& signature)
+{
+    signature += "types:";
+
+    HashPosition pos;
+    zval** entry;
+    for (zend_hash_internal_pointer_reset_ex(types, &pos);
+         zend_hash_get_current_data_ex(types, (void**) &entry, &pos) == SUCCESS;
+         zend_hash_move_forward_ex(types, &pos)) {
+        char* key;
+        uint key_len;
+        ulong index;
+        if (zend_hash_get_current_key_ex(types, &key, &key_len, &index, 0, &pos) != HASH_KEY_IS_STRING) {
+            throw std::runtime_error("The types should be keyed by variable name");
+        }
+
+        std::string name(key, key_len - 1);
+        b2::ExpressionValueType type;
+        parseTypeHint(*entry, "variable '" + name + "'", type);
+        typeHints.variables[engine->includeContext.symbols().intern(name)] = type;
+        signature += name + "=" + std::string(Z_STRVAL_PP(entry), Z_STRLEN_PP(entry)) + ";";
+    }
+}
+
+static PHP_METHOD(Engine, parseTemplate)
+{
+    char* input = NULL;
+    int input_len = 0;
+    HashTable* assignments = nullptr;
+    HashTable* types = nullptr;
+
+    // parse parameters
+    if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s|hh", &input, &input_len, &assignments, &types) == FAILURE) {
+        RETURN_NULL();
+    }
+
+    Engine_object* engine = (Engine_object*) zend_object_store_get_object(getThis() TSRMLS_CC);
+
+	std::string templateName(input, input_len);
+	std::string path = resolveTemplatePath(engine, templateName);
+
+    // every set of constants and variable types gets its own specialization of the template
+    b2::ConstantMap constants;
+    b2::TypeHints variableTypes;
+    std::string signature;
+    try {
+        if (assignments && zend_hash_num_elements(assignments) > 0) {
+            createConstants(engine, assignments, constants, signature);
+        }
+        if (types && zend_hash_num_elements(types) > 0) {
+            createTypeHints(engine, types, variableTypes, signature);
+        }
+    } catch (std::exception& ex) {
+        zend_throw_exception(nullptr, (char*) ex.what(), 0);
+        return;
+    }
+
+    if (!signature.empty()) {
+        char hex[17];
+        snprintf(hex, sizeof(hex), "%016llx", (unsigned long long) b2::hashBytes(signature.data(), signature.length()));
+        templateName += std::string("#") + hex;
+    }
+
+    compileTemplate(engine, getThis(), templateName, templateName, [&path](b2::Parser& parser) {
+        return parser.parse(path);
+    }, return_value, constants.empty() ? nullptr : &constants, &variableTypes);
+}
+
+static PHP_METHOD(Engine, compileString)
+{
+    char* name = NULL;
+    int name_len = 0;
+    char* source = NULL;
+    int source_len = 0;
+
+    // parse parameters
+    if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ss", &name, &name_len, &source, &source_len) == FAILURE) {
+        RETURN_NULL();
+    }
+
+    Engine_object* engine = (Engine_object*) zend_object_store_get_object(getThis() TSRMLS_CC);
+
+    // a name can get compiled from different sources, so its function is named after both
+    std::string templateName(name, name_len);
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long) b2::hashBytes(source, source_len));
+
+    compileTemplate(engine, getThis(), templateName, templateName + "$" + hex, [source, source_len](b2::Parser& parser) {
+        return parser.parse(source, source_len);
+    }, return_value);
+}
+
+// a template parsed and optimized by a job of parseTemplates()
+struct OptimizedTemplate {
+    std::unique_ptr<b2::AST> ast;
+    Fragments fragments;
+};
+
+static PHP_METHOD(Engine, parseTemplates)
+{
+    HashTable* filenames;
+
+    // parse parameters
+    if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "h", &filenames) == FAILURE) {
+        RETURN_NULL();
+    }
+
+    Engine_object* engine = (Engine_object*) zend_object_store_get_object(getThis() TSRMLS_CC);
+
+    std::vector<std::string> names;
+    HashPosition pos;
+    zval** entry;
+    for (zend_hash_internal_pointer_reset_ex(filenames, &pos);
+         zend_hash_get_current_data_ex(filenames, (void**) &entry, &pos) == SUCCESS;
+         zend_hash_move_forward_ex(filenames, &pos)) {
+        if (Z_TYPE_PP(entry) != IS_STRING) {
+            zend_throw_exception(nullptr, "parseTemplates() expects an array of filenames", 0);
+            return;
+        }
+        names.push_back(std::string(Z_STRVAL_PP(entry), Z_STRLEN_PP(entry)));
+    }
+
+    // parsing and optimizing only touch the AST, so every template gets its own job on
+    // the parse pool (or runs inline without one); the includes of a single template are
+    // resolved serially in that job, as a job waiting on the pool could deadlock it
+    b2::ASTContext context(engine->includeContext.sharedSymbols());
+    std::vector<std::future<OptimizedTemplate>> jobs;
+    for (auto &name : names) {
+        std::string path = resolveTemplatePath(engine, name);
+
+        auto job = [engine, &context, path]() {
+            b2::ASTContext::Scope scope(context);
+            b2::Parser parser(context);
+            OptimizedTemplate optimized;
+            optimized.ast.reset(parser.parse(path));
+            optimized.ast.reset(optimizeAST(engine, context, optimized.ast.release(), nullptr, nullptr, nullptr, &optimized.fragments));
+            return optimized;
+        };
+
+        if (b2_parse_pool) {
+            jobs.push_back(b2_parse_pool->enqueue(job));
+        } else {
+            std::packaged_task<OptimizedTemplate()> task(job);
+            jobs.push_back(task.get_future());
+            task();
+        }
+    }
+
+    // wait for all jobs, so none of them outlives this call
+    std::vector<OptimizedTemplate> optimizedTemplates;
+    std::string error;
+    bool isSyntaxError = false;
+    for (auto &job : jobs) {
+        try {
+            optimizedTemplates.push_back(job.get());
+        } catch (b2::SyntaxError& err) {
+            if (error.empty()) {
+                error = err.what();
+                isSyntaxError = true;
+            }
+        } catch (std::exception& ex) {
+            if (error.empty()) {
+                error = ex.what();
+            }
+        }
+    }
+
+    if (!error.empty()) {
+        // TODO: pass line number and filename
+        zend_throw_exception(isSyntaxError ? b2_syntaxerror_class_entry : nullptr, (char*) error.c_str(), 0);
+        return;
+    }
+
+    // code generation shares the engine's LLVM module, so it has to happen serially
+    array_init(return_value);
+    for (size_t i = 0; i < names.size(); i++) {
+        zval* templ;
+        MAKE_STD_ZVAL(templ);
+        if (!createTemplate(engine, getThis(), names[i], names[i], optimizedTemplates[i].ast.get(), optimizedTemplates[i].fragments, templ)) {
+            zval_ptr_dtor(&templ);
+            return;
+        }
+
+        add_next_index_zval(return_value, templ);
+    }
 }
 
 static PHP_METHOD(Engine, addFunction)
@@ -199,6 +716,18 @@ static PHP_METHOD(Engine, addFunction)
 
 	Engine_object* engine = (Engine_object*) zend_object_store_get_object(getThis() TSRMLS_CC);
 
+	// the templates compiled from here on convert what the function returns to this type once
+	zval** returns;
+	b2::ExpressionValueType returnType = b2::VariantType;
+	if (options && zend_hash_find(Z_ARRVAL_P(options), "returns", sizeof("returns"), (void**) &returns) == SUCCESS) {
+		try {
+			parseTypeHint(*returns, "what function '" + std::string(input, input_len) + "' returns", returnType);
+		} catch (std::exception& ex) {
+			zend_throw_exception(nullptr, (char*) ex.what(), 0);
+			return;
+		}
+	}
+
 	if (zend_hash_add(&engine->registeredFunctions, input, input_len, &cb, sizeof(zval*), nullptr) == FAILURE) {
 		zend_throw_exception(nullptr, "Couldn't add function to registeredFunctions hashtable", 0);
 		return;
@@ -206,6 +735,10 @@ static PHP_METHOD(Engine, addFunction)
 
 	// increase refcount
 	Z_ADDREF_P(cb);
+
+	if (returnType != b2::VariantType) {
+		engine->functionTypes[engine->includeContext.symbols().intern(std::string(input, input_len))] = returnType;
+	}
 }
 
 /* {{{ b2_functions[] : Engine class */
@@ -215,6 +748,17 @@ ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(engine_parseTemplate, 0, 0, 1)
     ZEND_ARG_INFO(0, filename)
+    ZEND_ARG_ARRAY_INFO(0, constants, 0)
+    ZEND_ARG_ARRAY_INFO(0, types, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(engine_compileString, 0, 0, 2)
+    ZEND_ARG_INFO(0, name)
+    ZEND_ARG_INFO(0, source)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(engine_parseTemplates, 0, 0, 1)
+    ZEND_ARG_ARRAY_INFO(0, filenames, 0)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(engine_addFunction, 0, 0, 1)
@@ -225,6 +769,8 @@ ZEND_END_ARG_INFO()
 static const zend_function_entry engine_functions[] = {
     PHP_ME(Engine, __construct,   engine_constructor,   ZEND_ACC_PUBLIC | ZEND_ACC_CTOR | ZEND_ACC_FINAL)
     PHP_ME(Engine, parseTemplate, engine_parseTemplate, ZEND_ACC_PUBLIC)
+    PHP_ME(Engine, compileString, engine_compileString, ZEND_ACC_PUBLIC)
+    PHP_ME(Engine, parseTemplates, engine_parseTemplates, ZEND_ACC_PUBLIC)
     PHP_ME(Engine, addFunction,   engine_addFunction,   ZEND_ACC_PUBLIC)
     PHP_FE_END
 };
@@ -262,16 +808,15 @@ static PHP_METHOD(Template, __construct)
     zend_throw_exception(NULL, "An object of this type cannot be created with the new operator", 0 TSRMLS_CC);
 }
 
-static void render_template(HashTable* assignments, Engine_object* engn, Template_object* templ, zval* dest_buffer)
+static void render_template(HashTable* assignments, Engine_object* engn, Template_object* templ, template_fn render, zval* dest_buffer)
 {
     // init buffer
-    template_buffer* buffer = (template_buffer*) emalloc(sizeof(template_buffer));
+    template_buffer* buffer = (template_buffer*) ecalloc(1, sizeof(template_buffer));
     buffer->ptr = (char*) emalloc(templ->estimatedBufferSize);
     buffer->allocated_length = templ->estimatedBufferSize;
-    buffer->str_length = 0;
 
     // run template
-    templ->renderFunc(assignments, buffer, &engn->registeredFunctions);
+    render(assignments, buffer, &engn->registeredFunctions);
 
     // fill dest_buffer
     ZVAL_STRINGL(dest_buffer, buffer->ptr, buffer->str_length, false);
@@ -280,6 +825,80 @@ static void render_template(HashTable* assignments, Engine_object* engn, Templat
     efree(buffer);
 }
 
+/*
+ * Where display() and renderTo() write to: the stream, or the output when there's none.
+ * When the output starts with `flushedPrefix`, which flushPrefix() already wrote, that
+ * part of it doesn't get written again.
+ */
+struct OutputTarget {
+    php_stream* stream;
+    const std::string* flushedPrefix;
+    size_t skipped; // how much of flushedPrefix got left out so far
+};
+
+static void write_to_target(OutputTarget* target, const char* data, size_t length)
+{
+    TSRMLS_FETCH();
+
+    if (target->stream) {
+        php_stream_write(target->stream, data, length);
+    } else {
+        PHPWRITE(data, length);
+    }
+}
+
+static void flush_to_target(template_buffer* buffer)
+{
+    OutputTarget* target = (OutputTarget*) buffer->flush_target;
+    const char* data = buffer->ptr;
+    size_t length = buffer->str_length;
+
+    if (target->flushedPrefix && target->skipped < target->flushedPrefix->length()) {
+        size_t compared = std::min(target->flushedPrefix->length() - target->skipped, length);
+        if (memcmp(data, target->flushedPrefix->data() + target->skipped, compared) == 0) {
+            target->skipped += compared;
+            data += compared;
+            length -= compared;
+        } else {
+            // the output doesn't start with the prefix after all, so write all of it
+            write_to_target(target, target->flushedPrefix->data(), target->skipped);
+            target->flushedPrefix = nullptr;
+        }
+    }
+
+    write_to_target(target, data, length);
+    buffer->str_length = 0;
+}
+
+/*
+ * Renders into a buffer which gets written to `target` whenever it grows past
+ * b2.flush_threshold, so the output goes out while it's being rendered and only that
+ * much of it is held in memory.
+ */
+static void stream_template(HashTable* assignments, Engine_object* engn, Template_object* templ, template_fn render, OutputTarget* target)
+{
+    size_t threshold = ini_size("b2.flush_threshold");
+
+    // init buffer
+    template_buffer buffer = {};
+    buffer.allocated_length = threshold > 0 ? threshold + BUFFER_CHUNK_SIZE : templ->estimatedBufferSize;
+    buffer.ptr = (char*) emalloc(buffer.allocated_length);
+    buffer.flush = threshold > 0 ? flush_to_target : nullptr;
+    buffer.flush_target = target;
+    buffer.flush_threshold = threshold;
+
+    // run template
+    render(assignments, &buffer, &engn->registeredFunctions);
+
+    // a render stopping early (eg. on a failed method call) doesn't store the output of
+    // the cache blocks it was in, which would keep the buffer from getting flushed
+    buffer.cache_marks = 0;
+
+    // write what's left, and free buffer
+    flush_to_target(&buffer);
+    efree(buffer.ptr);
+}
+
 static PHP_METHOD(Template, render)
 {
     HashTable* assignments;
@@ -293,7 +912,89 @@ static PHP_METHOD(Template, render)
 	Engine_object* engn = (Engine_object*) zend_object_store_get_object(z_engn TSRMLS_CC);
 
     // run template
-    render_template(assignments, engn, templ, return_value);
+    render_template(assignments, engn, templ, templ->renderFunc, return_value);
+}
+
+static PHP_METHOD(Template, renderMany)
+{
+    HashTable* assignmentSets;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "h", &assignmentSets) == FAILURE) {
+        RETURN_NULL();
+    }
+
+    Template_object* templ = (Template_object*) zend_object_store_get_object(getThis() TSRMLS_CC);
+	zval* z_engn = zend_read_property(b2_template_class_entry, getThis(), "engine", strlen("engine"), false);
+	Engine_object* engn = (Engine_object*) zend_object_store_get_object(z_engn TSRMLS_CC);
+
+    array_init_size(return_value, zend_hash_num_elements(assignmentSets));
+
+    // every render starts out with room for what the previous one rendered
+    template_buffer buffer = {};
+    size_t bufferSize = templ->estimatedBufferSize;
+
+    HashPosition pos;
+    zval** assignments;
+    for (zend_hash_internal_pointer_reset_ex(assignmentSets, &pos);
+         zend_hash_get_current_data_ex(assignmentSets, (void**) &assignments, &pos) == SUCCESS;
+         zend_hash_move_forward_ex(assignmentSets, &pos)) {
+        if (Z_TYPE_PP(assignments) != IS_ARRAY) {
+            zend_throw_exception(nullptr, "renderMany() expects an array of assignment arrays", 0);
+            return;
+        }
+
+        // run template
+        buffer.ptr = (char*) emalloc(bufferSize);
+        buffer.allocated_length = bufferSize;
+        buffer.str_length = 0;
+        buffer.cache_marks = 0;
+        templ->renderFunc(Z_ARRVAL_PP(assignments), &buffer, &engn->registeredFunctions);
+        bufferSize = buffer.str_length + BUFFER_CHUNK_SIZE;
+
+        // the result takes over the memory of the buffer, under the key of its assignments
+        zval* result;
+        MAKE_STD_ZVAL(result);
+        ZVAL_STRINGL(result, buffer.ptr, buffer.str_length, false);
+
+        char* key;
+        uint key_len;
+        ulong index;
+        if (zend_hash_get_current_key_ex(assignmentSets, &key, &key_len, &index, 0, &pos) == HASH_KEY_IS_STRING) {
+            add_assoc_zval_ex(return_value, key, key_len, result);
+        } else {
+            add_index_zval(return_value, index, result);
+        }
+
+        // a failed method call stops the batch, like it stops a render
+        if (EG(exception)) {
+            return;
+        }
+    }
+}
+
+static PHP_METHOD(Template, renderFragment)
+{
+    char* name = nullptr;
+    int name_len = 0;
+    HashTable* assignments;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "sH", &name, &name_len, &assignments) == FAILURE) {
+        RETURN_NULL();
+    }
+
+    Template_object* templ = (Template_object*) zend_object_store_get_object(getThis() TSRMLS_CC);
+    auto fragment = templ->fragments.find(std::string(name, name_len));
+    if (fragment == templ->fragments.end()) {
+        std::string message = "No fragment named '" + std::string(name, name_len) + "' found";
+        zend_throw_exception(nullptr, (char*) message.c_str(), 0);
+        return;
+    }
+
+	zval* z_engn = zend_read_property(b2_template_class_entry, getThis(), "engine", strlen("engine"), false);
+	Engine_object* engn = (Engine_object*) zend_object_store_get_object(z_engn TSRMLS_CC);
+
+    // run only the fragment
+    render_template(assignments, engn, templ, fragment->second, return_value);
 }
 
 static PHP_METHOD(Template, display)
@@ -308,16 +1009,48 @@ static PHP_METHOD(Template, display)
 	zval* z_engn = zend_read_property(b2_template_class_entry, getThis(), "engine", strlen("engine"), false);
 	Engine_object* engn = (Engine_object*) zend_object_store_get_object(z_engn TSRMLS_CC);
 
-    // allocate buffer
-    zval* buf;
-    MAKE_STD_ZVAL(buf);
+    // render template straight to the output, without what flushPrefix() already wrote
+    OutputTarget target = {nullptr, templ->prefixFlushed ? &templ->staticPrefix : nullptr, 0};
+    templ->prefixFlushed = false;
+    stream_template(assignments, engn, templ, templ->renderFunc, &target);
+}
+
+static PHP_METHOD(Template, flushPrefix)
+{
+    if (zend_parse_parameters_none() == FAILURE) {
+        return;
+    }
+
+    Template_object* templ = (Template_object*) zend_object_store_get_object(getThis() TSRMLS_CC);
+    if (templ->prefixFlushed) {
+        return;
+    }
+
+    // send the prefix to the client right away, the next display() leaves it out
+    PHPWRITE(templ->staticPrefix.data(), templ->staticPrefix.length());
+    sapi_flush(TSRMLS_C);
+    templ->prefixFlushed = true;
+}
+
+static PHP_METHOD(Template, renderTo)
+{
+    zval* z_stream;
+    HashTable* assignments;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "rH", &z_stream, &assignments) == FAILURE) {
+        return;
+    }
+
+    php_stream* stream;
+    php_stream_from_zval(stream, &z_stream);
 
-    // render template
-    render_template(assignments, engn, templ, buf);
+    Template_object* templ = (Template_object*) zend_object_store_get_object(getThis() TSRMLS_CC);
+	zval* z_engn = zend_read_property(b2_template_class_entry, getThis(), "engine", strlen("engine"), false);
+	Engine_object* engn = (Engine_object*) zend_object_store_get_object(z_engn TSRMLS_CC);
 
-    // write buffer to stdout and destroy it
-    PHPWRITE(Z_STRVAL_P(buf), Z_STRLEN_P(buf));
-    zval_ptr_dtor(&buf);
+    // render template straight to the stream
+    OutputTarget target = {stream, nullptr, 0};
+    stream_template(assignments, engn, templ, templ->renderFunc, &target);
 }
 
 /* {{{ b2_functions[] : Template class */
@@ -328,14 +1061,35 @@ ZEND_BEGIN_ARG_INFO_EX(template_render, 0, 0, 1)
     ZEND_ARG_INFO(0, assignments)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(template_renderMany, 0, 0, 1)
+    ZEND_ARG_ARRAY_INFO(0, assignmentSets, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(template_renderFragment, 0, 0, 2)
+    ZEND_ARG_INFO(0, name)
+    ZEND_ARG_INFO(0, assignments)
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_INFO_EX(template_display, 0, 0, 1)
     ZEND_ARG_INFO(0, assignments)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(template_flushPrefix, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(template_renderTo, 0, 0, 2)
+    ZEND_ARG_INFO(0, stream)
+    ZEND_ARG_INFO(0, assignments)
+ZEND_END_ARG_INFO()
+
 static const zend_function_entry template_functions[] = {
     PHP_ME(Template, __construct, template_constructor, ZEND_ACC_PRIVATE | ZEND_ACC_CTOR | ZEND_ACC_FINAL)
     PHP_ME(Template, render,      template_render,      ZEND_ACC_PUBLIC)
+    PHP_ME(Template, renderMany,  template_renderMany,  ZEND_ACC_PUBLIC)
+    PHP_ME(Template, renderFragment, template_renderFragment, ZEND_ACC_PUBLIC)
     PHP_ME(Template, display,     template_display,     ZEND_ACC_PUBLIC)
+    PHP_ME(Template, renderTo,    template_renderTo,    ZEND_ACC_PUBLIC)
+    PHP_ME(Template, flushPrefix, template_flushPrefix, ZEND_ACC_PUBLIC)
     PHP_FE_END
 };
 /* }}} */
@@ -344,6 +1098,19 @@ static PHP_MINIT_FUNCTION(b2) /* {{{ */
 {
     // TODO: implement clone handler
 
+    REGISTER_INI_ENTRIES();
+
+    // mapped before the SAPI forks its workers, so they all share it
+    size_t cacheSize = ini_size("b2.fragment_cache_size");
+    if (cacheSize > 0) {
+        b2_fragment_cache = fragment_cache_create(cacheSize, ini_size("b2.fragment_cache_slot_size"));
+    }
+
+    size_t parseThreads = ini_size("b2.parse_threads");
+    if (parseThreads > 1) {
+        b2_parse_pool = new b2::ThreadPool(parseThreads);
+    }
+
     zend_class_entry engine_ce;
     INIT_NS_CLASS_ENTRY(engine_ce, "b2", "Engine", engine_functions);
     engine_ce.create_object = Engine_object_create;
@@ -366,6 +1133,16 @@ static PHP_MINIT_FUNCTION(b2) /* {{{ */
 
 static PHP_MSHUTDOWN_FUNCTION(b2) /* {{{ */
 {
+    if (b2_fragment_cache) {
+        fragment_cache_destroy(b2_fragment_cache);
+        b2_fragment_cache = nullptr;
+    }
+
+    delete b2_parse_pool;
+    b2_parse_pool = nullptr;
+
+    UNREGISTER_INI_ENTRIES();
+
     return SUCCESS;
 }
 /* }}} */
@@ -2,6 +2,8 @@
 #include "php_bindings.hpp"
 
 #include <llvm/IR/Type.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/GlobalVariable.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/ValueSymbolTable.h>
@@ -13,6 +15,8 @@
 
 #include <llvm/Linker.h>
 
+#include <vector>
+
 using namespace llvm;
 using namespace b2;
 
@@ -21,7 +25,7 @@ extern "C" {
     extern int php_bindings_functions_len;
 }
 
-PHPBindings::PHPBindings(IRBuilder<> &irBuilder) : LLVMBindings(irBuilder)
+PHPBindings::PHPBindings(IRBuilder<> &irBuilder) : LLVMBindings(irBuilder), m_templateRegistry(nullptr), m_fragmentCache(nullptr)
 {
 	SMDiagnostic irErr;
     auto buffer = MemoryBuffer::getMemBuffer(StringRef(php_bindings_functions, php_bindings_functions_len), "php_bindings_functions.bc", false);
@@ -29,12 +33,31 @@ PHPBindings::PHPBindings(IRBuilder<> &irBuilder) : LLVMBindings(irBuilder)
     // TODO: check err
 }
 
+PHPBindings::~PHPBindings()
+{
+    for (auto array : m_constantArrays) {
+        Z_DELREF_P(array);
+        zval_ptr_dtor(&array);
+    }
+}
+
 void PHPBindings::linkInFunctions(llvm::Module *module)
 {
 	std::string linkerErr;
     if (Linker::LinkModules(module, m_module.get(), Linker::PreserveSource, &linkerErr) == true) {
         throw std::runtime_error("Error during linking of modules: " + linkerErr);
     }
+
+    // looking up a variable or attribute doesn't change anything, so LLVM may merge repeated lookups.
+    // These attributes are only sound because the variables of a template are immutable while it
+    // renders: a registered function or method modifying an object it got passed would break this
+    for (auto name : {"get_value_from_hashtable", "get_attribute"}) {
+        auto func = module->getFunction(name);
+        if (func) {
+            func->setOnlyReadsMemory();
+            func->setDoesNotThrow();
+        }
+    }
 }
 
 static Value* getArgumentAtIdx(Function* func, size_t argIdx)
@@ -108,11 +131,9 @@ Value* PHPBindings::createPrintCall(Value *value)
     auto valueType = value->getType();
     auto printMethod = this->getPrintMethodForType(valueType);
 
-    auto templateFn = m_irBuilder.GetInsertBlock()->getParent();
-
     Value* callArgs[] = {
         /*v*/      value,
-        /*buffer*/ getArgumentAtIdx(templateFn, 1) // TODO: use "buffer" instead of 1
+        /*buffer*/ getOutputBuffer(),
     };
     return m_irBuilder.CreateCall(printMethod, callArgs);
 }
@@ -293,14 +314,14 @@ Value* PHPBindings::createVariantUnaryOperation(UnaryOperation op, Value *val)
     return value;
 }
 
-Value* PHPBindings::createVariableLookup(const char* variableName)
+Value* PHPBindings::createVariableLookup(llvm::StringRef variableName)
 {
     auto function = m_irBuilder.GetInsertBlock()->getParent();
 
     Value* lookupVariableArgs[] = {
         /*map*/       getArgumentAtIdx(function, 0), // TODO: use "assignments" instead of 0
         /*key*/       m_irBuilder.CreateGlobalStringPtr(variableName),
-        /*keyLength*/ m_irBuilder.getInt32(strlen(variableName))
+        /*keyLength*/ m_irBuilder.getInt32(variableName.size())
     };
     auto value = m_irBuilder.CreateCall(findFunction("get_value_from_hashtable"), lookupVariableArgs);
 
@@ -310,7 +331,7 @@ Value* PHPBindings::createVariableLookup(const char* variableName)
     return value;
 }
 
-llvm::Value* PHPBindings::createMethodCall(const char* methodName, llvm::ArrayRef<llvm::Value*> arguments)
+llvm::Value* PHPBindings::createMethodCall(llvm::StringRef methodName, llvm::ArrayRef<llvm::Value*> arguments)
 {
     auto templateFn = m_irBuilder.GetInsertBlock()->getParent();
 
@@ -337,7 +358,7 @@ llvm::Value* PHPBindings::createMethodCall(const char* methodName, llvm::ArrayRe
     Value* methodCallArgs[] = {
 		/*func_table*/         getArgumentAtIdx(templateFn, 2), // TODO: use "functions" instead of 2
         /*functionName*/       m_irBuilder.CreateGlobalStringPtr(methodName),
-        /*functionNameLength*/ m_irBuilder.getInt32(strlen(methodName)),
+        /*functionNameLength*/ m_irBuilder.getInt32(methodName.size()),
         /*param_count*/        m_irBuilder.getInt32(arguments.size()),
         /*params*/             argumentsValue,
     };
@@ -356,12 +377,12 @@ llvm::Value* PHPBindings::createMethodCall(const char* methodName, llvm::ArrayRe
     return returnValue;
 }
 
-llvm::Value* PHPBindings::createGetAttribute(const char* attribute, llvm::Value* variable)
+llvm::Value* PHPBindings::createGetAttribute(llvm::StringRef attribute, llvm::Value* variable)
 {
     Value* getAttributeArgs[] = {
         /*map*/       variable,
         /*key*/       m_irBuilder.CreateGlobalStringPtr(attribute),
-        /*keyLength*/ m_irBuilder.getInt32(strlen(attribute))
+        /*keyLength*/ m_irBuilder.getInt32(attribute.size())
     };
     auto value = m_irBuilder.CreateCall(findFunction("get_attribute"), getAttributeArgs);
 
@@ -374,12 +395,464 @@ llvm::Value* PHPBindings::createGetAttribute(const char* attribute, llvm::Value*
     return value;
 }
 
+void PHPBindings::createIncludeCall(llvm::Value* function, llvm::Value* scope, llvm::ArrayRef<llvm::StringRef> variableNames, llvm::ArrayRef<llvm::Value*> variables)
+{
+    auto templateFn = m_irBuilder.GetInsertBlock()->getParent();
+    auto buffer = getOutputBuffer();
+    auto functions = getArgumentAtIdx(templateFn, 2); // TODO: use "functions" instead of 2
+
+    if (scope) {
+        if (!isVariantType(scope->getType())) {
+            scope = wrapAsVariant(scope);
+        }
+
+        Value* callArgs[] = {
+            /*include*/   function,
+            /*scope*/     scope,
+            /*buffer*/    buffer,
+            /*functions*/ functions,
+        };
+        m_irBuilder.CreateCall(findFunction("call_include_with_scope"), callArgs);
+
+        variableGoesOutOfScope(scope);
+    } else {
+        auto assignments = m_irBuilder.CreateCall(findFunction("include_assignments_init"), m_irBuilder.getInt32(variables.size()));
+
+        for (size_t i = 0; i < variables.size(); i++) {
+            llvm::Value* value = variables[i];
+            bool temporary = !isVariantType(value->getType());
+            if (temporary) {
+                value = wrapAsVariant(value);
+            }
+
+            Value* addArgs[] = {
+                /*assignments*/ assignments,
+                /*key*/         m_irBuilder.CreateGlobalStringPtr(variableNames[i]),
+                /*keyLength*/   m_irBuilder.getInt32(variableNames[i].size()),
+                /*value*/       value,
+                /*temporary*/   m_irBuilder.getInt1(temporary),
+            };
+            m_irBuilder.CreateCall(findFunction("include_assignments_add"), addArgs);
+
+            // the assignments hold their own reference
+            variableGoesOutOfScope(value);
+        }
+
+        Value* callArgs[] = {
+            /*assignments*/ assignments,
+            /*buffer*/      buffer,
+            /*functions*/   functions,
+        };
+        m_irBuilder.CreateCall(function, callArgs);
+        m_irBuilder.CreateCall(findFunction("include_assignments_destroy"), assignments);
+    }
+
+    // the include stops rendering when a method call fails, so should we
+    createRetVoidIfCallFails(m_irBuilder.CreateCall(findFunction("include_succeeded")));
+}
+
+llvm::Value* PHPBindings::createIncludeLookup(llvm::Value* name)
+{
+    if (!m_templateRegistry) {
+        throw std::runtime_error("No template registry to resolve dynamic includes with");
+    }
+
+    if (!isVariantType(name->getType())) {
+        name = wrapAsVariant(name);
+    }
+
+    auto resolveInclude = findFunction("resolve_include");
+    auto resolveIncludeType = resolveInclude->getFunctionType();
+    auto module = resolveInclude->getParent();
+
+    // the registry outlives the generated code, so its address can be baked in
+    auto registry = ConstantExpr::getIntToPtr(
+        ConstantInt::get(IntegerType::get(m_irBuilder.getContext(), sizeof(void*) * 8), reinterpret_cast<uintptr_t>(m_templateRegistry)),
+        resolveIncludeType->getParamType(0)
+    );
+
+    // every include site caches the template it resolved to last
+    auto lastResolvedType = static_cast<PointerType*>(resolveIncludeType->getParamType(1))->getElementType();
+    auto lastResolved = new GlobalVariable(*module, lastResolvedType, false, GlobalValue::InternalLinkage, Constant::getNullValue(lastResolvedType), "include_site");
+
+    Value* callArgs[] = {
+        /*registry*/      registry,
+        /*last_resolved*/ lastResolved,
+        /*name*/          name,
+    };
+    auto function = m_irBuilder.CreateCall(resolveInclude, callArgs);
+
+    variableGoesOutOfScope(name);
+
+    auto callSucceeded = m_irBuilder.CreateICmpNE(function, ConstantPointerNull::get(static_cast<PointerType*>(function->getType())));
+    createRetVoidIfCallFails(callSucceeded);
+
+    return function;
+}
+
 bool PHPBindings::isVariantType(llvm::Type *type)
 {
     return type->isPointerTy() && static_cast<PointerType*>(type)->getElementType()->isStructTy() &&
             static_cast<StructType*>(type->getPointerElementType())->isLayoutIdentical(getVariantType());
 }
 
+FunctionType* PHPBindings::getMacroFunctionType(Module* module, size_t parameterCount)
+{
+    auto templateFunctionType = getTemplateFunctionType(module);
+    auto variantType = module->getTypeByName("struct._zval_struct");
+    if (!variantType) {
+        throw std::runtime_error("Couldn't find _zval_struct!");
+    }
+
+    std::vector<Type*> parameterTypes(templateFunctionType->param_begin(), templateFunctionType->param_end());
+    parameterTypes.insert(parameterTypes.end(), parameterCount, variantType->getPointerTo());
+    return FunctionType::get(templateFunctionType->getReturnType(), parameterTypes, false);
+}
+
+Value* PHPBindings::getMacroArgument(Function* function, size_t index)
+{
+    auto templateArgumentCount = getTemplateFunctionType(function->getParent())->getNumParams();
+    auto argument = getArgumentAtIdx(function, templateArgumentCount + index);
+
+    // tag this variable as not-to-be-destroyed
+    m_variablesRefCount[argument] = -1;
+
+    return argument;
+}
+
+void PHPBindings::createMacroCall(Function* function, ArrayRef<Value*> arguments)
+{
+    auto templateFn = m_irBuilder.GetInsertBlock()->getParent();
+
+    // the macro renders for this template (which could be a macro itself)
+    auto templateArgumentCount = getTemplateFunctionType(templateFn->getParent())->getNumParams();
+    std::vector<Value*> callArgs;
+    for (size_t i = 0; i < templateArgumentCount; i++) {
+        callArgs.push_back(getArgumentAtIdx(templateFn, i));
+    }
+    callArgs[1] = getOutputBuffer(); // TODO: use "buffer" instead of 1
+
+    // the macro only borrows its arguments, so temporaries can stay on our stack
+    std::vector<Value*> variants;
+    for (auto argument : arguments) {
+        if (!isVariantType(argument->getType())) {
+            argument = wrapAsVariant(argument);
+        }
+        variants.push_back(argument);
+        callArgs.push_back(argument);
+    }
+    m_irBuilder.CreateCall(function, callArgs);
+
+    for (auto variant : variants) {
+        variableGoesOutOfScope(variant);
+    }
+
+    // the macro stops rendering when a method call fails, so should we
+    createRetVoidIfCallFails(m_irBuilder.CreateCall(findFunction("include_succeeded")));
+}
+
+void PHPBindings::createCaptureStart()
+{
+    auto templateFn = m_irBuilder.GetInsertBlock()->getParent();
+    auto bufferType = getTemplateFunctionType(templateFn->getParent())->getParamType(1)->getPointerElementType();
+
+    // allocate the buffer up front, a capture within a loop would grow the stack otherwise
+    auto &entryBlock = templateFn->getEntryBlock();
+    IRBuilder<> entryBuilder(&entryBlock, entryBlock.begin());
+    auto buffer = entryBuilder.CreateAlloca(bufferType);
+
+    // start out empty, the string of a previous capture got handed over to its variant
+    m_irBuilder.CreateStore(Constant::getNullValue(bufferType), buffer);
+
+    m_captureBuffers.push_back(buffer);
+}
+
+Value* PHPBindings::createCaptureEnd()
+{
+    auto buffer = m_captureBuffers.back();
+    m_captureBuffers.pop_back();
+
+    auto value = m_irBuilder.CreateCall(findFunction("capture_to_variant"), buffer);
+
+    // init variable refcount
+    m_variablesRefCount[value] = 1;
+
+    return value;
+}
+
+Value* PHPBindings::createVariantGetInteger(Value* variant, Value** value)
+{
+    // TODO: find out native integer width
+    auto ptrToValue = m_irBuilder.CreateAlloca(m_irBuilder.getInt64Ty());
+
+    Value* args[] = {
+        /*v*/      variant,
+        /*result*/ ptrToValue,
+    };
+    auto isInteger = m_irBuilder.CreateCall(findFunction("variant_get_long"), args);
+
+    *value = m_irBuilder.CreateLoad(ptrToValue);
+    return isInteger;
+}
+
+Value* PHPBindings::createVariantGetString(Value* variant, Value** characters, Value** length)
+{
+    auto ptrToCharacters = m_irBuilder.CreateAlloca(m_irBuilder.getInt8PtrTy());
+    // TODO: find out native size_t width
+    auto ptrToLength = m_irBuilder.CreateAlloca(m_irBuilder.getInt64Ty());
+
+    Value* args[] = {
+        /*v*/      variant,
+        /*str*/    ptrToCharacters,
+        /*length*/ ptrToLength,
+    };
+    auto isString = m_irBuilder.CreateCall(findFunction("variant_get_string"), args);
+
+    *characters = m_irBuilder.CreateLoad(ptrToCharacters);
+    *length = m_irBuilder.CreateLoad(ptrToLength);
+    return isString;
+}
+
+Value* PHPBindings::createVariantConversion(Value* variant, ExpressionValueType type)
+{
+    const char* functionName;
+    switch (type) {
+        case IntegerType:
+            functionName = "variant_to_long";
+            break;
+        case DoubleType:
+            functionName = "variant_to_double";
+            break;
+        case BooleanType:
+            functionName = "variant_to_bool";
+            break;
+        default:
+            throw std::runtime_error("Variants can only be converted to integers, doubles and booleans");
+    }
+
+    auto value = m_irBuilder.CreateCall(findFunction(functionName), variant);
+    variableGoesOutOfScope(variant);
+    return value;
+}
+
+Value* PHPBindings::createConcatenation(ArrayRef<Value*> operands)
+{
+    auto variantPtrType = getVariantType()->getPointerTo();
+    auto operandsValue = m_irBuilder.CreateAlloca(variantPtrType, m_irBuilder.getInt32(operands.size()));
+
+    int index = 0;
+    std::vector<Value*> variants;
+    for (Value* operand : operands) {
+        auto ptr = m_irBuilder.CreateInBoundsGEP(operandsValue, m_irBuilder.getInt32(index++));
+        if (!isVariantType(operand->getType())) {
+            operand = wrapAsVariant(operand);
+        }
+        m_irBuilder.CreateStore(operand, ptr);
+        variants.push_back(operand);
+    }
+
+    Value* concatArgs[] = {
+        /*count*/    m_irBuilder.getInt32(operands.size()),
+        /*operands*/ operandsValue,
+    };
+    auto value = m_irBuilder.CreateCall(findFunction("concat_variants"), concatArgs);
+
+	// init variable refcount
+	m_variablesRefCount[value] = 1;
+
+    for (auto variant : variants) {
+        variableGoesOutOfScope(variant);
+    }
+
+    return value;
+}
+
+Value* PHPBindings::createArray(ArrayRef<Value*> keys, ArrayRef<Value*> values)
+{
+    auto array = m_irBuilder.CreateCall(findFunction("array_literal_init"), m_irBuilder.getInt32(values.size()));
+
+	// init variable refcount
+	m_variablesRefCount[array] = 1;
+
+    for (size_t i = 0; i < values.size(); i++) {
+        auto value = values[i];
+        if (!isVariantType(value->getType())) {
+            value = wrapAsVariant(value);
+        }
+
+        if (keys.empty()) {
+            Value* appendArgs[] = {
+                /*array*/ array,
+                /*value*/ value,
+            };
+            m_irBuilder.CreateCall(findFunction("array_literal_append"), appendArgs);
+        } else {
+            auto key = keys[i];
+            if (!isVariantType(key->getType())) {
+                key = wrapAsVariant(key);
+            }
+
+            Value* setArgs[] = {
+                /*array*/ array,
+                /*key*/   key,
+                /*value*/ value,
+            };
+            m_irBuilder.CreateCall(findFunction("array_literal_set"), setArgs);
+            variableGoesOutOfScope(key);
+        }
+
+        variableGoesOutOfScope(value);
+    }
+
+    return array;
+}
+
+static zval* createConstantZval(Expression* literal)
+{
+    zval* value;
+    MAKE_STD_ZVAL(value);
+
+    switch (literal->type()) {
+        case IntegerLiteralExpressionType:
+            ZVAL_LONG(value, static_cast<IntegerLiteralExpression*>(literal)->value);
+            break;
+        case DoubleLiteralExpressionType:
+            ZVAL_DOUBLE(value, static_cast<DoubleLiteralExpression*>(literal)->value);
+            break;
+        case BooleanLiteralExpressionType:
+            ZVAL_BOOL(value, static_cast<BooleanLiteralExpression*>(literal)->value);
+            break;
+        case StringLiteralExpressionType: {
+            auto &str = static_cast<StringLiteralExpression*>(literal)->value;
+            ZVAL_STRINGL(value, str.data(), str.length(), 1);
+            break;
+        }
+        case ArrayLiteralExpressionType: {
+            auto array = static_cast<ArrayLiteralExpression*>(literal);
+            array_init_size(value, array->values->size());
+            for (size_t i = 0; i < array->values->size(); i++) {
+                auto element = createConstantZval((*array->values)[i].get());
+                if (!array->isMap()) {
+                    add_next_index_zval(value, element);
+                    continue;
+                }
+
+                auto key = (*array->keys)[i].get();
+                if (key->type() == IntegerLiteralExpressionType) {
+                    add_index_zval(value, static_cast<IntegerLiteralExpression*>(key)->value, element);
+                } else {
+                    // the key needs to be NUL-terminated
+                    std::string name(static_cast<StringLiteralExpression*>(key)->value.str());
+                    add_assoc_zval_ex(value, name.c_str(), name.length() + 1, element);
+                }
+            }
+            break;
+        }
+        default:
+            throw std::runtime_error("Array literal has a non-constant value");
+    }
+
+    return value;
+}
+
+Value* PHPBindings::createConstantArray(ArrayLiteralExpression* literal)
+{
+    // the array gets built once; the extra reference keeps it from being destroyed or
+    // separated by the functions it gets passed to, which copy it on write instead
+    zval* array = createConstantZval(literal);
+    Z_ADDREF_P(array);
+    m_constantArrays.push_back(array);
+
+    auto value = ConstantExpr::getIntToPtr(
+        ConstantInt::get(IntegerType::get(m_irBuilder.getContext(), sizeof(void*) * 8), reinterpret_cast<uintptr_t>(array)),
+        getVariantType()->getPointerTo()
+    );
+
+    // tag zval as not-to-be-destroyed
+	m_variablesRefCount[value] = -1;
+
+    return value;
+}
+
+Value* PHPBindings::createCacheFetch(StringRef block, Value* key)
+{
+    auto fetch = findFunction("fragment_cache_fetch");
+
+    bool isWrapped = !isVariantType(key->getType());
+    if (isWrapped) {
+        key = wrapAsVariant(key);
+    }
+
+    Value* callArgs[] = {
+        /*cache*/  getFragmentCache(fetch),
+        /*block*/  m_irBuilder.CreateGlobalStringPtr(block),
+        /*key*/    key,
+        /*buffer*/ getOutputBuffer(),
+    };
+    auto isCached = m_irBuilder.CreateCall(fetch, callArgs);
+
+    if (isWrapped) {
+        variableGoesOutOfScope(key);
+    }
+
+    return isCached;
+}
+
+Value* PHPBindings::createCacheMark()
+{
+    return m_irBuilder.CreateCall(findFunction("fragment_cache_mark"), getOutputBuffer());
+}
+
+void PHPBindings::createCacheStore(StringRef block, Value* key, long ttl, Value* mark)
+{
+    auto store = findFunction("fragment_cache_store");
+
+    bool isWrapped = !isVariantType(key->getType());
+    if (isWrapped) {
+        key = wrapAsVariant(key);
+    }
+
+    Value* callArgs[] = {
+        /*cache*/  getFragmentCache(store),
+        /*block*/  m_irBuilder.CreateGlobalStringPtr(block),
+        /*key*/    key,
+        /*ttl*/    m_irBuilder.getInt64(ttl), // TODO: find out native integer width
+        /*buffer*/ getOutputBuffer(),
+        /*mark*/   mark,
+    };
+    m_irBuilder.CreateCall(store, callArgs);
+
+    if (isWrapped) {
+        variableGoesOutOfScope(key);
+    }
+}
+
+/*
+ * Returns the fragment cache as the first argument of `cacheFunction`: it outlives the
+ * generated code, so its address can be baked in.
+ */
+Value* PHPBindings::getFragmentCache(Function* cacheFunction)
+{
+    return ConstantExpr::getIntToPtr(
+        ConstantInt::get(IntegerType::get(m_irBuilder.getContext(), sizeof(void*) * 8), reinterpret_cast<uintptr_t>(m_fragmentCache)),
+        cacheFunction->getFunctionType()->getParamType(0)
+    );
+}
+
+/*
+ * Returns the buffer to render into: the one of the innermost capture, otherwise the
+ * one of the template.
+ */
+Value* PHPBindings::getOutputBuffer()
+{
+    if (!m_captureBuffers.empty()) {
+        return m_captureBuffers.back();
+    }
+
+    auto templateFn = m_irBuilder.GetInsertBlock()->getParent();
+    return getArgumentAtIdx(templateFn, 1); // TODO: use "buffer" instead of 1
+}
+
 Value* PHPBindings::wrapAsVariant(Value *value)
 {
     Value* wrappingFunction;
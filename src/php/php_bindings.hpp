@@ -9,6 +9,11 @@
 
 #include <memory>
 #include <unordered_map>
+#include <vector>
+
+struct fragment_cache;
+struct template_registry;
+struct _zval_struct;
 
 namespace b2 {
 
@@ -21,18 +26,35 @@ class PHPBindings : public LLVMBindings
 {
 public:
     PHPBindings(llvm::IRBuilder<> &irBuilder);
-    virtual ~PHPBindings() {}
+    virtual ~PHPBindings();
 
 	void linkInFunctions(llvm::Module* module);
 	llvm::Module* getFunctionsModule() {
 		return m_module.get();
 	}
 
+	/*
+	 * Sets the registry dynamic includes get resolved with, it should outlive every template
+	 * generated with these bindings.
+	 */
+	void setTemplateRegistry(template_registry* registry) {
+		m_templateRegistry = registry;
+	}
+
+	/*
+	 * Sets the fragment cache cache blocks get stored in, it should outlive every template
+	 * generated with these bindings. Without one, cache blocks always get rendered.
+	 */
+	void setFragmentCache(fragment_cache* cache) {
+		m_fragmentCache = cache;
+	}
+
     virtual void functionTeardown() override {
         m_irBuilder.CreateRetVoid();
 
         // reset internal state
 		m_variablesRefCount.clear();
+		m_captureBuffers.clear();
     }
 
     virtual llvm::FunctionType* getTemplateFunctionType(llvm::Module* module) override;
@@ -49,14 +71,32 @@ public:
     virtual llvm::Value* createVariantComparison(ComparisonOperation op, llvm::Value* left, llvm::Value *right) override;
     virtual llvm::Value* createVariantBinaryOperation(BinaryOperation op, llvm::Value* left, llvm::Value *right) override;
     virtual llvm::Value* createVariantUnaryOperation(UnaryOperation op, llvm::Value* val) override;
-    virtual llvm::Value* createVariableLookup(const char* variableName) override;
-    virtual llvm::Value* createMethodCall(const char* methodName, llvm::ArrayRef<llvm::Value*> arguments) override;
-    virtual llvm::Value* createGetAttribute(const char* attributeName, llvm::Value* variable) override;
+    virtual llvm::Value* createVariableLookup(llvm::StringRef variableName) override;
+    virtual llvm::Value* createMethodCall(llvm::StringRef methodName, llvm::ArrayRef<llvm::Value*> arguments) override;
+    virtual llvm::Value* createGetAttribute(llvm::StringRef attributeName, llvm::Value* variable) override;
+    virtual void createIncludeCall(llvm::Value* function, llvm::Value* scope, llvm::ArrayRef<llvm::StringRef> variableNames, llvm::ArrayRef<llvm::Value*> variables) override;
+    virtual llvm::Value* createIncludeLookup(llvm::Value* name) override;
+    virtual llvm::FunctionType* getMacroFunctionType(llvm::Module* module, size_t parameterCount) override;
+    virtual llvm::Value* getMacroArgument(llvm::Function* function, size_t index) override;
+    virtual void createMacroCall(llvm::Function* function, llvm::ArrayRef<llvm::Value*> arguments) override;
+    virtual void createCaptureStart() override;
+    virtual llvm::Value* createCaptureEnd() override;
+    virtual llvm::Value* createVariantGetInteger(llvm::Value* variant, llvm::Value** value) override;
+    virtual llvm::Value* createVariantGetString(llvm::Value* variant, llvm::Value** characters, llvm::Value** length) override;
+    virtual llvm::Value* createVariantConversion(llvm::Value* variant, ExpressionValueType type) override;
+    virtual llvm::Value* createConcatenation(llvm::ArrayRef<llvm::Value*> operands) override;
+    virtual llvm::Value* createArray(llvm::ArrayRef<llvm::Value*> keys, llvm::ArrayRef<llvm::Value*> values) override;
+    virtual llvm::Value* createConstantArray(ArrayLiteralExpression* literal) override;
+    virtual llvm::Value* createCacheFetch(llvm::StringRef block, llvm::Value* key) override;
+    virtual llvm::Value* createCacheMark() override;
+    virtual void createCacheStore(llvm::StringRef block, llvm::Value* key, long ttl, llvm::Value* mark) override;
 private:
 	void createRetVoidIfCallFails(llvm::Value* callResult);
     llvm::Value* wrapAsVariant(llvm::Value* value);
     llvm::Function* getPrintMethodForType(llvm::Type* type);
     llvm::Function* findFunction(llvm::StringRef name);
+    llvm::Value* getOutputBuffer();
+    llvm::Value* getFragmentCache(llvm::Function* cacheFunction);
     void linkInModule(llvm::Module* dest);
 
 	inline llvm::StructType* getVariantType() {
@@ -69,9 +109,15 @@ private:
 	}
 
 	std::unique_ptr<llvm::Module> m_module;
+	template_registry* m_templateRegistry;
+	fragment_cache* m_fragmentCache;
 
     std::unordered_map<llvm::Value*,ForLoopMetadata> m_forLoopMetadata;
 	std::unordered_map<llvm::Value*,int> m_variablesRefCount;
+	// the scratch buffers of the captures being rendered, innermost last
+	std::vector<llvm::Value*> m_captureBuffers;
+	// the arrays of constant array literals, shared by every render of the generated code
+	std::vector<_zval_struct*> m_constantArrays;
 };
 
 } // namespace b2
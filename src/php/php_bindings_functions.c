@@ -1,7 +1,12 @@
 #include "php_template.h"
 
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include <main/php.h>
 #include <Zend/zend_API.h>
@@ -14,6 +19,13 @@ void php_prototype(HashTable* assignments, struct template_buffer* buffer, HashT
 {
 }
 
+static void flush_buffer_if_full(struct template_buffer* buffer)
+{
+    if (buffer->flush != NULL && buffer->str_length >= buffer->flush_threshold && buffer->cache_marks == 0) {
+        buffer->flush(buffer);
+    }
+}
+
 static void add_to_buffer(struct template_buffer* buffer, zval* str)
 {
     int str_len = Z_STRLEN_P(str);
@@ -29,6 +41,8 @@ static void add_to_buffer(struct template_buffer* buffer, zval* str)
 
 	// NULL-terminate string
 	buffer->ptr[buffer->str_length] = 0;
+
+	flush_buffer_if_full(buffer);
 }
 
 ALWAYS_INLINE void print_double(double v, struct template_buffer* buffer)
@@ -176,6 +190,181 @@ bool unary_variant_operation(const char op, zval** result, zval* value)
 	}
 }
 
+/*
+ * Stores the integer held by `v` in `result`, returns whether `v` holds one.
+ */
+ALWAYS_INLINE bool variant_get_long(zval* v, long* result)
+{
+    if (Z_TYPE_P(v) != IS_LONG) {
+        return false;
+    }
+
+    *result = Z_LVAL_P(v);
+    return true;
+}
+
+/*
+ * Returns the integer held by `v`, converting what it holds when it isn't one.
+ */
+ALWAYS_INLINE long variant_to_long(zval* v)
+{
+    zval copy;
+
+    if (Z_TYPE_P(v) == IS_LONG) {
+        return Z_LVAL_P(v);
+    }
+
+    ZVAL_COPY_VALUE(&copy, v);
+    zval_copy_ctor(&copy);
+    convert_to_long(&copy);
+    return Z_LVAL(copy);
+}
+
+/*
+ * Returns the double held by `v`, converting what it holds when it isn't one.
+ */
+ALWAYS_INLINE double variant_to_double(zval* v)
+{
+    zval copy;
+
+    if (Z_TYPE_P(v) == IS_DOUBLE) {
+        return Z_DVAL_P(v);
+    }
+
+    ZVAL_COPY_VALUE(&copy, v);
+    zval_copy_ctor(&copy);
+    convert_to_double(&copy);
+    return Z_DVAL(copy);
+}
+
+/*
+ * Returns whether `v` is true, the way PHP would convert it to a boolean.
+ */
+ALWAYS_INLINE bool variant_to_bool(zval* v)
+{
+    if (Z_TYPE_P(v) == IS_BOOL) {
+        return Z_BVAL_P(v);
+    }
+
+    return zval_is_true(v);
+}
+
+/*
+ * Stores the string held by `v` in `str` and `length`, returns whether `v` holds one.
+ */
+ALWAYS_INLINE bool variant_get_string(zval* v, const char** str, size_t* length)
+{
+    if (Z_TYPE_P(v) != IS_STRING) {
+        return false;
+    }
+
+    *str = Z_STRVAL_P(v);
+    *length = Z_STRLEN_P(v);
+    return true;
+}
+
+/*
+ * Turns the output rendered into `captured` into a string, which takes over its memory.
+ */
+zval* capture_to_variant(struct template_buffer* captured)
+{
+    zval* result;
+    MAKE_STD_ZVAL(result);
+
+    if (captured->ptr) {
+        ZVAL_STRINGL(result, captured->ptr, captured->str_length, false);
+    } else {
+        ZVAL_EMPTY_STRING(result);
+    }
+
+    return result;
+}
+
+/*
+ * Concatenates the `count` variants in `operands` into a new string, converting the ones
+ * which aren't strings the way printing them would. The string gets allocated once, at
+ * its final size.
+ */
+zval* concat_variants(uint count, zval* operands[])
+{
+    zval* result;
+    zval* strings = safe_emalloc(count, sizeof(zval), 0);
+    size_t length = 0;
+    char* str;
+    uint i;
+
+    for (i = 0; i < count; i++) {
+        ZVAL_COPY_VALUE(&strings[i], operands[i]);
+        if (Z_TYPE(strings[i]) != IS_STRING) {
+            zval_copy_ctor(&strings[i]);
+            convert_to_string(&strings[i]);
+        }
+        length += Z_STRLEN(strings[i]);
+    }
+
+    str = emalloc(length + 1);
+    length = 0;
+    for (i = 0; i < count; i++) {
+        memcpy(&str[length], Z_STRVAL(strings[i]), Z_STRLEN(strings[i]));
+        length += Z_STRLEN(strings[i]);
+
+        if (Z_TYPE_P(operands[i]) != IS_STRING) {
+            zval_dtor(&strings[i]);
+        }
+    }
+    str[length] = 0;
+    efree(strings);
+
+    MAKE_STD_ZVAL(result);
+    ZVAL_STRINGL(result, str, length, false);
+    return result;
+}
+
+/*
+ * Returns a new, empty array with room for `size` elements.
+ */
+zval* array_literal_init(uint size)
+{
+    zval* array;
+    MAKE_STD_ZVAL(array);
+    array_init_size(array, size);
+    return array;
+}
+
+/*
+ * Returns a copy of `value` for storing in an array, as it could live on the stack.
+ */
+static zval* array_literal_value(zval* value)
+{
+    zval* copy;
+    MAKE_STD_ZVAL(copy);
+    ZVAL_COPY_VALUE(copy, value);
+    zval_copy_ctor(copy);
+    return copy;
+}
+
+/*
+ * Appends a copy of `value` to `array`.
+ */
+void array_literal_append(zval* array, zval* value)
+{
+    add_next_index_zval(array, array_literal_value(value));
+}
+
+/*
+ * Stores a copy of `value` in `array`, keyed by `key` (an integer or a string).
+ */
+void array_literal_set(zval* array, zval* key, zval* value)
+{
+    zval* copy = array_literal_value(value);
+
+    if (Z_TYPE_P(key) == IS_LONG) {
+        zend_hash_index_update(Z_ARRVAL_P(array), Z_LVAL_P(key), &copy, sizeof(zval*), NULL);
+    } else {
+        zend_symtable_update(Z_ARRVAL_P(array), Z_STRVAL_P(key), Z_STRLEN_P(key) + 1, &copy, sizeof(zval*), NULL);
+    }
+}
+
 /*
  * The return value of this function should never be destroyed nor refcount decremented!
  */
@@ -302,6 +491,365 @@ ALWAYS_INLINE void set_zval_string_nocopy(zval* zv, const char* value)
     ZVAL_STRING(zv, value, false);
 }
 
+HashTable* include_assignments_init(uint count)
+{
+    HashTable* assignments;
+    ALLOC_HASHTABLE(assignments);
+    zend_hash_init(assignments, count, NULL, ZVAL_PTR_DTOR, 0);
+    return assignments;
+}
+
+/*
+ * Binds `value` to `key`. A `temporary` value lives on the stack of the calling template, so
+ * it gets copied; other values are shared.
+ */
+void include_assignments_add(HashTable* assignments, const char* key, uint keyLength, zval* value, bool temporary)
+{
+    zval* assignment;
+    if (temporary) {
+        ALLOC_ZVAL(assignment);
+        ZVAL_COPY_VALUE(assignment, value);
+        zval_copy_ctor(assignment);
+        INIT_PZVAL(assignment);
+    } else {
+        Z_ADDREF_P(value);
+        assignment = value;
+    }
+
+    zend_hash_update(assignments, key, keyLength + 1, &assignment, sizeof(zval*), NULL);
+}
+
+void include_assignments_destroy(HashTable* assignments)
+{
+    zend_hash_destroy(assignments);
+    FREE_HASHTABLE(assignments);
+}
+
+void call_include_with_scope(template_fn include, zval* scope, struct template_buffer* buffer, HashTable* functions)
+{
+    if (Z_TYPE_P(scope) == IS_OBJECT) {
+        include(Z_OBJPROP_P(scope), buffer, functions);
+    } else if (Z_TYPE_P(scope) == IS_ARRAY) {
+        include(Z_ARRVAL_P(scope), buffer, functions);
+    } else {
+        // every variable is undefined
+        HashTable empty;
+        zend_hash_init(&empty, 0, NULL, NULL, 0);
+        include(&empty, buffer, functions);
+        zend_hash_destroy(&empty);
+    }
+}
+
+/*
+ * Returns the template named `name`, or NULL (with an exception thrown) if it can't be found.
+ *
+ * `last_resolved` caches the template this include site resolved to the last time, so rendering
+ * the same template over and over again doesn't cost a hashtable lookup.
+ */
+template_fn resolve_include(struct template_registry* registry, struct compiled_template** last_resolved, zval* name)
+{
+    zval str_name;
+    struct compiled_template* resolved;
+
+    INIT_ZVAL(str_name);
+    ZVAL_COPY_VALUE(&str_name, name);
+    if (Z_TYPE_P(name) != IS_STRING) {
+        zval_copy_ctor(&str_name);
+        convert_to_string(&str_name);
+    }
+
+    resolved = *last_resolved;
+    if (resolved == NULL || resolved->name_length != Z_STRLEN(str_name) || memcmp(resolved->name, Z_STRVAL(str_name), Z_STRLEN(str_name)) != 0) {
+        if (zend_hash_find(&registry->templates, Z_STRVAL(str_name), Z_STRLEN(str_name) + 1, (void**) &resolved) != SUCCESS) {
+            resolved = registry->load(registry, Z_STRVAL(str_name), Z_STRLEN(str_name));
+        }
+        *last_resolved = resolved;
+    }
+
+    if (Z_TYPE_P(name) != IS_STRING) {
+        zval_dtor(&str_name);
+    }
+
+    return resolved ? resolved->render : NULL;
+}
+
+static size_t fragment_cache_mapped_size(size_t set_count, size_t slot_size)
+{
+    return sizeof(struct fragment_cache) + set_count * FRAGMENT_CACHE_WAYS * (sizeof(struct fragment_cache_slot) + slot_size);
+}
+
+struct fragment_cache* fragment_cache_create(size_t size, size_t slot_size)
+{
+    struct fragment_cache* cache;
+    size_t set_count;
+
+    if (size < sizeof(struct fragment_cache)) {
+        return NULL;
+    }
+    set_count = (size - sizeof(struct fragment_cache)) / (FRAGMENT_CACHE_WAYS * (sizeof(struct fragment_cache_slot) + slot_size));
+    if (set_count == 0) {
+        return NULL;
+    }
+
+    // anonymous shared memory starts out zeroed, iow. with every slot empty
+    cache = mmap(NULL, fragment_cache_mapped_size(set_count, slot_size), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (cache == MAP_FAILED) {
+        return NULL;
+    }
+
+    cache->set_count = set_count;
+    cache->slot_size = slot_size;
+    return cache;
+}
+
+void fragment_cache_destroy(struct fragment_cache* cache)
+{
+    munmap(cache, fragment_cache_mapped_size(cache->set_count, cache->slot_size));
+}
+
+/*
+ * The lock holds the pid of the process owning it. When that process died while holding
+ * it (eg. a worker got killed), it gets taken over instead of waiting forever: everything
+ * done while holding it leaves the cache consistent at every point, see
+ * fragment_cache_put().
+ */
+static void fragment_cache_lock(struct fragment_cache* cache)
+{
+    pid_t pid = getpid();
+    pid_t owner;
+
+    while ((owner = __sync_val_compare_and_swap(&cache->lock, 0, pid)) != 0) {
+        if (kill(owner, 0) == -1 && errno == ESRCH && __sync_bool_compare_and_swap(&cache->lock, owner, pid)) {
+            break;
+        }
+        sched_yield();
+    }
+}
+
+static void fragment_cache_unlock(struct fragment_cache* cache)
+{
+    __sync_lock_release(&cache->lock);
+}
+
+/*
+ * Returns the FRAGMENT_CACHE_WAYS slots of the set `hash` maps to.
+ */
+static struct fragment_cache_slot* fragment_cache_set(struct fragment_cache* cache, uint64_t hash)
+{
+    struct fragment_cache_slot* slots = (struct fragment_cache_slot*) (cache + 1);
+    return &slots[(hash % cache->set_count) * FRAGMENT_CACHE_WAYS];
+}
+
+static char* fragment_cache_data(struct fragment_cache* cache, struct fragment_cache_slot* slot)
+{
+    struct fragment_cache_slot* slots = (struct fragment_cache_slot*) (cache + 1);
+    char* data = (char*) &slots[cache->set_count * FRAGMENT_CACHE_WAYS];
+    return &data[(slot - slots) * cache->slot_size];
+}
+
+static uint64_t fragment_cache_hash(const char* key, size_t length)
+{
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        hash ^= (unsigned char) key[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*
+ * Returns the slot holding `key` in `set`, or NULL when it isn't cached (anymore).
+ */
+static struct fragment_cache_slot* fragment_cache_find(struct fragment_cache* cache, struct fragment_cache_slot* set, uint64_t hash, const char* key, uint32_t key_length)
+{
+    uint i;
+
+    for (i = 0; i < FRAGMENT_CACHE_WAYS; i++) {
+        struct fragment_cache_slot* slot = &set[i];
+        if (slot->last_used != 0 && slot->hash == hash && slot->key_length == key_length && memcmp(fragment_cache_data(cache, slot), key, key_length) == 0) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Returns what `key` of the cache block identified by `block` gets cached under (which
+ * should be freed with efree()), and sets `length` to its length.
+ */
+static char* fragment_cache_key(const char* block, zval* key, uint32_t* length)
+{
+    zval str_key;
+    size_t block_length = strlen(block);
+    char* cache_key;
+
+    INIT_ZVAL(str_key);
+    ZVAL_COPY_VALUE(&str_key, key);
+    if (Z_TYPE_P(key) != IS_STRING) {
+        zval_copy_ctor(&str_key);
+        convert_to_string(&str_key);
+    }
+
+    *length = block_length + 1 + Z_STRLEN(str_key);
+    cache_key = emalloc(*length);
+    memcpy(cache_key, block, block_length);
+    cache_key[block_length] = ':';
+    memcpy(&cache_key[block_length + 1], Z_STRVAL(str_key), Z_STRLEN(str_key));
+
+    if (Z_TYPE_P(key) != IS_STRING) {
+        zval_dtor(&str_key);
+    }
+    return cache_key;
+}
+
+/*
+ * Appends the output cached under `key` of the cache block identified by `block` to
+ * `buffer`, and returns whether there was any.
+ *
+ * Nothing which could bail out gets called while holding the lock, as that would leave
+ * it locked for every process: when the buffer has to grow first, the lock gets released
+ * and the lookup done again.
+ */
+bool fragment_cache_fetch(struct fragment_cache* cache, const char* block, zval* key, struct template_buffer* buffer)
+{
+    char* cache_key;
+    uint32_t key_length;
+    struct fragment_cache_slot* set;
+    struct fragment_cache_slot* slot;
+    uint64_t hash;
+    size_t needed_length = 0;
+    bool found = false;
+
+    if (cache == NULL) {
+        return false;
+    }
+
+    cache_key = fragment_cache_key(block, key, &key_length);
+    hash = fragment_cache_hash(cache_key, key_length);
+    set = fragment_cache_set(cache, hash);
+
+    while (true) {
+        if (needed_length > buffer->allocated_length) {
+            buffer->ptr = erealloc(buffer->ptr, needed_length);
+            buffer->allocated_length = needed_length;
+        }
+
+        fragment_cache_lock(cache);
+        slot = fragment_cache_find(cache, set, hash, cache_key, key_length);
+        if (slot != NULL && slot->expires != 0 && slot->expires <= time(NULL)) {
+            slot->last_used = 0;
+            slot = NULL;
+        }
+        if (slot == NULL) {
+            fragment_cache_unlock(cache);
+            break;
+        }
+
+        needed_length = buffer->str_length + slot->length + 1;
+        if (needed_length > buffer->allocated_length) {
+            fragment_cache_unlock(cache);
+            continue;
+        }
+
+        memcpy(&buffer->ptr[buffer->str_length], fragment_cache_data(cache, slot) + slot->key_length, slot->length);
+        buffer->str_length += slot->length;
+        buffer->ptr[buffer->str_length] = 0;
+        slot->last_used = ++cache->clock;
+        fragment_cache_unlock(cache);
+
+        flush_buffer_if_full(buffer);
+        found = true;
+        break;
+    }
+
+    efree(cache_key);
+    return found;
+}
+
+/*
+ * Returns a mark of what got rendered into `buffer` so far, for fragment_cache_store().
+ * Until then, the buffer doesn't get flushed.
+ */
+ALWAYS_INLINE size_t fragment_cache_mark(struct template_buffer* buffer)
+{
+    buffer->cache_marks++;
+    return buffer->str_length;
+}
+
+/*
+ * Stores the `length` bytes of `output` under `key` of the cache block identified by
+ * `block`, for `ttl` seconds. They take the place of the entry already stored under that
+ * key, or otherwise of an empty slot or the least recently used one of its set.
+ */
+static void fragment_cache_put(struct fragment_cache* cache, const char* block, zval* key, long ttl, const char* output, size_t length)
+{
+    char* cache_key;
+    uint32_t key_length;
+    struct fragment_cache_slot* set;
+    struct fragment_cache_slot* slot;
+    uint64_t hash;
+    uint i;
+
+    cache_key = fragment_cache_key(block, key, &key_length);
+    if (key_length + length <= cache->slot_size) {
+        hash = fragment_cache_hash(cache_key, key_length);
+        set = fragment_cache_set(cache, hash);
+
+        fragment_cache_lock(cache);
+        slot = fragment_cache_find(cache, set, hash, cache_key, key_length);
+        if (slot == NULL) {
+            // an empty slot was used the least recently of all
+            slot = &set[0];
+            for (i = 1; i < FRAGMENT_CACHE_WAYS; i++) {
+                if (set[i].last_used < slot->last_used) {
+                    slot = &set[i];
+                }
+            }
+        }
+
+        // empty the slot while it's being written, so it doesn't get used when this
+        // process dies halfway
+        slot->last_used = 0;
+        __sync_synchronize();
+
+        memcpy(fragment_cache_data(cache, slot), cache_key, key_length);
+        if (length > 0) {
+            memcpy(fragment_cache_data(cache, slot) + key_length, output, length);
+        }
+        slot->hash = hash;
+        slot->key_length = key_length;
+        slot->length = length;
+        slot->expires = ttl > 0 ? time(NULL) + ttl : 0;
+        __sync_synchronize();
+        slot->last_used = ++cache->clock;
+        fragment_cache_unlock(cache);
+    }
+
+    efree(cache_key);
+}
+
+/*
+ * Stores the output rendered into `buffer` since `mark` under `key` of the cache block
+ * identified by `block`, for `ttl` seconds.
+ */
+void fragment_cache_store(struct fragment_cache* cache, const char* block, zval* key, long ttl, struct template_buffer* buffer, size_t mark)
+{
+    if (cache != NULL) {
+        fragment_cache_put(cache, block, key, ttl, buffer->ptr + mark, buffer->str_length - mark);
+    }
+
+    buffer->cache_marks--;
+    flush_buffer_if_full(buffer);
+}
+
+bool include_succeeded()
+{
+    return EG(exception) == NULL;
+}
+
 ALWAYS_INLINE void destruct_zval(zval* v)
 {
     // decrement refcount and destroy if necessary
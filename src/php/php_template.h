@@ -2,6 +2,8 @@
 #define __PHP_TEMPLATE_H_
 
 #include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
 
 #include <Zend/zend_API.h>
 
@@ -9,15 +11,78 @@
 extern "C" {
 #endif
 
+/*
+ * The output of a template. When `flush` is set, it gets called whenever the output
+ * grows past `flush_threshold`, to write it to `flush_target` and empty the buffer;
+ * except while a cache block is storing its output (`cache_marks` > 0), as that output
+ * has to stay in the buffer.
+ */
 struct template_buffer {
     char* ptr;
     size_t str_length;
     size_t allocated_length;
+    void (*flush)(struct template_buffer* buffer);
+    void* flush_target;
+    size_t flush_threshold;
+    uint cache_marks;
 };
 #define BUFFER_CHUNK_SIZE 256
 
 typedef void (*template_fn)(HashTable*, struct template_buffer*, HashTable*);
 
+struct compiled_template {
+    char* name;
+    uint name_length;
+    template_fn render;
+};
+
+/*
+ * All templates compiled by an engine, by name. Dynamic includes look up their template
+ * in here; when it isn't, `load` gets called to compile it. On failure, `load` throws an
+ * exception and returns NULL.
+ */
+struct template_registry {
+    HashTable templates; // name => struct compiled_template
+    struct compiled_template* (*load)(struct template_registry* registry, const char* name, uint name_length);
+    void* engine;
+};
+
+/*
+ * The fragment cache, holding the output of cache blocks: a fixed-size arena shared by
+ * every process it got mapped in before forking (eg. the workers of PHP-FPM), guarded by
+ * a spinlock which gets taken over when its owner died. It's set-associative: a key only
+ * gets stored in one of the FRAGMENT_CACHE_WAYS slots of the set it hashes to, evicting
+ * the least recently used one. Output which doesn't fit in a slot doesn't get cached.
+ *
+ * Every key is stored prefixed with the identifier of its cache block, the hash of its
+ * body, so different blocks using the same key don't share their output.
+ *
+ * The header is followed by the slots of every set, and after those by their data.
+ */
+#define FRAGMENT_CACHE_WAYS 8
+
+struct fragment_cache_slot {
+    uint64_t hash;
+    uint64_t last_used; // 0 when the slot is empty
+    time_t expires;     // 0 when it never expires
+    uint32_t key_length;
+    uint32_t length;    // of the output, which follows the key in the data of the slot
+};
+
+struct fragment_cache {
+    volatile pid_t lock; // the pid of the process holding it, or 0
+    uint64_t clock;
+    size_t set_count;
+    size_t slot_size;   // of the data of a slot
+};
+
+/*
+ * Maps a fragment cache of (about) `size` bytes with slots of `slot_size` bytes, or
+ * returns NULL when it can't or when that doesn't leave room for a single set.
+ */
+struct fragment_cache* fragment_cache_create(size_t size, size_t slot_size);
+void fragment_cache_destroy(struct fragment_cache* cache);
+
 #ifdef __cplusplus
 }
 #endif